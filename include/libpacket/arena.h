@@ -0,0 +1,106 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef __LIBPACKET_ARENA
+#define __LIBPACKET_ARENA
+
+/**
+ * @file arena.h
+ * @author David "Ole" Luengo
+ * @date 10 March 2018
+ * @brief File implementing a region allocator.
+ */
+
+#include <stddef.h>
+
+/**
+ * @class Arena "libpacket/arena.h"
+ * @brief Class implementing a bump allocator over big blocks of memory.
+ *
+ * Objects allocated from an Arena can't be freed one by one, all of them are
+ * released at once with Arena_reset(), which keeps the blocks around to be
+ * reused. It's meant to build a Packet, or a batch of them, with a handful of
+ * pointer increments instead of a malloc() per layer (see
+ * Packet_createInArena() and the *Proto_createInArena() constructors).
+ *
+ * An Arena isn't thread safe, use one per thread.
+ */
+typedef struct Arena Arena_t;
+
+/* An ArenaBlock is the header of every block, the memory handed out follows
+ * it. The member used is the number of bytes already handed out.
+ */
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size;
+    size_t used;
+} ArenaBlock_t;
+
+/* The blocks are kept in a list starting at first, current being the one we
+ * are allocating from. The blocks after current are empty.
+ */
+typedef struct Arena {
+    ArenaBlock_t *first;
+    ArenaBlock_t *current;
+    size_t block_size;
+} Arena_t;
+
+#define ARENA_DEFAULT_BLOCK_SIZE (16384)
+#define ARENA_ALIGN (16)
+
+/**
+ * @memberof Arena
+ *
+ * Class constructor. Allocates an Arena and its first block.
+ *
+ * @param block_size The size in bytes of the blocks of the Arena, 0 for
+ * ARENA_DEFAULT_BLOCK_SIZE. Bigger allocations get a block of their own.
+ * @return A pointer to the newly allocated Arena or NULL.
+ */
+Arena_t * Arena_create(size_t block_size);
+
+/**
+ * @memberof Arena
+ *
+ * Class destructor. Frees the Arena and everything allocated from it.
+ *
+ * @param arena Pointer to the Arena instance to be freed.
+ */
+void Arena_delete(Arena_t *arena);
+
+/**
+ * @memberof Arena
+ *
+ * Allocates memory from the Arena, aligned to ARENA_ALIGN bytes.
+ *
+ * @param arena Pointer to the Arena instance.
+ * @param size The number of bytes to allocate.
+ * @return A pointer to the allocated memory or NULL.
+ */
+void * Arena_alloc(Arena_t *arena, size_t size);
+
+/**
+ * @memberof Arena
+ *
+ * Frees everything allocated from the Arena at once. The memory of the Arena
+ * is kept to be reused by the next allocations.
+ *
+ * @param arena Pointer to the Arena instance.
+ */
+void Arena_reset(Arena_t *arena);
+
+#endif
@@ -0,0 +1,219 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef __LIBPACKET_BATCH
+#define __LIBPACKET_BATCH
+
+/**
+ * @file batch.h
+ * @author David "Ole" Luengo
+ * @date 10 March 2018
+ * @brief File implementing a batch of packets serialized back to back.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "libpacket/packet.h"
+
+/**
+ * @class PacketBatch "libpacket/batch.h"
+ * @brief Class holding several packets and their wire representation, one
+ * after the other in a single buffer.
+ *
+ * Packets are added to the batch and then serialized all at once, in a
+ * single pass, into a buffer owned by the batch. The buffer is aligned to
+ * PACKET_BATCH_ALIGN bytes and kept between serializations, so bursts of
+ * packets are written into the same memory over and over. The offset and the
+ * length of every packet within the buffer are ready to be handed to
+ * sendmmsg() or copied into a ring (see Socket_injectPacketBatch()).
+ *
+ * The batch doesn't own the packets, they must outlive it or be removed with
+ * PacketBatch_clear().
+ */
+typedef struct PacketBatch PacketBatch_t;
+
+#define PACKET_BATCH_DEFAULT_CAPACITY (64)
+#define PACKET_BATCH_ALIGN (64)
+
+/* The members packs, offsets, lens and bufs are arrays of capacity elements,
+ * the first packs_nr being in use. The member buf is the buffer of buf_size
+ * bytes where the packets are serialized, length of them being used. The
+ * members offsets, lens, bufs and length are only meaningful if serialized is
+ * set, bufs holding the address of every packet within buf.
+ */
+typedef struct PacketBatch {
+    const Packet_t **packs;
+    unsigned int packs_nr;
+    unsigned int capacity;
+    unsigned int *offsets;
+    unsigned int *lens;
+    const uint8_t **bufs;
+    uint8_t *buf;
+    size_t buf_size;
+    size_t length;
+    int serialized;
+} PacketBatch_t;
+
+/**
+ * @memberof PacketBatch
+ *
+ * Class constructor with parameters. Creates an empty batch.
+ *
+ * @param capacity The number of packets the batch can hold before it needs
+ * to grow.
+ * @return A pointer to the newly allocated PacketBatch or NULL.
+ */
+PacketBatch_t * PacketBatch_createWithParams(unsigned int capacity);
+
+/**
+ * @memberof PacketBatch
+ *
+ * Class constructor. Creates an empty batch that can hold
+ * PACKET_BATCH_DEFAULT_CAPACITY packets before it needs to grow.
+ *
+ * @return A pointer to the newly allocated PacketBatch or NULL.
+ */
+PacketBatch_t * PacketBatch_create(void);
+
+/**
+ * @memberof PacketBatch
+ *
+ * Class destructor. Frees all the resources associated to this instance, but
+ * not the packets it holds.
+ *
+ * @param batch Pointer to the PacketBatch instance to be freed.
+ */
+void PacketBatch_delete(PacketBatch_t *batch);
+
+/**
+ * @memberof PacketBatch
+ *
+ * Adds a packet at the end of the batch. The batch has to be serialized
+ * again.
+ *
+ * @param batch Pointer to the PacketBatch instance.
+ * @param pack Pointer to the Packet to add.
+ * @return 0 on success, -1 otherwise.
+ */
+int PacketBatch_add(PacketBatch_t *batch, const Packet_t *pack);
+
+/**
+ * @memberof PacketBatch
+ *
+ * Removes all the packets from the batch. The memory of the batch is kept
+ * for the next packets.
+ *
+ * @param batch Pointer to the PacketBatch instance.
+ */
+void PacketBatch_clear(PacketBatch_t *batch);
+
+/**
+ * @memberof PacketBatch
+ *
+ * Writes the wire representation of all the packets of the batch back to back
+ * into its buffer. The size of every packet is found first, so the buffer
+ * grows at most once, and then every packet is written straight into its
+ * place in the buffer (see Packet_getBitstreamWithFlags()). Packets changed
+ * after this call aren't seen until the batch is serialized again.
+ *
+ * @param batch Pointer to the PacketBatch instance.
+ * @param flags 0 or PACKET_PARTIAL_CHECKSUM.
+ * @return The number of bytes written into the buffer or -1 on error.
+ */
+int PacketBatch_serialize(PacketBatch_t *batch, unsigned int flags);
+
+/**
+ * @memberof PacketBatch
+ *
+ * Returns the number of packets in the batch.
+ *
+ * @param batch Pointer to the PacketBatch instance.
+ * @return The number of packets in the batch.
+ */
+unsigned int PacketBatch_getNumPackets(const PacketBatch_t *batch);
+
+/**
+ * @memberof PacketBatch
+ *
+ * Returns the buffer where the batch was serialized.
+ *
+ * @param batch Pointer to the PacketBatch instance.
+ * @param length Pointer to where to store the number of bytes used in the
+ * buffer. Can be NULL.
+ * @return A pointer to the buffer, valid until the batch is serialized again
+ * or deleted, or NULL if it isn't serialized.
+ */
+const uint8_t * PacketBatch_getBuffer(
+        const PacketBatch_t *batch,
+        size_t *length);
+
+/**
+ * @memberof PacketBatch
+ *
+ * Returns the wire representation of one of the packets of the batch.
+ *
+ * @param batch Pointer to the PacketBatch instance.
+ * @param index The index of the packet, in the order they were added.
+ * @param length Pointer to where to store the length of the packet. Can be
+ * NULL.
+ * @return A pointer to the packet within the buffer of the batch or NULL if
+ * it doesn't exist or the batch isn't serialized.
+ */
+const uint8_t * PacketBatch_getPacketData(
+        const PacketBatch_t *batch,
+        unsigned int index,
+        unsigned int *length);
+
+/**
+ * @memberof PacketBatch
+ *
+ * Returns the offset of every packet within the buffer of the batch, an
+ * array of PacketBatch_getNumPackets() elements.
+ *
+ * @param batch Pointer to the PacketBatch instance.
+ * @return A pointer to the array of offsets or NULL if the batch isn't
+ * serialized.
+ */
+const unsigned int * PacketBatch_getOffsets(const PacketBatch_t *batch);
+
+/**
+ * @memberof PacketBatch
+ *
+ * Returns the length of every packet of the batch, an array of
+ * PacketBatch_getNumPackets() elements.
+ *
+ * @param batch Pointer to the PacketBatch instance.
+ * @return A pointer to the array of lengths or NULL if the batch isn't
+ * serialized.
+ */
+const unsigned int * PacketBatch_getLengths(const PacketBatch_t *batch);
+
+/**
+ * @memberof PacketBatch
+ *
+ * Returns the address of every packet within the buffer of the batch, an
+ * array of PacketBatch_getNumPackets() elements, as expected by
+ * Socket_injectRawBatch().
+ *
+ * @param batch Pointer to the PacketBatch instance.
+ * @return A pointer to the array of addresses or NULL if the batch isn't
+ * serialized.
+ */
+const uint8_t * const * PacketBatch_getPackets(const PacketBatch_t *batch);
+
+#endif
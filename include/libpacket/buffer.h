@@ -0,0 +1,161 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef __LIBPACKET_BUFFER
+#define __LIBPACKET_BUFFER
+
+/**
+ * @file buffer.h
+ * @author David "Ole" Luengo
+ * @date 10 March 2018
+ * @brief File implementing a buffer with room to grow at both ends.
+ */
+
+#include <stdint.h>
+
+/**
+ * @class PacketBuffer "libpacket/buffer.h"
+ * @brief Class implementing a buffer holding a frame, with room reserved in
+ * front of it (headroom) and behind it (tailroom).
+ *
+ * Headers are added in front of the frame taking bytes from the headroom,
+ * so encapsulating a frame never moves it. The memory layout is:
+ *
+ *   head                data               data+length            head+size
+ *    |----- headroom -----|------ frame ------|------ tailroom ------|
+ *
+ * See Packet_encapsulate() to prepend the layers of a Packet.
+ */
+typedef struct PacketBuffer PacketBuffer_t;
+
+typedef struct PacketBuffer {
+    uint8_t *head;
+    uint8_t *data;
+    unsigned int length;
+    unsigned int size;
+} PacketBuffer_t;
+
+/**
+ * @memberof PacketBuffer
+ *
+ * Class constructor. Allocates an empty PacketBuffer.
+ *
+ * @param headroom The number of bytes reserved in front of the frame.
+ * @param size The number of bytes available for the frame itself, that is,
+ * the tailroom of the empty buffer.
+ * @return A pointer to the newly allocated PacketBuffer or NULL.
+ */
+PacketBuffer_t * PacketBuffer_create(unsigned int headroom, unsigned int size);
+
+/**
+ * @memberof PacketBuffer
+ *
+ * Class destructor. Frees all the resources associated to this instance.
+ *
+ * @param pb Pointer to the PacketBuffer instance to be freed.
+ */
+void PacketBuffer_delete(PacketBuffer_t *pb);
+
+/**
+ * @memberof PacketBuffer
+ *
+ * Empties the buffer, leaving headroom bytes in front of the frame.
+ *
+ * @param pb Pointer to the PacketBuffer instance.
+ * @param headroom The number of bytes reserved in front of the frame.
+ * @return 0 on success, -1 if headroom is bigger than the buffer.
+ */
+int PacketBuffer_reset(PacketBuffer_t *pb, unsigned int headroom);
+
+/**
+ * @memberof PacketBuffer
+ *
+ * Adds len bytes in front of the frame, taken from the headroom.
+ *
+ * @param pb Pointer to the PacketBuffer instance.
+ * @param len The number of bytes to add.
+ * @return A pointer to the first of the added bytes, the new start of the
+ * frame, or NULL if there isn't enough headroom.
+ */
+uint8_t * PacketBuffer_push(PacketBuffer_t *pb, unsigned int len);
+
+/**
+ * @memberof PacketBuffer
+ *
+ * Adds len bytes at the end of the frame, taken from the tailroom.
+ *
+ * @param pb Pointer to the PacketBuffer instance.
+ * @param len The number of bytes to add.
+ * @return A pointer to the first of the added bytes or NULL if there isn't
+ * enough tailroom.
+ */
+uint8_t * PacketBuffer_put(PacketBuffer_t *pb, unsigned int len);
+
+/**
+ * @memberof PacketBuffer
+ *
+ * Removes len bytes from the front of the frame, giving them back to the
+ * headroom (i.e. to decapsulate it).
+ *
+ * @param pb Pointer to the PacketBuffer instance.
+ * @param len The number of bytes to remove.
+ * @return A pointer to the new start of the frame or NULL if the frame is
+ * shorter than len.
+ */
+uint8_t * PacketBuffer_pull(PacketBuffer_t *pb, unsigned int len);
+
+/**
+ * @memberof PacketBuffer
+ *
+ * Getter of the frame.
+ *
+ * @param pb Pointer to the PacketBuffer instance.
+ * @return A pointer to the start of the frame.
+ */
+uint8_t * PacketBuffer_getData(const PacketBuffer_t *pb);
+
+/**
+ * @memberof PacketBuffer
+ *
+ * Getter of the length of the frame.
+ *
+ * @param pb Pointer to the PacketBuffer instance.
+ * @return The length in bytes of the frame.
+ */
+unsigned int PacketBuffer_getLength(const PacketBuffer_t *pb);
+
+/**
+ * @memberof PacketBuffer
+ *
+ * Returns the number of bytes left in front of the frame.
+ *
+ * @param pb Pointer to the PacketBuffer instance.
+ * @return The size in bytes of the headroom.
+ */
+unsigned int PacketBuffer_getHeadroom(const PacketBuffer_t *pb);
+
+/**
+ * @memberof PacketBuffer
+ *
+ * Returns the number of bytes left behind the frame.
+ *
+ * @param pb Pointer to the PacketBuffer instance.
+ * @return The size in bytes of the tailroom.
+ */
+unsigned int PacketBuffer_getTailroom(const PacketBuffer_t *pb);
+
+#endif
@@ -0,0 +1,120 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef __LIBPACKET_CHECKSUM
+#define __LIBPACKET_CHECKSUM
+
+/**
+ * @file checksum.h
+ * @author David "Ole" Luengo
+ * @date 10 March 2018
+ * @brief File implementing the Internet checksum (RFC 1071).
+ *
+ * All the checksums handled here are the 16 bits values as they are read
+ * from the wire, in host byte order.
+ */
+
+#include <stdint.h>
+
+/**
+ * Computes the one's complement sum of a buffer, treating it as a sequence of
+ * 16 bits big endian words (if its length is odd, the last byte is padded
+ * with a zero). The result isn't folded nor complemented, so it can be fed
+ * back into this function to keep adding data starting at an even offset.
+ *
+ * Depending on the CPU this runs a SSE2 or AVX2 implementation, chosen the
+ * first time it's called, or a portable one.
+ *
+ * @param buf Pointer to the data.
+ * @param len The number of bytes of data.
+ * @param sum A partial sum to add the data to. 0 to start a new sum.
+ * @return The partial sum.
+ */
+uint32_t Checksum_partial(const uint8_t *buf, unsigned int len, uint32_t sum);
+
+/**
+ * Adds two partial sums, the second one computed over data that starts at
+ * offset bytes from the start of the data of the first one.
+ *
+ * @param sum The first partial sum.
+ * @param partial The second partial sum.
+ * @param offset The offset where the data of the second sum starts. Only
+ * its parity matters.
+ * @return The resulting partial sum.
+ */
+uint32_t Checksum_combine(uint32_t sum, uint32_t partial, unsigned int offset);
+
+/**
+ * Folds a partial sum into 16 bits.
+ *
+ * @param sum A partial sum returned by Checksum_partial().
+ * @return The folded sum. The checksum is its one's complement.
+ */
+uint16_t Checksum_fold(uint32_t sum);
+
+/**
+ * Computes the Internet checksum of a buffer.
+ *
+ * @param buf Pointer to the data.
+ * @param len The number of bytes of data.
+ * @return The checksum of the data.
+ */
+uint16_t Checksum_compute(const uint8_t *buf, unsigned int len);
+
+/**
+ * Updates a checksum after some bytes of the data it covers changed, as
+ * described in RFC 1624 (HC' = ~(~HC + ~m + m')). The cost depends on the
+ * number of bytes that changed, not on the size of the data covered by the
+ * checksum.
+ *
+ * @param checksum The checksum before the change.
+ * @param old The bytes before the change.
+ * @param new The bytes after the change.
+ * @param len The number of bytes that changed.
+ * @param odd Non-zero if the bytes start at an odd offset from the start of
+ * the data covered by the checksum.
+ * @return The updated checksum.
+ */
+uint16_t Checksum_update(
+        uint16_t checksum,
+        const uint8_t *old,
+        const uint8_t *new,
+        unsigned int len,
+        int odd);
+
+/**
+ * Updates a checksum after a 16 bits word, aligned to an even offset of the
+ * data covered by the checksum, changed.
+ *
+ * @param checksum The checksum before the change.
+ * @param old The value of the word before the change, in host byte order.
+ * @param new The value of the word after the change, in host byte order.
+ * @return The updated checksum.
+ */
+uint16_t Checksum_update16(uint16_t checksum, uint16_t old, uint16_t new);
+
+/**
+ * Same as Checksum_update16() but for a 32 bits word.
+ *
+ * @param checksum The checksum before the change.
+ * @param old The value of the word before the change, in host byte order.
+ * @param new The value of the word after the change, in host byte order.
+ * @return The updated checksum.
+ */
+uint16_t Checksum_update32(uint16_t checksum, uint32_t old, uint32_t new);
+
+#endif
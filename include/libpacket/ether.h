@@ -38,8 +38,19 @@
  */
 typedef struct EtherProto EtherProto_t;
 
+/**
+ * @enum EtherField
+ * @brief Identifiers of the patchable fields of EtherProto (see
+ * ProtocolField).
+ */
+enum EtherField {
+    ETHER_FIELD_DADDR = 0,
+    ETHER_FIELD_SADDR,
+    ETHER_FIELD_TYPE,
+};
+
 typedef struct EtherProto {
-    Protocol_t *proto_base;
+    Protocol_t base;
     uint8_t daddr[ADDR_LEN];
     uint8_t saddr[ADDR_LEN];
     uint16_t type;
@@ -56,10 +67,34 @@ typedef struct EtherProto {
  */
 EtherProto_t * EtherProto_create(void);
 
+/**
+ * @memberof EtherProto
+ *
+ * Same as EtherProto_create() but the instance, Protocol included, is allocated
+ * from an Arena. It must not be deleted, it's freed with the Arena.
+ *
+ * @param arena Pointer to the Arena where to allocate the instance.
+ * @return A pointer to the newly allocated EtherProto instance or NULL.
+ */
+EtherProto_t * EtherProto_createInArena(Arena_t *arena);
+
+/**
+ * @memberof EtherProto
+ *
+ * Copy constructor. Creates a new EtherProto with the same members as another
+ * one, not stacked on any Packet.
+ *
+ * @param proto Pointer to the EtherProto instance to copy.
+ * @return A pointer to the newly allocated EtherProto instance or NULL.
+ */
+EtherProto_t * EtherProto_clone(const EtherProto_t *proto);
+
 /**
  * @memberof EtherProto
  *
  * Class destructor. Frees the resources associated to a EtherProto instance.
+ * If the instance is shared by clones of a Packet (see Packet_clone()) it's
+ * only freed once they release it too.
  *
  * @param proto Pointer to the instance to destroy.
  */
@@ -93,11 +128,44 @@ int EtherProto_getBitstream(
 /**
  * @memberof EtherProto
  * 
- * Getter of the member proto_base.
+ * Getter of the Protocol embedded in the instance (member base).
  *
  * @param proto Ponter to an instance of EtherProto.
  * @return A pointer to the Protocol instance own by this EtherProto instance.
  */
 Protocol_t * EtherProto_getProtoBase(const EtherProto_t *proto);
 
+/**
+ * @memberof EtherProto
+ *
+ * Setter of the member daddr.
+ *
+ * @param proto Pointer to the instance to set its daddr.
+ * @param addr The ADDR_LEN bytes of the destination address.
+ * @return 0 on success, -1 otherwise.
+ */
+int EtherProto_setDaddr(EtherProto_t *proto, const uint8_t *addr);
+
+/**
+ * @memberof EtherProto
+ *
+ * Setter of the member saddr.
+ *
+ * @param proto Pointer to the instance to set its saddr.
+ * @param addr The ADDR_LEN bytes of the source address.
+ * @return 0 on success, -1 otherwise.
+ */
+int EtherProto_setSaddr(EtherProto_t *proto, const uint8_t *addr);
+
+/**
+ * @memberof EtherProto
+ *
+ * Setter of the member type.
+ *
+ * @param proto Pointer to the instance to set its type.
+ * @param type The EtherType, in host byte order.
+ * @return 0 on success, -1 otherwise.
+ */
+int EtherProto_setType(EtherProto_t *proto, uint16_t type);
+
 #endif
@@ -0,0 +1,195 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef __LIBPACKET_FLOW
+#define __LIBPACKET_FLOW
+
+/**
+ * @file flow.h
+ * @author David "Ole" Luengo
+ * @date 10 March 2018
+ * @brief File implementing a table of UDP flows emitted from a Template.
+ */
+
+#include <stdint.h>
+
+#include "libpacket/template.h"
+
+/**
+ * @class FlowTable "libpacket/flow.h"
+ * @brief Class holding the state of many IPv4/UDP flows, to emit their
+ * frames from a single Template.
+ *
+ * Instead of a Packet per flow, a FlowTable keeps every field that differs
+ * between flows in an array of its own (struct of arrays): addresses, ports,
+ * the IPv4 id and the counters of packets and bytes sent. A flow takes 30
+ * bytes, so a million of them fit in about 30MB.
+ *
+ * Frames are emitted from a Template of an Ethernet - IPv4 - UDPv4 Packet
+ * (see Packet_compile()). The fields of a run of flows are converted to
+ * network byte order and their checksums computed several flows at a time,
+ * with SSE2 or AVX2 depending on the CPU, and then patched into copies of
+ * the frame of the Template. Both checksums are derived from the ones of the
+ * Template (RFC 1624), so the payload is never read again.
+ */
+typedef struct FlowTable FlowTable_t;
+
+#define FLOW_TABLE_DEFAULT_CAPACITY (1024)
+
+/**
+ * @enum FlowField
+ * @brief The fields of the Template patched for every flow.
+ */
+enum FlowField {
+    FLOW_FIELD_SADDR = 0,
+    FLOW_FIELD_DADDR,
+    FLOW_FIELD_SPORT,
+    FLOW_FIELD_DPORT,
+    FLOW_FIELD_ID,
+    FLOW_FIELD_IPV4_CHECKSUM,
+    FLOW_FIELD_UDPV4_CHECKSUM,
+    FLOW_FIELD_NR,
+};
+
+/* The members saddr to bytes are arrays of capacity elements, indexed by
+ * flow, the first flows_nr of them in use. All of them in host byte order.
+ *
+ * The members from tmpl on are set by FlowTable_setTemplate(): offsets holds
+ * where every FlowField is in the frame, ipv4_base and udpv4_base are the
+ * partial sums of everything covered by each checksum except the fields
+ * patched, and udpv4_checksum is 0 if the Template has no UDP checksum.
+ */
+typedef struct FlowTable {
+    uint32_t *saddr;
+    uint32_t *daddr;
+    uint16_t *sport;
+    uint16_t *dport;
+    uint16_t *id;
+    uint64_t *packets;
+    uint64_t *bytes;
+    unsigned int flows_nr;
+    unsigned int capacity;
+    const Template_t *tmpl;
+    unsigned int offsets[FLOW_FIELD_NR];
+    uint32_t ipv4_base;
+    uint32_t udpv4_base;
+    int udpv4_checksum;
+} FlowTable_t;
+
+/**
+ * @memberof FlowTable
+ *
+ * Class constructor with parameters. Creates an empty table.
+ *
+ * @param capacity The number of flows the table can hold before it needs to
+ * grow.
+ * @return A pointer to the newly allocated FlowTable or NULL.
+ */
+FlowTable_t * FlowTable_createWithParams(unsigned int capacity);
+
+/**
+ * @memberof FlowTable
+ *
+ * Class constructor. Creates an empty table that can hold
+ * FLOW_TABLE_DEFAULT_CAPACITY flows before it needs to grow.
+ *
+ * @return A pointer to the newly allocated FlowTable or NULL.
+ */
+FlowTable_t * FlowTable_create(void);
+
+/**
+ * @memberof FlowTable
+ *
+ * Class destructor. Frees all the resources associated to this instance, but
+ * not its Template.
+ *
+ * @param table Pointer to the FlowTable instance to be freed.
+ */
+void FlowTable_delete(FlowTable_t *table);
+
+/**
+ * @memberof FlowTable
+ *
+ * Adds a flow to the table, with its IPv4 id and its counters set to 0.
+ *
+ * @param table Pointer to the FlowTable instance.
+ * @param saddr The IPv4 source address, in host byte order.
+ * @param daddr The IPv4 destination address, in host byte order.
+ * @param sport The UDP source port, in host byte order.
+ * @param dport The UDP destination port, in host byte order.
+ * @return The index of the new flow or -1 on error.
+ */
+int FlowTable_add(
+        FlowTable_t *table,
+        uint32_t saddr,
+        uint32_t daddr,
+        uint16_t sport,
+        uint16_t dport);
+
+/**
+ * @memberof FlowTable
+ *
+ * Returns the number of flows in the table.
+ *
+ * @param table Pointer to the FlowTable instance.
+ * @return The number of flows.
+ */
+unsigned int FlowTable_getNumFlows(const FlowTable_t *table);
+
+/**
+ * @memberof FlowTable
+ *
+ * Sets the Template the frames of the flows are emitted from. The fields of
+ * the flows replace the addresses and the id of its IPv4 layer and the ports
+ * of its UDPv4 layer, which must be right on top. The IPv4 header checksum
+ * is computed from the header, the UDP one is derived from the one of the
+ * Template and can be 0 if unused.
+ *
+ * @param table Pointer to the FlowTable instance.
+ * @param tmpl Pointer to the Template. It isn't copied, it must outlive the
+ * table or be replaced.
+ * @param ipv4_layer The index of the IPv4 layer in the compiled Packet.
+ * @return 0 on success, -1 if the Template doesn't fit.
+ */
+int FlowTable_setTemplate(
+        FlowTable_t *table,
+        const Template_t *tmpl,
+        unsigned int ipv4_layer);
+
+/**
+ * @memberof FlowTable
+ *
+ * Writes the frames of a run of flows back to back into buf, each one
+ * Template_getSize() bytes long. The IPv4 id of every flow emitted is
+ * incremented afterwards and its counters updated.
+ *
+ * @param table Pointer to the FlowTable instance.
+ * @param first The index of the first flow.
+ * @param n The number of flows.
+ * @param buf The buffer where to write the frames.
+ * @param size The length of buf.
+ * @return The number of frames written, less than n if buf is too small or
+ * the table runs out of flows, or -1 on error.
+ */
+int FlowTable_emit(
+        FlowTable_t *table,
+        unsigned int first,
+        unsigned int n,
+        uint8_t *buf,
+        unsigned int size);
+
+#endif
@@ -0,0 +1,265 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+#ifndef __LIBPACKET_INJECTOR
+#define __LIBPACKET_INJECTOR
+
+/**
+ * @file injector.h
+ * @author David "Ole" Luengo
+ * @date 10 March 2018
+ * @brief File implementing an asynchronous injector with its own thread.
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "libpacket/packet.h"
+#include "libpacket/socket.h"
+
+/**
+ * @class Injector "libpacket/injector.h"
+ * @brief Class implementing a thread that injects the packets other threads
+ * submit.
+ *
+ * Building a packet and handing it to the kernel have very different costs.
+ * An Injector decouples them: any number of threads submit packets (or
+ * frames already serialized) into a bounded lock-free queue and a dedicated
+ * thread, optionally pinned to a core, drains the queue in bursts and injects
+ * them through a Socket with as few system calls as possible.
+ *
+ * Submitting doesn't take any lock. What happens when the queue is full is
+ * decided by the InjectorPolicy of the Injector. Once a packet has been
+ * injected, or has failed to, the callback of the Injector is called from the
+ * injecting thread, so the submitter knows when it can reuse it.
+ *
+ * A submitted Packet belongs to the Injector until its callback is called or
+ * Injector_flush() returns: it must not be modified nor deleted before. The
+ * Socket belongs to the injecting thread for the whole life of the Injector,
+ * other threads willing to inject through the same interface meanwhile need
+ * a SocketContext each.
+ */
+typedef struct Injector Injector_t;
+
+/**
+ * @enum InjectorPolicy
+ * @brief What a submitter does when the queue of the Injector is full.
+ */
+typedef enum InjectorPolicy {
+    /** Sleep until the injecting thread makes room. The default. */
+    INJECTOR_POLICY_BLOCK = 0,
+    /** Give up, the submission fails and is counted as dropped. */
+    INJECTOR_POLICY_DROP,
+    /** Busy-wait until the injecting thread makes room. */
+    INJECTOR_POLICY_SPIN,
+} InjectorPolicy_t;
+
+/**
+ * @struct InjectorRequest
+ * @brief Something submitted to an Injector: either a Packet, with frame set
+ * to NULL, or a frame of length bytes, with pack set to NULL. The member arg
+ * is handed back to the callback as it is.
+ */
+typedef struct InjectorRequest {
+    const Packet_t *pack;
+    const uint8_t *frame;
+    unsigned int length;
+    void *arg;
+} InjectorRequest_t;
+
+/**
+ * Called from the injecting thread once a request has been handled. The
+ * result is the number of bytes written into the network or -1 if the request
+ * couldn't be injected.
+ */
+typedef void (*Injector_callbackFunc_t)(const InjectorRequest_t *req, int result);
+
+#define INJECTOR_DEFAULT_CAPACITY (1024)
+#define INJECTOR_DEFAULT_BURST (32)
+
+/**
+ * @struct InjectorParams
+ * @brief Parameters accepted by Injector_createWithParams().
+ */
+typedef struct InjectorParams {
+    /** Number of requests the queue holds, rounded up to a power of two. 0
+     * for INJECTOR_DEFAULT_CAPACITY. */
+    unsigned int capacity;
+    /** Maximum number of requests injected at once. 0 for
+     * INJECTOR_DEFAULT_BURST. */
+    unsigned int burst;
+    /** What submitters do when the queue is full. */
+    InjectorPolicy_t policy;
+    /** The core the injecting thread is pinned to, -1 to let it float. */
+    int cpu;
+    /** Called for every request handled, can be NULL. */
+    Injector_callbackFunc_t callback;
+} InjectorParams_t;
+
+/**
+ * @struct InjectorStats
+ * @brief Counters of an Injector.
+ */
+typedef struct InjectorStats {
+    /** Requests injected. */
+    uint64_t packets;
+    /** Bytes injected, not counting the virtio_net_hdr. */
+    uint64_t bytes;
+    /** Requests that couldn't be injected. */
+    uint64_t errors;
+    /** Submissions refused because the queue was full. */
+    uint64_t dropped;
+} InjectorStats_t;
+
+/* One element of the queue. The member seq tells who may use it next: the
+ * submitter of ticket seq if it equals it, the injecting thread if it's one
+ * more (Vyukov's bounded queue).
+ */
+typedef struct InjectorSlot {
+    unsigned long seq;
+    InjectorRequest_t req;
+} InjectorSlot_t;
+
+/* The members tail and head are the next tickets to be taken by submitters
+ * and by the injecting thread respectively, each in its own cache line, and
+ * done is how many requests have already been handled. The arrays reqs,
+ * packs, bufs, lens and results hold a burst and are only touched by the
+ * injecting thread.
+ *
+ * The members lock, ready and space are only used to sleep: the injecting
+ * thread waits on ready when the queue is empty, with sleeping set, and
+ * submitters and flushers wait on space, counted by waiting.
+ */
+typedef struct Injector {
+    Socket_t *sock;
+    InjectorSlot_t *slots;
+    unsigned long mask;
+    unsigned int burst;
+    InjectorPolicy_t policy;
+    Injector_callbackFunc_t callback;
+    InjectorRequest_t *reqs;
+    const Packet_t **packs;
+    const uint8_t **bufs;
+    unsigned int *lens;
+    int *results;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_cond_t space;
+    int sleeping;
+    int waiting;
+    int running;
+    InjectorStats_t stats;
+    unsigned long tail __attribute__((aligned(64)));
+    unsigned long head __attribute__((aligned(64)));
+    unsigned long done;
+} Injector_t;
+
+/**
+ * @memberof Injector
+ *
+ * Class constructor with parameters. Creates the queue and starts the
+ * injecting thread.
+ *
+ * @param sock A pointer to the socket where to inject the requests. It must
+ * outlive the Injector and, being written by its thread, not be used by any
+ * other thread meanwhile.
+ * @param params Pointer to the parameters of the Injector. If NULL the
+ * default parameters are used, the same as in Injector_create().
+ * @return A pointer to the newly allocated Injector or NULL.
+ */
+Injector_t * Injector_createWithParams(
+        Socket_t *sock,
+        const InjectorParams_t *params);
+
+/**
+ * @memberof Injector
+ *
+ * Class constructor. Creates an Injector with a queue of
+ * INJECTOR_DEFAULT_CAPACITY requests, injecting bursts of up to
+ * INJECTOR_DEFAULT_BURST of them, with the INJECTOR_POLICY_BLOCK policy, no
+ * callback and a thread that isn't pinned to any core.
+ *
+ * @param sock A pointer to the socket where to inject the requests.
+ * @return A pointer to the newly allocated Injector or NULL.
+ */
+Injector_t * Injector_create(Socket_t *sock);
+
+/**
+ * @memberof Injector
+ *
+ * Class destructor. The requests already submitted are injected, then the
+ * injecting thread is stopped and all the resources of the Injector freed.
+ * Nobody may be submitting meanwhile.
+ *
+ * @param inj Pointer to the Injector to be freed.
+ */
+void Injector_delete(Injector_t *inj);
+
+/**
+ * @memberof Injector
+ *
+ * Submits a packet to be injected. Can be called from any thread.
+ *
+ * @param inj Pointer to the Injector.
+ * @param pack Pointer to the Packet to inject.
+ * @param arg Handed to the callback of the Injector, see InjectorRequest.
+ * @return 0 on success, -1 if the packet was dropped or on error.
+ */
+int Injector_submit(Injector_t *inj, const Packet_t *pack, void *arg);
+
+/**
+ * @memberof Injector
+ *
+ * Submits a frame already serialized to be injected, as with
+ * Socket_injectRawBatch(). Can be called from any thread. The frame must be
+ * left untouched until its callback is called.
+ *
+ * @param inj Pointer to the Injector.
+ * @param frame Pointer to the frame to inject.
+ * @param length The length of the frame in bytes.
+ * @param arg Handed to the callback of the Injector, see InjectorRequest.
+ * @return 0 on success, -1 if the frame was dropped or on error.
+ */
+int Injector_submitFrame(
+        Injector_t *inj,
+        const uint8_t *frame,
+        unsigned int length,
+        void *arg);
+
+/**
+ * @memberof Injector
+ *
+ * Waits until every request submitted before the call has been handled and
+ * its callback called. Must not be called from the callback.
+ *
+ * @param inj Pointer to the Injector.
+ * @return 0 on success, -1 otherwise.
+ */
+int Injector_flush(Injector_t *inj);
+
+/**
+ * @memberof Injector
+ *
+ * Reads the counters of an Injector. Can be called from any thread.
+ *
+ * @param inj Pointer to the Injector.
+ * @param stats Pointer to where to copy the counters.
+ * @return 0 on success, -1 otherwise.
+ */
+int Injector_getStats(const Injector_t *inj, InjectorStats_t *stats);
+
+#endif
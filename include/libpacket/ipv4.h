@@ -35,8 +35,25 @@
  */
 typedef struct Ipv4Proto Ipv4Proto_t;
 
+/**
+ * @enum Ipv4Field
+ * @brief Identifiers of the patchable fields of Ipv4Proto (see
+ * ProtocolField).
+ */
+enum Ipv4Field {
+    IPV4_FIELD_TOS = 0,
+    IPV4_FIELD_LENGTH,
+    IPV4_FIELD_ID,
+    IPV4_FIELD_TTL,
+    IPV4_FIELD_PROTOCOL,
+    IPV4_FIELD_CHECKSUM,
+    IPV4_FIELD_SADDR,
+    IPV4_FIELD_DADDR,
+};
+
 //TODO: Don't use literals, but macros instead.
 typedef struct Ipv4Proto {
+    Protocol_t base;
     uint8_t version: 4;
     uint8_t hdr_length: 4;
     uint8_t tos;
@@ -50,7 +67,6 @@ typedef struct Ipv4Proto {
     uint32_t saddr;
     uint32_t daddr;
     uint32_t *opts_padding;
-    Protocol_t *proto_base;
 } Ipv4Proto_t;
 
 //TODO: createWithParams().
@@ -65,10 +81,34 @@ typedef struct Ipv4Proto {
  */
 Ipv4Proto_t * Ipv4Proto_create(void);
 
+/**
+ * @memberof Ipv4Proto
+ *
+ * Same as Ipv4Proto_create() but the instance, Protocol included, is allocated
+ * from an Arena. It must not be deleted, it's freed with the Arena.
+ *
+ * @param arena Pointer to the Arena where to allocate the instance.
+ * @return A pointer to the newly allocated Ipv4Proto instance or NULL.
+ */
+Ipv4Proto_t * Ipv4Proto_createInArena(Arena_t *arena);
+
+/**
+ * @memberof Ipv4Proto
+ *
+ * Copy constructor. Creates a new Ipv4Proto with the same members as another
+ * one, not stacked on any Packet.
+ *
+ * @param proto Pointer to the Ipv4Proto instance to copy.
+ * @return A pointer to the newly allocated Ipv4Proto instance or NULL.
+ */
+Ipv4Proto_t * Ipv4Proto_clone(const Ipv4Proto_t *proto);
+
 /**
  * @memberof Ipv4Proto
  *
  * Class destructor. Frees all the resources associated to an Ipv4Proto header.
+ * If the instance is shared by clones of a Packet (see Packet_clone()) it's
+ * only freed once they release it too.
  *
  * @param proto Pointer to an Ipv4Proto instance to free its resources.
  */
@@ -89,6 +129,9 @@ unsigned int Ipv4Proto_getSize(const Ipv4Proto_t *proto);
  *
  * Implements the getBitstream() behavior (read Protocol for further details).
  *
+ * If the member checksum is 0 (the default) the header checksum is computed
+ * here, otherwise its value is written as is.
+ *
  * @param proto Pointer to an Ipv4Proto instance to get its bitstream from.
  * @param buf Pointer to a buffer where the bitstream will be written into.
  * @param size The maximum size of the buffer.
@@ -102,10 +145,31 @@ int Ipv4Proto_getBitstream(
 /**
  * @memberof Ipv4Proto
  *
- * Getter of the member proto_base.
+ * Updates the checksum of an already serialized IPv4 header after some of its
+ * bytes changed, without going over the whole header again (RFC 1624).
  *
- * @param proto Pointer to the instance to get its proto_base.
- * @return A pointer to the member proto_base or NULL.
+ * @param hdr Pointer to the serialized header. Its checksum is updated in
+ * place.
+ * @param offset The offset within the header of the bytes that changed.
+ * @param old The bytes before the change.
+ * @param new The bytes after the change.
+ * @param len The number of bytes that changed.
+ * @return 0 on success, -1 otherwise.
+ */
+int Ipv4Proto_updateChecksum(
+        uint8_t *hdr,
+        unsigned int offset,
+        const uint8_t *old,
+        const uint8_t *new,
+        unsigned int len);
+
+/**
+ * @memberof Ipv4Proto
+ *
+ * Getter of the Protocol embedded in the instance (member base).
+ *
+ * @param proto Pointer to the instance to get its Protocol.
+ * @return A pointer to the member base or NULL.
  */
 Protocol_t * Ipv4Proto_getProtoBase(const Ipv4Proto_t *proto);
 
@@ -163,5 +227,49 @@ int Ipv4Proto_setProtocol(Ipv4Proto_t *proto, uint8_t proto_num);
  */
 uint8_t Ipv4Proto_getProtocol(const Ipv4Proto_t *proto);
 
+/**
+ * @memberof Ipv4Proto
+ *
+ * Setter of the member id.
+ *
+ * @param proto Pointer to the instance to set its id.
+ * @param id The identification of the datagram.
+ * @return 0 on success, -1 otherwise.
+ */
+int Ipv4Proto_setId(Ipv4Proto_t *proto, uint16_t id);
+
+/**
+ * @memberof Ipv4Proto
+ *
+ * Setter of the member ttl.
+ *
+ * @param proto Pointer to the instance to set its ttl.
+ * @param ttl The time to live of the datagram.
+ * @return 0 on success, -1 otherwise.
+ */
+int Ipv4Proto_setTtl(Ipv4Proto_t *proto, uint8_t ttl);
+
+/**
+ * @memberof Ipv4Proto
+ *
+ * Setter of the member saddr.
+ *
+ * @param proto Pointer to the instance to set its saddr.
+ * @param addr The source address, in host byte order.
+ * @return 0 on success, -1 otherwise.
+ */
+int Ipv4Proto_setSaddr(Ipv4Proto_t *proto, uint32_t addr);
+
+/**
+ * @memberof Ipv4Proto
+ *
+ * Setter of the member daddr.
+ *
+ * @param proto Pointer to the instance to set its daddr.
+ * @param addr The destination address, in host byte order.
+ * @return 0 on success, -1 otherwise.
+ */
+int Ipv4Proto_setDaddr(Ipv4Proto_t *proto, uint32_t addr);
+
 #endif
 
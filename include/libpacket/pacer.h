@@ -0,0 +1,263 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+#ifndef __LIBPACKET_PACER
+#define __LIBPACKET_PACER
+
+/**
+ * @file pacer.h
+ * @author David "Ole" Luengo
+ * @date 10 March 2018
+ * @brief File implementing a pacer to inject packets at a given rate.
+ */
+
+#include <stdint.h>
+
+#include "libpacket/packet.h"
+#include "libpacket/socket.h"
+
+/**
+ * @enum PacerUnit
+ * @brief What the rate of a Pacer counts.
+ */
+typedef enum PacerUnit {
+    /** Packets per second. The default. */
+    PACER_UNIT_PPS = 0,
+    /** Bits per second, counting the bytes of every frame. */
+    PACER_UNIT_BPS,
+} PacerUnit_t;
+
+#define PACER_DEFAULT_BURST (32)
+#define PACER_DEFAULT_SPIN_NS (50000)
+
+/**
+ * @struct PacerParams
+ * @brief Parameters accepted by Pacer_createWithParams().
+ */
+typedef struct PacerParams {
+    /** The rate, in unit. */
+    double rate;
+    /** What rate counts. */
+    PacerUnit_t unit;
+    /** Packets (PPS) or bytes (BPS) that may go back to back, either after
+     * being idle or to catch up with a late wake up. 0 for
+     * PACER_DEFAULT_BURST packets, or one frame worth of bytes. */
+    unsigned int burst;
+    /** Waits shorter than this many nanoseconds spin instead of sleeping. 0
+     * for PACER_DEFAULT_SPIN_NS. */
+    uint64_t spin_ns;
+    /** If not 0, the rate goes linearly from rate to ramp_rate during the
+     * first ramp_ns nanoseconds, then stays at ramp_rate. */
+    uint64_t ramp_ns;
+    /** The rate at the end of the ramp, in unit. */
+    double ramp_rate;
+} PacerParams_t;
+
+/**
+ * @struct PacerStats
+ * @brief What a Pacer achieved so far.
+ *
+ * The jitter of a packet is how late it was released with respect to the
+ * time it was scheduled for. It's only measured for the packets the Pacer
+ * releases itself: those injected with Pacer_injectAt() are released by the
+ * qdisc, and the Pacer never knows when.
+ */
+typedef struct PacerStats {
+    /** Packets released. */
+    uint64_t packets;
+    /** Bytes released. */
+    uint64_t bytes;
+    /** Nanoseconds between the first and the last packet released. */
+    uint64_t elapsed_ns;
+    /** Packets per second achieved. */
+    double pps;
+    /** Bits per second achieved. */
+    double bps;
+    /** Average jitter in nanoseconds. */
+    double jitter_avg_ns;
+    /** Maximum jitter in nanoseconds. */
+    double jitter_max_ns;
+} PacerStats_t;
+
+/**
+ * @class Pacer "libpacket/pacer.h"
+ * @brief Class implementing a token bucket to release packets at a rate.
+ *
+ * A Pacer schedules every packet at the time the rate allows it (a token
+ * bucket expressed as the theoretical arrival time of the next packet, as in
+ * GCRA) and waits until then: sleeping with clock_nanosleep() while the wait
+ * is long and spinning on CLOCK_MONOTONIC for the last spin_ns nanoseconds,
+ * so the precision is the one of the clock and not the one of the scheduler.
+ *
+ * Being late doesn't lower the rate: the packets that should have gone
+ * meanwhile go back to back, up to burst of them. Being idle doesn't raise
+ * it either: no more than burst packets are saved up.
+ *
+ * Pacer_injectBatch() releases at once all the packets whose time has come
+ * and injects them with a single Socket_injectBatch(), so high rates aren't
+ * limited by the cost of a system call per packet. Any backend can be used.
+ *
+ * With a socket supporting launch times Pacer_injectAt() hands every packet
+ * to the kernel ahead of time, and the qdisc sends it when it's due.
+ */
+typedef struct Pacer Pacer_t;
+
+/* Times are in nanoseconds since start, the CLOCK_MONOTONIC time the Pacer
+ * was first used. The member tat is the time the next packet is scheduled
+ * for. The members jitter_sum and jitter_max accumulate the jitter of the
+ * jitter_packets packets whose jitter was measured. The members first and
+ * last are the times of the first and last packets released and
+ * first_length the length of the first one.
+ */
+typedef struct Pacer {
+    PacerParams_t params;
+    uint64_t start;
+    int started;
+    double tat;
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t first;
+    uint64_t last;
+    unsigned int first_length;
+    double jitter_sum;
+    double jitter_max;
+    uint64_t jitter_packets;
+} Pacer_t;
+
+/**
+ * @memberof Pacer
+ *
+ * Class constructor with parameters.
+ *
+ * @param params Pointer to the parameters of the Pacer.
+ * @return A pointer to the newly allocated Pacer or NULL.
+ */
+Pacer_t * Pacer_createWithParams(const PacerParams_t *params);
+
+/**
+ * @memberof Pacer
+ *
+ * Class constructor. Creates a Pacer releasing pps packets per second, with
+ * the default parameters otherwise.
+ *
+ * @param pps The rate in packets per second.
+ * @return A pointer to the newly allocated Pacer or NULL.
+ */
+Pacer_t * Pacer_create(double pps);
+
+/**
+ * @memberof Pacer
+ *
+ * Class destructor.
+ *
+ * @param pacer Pointer to the Pacer to be freed.
+ */
+void Pacer_delete(Pacer_t *pacer);
+
+/**
+ * @memberof Pacer
+ *
+ * Changes the rate from now on, ending any ramp.
+ *
+ * @param pacer Pointer to an instance of Pacer.
+ * @param rate The new rate, in the unit of the Pacer.
+ * @return 0 on success, -1 otherwise.
+ */
+int Pacer_setRate(Pacer_t *pacer, double rate);
+
+/**
+ * @memberof Pacer
+ *
+ * Waits until a frame may be released and accounts for it. Useful to pace
+ * anything else than a Socket.
+ *
+ * @param pacer Pointer to an instance of Pacer.
+ * @param length The length of the frame in bytes.
+ * @return 0 on success, -1 otherwise.
+ */
+int Pacer_wait(Pacer_t *pacer, unsigned int length);
+
+/**
+ * @memberof Pacer
+ *
+ * Waits until a packet may be released and injects it, see Socket_inject().
+ * If it isn't injected it isn't accounted for.
+ *
+ * @param pacer Pointer to an instance of Pacer.
+ * @param sock A pointer to the socket where to inject the packet.
+ * @param pack A pointer to the packet to inject.
+ * @return The number of bytes written into the network or -1 on error.
+ */
+int Pacer_inject(Pacer_t *pacer, Socket_t *sock, const Packet_t *pack);
+
+/**
+ * @memberof Pacer
+ *
+ * Injects several packets, each one of them at its time. The packets whose
+ * time has already come are injected together, see Socket_injectBatch().
+ *
+ * @param pacer Pointer to an instance of Pacer.
+ * @param sock A pointer to the socket where to inject the packets.
+ * @param packs An array of n pointers to the packets to be injected.
+ * @param n The number of packets.
+ * @param results An optional array of n elements (can be NULL), see
+ * Socket_injectBatch().
+ * @return The number of packets injected or -1 on error. If the socket
+ * refuses a packet the remaining ones aren't injected.
+ */
+int Pacer_injectBatch(
+        Pacer_t *pacer,
+        Socket_t *sock,
+        const Packet_t * const *packs,
+        unsigned int n,
+        int *results);
+
+/**
+ * @memberof Pacer
+ *
+ * Injects a packet with its scheduled time as launch time, see
+ * Socket_injectAt(), so the qdisc releases it and not the Pacer. The Pacer
+ * only waits until lead_ns nanoseconds before that time, staying ahead of the
+ * wire and leaving no room for the jitter of the scheduler. A packet that is
+ * already late is given the current time. The socket must have been created
+ * with SOCKET_FLAG_TXTIME. The packet counts for the rate in the statistics
+ * but not for the jitter (see PacerStats).
+ *
+ * @param pacer Pointer to an instance of Pacer.
+ * @param sock A pointer to the socket where to inject the packet.
+ * @param pack A pointer to the packet to inject.
+ * @param lead_ns How long before its launch time a packet is handed to the
+ * kernel. With etf it must be more than the delta of the qdisc.
+ * @return The number of bytes written into the network or -1 on error.
+ */
+int Pacer_injectAt(
+        Pacer_t *pacer,
+        Socket_t *sock,
+        const Packet_t *pack,
+        uint64_t lead_ns);
+
+/**
+ * @memberof Pacer
+ *
+ * Gets the statistics of the Pacer.
+ *
+ * @param pacer Pointer to an instance of Pacer.
+ * @param stats Pointer to where to copy them.
+ * @return 0 on success, -1 otherwise.
+ */
+int Pacer_getStats(const Pacer_t *pacer, PacerStats_t *stats);
+
+#endif
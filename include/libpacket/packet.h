@@ -26,8 +26,10 @@
  */
 
 #include <stdint.h>
+#include <sys/uio.h>
 
 #include "libpacket/stack.h"
+#include "libpacket/buffer.h"
 
 /*-------------------------------- Protocol ---------------------------------*/
 
@@ -40,9 +42,18 @@
  *
  * Ideally other developers will develop their own protocols for libpacket.
  * Here is how you do it:
- *   - Declaring one of the extending class members of type Protocol_t *.
+ *   - Embedding a Protocol_t in the extending class and calling
+ *     Protocol_init() from its constructors.
+ *   - Defining a const ProtocolOps with the methods of the class.
  *   - Implementing a getSize() method.
  *   - Implementing a getBitstream() method.
+ *   - Optionally, implementing a finalize() method if some part of the header
+ *     depends on other layers (i.e. a checksum over the payload).
+ *   - Optionally, implementing a getData() method if the wire representation
+ *     of the Protocol already lives somewhere in memory (i.e. a payload owned
+ *     by the application).
+ *   - Optionally, implementing clone() and release() methods, so Packets
+ *     stacking the Protocol can be cloned (see Packet_clone()).
  */
 typedef struct Protocol Protocol_t;
 
@@ -79,38 +90,209 @@ typedef int (*Protocol_getBitstreamFunc_t)(
         uint8_t *,
         unsigned int);
 
-typedef struct Protocol {
+/**
+ * @struct ProtocolFinalize
+ * @brief What a Protocol gets to finish its header once the whole Packet has
+ * been serialized.
+ *
+ * The member hdr points to the header written by getBitstream(), hdr_size
+ * bytes long. The member lower points to the serialized header of the layer
+ * below, lower_size bytes long, or is NULL for the bottom layer. The member
+ * payload_size is the number of bytes after the header and payload_sum their
+ * one's complement sum (see Checksum_partial()) as if they started right at
+ * the start of hdr. The member flags holds the flags passed to
+ * Packet_getBitstreamWithFlags().
+ *
+ * With PACKET_PARTIAL_CHECKSUM set, payload_sum is always 0 and checksums
+ * covering the payload must be left with the sum of the pseudo header only,
+ * not complemented, for someone else (the kernel or the NIC) to finish them.
+ */
+typedef struct ProtocolFinalize {
+    uint8_t *hdr;
+    unsigned int hdr_size;
+    const uint8_t *lower;
+    unsigned int lower_size;
+    unsigned int payload_size;
+    uint32_t payload_sum;
+    unsigned int flags;
+} ProtocolFinalize_t;
+
+/* Checksums covering the payload are left partial (see ProtocolFinalize). */
+#define PACKET_PARTIAL_CHECKSUM (1 << 0)
+
+/**
+ * @typedef int (*Protocol_finalizeFunc_t)(Protocol_t *, ProtocolFinalize_t *)
+ *
+ * This is the signature of the methods implementing the optional finalize()
+ * behavior.
+ *
+ * After all the layers of a Packet have been written, the finalize() method
+ * of every layer that has one is called, from the top of the Packet to the
+ * bottom, so layers can fill in the parts of their header that depend on the
+ * rest of the Packet. It receives a pointer to its instance (self/this) and
+ * a ProtocolFinalize describing where the layer ended up. Returns 0 on
+ * success, -1 otherwise.
+ */
+typedef int (*Protocol_finalizeFunc_t)(Protocol_t *, ProtocolFinalize_t *);
+
+/**
+ * @typedef const uint8_t * (*Protocol_getDataFunc_t)(Protocol_t *)
+ *
+ * This is the signature of the methods implementing the optional getData()
+ * behavior.
+ *
+ * It receives a pointer to its instance (self/this) and returns a pointer to
+ * the getSize() bytes of the wire representation of the Protocol, or NULL if
+ * they have to be written with getBitstream(). Packet_getIovec() references
+ * that memory instead of copying it.
+ */
+typedef const uint8_t * (*Protocol_getDataFunc_t)(Protocol_t *);
+
+/**
+ * @typedef Protocol_t * (*Protocol_cloneFunc_t)(Protocol_t *)
+ *
+ * This is the signature of the methods implementing the optional clone()
+ * behavior.
+ *
+ * It receives a pointer to its instance (self/this) and returns a pointer to
+ * the Protocol of a new instance of the extending class with the same
+ * members, not stacked on any Packet, or NULL. Without it the layers of a
+ * Packet can't be copied on write (see Packet_clone()).
+ */
+typedef Protocol_t * (*Protocol_cloneFunc_t)(Protocol_t *);
+
+/**
+ * @typedef void (*Protocol_releaseFunc_t)(Protocol_t *)
+ *
+ * This is the signature of the methods implementing the optional release()
+ * behavior.
+ *
+ * It receives a pointer to its instance (self/this) and drops a reference to
+ * it, freeing it if it was the last one (see Protocol_unref()). It's usually
+ * the class destructor.
+ */
+typedef void (*Protocol_releaseFunc_t)(Protocol_t *);
+
+#define PROTOCOL_FIELD_BIG_ENDIAN (0)
+#define PROTOCOL_FIELD_LITTLE_ENDIAN (1)
+
+/* The field is a checksum over the header of its protocol. */
+#define PROTOCOL_FIELD_CHECKSUM (1 << 0)
+/* The checksum also covers the payload of the protocol and the fields flagged
+ * with PROTOCOL_FIELD_PSEUDO_HEADER, of its own layer and of the layer below.
+ */
+#define PROTOCOL_FIELD_CHECKSUM_PAYLOAD (1 << 1)
+/* A checksum of 0 means there is no checksum. */
+#define PROTOCOL_FIELD_CHECKSUM_OPTIONAL (1 << 2)
+/* The field is part of the pseudo header of the payload checksum of its own
+ * layer or, if it has none, of the transport layer above. */
+#define PROTOCOL_FIELD_PSEUDO_HEADER (1 << 3)
+
+/**
+ * @struct ProtocolField
+ * @brief Description of where a field of a protocol lives in the wire.
+ *
+ * Protocols describe the fields that can be patched in an already serialized
+ * header with a table of ProtocolField (see Template). The id is chosen by
+ * the protocol (i.e. IPV4_FIELD_ID) and the offset is relative to the start
+ * of the header. Fields are whole bytes, up to 8 of them. The flags tell
+ * which checksums have to be updated when the field changes
+ * (PROTOCOL_FIELD_*).
+ */
+typedef struct ProtocolField {
+    unsigned int id;
+    unsigned int offset;
+    unsigned int width;
+    unsigned int byte_order;
+    unsigned int flags;
+} ProtocolField_t;
+
+/**
+ * @enum ProtocolType
+ * @brief Identifiers of the classes extending Protocol implemented by the
+ * library, used to recognize well-known stacks of layers (see Serializer).
+ */
+enum ProtocolType {
+    PROTOCOL_TYPE_OTHER = 0,
+    PROTOCOL_TYPE_ETHER,
+    PROTOCOL_TYPE_IPV4,
+    PROTOCOL_TYPE_UDPV4,
+    PROTOCOL_TYPE_RAW,
+};
+
+/**
+ * @struct ProtocolOps
+ * @brief The methods and the table of fields of a class extending Protocol.
+ *
+ * Every class extending Protocol defines a single const ProtocolOps shared by
+ * all its instances. The members getSize and getBitstream are required, the
+ * rest can be NULL. The members fields and fields_nr are the table of
+ * patchable fields of the class (see ProtocolField), the table must outlive
+ * the instances. The member type is one of ProtocolType, classes outside the
+ * library leave it as PROTOCOL_TYPE_OTHER. The members clone and release are
+ * both needed for Packet_clone() to work with the class.
+ */
+typedef struct ProtocolOps {
     Protocol_getSizeFunc_t getSize;
     Protocol_getBitstreamFunc_t getBitstream;
-    StackItem_t *item;
+    Protocol_finalizeFunc_t finalize;
+    Protocol_getDataFunc_t getData;
+    Protocol_cloneFunc_t clone;
+    Protocol_releaseFunc_t release;
+    const ProtocolField_t *fields;
+    unsigned int fields_nr;
+    unsigned int type;
+} ProtocolOps_t;
+
+/* A Protocol is meant to be embedded in the struct of the extending class,
+ * with the StackItem used to stack it on a Packet embedded in turn, so a
+ * layer is a single block of memory. The member owner points to the instance
+ * of the extending class and packet to the Packet this Protocol is stacked
+ * on, if any, so the Packet can be told when one of its layers changes. The
+ * member dirty is set by Protocol_changed() until the Packet writes the layer
+ * again into its image (see Packet_getImage()). The member refs counts the
+ * references to the instance, the one of its creator plus one per clone of a
+ * Packet sharing it (see Packet_clone()).
+ */
+typedef struct Protocol {
+    StackItem_t item;
+    const ProtocolOps_t *ops;
     void *owner;
+    struct Packet *packet;
+    int dirty;
+    unsigned int refs;
 } Protocol_t;
 
 /**
  * @memberof Protocol
  *
- * Class constructor with parameters. Allocates and initializes a new instance
- * of Protocol.
+ * Initializes a Protocol embedded in an instance of an extending class. Every
+ * constructor of an extending class must call it.
+ *
+ * @param proto Pointer to the Protocol to initialize.
+ * @param ops Pointer to the ProtocolOps of the extending class, it isn't
+ * copied. If NULL the Protocol has no bytes.
+ * @param owner A pointer to the instance of the extending class.
+ */
+void Protocol_init(Protocol_t *proto, const ProtocolOps_t *ops, void *owner);
+
+/**
+ * @memberof Protocol
+ *
+ * Class constructor with parameters. Allocates and initializes a standalone
+ * instance of Protocol.
  * 
- * @param getSize Pointer to the getSize() function of the implementing
- * protocol.
- * @param getBitstream Pointer to the getBitstream() function of the
- * implementing Protocol.
- * @param item The StackItem instance hold by this Protocol.
+ * @param ops Pointer to the ProtocolOps of the implementing protocol.
  * @param owner A pointer to an instance of an extending class.
  * @return A pointer to the newly allocated Protocol or NULL.
  */
-Protocol_t * Protocol_createWithParams(
-        Protocol_getSizeFunc_t getSize,
-        Protocol_getBitstreamFunc_t getBitstream,
-        StackItem_t *item,
-        void *owner);
+Protocol_t * Protocol_createWithParams(const ProtocolOps_t *ops, void *owner);
 
 /**
  * @memberof Protocol
  * 
  * Class constructor. Allocates and initializes a new Protocol instance with
- * its member with default values.
+ * no bytes and no owner.
  *
  * @return A pointer to the newly allocated Protocol or NULL.
  */
@@ -119,7 +301,21 @@ Protocol_t * Protocol_create(void);
 /**
  * @memberof Protocol
  *
- * Class destructor. Frees all the resources associated to a Protocol instance.
+ * Same as Protocol_create() but the instance is allocated from an Arena. It
+ * must not be deleted, it's freed with the Arena.
+ *
+ * @param arena Pointer to the Arena where to allocate the instance.
+ * @return A pointer to the newly allocated Protocol or NULL.
+ */
+Protocol_t * Protocol_createInArena(Arena_t *arena);
+
+/**
+ * @memberof Protocol
+ *
+ * Class destructor. Frees a Protocol allocated by Protocol_create() or
+ * Protocol_createWithParams(), once the last reference to it is dropped (see
+ * Protocol_unref()). Protocols embedded in other classes are freed with
+ * them.
  * 
  * @param proto A pointer to the instance of Protocol to be freed.
  */
@@ -128,13 +324,23 @@ void Protocol_delete(Protocol_t *proto);
 /**
  * @memberof Protocol
  *
- * Setter of the member item.
- * 
- * @param proto Pointer to the Protocol instance to set its StackItem member.
- * @param item Pointer to the StackItem instance to be set.
- * @return 0 on success, -1 otherwise.
+ * Takes a reference to a Protocol. It won't be freed until it's released as
+ * many times as it was referenced, plus one.
+ *
+ * @param proto Pointer to the Protocol instance.
  */
-int Protocol_setItem(Protocol_t *proto, StackItem_t *item);
+void Protocol_ref(Protocol_t *proto);
+
+/**
+ * @memberof Protocol
+ *
+ * Drops a reference to a Protocol. The destructors of the classes extending
+ * Protocol call it and only free the instance when it returns 1.
+ *
+ * @param proto Pointer to the Protocol instance.
+ * @return 1 if that was the last reference, 0 otherwise or if proto is NULL.
+ */
+int Protocol_unref(Protocol_t *proto);
 
 /**
  * @memberof Protocol
@@ -145,7 +351,7 @@ int Protocol_setItem(Protocol_t *proto, StackItem_t *item);
  * StackItem member.
  * @return A pointer to the StackItem member or NULL;
  */
-StackItem_t * Protocol_getItem(const Protocol_t *proto);
+StackItem_t * Protocol_getItem(Protocol_t *proto);
 
 /**
  * @memberof Protocol
@@ -174,51 +380,50 @@ void * Protocol_getOwner(const Protocol_t *proto);
 /**
  * @memberof Protocol
  *
- * Setter of the member getSize.
- * 
- * @param proto Pointer to the Protocol instance to set its getSize member.
- * @param func Pointer to the method of an extending class that implements
- * the getSize() behavior.
+ * Setter of the member ops.
+ *
+ * @param proto Pointer to the Protocol instance to set its ops member.
+ * @param ops Pointer to the ProtocolOps of the extending class, it isn't
+ * copied. If NULL the Protocol has no bytes.
  * @return 0 if sucess, -1 otherwise.
  */
-int Protocol_setGetSize(Protocol_t *proto, Protocol_getSizeFunc_t func);
+int Protocol_setOps(Protocol_t *proto, const ProtocolOps_t *ops);
 
 /**
  * @memberof Protocol
  *
- * Getter of the member getSize.
- * 
- * @param proto Pointer to the Protocol instance from where to get the getSize
+ * Getter of the member ops.
+ *
+ * @param proto Pointer to the Protocol instance from where to get the ops
  * member.
- * @return A pointer to the getSize method of this Protocol.
+ * @return A pointer to the ProtocolOps of this Protocol or NULL.
  */
-Protocol_getSizeFunc_t Protocol_getGetSize(const Protocol_t *proto);
+const ProtocolOps_t * Protocol_getOps(const Protocol_t *proto);
 
 /**
  * @memberof Protocol
  *
- * Setter of the member getBitstream.
- * 
- * @param proto Pointer to the Protocol instance to set its getBitstream
- * member.
- * @param func Pointer to the method of an extending class that implements the
- * getBitstream() behavior.
- * @return 0 if sucess, -1 otherwise.
+ * Getter of the table of fields of the Protocol (see ProtocolOps).
+ *
+ * @param proto Pointer to the Protocol instance to get its fields from.
+ * @param fields_nr Output parameter where the number of fields is written.
+ * @return A pointer to the table of fields or NULL.
  */
-int Protocol_setGetBitstream(
-        Protocol_t *proto,
-        Protocol_getBitstreamFunc_t func);
+const ProtocolField_t * Protocol_getFields(
+        const Protocol_t *proto,
+        unsigned int *fields_nr);
 
 /**
  * @memberof Protocol
  *
- * Getter of the member getBitstream.
- * 
- * @param Pointer to the Protocol instance from where to get the getBitstream
- * member.
- * @return A pointer to the getBitstream method of this Protocol.
+ * Notifies that some member of an extending class changed. Every setter of a
+ * class extending Protocol must call this method, otherwise the Packet the
+ * Protocol is stacked on could keep using stale information about it. Same
+ * if a member is modified directly, without a setter.
+ *
+ * @param proto Pointer to the Protocol instance that changed.
  */
-Protocol_getBitstreamFunc_t Protocol_getGetBitstream(const Protocol_t *proto);
+void Protocol_changed(Protocol_t *proto);
 
 /*--------------------------------- Packet ----------------------------------*/
 
@@ -230,11 +435,68 @@ Protocol_getBitstreamFunc_t Protocol_getGetBitstream(const Protocol_t *proto);
  * protocols one on top of each other. To give an example, a common DNS query
  * would be Ethernet - IPv4 - UDPv4 - DNS, with Ethernet being the bottom of
  * the Packet/Stack and DNS at the top.
+ *
+ * A Packet caches its size and the offset of every layer within its wire
+ * representation. The cache is rebuilt the first time it's needed after a
+ * layer is stacked or changes, so serializing the same Packet over and over
+ * doesn't walk its layers to compute sizes every time.
+ *
+ * A Packet also keeps its last wire representation, its image, to be sent
+ * again by Socket_inject(). Only the layers that changed since (see
+ * Protocol_changed()) are written again, and only the checksums depending on
+ * them are computed again.
+ *
+ * Many similar Packets are better built cloning a base one (see
+ * Packet_clone()). Clones share the layers of the base Packet and its image,
+ * and only the layers changed in a clone are copied.
+ *
+ * Even the methods taking a const Packet update its caches, so a Packet can
+ * only be used by one thread at a time. To share it among threads it has to
+ * be frozen first (see Packet_freeze()).
  */
 typedef struct Packet Packet_t;
 
+/* The member size is the cached size of the Packet and offsets an array of
+ * offsets_nr elements with the offset of every layer, bottom first. Both are
+ * only meaningful if layout_valid is set. The member offsets points to
+ * inline_offsets until the Packet has more than STACK_INLINE_ITEMS layers.
+ * The member arena is the Arena the Packet was allocated from, or NULL.
+ *
+ * The image of the Packet lives in image_mem, a block of image_mem_size
+ * bytes: sums, the partial checksum of every layer in the image, and
+ * image_offsets, the offset of every layer in the image, followed by image
+ * itself, image_size bytes. The layout may be computed again before the
+ * image is, so the image keeps the offsets it was written with. It's only
+ * meaningful if image_valid is set, and was written with image_flags. The
+ * member dirty is set when any layer is dirty.
+ *
+ * The member serializer, found along with the layout, writes the bottom
+ * layers of the Packet at once when they are a well-known stack, or is NULL.
+ *
+ * The member owns_layers is set in clones, which hold a reference to every
+ * one of their layers and release them when deleted. The member frozen is set
+ * by Packet_freeze().
+ */
 typedef struct Packet {
     Stack_t *stack;
+    unsigned int size;
+    unsigned int *offsets;
+    unsigned int offsets_nr;
+    int layout_valid;
+    Arena_t *arena;
+    unsigned int inline_offsets[STACK_INLINE_ITEMS];
+    void *image_mem;
+    size_t image_mem_size;
+    uint32_t *sums;
+    unsigned int *image_offsets;
+    uint8_t *image;
+    unsigned int image_size;
+    int image_valid;
+    unsigned int image_flags;
+    int dirty;
+    const struct Serializer *serializer;
+    int owns_layers;
+    int frozen;
 } Packet_t;
 
 /**
@@ -257,6 +519,44 @@ Packet_t * Packet_createWithParams(Stack_t *stack);
  */
 Packet_t * Packet_create(void);
 
+/**
+ * @memberof Packet
+ *
+ * Class constructor. Same as Packet_create() but the Packet, its Stack and
+ * the memory it needs later on are allocated from an Arena. Together with the
+ * *Proto_createInArena() constructors, building a Packet doesn't need to call
+ * malloc(). The Packet is freed with the Arena, Packet_delete() only
+ * releases the layers Packet_getLayerForWrite() copied for it, if any, and
+ * must then be called before the Arena is freed.
+ *
+ * @param arena Pointer to the Arena where to allocate the Packet.
+ * @return A pointer to the newly allocated Packet or NULL.
+ */
+Packet_t * Packet_createInArena(Arena_t *arena);
+
+/**
+ * @memberof Packet
+ *
+ * Class constructor. Creates a copy of a Packet that shares its layers, and
+ * starts with a copy of its image (see Packet_getImage()), so no layer is
+ * copied or written again until it changes. The layers of the clone must be
+ * changed through Packet_getLayerForWrite(), which copies the shared ones the
+ * first time. Packet_getLayer() only gives them to be read.
+ *
+ * The layers of pack are shared for as long as any clone lives, they must
+ * not be changed through the pointers kept by the application, only through
+ * Packet_getLayerForWrite() on pack, which copies them as well. Deleting them
+ * is fine, the clones hold a reference.
+ *
+ * Every layer of pack must implement clone() and release() (see
+ * ProtocolOps). Clones of a Packet built in an Arena must not outlive the
+ * Arena.
+ *
+ * @param pack Pointer to the Packet instance to clone.
+ * @return A pointer to the newly allocated Packet or NULL.
+ */
+Packet_t * Packet_clone(const Packet_t *pack);
+
 /**
  * @memberof Packet
  *
@@ -266,6 +566,48 @@ Packet_t * Packet_create(void);
  */
 void Packet_delete(Packet_t *pack);
 
+/**
+ * @memberof Packet
+ *
+ * Freezes a Packet so it can be shared by several threads. Its layout and
+ * its image are brought up to date once and from then on nothing of the
+ * Packet is written: Packet_getImage() with the same flags, Packet_getSize(),
+ * Packet_getBitstream(), Packet_getIovec(), Packet_clone() and
+ * Socket_inject() only read it, and can be called at the same time from any
+ * number of threads.
+ *
+ * A frozen Packet can't be stacked on, Packet_getLayerForWrite() fails on it
+ * and Packet_getImage() with other flags returns NULL. Its layers must not be
+ * changed until it's thawed (see Packet_thaw()), those methods would have to
+ * write the Packet again: builds without NDEBUG abort on an assertion then.
+ *
+ * @param pack Pointer to the Packet instance.
+ * @param flags The flags its image is written with, 0 or
+ * PACKET_PARTIAL_CHECKSUM (the latter for sockets with SOCKET_FLAG_VNET_HDR).
+ * @return 0 on success, -1 otherwise.
+ */
+int Packet_freeze(Packet_t *pack, unsigned int flags);
+
+/**
+ * @memberof Packet
+ *
+ * Thaws a frozen Packet, so it can be changed again. No other thread may be
+ * using it.
+ *
+ * @param pack Pointer to the Packet instance.
+ */
+void Packet_thaw(Packet_t *pack);
+
+/**
+ * @memberof Packet
+ *
+ * Tells if a Packet is frozen (see Packet_freeze()).
+ *
+ * @param pack Pointer to the Packet instance.
+ * @return Non-zero if the Packet is frozen, 0 otherwise.
+ */
+int Packet_isFrozen(const Packet_t *pack);
+
 /**
  * @memberof Packet
  *
@@ -281,7 +623,9 @@ int Packet_stack(Packet_t *pack, Protocol_t *layer);
 /**
  * @memberof Packet
  *
- * Returns the size in bytes of the Packet.
+ * Returns the size in bytes of the Packet. The first call after a layer
+ * changes computes the layout of the Packet again and keeps it in the Packet,
+ * even if pack is const (see Packet_freeze()).
  *
  * @param pack Pointer to the instance of Packet to want its size.
  * @return The size in bytes of the Packet.
@@ -292,14 +636,190 @@ unsigned int Packet_getSize(const Packet_t *pack);
  * @memberof Packet
  *
  * This method writes into buf the wire representation of the Packet up to
- * size bytes.
+ * size bytes. Well-known stacks of layers at the bottom of the Packet, like
+ * Ethernet - IPv4 - UDPv4, are written at once (see Serializer).
  *
  * @param pack Pointer to the Packet instance.
  * @param buf The buffer where to put the bytes.
  * @param size The length of buffer.
- * @return The number of bytes written into the buffer.
+ * @return The number of bytes written into the buffer. If the buffer is too
+ * small nothing is written and 0 is returned.
  */
 int Packet_getBitstream(const Packet_t *pack, uint8_t *buf, unsigned int size);
 
+/**
+ * @memberof Packet
+ *
+ * Same as Packet_getBitstream() but changing how the Packet is written
+ * according to flags.
+ *
+ * @param pack Pointer to the Packet instance.
+ * @param buf The buffer where to put the bytes.
+ * @param size The length of buffer.
+ * @param flags 0 or PACKET_PARTIAL_CHECKSUM.
+ * @return The number of bytes written into the buffer. If the buffer is too
+ * small nothing is written and 0 is returned.
+ */
+int Packet_getBitstreamWithFlags(
+        const Packet_t *pack,
+        uint8_t *buf,
+        unsigned int size,
+        unsigned int flags);
+
+/**
+ * @memberof Packet
+ *
+ * Returns the wire representation of the Packet kept by the Packet itself.
+ * The first call writes every layer, the following ones only the layers
+ * changed since, plus those with a checksum to compute again (i.e. UDPv4 if
+ * the payload or the IPv4 addresses changed). The partial checksums of the
+ * layers that didn't change are reused, so the cost is proportional to what
+ * changed, not to the size of the Packet.
+ *
+ * Members of layers modified without a setter, or the memory referenced by
+ * a layer (see getData()) modified in place, won't be seen unless
+ * Protocol_changed() is called on the layer.
+ *
+ * Even if pack is const, the image and the layout kept by the Packet are
+ * written, so two threads must not call it on the same Packet at once unless
+ * it's frozen (see Packet_freeze()).
+ *
+ * @param pack Pointer to the Packet instance.
+ * @param flags 0 or PACKET_PARTIAL_CHECKSUM. Changing them writes the whole
+ * image again.
+ * @param size Pointer to where to store the size of the image.
+ * @return A pointer to the image, valid until the Packet changes or is
+ * deleted, or NULL. Also NULL if the Packet is frozen with other flags.
+ */
+const uint8_t * Packet_getImage(
+        const Packet_t *pack,
+        unsigned int flags,
+        unsigned int *size);
+
+/**
+ * @memberof Packet
+ *
+ * Describes the wire representation of the Packet with an array of iovec,
+ * ready for sendmsg(). The layers referencing memory of their own (see
+ * getData()) are not copied, the iovec points to them. The rest of the layers
+ * are written into buf, one after the other, and every run of them takes a
+ * single iovec.
+ *
+ * Checksums are computed as in Packet_getBitstream(), reading the referenced
+ * memory but never writing it.
+ *
+ * A Packet without referenced layers is described by a single iovec pointing
+ * to its image (see Packet_getImage()) and buf isn't used.
+ *
+ * @param pack Pointer to the Packet instance.
+ * @param iov An array of n iovec to fill in.
+ * @param n The number of elements of iov.
+ * @param buf The buffer where to write the layers that aren't referenced.
+ * @param size The length of buf.
+ * @return The number of iovec used or -1 if the Packet doesn't fit in iov or
+ * in buf.
+ */
+int Packet_getIovec(
+        const Packet_t *pack,
+        struct iovec *iov,
+        unsigned int n,
+        uint8_t *buf,
+        unsigned int size);
+
+/**
+ * @memberof Packet
+ *
+ * Same as Packet_getIovec() but changing how the Packet is written according
+ * to flags (see Packet_getBitstreamWithFlags()).
+ *
+ * @param pack Pointer to the Packet instance.
+ * @param iov An array of n iovec to fill in.
+ * @param n The number of elements of iov.
+ * @param buf The buffer where to write the layers that aren't referenced.
+ * @param size The length of buf.
+ * @param flags 0 or PACKET_PARTIAL_CHECKSUM.
+ * @return The number of iovec used or -1 if the Packet doesn't fit in iov or
+ * in buf.
+ */
+int Packet_getIovecWithFlags(
+        const Packet_t *pack,
+        struct iovec *iov,
+        unsigned int n,
+        uint8_t *buf,
+        unsigned int size,
+        unsigned int flags);
+
+/**
+ * @memberof Packet
+ *
+ * Encapsulates the frame held in a PacketBuffer with the layers of the
+ * Packet. The layers are written from the top to the bottom, each one of them
+ * in front of the previous one, taking their bytes from the headroom of the
+ * PacketBuffer, so the frame already there is never moved. That frame is the
+ * payload of the Packet, the checksums covering it are computed over it.
+ *
+ * Length fields (i.e. IPv4 total length) are written as they are set in the
+ * layers, so they must already account for the frame.
+ *
+ * @param pack Pointer to the Packet instance.
+ * @param pb Pointer to the PacketBuffer holding the frame to encapsulate.
+ * @return 0 on success, -1 if the headroom is too small, in which case the
+ * PacketBuffer isn't modified.
+ */
+int Packet_encapsulate(const Packet_t *pack, PacketBuffer_t *pb);
+
+/**
+ * @memberof Packet
+ *
+ * Returns the number of layers stacked on the Packet.
+ *
+ * @param pack Pointer to the Packet instance.
+ * @return The number of layers of the Packet.
+ */
+unsigned int Packet_getNumLayers(const Packet_t *pack);
+
+/**
+ * @memberof Packet
+ *
+ * Returns one of the layers stacked on the Packet, to be read only. In a
+ * clone (see Packet_clone()) or a cloned Packet the layer may be shared with
+ * the base Packet and the clones, and changing it would change all of them
+ * while only one of them would notice. Layers are changed through Packet_getLayerForWrite().
+ *
+ * @param pack Pointer to the Packet instance.
+ * @param index The index of the layer, 0 being the bottom of the Packet.
+ * @return A pointer to the Protocol of the layer or NULL if it doesn't exist.
+ */
+const Protocol_t * Packet_getLayer(const Packet_t *pack, unsigned int index);
+
+/**
+ * @memberof Packet
+ *
+ * Returns one of the layers stacked on the Packet, ready to be changed with
+ * its setters. If the layer is shared with other Packets, because the Packet
+ * is a clone (see Packet_clone()) or was cloned, the layer is copied first
+ * and the copy replaces it in this Packet, so the pointers returned by earlier
+ * calls for this layer, or kept by the application, no longer refer to it.
+ * The copy belongs to the Packet and is released by Packet_delete().
+ *
+ * @param pack Pointer to the Packet instance.
+ * @param index The index of the layer, 0 being the bottom of the Packet.
+ * @return A pointer to the Protocol of the layer or NULL if it doesn't exist
+ * or couldn't be copied.
+ */
+Protocol_t * Packet_getLayerForWrite(Packet_t *pack, unsigned int index);
+
+/**
+ * @memberof Packet
+ *
+ * Returns the offset of a layer within the wire representation of the
+ * Packet.
+ *
+ * @param pack Pointer to the Packet instance.
+ * @param index The index of the layer, 0 being the bottom of the Packet.
+ * @return The offset in bytes of the layer or 0 if it doesn't exist.
+ */
+unsigned int Packet_getLayerOffset(const Packet_t *pack, unsigned int index);
+
 #endif
 
@@ -0,0 +1,166 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef __LIBPACKET_POOL
+#define __LIBPACKET_POOL
+
+/**
+ * @file pool.h
+ * @author David "Ole" Luengo
+ * @date 10 March 2018
+ * @brief File implementing pools of objects of the same size.
+ */
+
+#include <stddef.h>
+#include <pthread.h>
+
+/**
+ * @class Pool "libpacket/pool.h"
+ * @brief Class implementing a pool of recycled objects of a fixed size.
+ *
+ * Objects freed to a Pool aren't given back to the system, they are kept to
+ * be handed out again by the next Pool_alloc(). Every thread keeps a free
+ * list of its own for each Pool, so allocating and freeing don't contend
+ * with other threads. When the free list of a thread grows past
+ * POOL_CACHE_MAX objects, all but POOL_CACHE_MAX/2 of them are moved as a
+ * batch to a list shared by all threads, and a thread that runs out of
+ * objects takes a single batch from there. The shared list is only touched
+ * once every POOL_CACHE_MAX/2 operations at most, under a lock held for a
+ * couple of stores.
+ *
+ * The constructors and destructors of EtherProto, Ipv4Proto, Udpv4Proto,
+ * RawProto, Packet and Stack recycle their instances through pools. The
+ * pools are meant to be static, live as long as the process and are found
+ * with Pool_getNumPools() and Pool_getPool() to read their statistics.
+ */
+typedef struct Pool Pool_t;
+
+/* The member name identifies the Pool and size is the size of its objects.
+ * The member id is the index of the Pool in the table of the free lists of
+ * every thread, 0 until the Pool is first used. The member shared is the list
+ * of batches of objects shared by all threads, protected by lock, and the
+ * rest are the statistics, updated by every thread once in a while (see
+ * PoolStats).
+ *
+ * Use POOL_INITIALIZER() to define a Pool.
+ */
+typedef struct Pool {
+    const char *name;
+    size_t size;
+    unsigned int id;
+    void *shared;
+    pthread_mutex_t lock;
+    unsigned long allocs;
+    unsigned long hits;
+    unsigned long frees;
+    unsigned long high_water;
+} Pool_t;
+
+/**
+ * The number of objects the free list of a thread holds before moving half of
+ * them to the shared list.
+ */
+#define POOL_CACHE_MAX (64)
+
+/**
+ * The maximum number of pools in a process.
+ */
+#define POOL_MAX_NR (16)
+
+/**
+ * Initializer of a static Pool of objects of type_size bytes.
+ */
+#define POOL_INITIALIZER(pool_name, type_size) \
+    {(pool_name), (type_size), 0, NULL, PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0}
+
+/**
+ * @class PoolStats "libpacket/pool.h"
+ * @brief Statistics of a Pool.
+ *
+ * Every thread adds its numbers to the Pool every few hundred operations, so
+ * they can lag behind by that much for every thread using the Pool.
+ */
+typedef struct PoolStats {
+    unsigned long allocs;       /**< Objects handed out. */
+    unsigned long hits;         /**< Objects handed out without malloc(). */
+    unsigned long frees;        /**< Objects given back. */
+    unsigned long in_use;       /**< Objects currently handed out. */
+    unsigned long high_water;   /**< Maximum of in_use seen. */
+} PoolStats_t;
+
+/**
+ * @memberof Pool
+ *
+ * Gets an object from the Pool, or allocates a new one if there is none to
+ * recycle. The contents of the object are undefined.
+ *
+ * @param pool Pointer to the Pool.
+ * @return A pointer to the object or NULL.
+ */
+void * Pool_alloc(Pool_t *pool);
+
+/**
+ * @memberof Pool
+ *
+ * Gives an object back to the Pool it was allocated from.
+ *
+ * @param pool Pointer to the Pool.
+ * @param obj Pointer to the object or NULL.
+ */
+void Pool_free(Pool_t *pool, void *obj);
+
+/**
+ * @memberof Pool
+ *
+ * Reads the statistics of a Pool.
+ *
+ * @param pool Pointer to the Pool.
+ * @param stats Pointer to where to store the statistics.
+ * @return 0 on success, -1 otherwise.
+ */
+int Pool_getStats(const Pool_t *pool, PoolStats_t *stats);
+
+/**
+ * @memberof Pool
+ *
+ * Getter of the member name.
+ *
+ * @param pool Pointer to the Pool.
+ * @return The name of the Pool or NULL.
+ */
+const char * Pool_getName(const Pool_t *pool);
+
+/**
+ * @memberof Pool
+ *
+ * Returns the number of pools used so far in the process.
+ *
+ * @return The number of pools.
+ */
+unsigned int Pool_getNumPools(void);
+
+/**
+ * @memberof Pool
+ *
+ * Gets one of the pools used so far in the process, in order of first use.
+ *
+ * @param index The index of the Pool, less than Pool_getNumPools().
+ * @return A pointer to the Pool or NULL.
+ */
+Pool_t * Pool_getPool(unsigned int index);
+
+#endif
@@ -0,0 +1,166 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef __LIBPACKET_RAW
+#define __LIBPACKET_RAW
+
+/**
+ * @file raw.h
+ * @author David "Ole" Luengo
+ * @date 10 March 2018
+ * @brief File implementing a layer of raw bytes owned by the application.
+ */
+
+#include <stdint.h>
+
+#include "libpacket/packet.h"
+
+/**
+ * @class RawProto
+ * @brief Class implementing a layer of arbitrary bytes, usually a payload.
+ *
+ * A RawProto doesn't own its bytes, it references memory of the application.
+ * That memory must stay valid and unchanged while the RawProto is in use.
+ * Packet_getIovec() points straight to it, so big payloads are never copied
+ * by libpacket.
+ */
+typedef struct RawProto RawProto_t;
+
+typedef struct RawProto {
+    Protocol_t base;
+    const uint8_t *data;
+    unsigned int size;
+} RawProto_t;
+
+/**
+ * @memberof RawProto
+ *
+ * Class constructor. Creates a new instance of RawProto referencing the
+ * memory passed by parameters.
+ *
+ * @param data Pointer to the bytes of the layer.
+ * @param size The number of bytes of the layer.
+ * @return A pointer to the newly allocated RawProto instance.
+ */
+RawProto_t * RawProto_createWithParams(
+        const uint8_t *data,
+        unsigned int size);
+
+/**
+ * @memberof RawProto
+ *
+ * Class constructor. Allocates a new RawProto instance with no bytes.
+ *
+ * @return A pointer to the newly allocated RawProto instance.
+ */
+RawProto_t * RawProto_create(void);
+
+/**
+ * @memberof RawProto
+ *
+ * Same as RawProto_create() but the instance, Protocol included, is allocated
+ * from an Arena. It must not be deleted, it's freed with the Arena.
+ *
+ * @param arena Pointer to the Arena where to allocate the instance.
+ * @param data Pointer to the bytes of the layer.
+ * @param size The number of bytes of the layer.
+ * @return A pointer to the newly allocated RawProto instance or NULL.
+ */
+RawProto_t * RawProto_createInArena(
+        Arena_t *arena,
+        const uint8_t *data,
+        unsigned int size);
+
+/**
+ * @memberof RawProto
+ *
+ * Copy constructor. Creates a new RawProto with the same members as another
+ * one, not stacked on any Packet.
+ *
+ * @param proto Pointer to the RawProto instance to copy.
+ * @return A pointer to the newly allocated RawProto instance or NULL.
+ */
+RawProto_t * RawProto_clone(const RawProto_t *proto);
+
+/**
+ * @memberof RawProto
+ *
+ * Class destructor. Frees all the resources associated to this instance, but
+ * not the referenced memory. If the instance is shared by clones of a Packet
+ * (see Packet_clone()) it's only freed once they release it too.
+ *
+ * @param proto Pointer to a RawProto instance to be freed.
+ */
+void RawProto_delete(RawProto_t *proto);
+
+/**
+ * @memberof RawProto
+ *
+ * Implements the getSize() behavior needed by the Protocol class.
+ *
+ * @param proto Pointer to the RawProto instance to get its size.
+ * @return The number of bytes referenced by this instance.
+ */
+unsigned int RawProto_getSize(const RawProto_t *proto);
+
+/**
+ * @memberof RawProto
+ *
+ * Implements the getBitstream() behavior needed by the Protocol class,
+ * copying the referenced bytes into buf.
+ *
+ * @param proto Pointer to the RawProto instance to get its bitstream.
+ * @param buf The buffer where to write the bitstream that represents this
+ * instance in the wire.
+ * @param size The maximum size of the buffer.
+ * @return The number of bytes written into the buffer.
+ */
+int RawProto_getBitstream(RawProto_t *proto, uint8_t *buf, unsigned int size);
+
+/**
+ * @memberof RawProto
+ *
+ * Implements the getData() behavior (read Protocol for further details).
+ *
+ * @param proto Pointer to the RawProto instance.
+ * @return A pointer to the referenced bytes.
+ */
+const uint8_t * RawProto_getData(const RawProto_t *proto);
+
+/**
+ * @memberof RawProto
+ *
+ * Makes the RawProto reference other memory.
+ *
+ * @param proto Pointer to the RawProto instance.
+ * @param data Pointer to the bytes of the layer.
+ * @param size The number of bytes of the layer.
+ * @return 0 on success, -1 otherwise.
+ */
+int RawProto_setData(RawProto_t *proto, const uint8_t *data, unsigned int size);
+
+/**
+ * @memberof RawProto
+ *
+ * Getter of the Protocol embedded in the instance (member base).
+ *
+ * @param proto Pointer to the RawProto instance.
+ * @return A pointer to the Protocol instance associated to this RawProto.
+ */
+Protocol_t * RawProto_getProtoBase(const RawProto_t *proto);
+
+#endif
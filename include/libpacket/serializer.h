@@ -0,0 +1,108 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef __LIBPACKET_SERIALIZER
+#define __LIBPACKET_SERIALIZER
+
+/**
+ * @file serializer.h
+ * @author David "Ole" Luengo
+ * @date 10 March 2018
+ * @brief File implementing the serializers of well-known stacks of layers.
+ */
+
+#include <stdint.h>
+
+#include "libpacket/packet.h"
+
+/**
+ * The maximum number of layers a Serializer writes.
+ */
+#define SERIALIZER_MAX_LAYERS (4)
+
+/**
+ * @class Serializer "libpacket/serializer.h"
+ * @brief Class writing a well-known sequence of layers at once.
+ *
+ * Writing a Packet layer by layer costs an indirect call per layer, and every
+ * layer swaps and copies its fields one by one. A Serializer knows the
+ * classes of a sequence of layers, Ethernet - IPv4 - UDPv4 for instance, and
+ * writes all of them with a handful of wide stores. A Packet looks for one
+ * matching its bottom layers whenever its layout is computed (see
+ * Packet_getBitstream()), the layers above are written one by one as usual.
+ *
+ * The Serializers are static, there is no constructor nor destructor.
+ */
+typedef struct Serializer Serializer_t;
+
+/**
+ * Signature of the functions writing the layers of a Serializer.
+ */
+typedef void (*Serializer_writeFunc_t)(StackItem_t * const *items, uint8_t *buf);
+
+/* The member types holds the ProtocolType of each one of the layers_nr layers
+ * written, bottom first, and sizes their size. The member write writes them
+ * into a buffer of size bytes.
+ */
+typedef struct Serializer {
+    unsigned int types[SERIALIZER_MAX_LAYERS];
+    unsigned int sizes[SERIALIZER_MAX_LAYERS];
+    unsigned int layers_nr;
+    unsigned int size;
+    Serializer_writeFunc_t write;
+} Serializer_t;
+
+/**
+ * @memberof Serializer
+ *
+ * Looks for the Serializer writing the most layers at the bottom of a stack.
+ *
+ * @param items The layers of the stack, bottom first.
+ * @param items_nr The number of elements of items.
+ * @return A pointer to the Serializer or NULL if none matches.
+ */
+const Serializer_t * Serializer_find(
+        StackItem_t * const *items,
+        unsigned int items_nr);
+
+/**
+ * @memberof Serializer
+ *
+ * Writes the bottom layers of a stack, the same way their getBitstream()
+ * methods would do.
+ *
+ * @param ser Pointer to a Serializer returned by Serializer_find() for items.
+ * @param items The layers of the stack, bottom first.
+ * @param buf The buffer where to write, at least Serializer_getSize() bytes.
+ * @return The number of layers written.
+ */
+unsigned int Serializer_write(
+        const Serializer_t *ser,
+        StackItem_t * const *items,
+        uint8_t *buf);
+
+/**
+ * @memberof Serializer
+ *
+ * Getter of the member size.
+ *
+ * @param ser Pointer to the Serializer.
+ * @return The number of bytes written by the Serializer, 0 if ser is NULL.
+ */
+unsigned int Serializer_getSize(const Serializer_t *ser);
+
+#endif
@@ -27,10 +27,15 @@
  */
 
 #include <sys/socket.h>
+#include <time.h>
 #include <linux/if_packet.h>
 #include <net/ethernet.h>
 
 #include "libpacket/packet.h"
+#include "libpacket/batch.h"
+#include "libpacket/txring.h"
+#include "libpacket/xsk.h"
+#include "libpacket/uring.h"
 
 /**
  * @class Socket "libpacket/socket.h"
@@ -53,14 +58,149 @@
  * option -Wl,-rpath so the resulting programs contain a path in the system
  * where to look for libraries. It's a dirty trick, but at least it lets me be
  * up and running with libpacket fast.
+ *
+ * A Socket serializes packets into a scratch buffer of its own, so it can
+ * only be used by one thread at a time. Threads injecting through the same
+ * interface in parallel get a SocketContext each, holding its own scratch
+ * buffer and statistics, and share frozen packets (see Packet_freeze())
+ * without any lock.
  */
 typedef struct Socket Socket_t;
 
+/**
+ * @enum SocketBackend
+ * @brief The different ways a Socket can hand packets to the kernel.
+ */
+typedef enum SocketBackend {
+    /** One sendto() per packet (or sendmmsg() per batch). The default. */
+    SOCKET_BACKEND_SENDTO = 0,
+    /** Packets are written into a memory mapped PACKET_TX_RING. */
+    SOCKET_BACKEND_TXRING,
+    /** Packets are written into the UMEM of an AF_XDP socket. */
+    SOCKET_BACKEND_XDP,
+    /** Packets are written into frames sent asynchronously with io_uring,
+     * see Socket_reap(). */
+    SOCKET_BACKEND_URING,
+} SocketBackend_t;
+
+/**
+ * Called for every completed send of a Socket using the URING backend. The
+ * member seq is the number of frames injected through the socket before this
+ * one and result the number of bytes sent, not counting the virtio_net_hdr,
+ * or a negative errno. It must not inject through the same Socket.
+ */
+typedef void (*Socket_completionFunc_t)(void *arg, uint64_t seq, int result);
+
+/**
+ * @struct SocketParams
+ * @brief Parameters accepted by Socket_createWithParams().
+ *
+ * The members that don't apply to the selected backend are ignored.
+ */
+typedef struct SocketParams {
+    /** The backend used to inject packets. */
+    SocketBackend_t backend;
+    /** Size in bytes of every frame of the ring (TXRING, XDP, URING). */
+    unsigned int frame_size;
+    /** Number of frames of the ring (TXRING, XDP, URING). */
+    unsigned int frame_nr;
+    /** Queue of the interface to bind to (XDP). */
+    unsigned int queue;
+    /** Flags passed to the AF_XDP bind(), see Xsk_create() (XDP). */
+    unsigned int xdp_flags;
+    /** Size of the buffer where packets are serialized before being sent.
+     * 0 to size it after the MTU of the interface, or to fit a whole UDP
+     * datagram of 64KiB if the kernel splits them (see gso_size) (SENDTO). */
+    unsigned int scratch_size;
+    /** A combination of SOCKET_FLAG_* values. */
+    unsigned int flags;
+    /** With SOCKET_FLAG_VNET_HDR, the size of the payload of every segment
+     * the kernel splits a bigger UDP datagram into. 0 to never split them
+     * (SENDTO, TXRING). */
+    unsigned int gso_size;
+    /** Flags passed to Uring_create(), a combination of URING_FLAG_* values
+     * (URING). */
+    unsigned int uring_flags;
+    /** Called for every completed send, can be NULL (URING). */
+    Socket_completionFunc_t completion;
+    /** Handed to completion as it is (URING). */
+    void *completion_arg;
+    /** With SOCKET_FLAG_TXTIME, the clock the launch times are read from:
+     * CLOCK_MONOTONIC for the fq qdisc, usually CLOCK_TAI for etf (SENDTO). */
+    clockid_t txtime_clock;
+    /** With SOCKET_FLAG_TXTIME, the flags of SO_TXTIME, a combination of
+     * SOF_TXTIME_* values (SENDTO). */
+    unsigned int txtime_flags;
+} SocketParams_t;
+
+#define SOCKET_DEFAULT_FRAME_SIZE (2048)
+#define SOCKET_DEFAULT_FRAME_NR (256)
+#define SOCKET_MIN_SCRATCH_SIZE (65536)
+
+/* Every frame handed to the kernel starts with a struct virtio_net_hdr
+ * (PACKET_VNET_HDR), used to offload checksums and segmentation. Not
+ * available with the XDP backend. */
+#define SOCKET_FLAG_VNET_HDR (1 << 0)
+/* Injecting never blocks. When the kernel can't take more packets injection
+ * fails with errno set to EAGAIN, or to ENOBUFS if the device queue is full,
+ * and nothing is lost: the packet wasn't sent and can be injected again once
+ * Socket_wait() says so (or the descriptor of Socket_getDescriptor() is
+ * ready, for EAGAIN). Without it a Socket waits in those cases. */
+#define SOCKET_FLAG_NONBLOCK (1 << 2)
+/* Packets can carry the time they must leave at (SO_TXTIME), see
+ * Socket_injectAt(). The qdisc of the interface (fq or etf) holds them until
+ * then. Only the SENDTO backend supports it. */
+#define SOCKET_FLAG_TXTIME (1 << 3)
+
+/* The member scratch is a buffer of scratch_size bytes owned by the socket,
+ * where packets are serialized before handing them to the kernel, so
+ * injecting doesn't need to allocate memory. The member vnet_hdr_len is the
+ * size of the virtio_net_hdr preceding every frame, 0 if there is none. The
+ * members completion and completion_arg are the callback given in the
+ * parameters (URING). The member congested is set when the device queue
+ * refused a packet (ENOBUFS), until Socket_wait() waits for it to drain. The
+ * member backoff is how long, in microseconds, Socket_wait() sleeps then: it
+ * doubles as long as the queue stays full, up to a cap, and starts over once
+ * a packet goes through. The member txtime is set if SO_TXTIME is enabled,
+ * with the clock txtime_clock and the flags txtime_flags.
+ */
 typedef struct Socket {
     int desc;
     struct sockaddr_ll addr;
+    SocketBackend_t backend;
+    TxRing_t *ring;
+    Xsk_t *xsk;
+    Uring_t *uring;
+    Socket_completionFunc_t completion;
+    void *completion_arg;
+    uint8_t *scratch;
+    unsigned int scratch_size;
+    unsigned int vnet_hdr_len;
+    unsigned int gso_size;
+    int nonblock;
+    int congested;
+    unsigned int backoff;
+    int txtime;
+    clockid_t txtime_clock;
+    unsigned int txtime_flags;
 } Socket_t;
 
+/**
+ * @memberof Socket
+ *
+ * Class constructor with parameters. Creates a new socket that injects
+ * traffic using the backend described by params.
+ *
+ * @param ifname A string with the name of the interface to be used to inject
+ * traffic into.
+ * @param params Pointer to the parameters of the socket. If NULL the default
+ * parameters are used, the same as in Socket_create().
+ * @return A pointer to the newly allocated socket or NULL.
+ */
+Socket_t * Socket_createWithParams(
+        const char *ifname,
+        const SocketParams_t *params);
+
 /**
  * @memberof Socket
  * 
@@ -85,17 +225,336 @@ void Socket_delete(Socket_t *sock);
 /**
  * @memberof Socket
  * 
- * Injects a single packet into a socket. Underneath sendto() is used and, due
- * to its nature, it could happen that not all of the bytes of a packet are
- * written. Internally if this happens, we try again a couple of times but if
- * after some retries we haven't still injected everything we give up and
- * return the number of bytes written so far.
+ * Injects a single packet into a socket. Underneath sendmsg() is used, with
+ * the headers of the packet serialized into the scratch buffer of the socket
+ * and the layers referencing memory of the application (see RawProto) passed
+ * as they are, see Packet_getIovec(). The headers must fit in the scratch
+ * buffer.
+ *
+ * With the TXRING, XDP and URING backends the packet is written straight
+ * into a frame of the ring and the kernel is asked to send it right away. If
+ * the ring is full we wait until the kernel releases a frame.
+ *
+ * If the kernel can't take the packet, a blocking socket waits (see
+ * Socket_wait()) and tries again, while a non-blocking one fails with errno
+ * set to EAGAIN or ENOBUFS.
+ *
+ * With SOCKET_FLAG_VNET_HDR the checksum of the first layer covering its
+ * payload (the UDP one) is left for the kernel or the NIC to finish, and if
+ * that payload is bigger than the gso_size of the socket the datagram is
+ * split in as many frames as needed (UDP GSO). The IPv4 length and the UDP
+ * length must then describe the whole datagram. A UDP checksum the library
+ * doesn't compute (see Udpv4Proto_hasComputedChecksum()) is sent as it is,
+ * and the datagram isn't split.
  *
  * @param sock A pointer to the socket where we want to inject the packet.
  * @param pack A pointer to a packet that contains the information to be
  * injected in the network.
- * @return The number of bytes written into the network.
+ * @return The number of bytes written into the network or -1 on error.
+ */
+int Socket_inject(Socket_t *sock, const Packet_t *pack);
+
+/**
+ * @memberof Socket
+ *
+ * Injects a single packet, as Socket_inject(), that the kernel holds until
+ * its launch time. The socket must have been created with SOCKET_FLAG_TXTIME
+ * and the interface must have a qdisc honoring launch times (fq or etf),
+ * otherwise the packet leaves right away. The etf qdisc drops the packets
+ * whose time is already past, or not far enough in the future.
+ *
+ * @param sock A pointer to the socket where we want to inject the packet.
+ * @param pack A pointer to the packet to be injected.
+ * @param txtime The launch time in nanoseconds, read from the clock of the
+ * socket (see Socket_getTime()).
+ * @return The number of bytes written into the network or -1 on error, with
+ * errno set to EINVAL if the socket doesn't support launch times.
+ */
+int Socket_injectAt(Socket_t *sock, const Packet_t *pack, uint64_t txtime);
+
+/**
+ * @memberof Socket
+ *
+ * Gets the current time of the clock the launch times of the socket are read
+ * from, CLOCK_MONOTONIC if it has none.
+ *
+ * @param sock A pointer to the socket.
+ * @return The time in nanoseconds or 0 on error.
+ */
+uint64_t Socket_getTime(const Socket_t *sock);
+
+/**
+ * @memberof Socket
+ *
+ * Injects several raw buffers into a socket using as few system calls as
+ * possible. Underneath sendmmsg() is used, so the whole batch is usually
+ * handed to the kernel in a single call.
+ *
+ * The buffers are sent in order. If the kernel refuses one of them the
+ * remaining ones are not sent, so the return value is also the index of the
+ * first buffer that wasn't injected. A non-blocking socket stops as soon as
+ * the kernel can't take more, leaving EAGAIN or ENOBUFS in errno.
+ *
+ * With the TXRING and XDP backends the buffers are copied into the ring and
+ * the kernel is kicked once for the whole batch.
+ *
+ * With SOCKET_FLAG_VNET_HDR the buffers are sent as they are, asking the
+ * kernel for no offload at all.
+ *
+ * @param sock A pointer to the socket where we want to inject the buffers.
+ * @param bufs An array of n pointers to the buffers to be injected, each one
+ * of them holding a complete frame.
+ * @param lens An array with the length of each one of the buffers.
+ * @param n The number of buffers in the batch.
+ * @param results An optional array of n elements (can be NULL). On return it
+ * holds the number of bytes written for every injected buffer and -1 for the
+ * ones that weren't.
+ * @return The number of buffers injected, or -1 with errno set if none of
+ * them could be.
+ */
+int Socket_injectRawBatch(
+        Socket_t *sock,
+        const uint8_t * const *bufs,
+        const unsigned int *lens,
+        unsigned int n,
+        int *results);
+
+/**
+ * @memberof Socket
+ *
+ * Injects several packets into a socket. As many packets as fit are
+ * serialized back to back into the scratch buffer of the socket and then
+ * injected as with Socket_injectRawBatch().
+ *
+ * With the TXRING and XDP backends every packet is serialized straight into a
+ * frame of the ring and the kernel is kicked once for the whole batch.
+ *
+ * @param sock A pointer to the socket where we want to inject the packets.
+ * @param packs An array of n pointers to the packets to be injected.
+ * @param n The number of packets in the batch.
+ * @param results An optional array of n elements (can be NULL). On return it
+ * holds the number of bytes written for every injected packet and -1 for the
+ * ones that weren't.
+ * @return The number of packets injected, or -1 with errno set if none of
+ * them could be (EMSGSIZE if the first one doesn't fit in the scratch
+ * buffer).
+ */
+int Socket_injectBatch(
+        Socket_t *sock,
+        const Packet_t * const *packs,
+        unsigned int n,
+        int *results);
+
+/**
+ * @memberof Socket
+ *
+ * Injects several packets as Socket_injectBatch(), each one of them with its
+ * launch time, see Socket_injectAt(). The whole batch can be handed to the
+ * kernel well before the first packet has to leave.
+ *
+ * @param sock A pointer to the socket where we want to inject the packets.
+ * @param packs An array of n pointers to the packets to be injected.
+ * @param txtimes An array with the launch time of each one of the packets.
+ * @param n The number of packets in the batch.
+ * @param results An optional array of n elements (can be NULL), see
+ * Socket_injectBatch().
+ * @return The number of packets injected, or -1 with errno set if none of
+ * them could be, EINVAL if the socket doesn't support launch times.
+ */
+int Socket_injectBatchAt(
+        Socket_t *sock,
+        const Packet_t * const *packs,
+        const uint64_t *txtimes,
+        unsigned int n,
+        int *results);
+
+/**
+ * @memberof Socket
+ *
+ * Injects the packets of a PacketBatch, already serialized by the batch
+ * itself, as with Socket_injectRawBatch(). If the batch isn't serialized it
+ * is serialized first, with all its checksums computed.
+ *
+ * @param sock A pointer to the socket where we want to inject the packets.
+ * @param batch A pointer to the batch holding the packets.
+ * @param results An optional array of as many elements as packets in the
+ * batch (can be NULL), filled in as in Socket_injectRawBatch().
+ * @return The number of packets injected or -1 on error.
+ */
+int Socket_injectPacketBatch(
+        Socket_t *sock,
+        PacketBatch_t *batch,
+        int *results);
+
+/**
+ * @memberof Socket
+ *
+ * Asks the kernel to send everything that is pending in the socket. Only
+ * meaningful for the backends that queue packets in userspace, for the rest
+ * it does nothing.
+ *
+ * @param sock A pointer to the socket to flush.
+ * @return 0 on success, -1 otherwise.
+ */
+int Socket_flush(const Socket_t *sock);
+
+/**
+ * @memberof Socket
+ *
+ * Collects the completions of the sends made asynchronously by the URING
+ * backend, calling the completion callback of the socket for each of them.
+ * Whatever is pending in the socket is submitted first.
+ *
+ * This is the only way to find out the outcome of those sends without a
+ * callback: the number of frames in flight goes down as they complete.
+ *
+ * @param sock A pointer to the socket.
+ * @param min The number of completions to wait for, 0 not to wait at all.
+ * @return The number of frames still in flight, 0 with any other backend, or
+ * -1 on error.
+ */
+int Socket_reap(const Socket_t *sock, unsigned int min);
+
+/**
+ * @memberof Socket
+ *
+ * Gets the file descriptor to watch, with poll() or epoll, to know when the
+ * socket can take more packets, so it can be integrated into any event loop.
+ * With the URING backend it's the descriptor of the io_uring instance, ready
+ * when sends complete, and Socket_reap() has to be called then.
+ *
+ * A full device queue (ENOBUFS) doesn't show up on the descriptor, the
+ * kernel never lets us know when it drains. Use Socket_wait() then.
+ *
+ * @param sock A pointer to the socket.
+ * @param events Output parameter where the events to watch (POLLOUT or
+ * POLLIN) are written. Can be NULL.
+ * @return The file descriptor or -1 on error.
+ */
+int Socket_getDescriptor(const Socket_t *sock, short *events);
+
+/**
+ * @memberof Socket
+ *
+ * Waits until the socket can take more packets, without burning CPU: it
+ * sleeps on the descriptor of Socket_getDescriptor() or, if the last packet
+ * was refused because the device queue was full, for a while to let it drain:
+ * 100 microseconds at first, twice as long every time it's still full, up to
+ * 10 milliseconds. A timeout shorter than that returns 0, the socket still
+ * congested.
+ *
+ * @param sock A pointer to the socket.
+ * @param timeout The maximum time to wait in milliseconds, -1 to wait as long
+ * as needed, 0 not to wait at all.
+ * @return 1 if the socket is ready, 0 on timeout or -1 on error.
+ */
+int Socket_wait(Socket_t *sock, int timeout);
+
+/**
+ * @class SocketContext "libpacket/socket.h"
+ * @brief Class holding what a thread needs to inject packets through a
+ * Socket in parallel with other threads.
+ *
+ * A SocketContext has its own scratch buffer and statistics and, optionally,
+ * its own file descriptor bound to the same interface, so nothing is shared
+ * on the hot path but the kernel side of the socket (or not even that). Each
+ * thread creates its own SocketContext and injects through it. Packets used
+ * by several threads at once must be frozen (see Packet_freeze()).
+ *
+ * Only the SENDTO backend supports contexts, rings have a single producer.
+ */
+typedef struct SocketContext SocketContext_t;
+
+/* Use a file descriptor of its own instead of the one of the Socket. It
+ * doesn't receive traffic, so it costs nothing when idle. It gets the
+ * options of the Socket: SOCKET_FLAG_NONBLOCK, SOCKET_FLAG_VNET_HDR and
+ * SOCKET_FLAG_TXTIME, with the same clock, apply to it too. */
+#define SOCKET_CONTEXT_OWN_DESC (1 << 0)
+
+/**
+ * @struct SocketStats
+ * @brief Counters of a SocketContext.
+ */
+typedef struct SocketStats {
+    /** Packets injected. */
+    uint64_t packets;
+    /** Bytes injected, not counting the virtio_net_hdr. */
+    uint64_t bytes;
+    /** Packets that couldn't be injected. */
+    uint64_t errors;
+} SocketStats_t;
+
+/* The member sock is a copy of the Socket the context was created from, but
+ * with the scratch buffer of the context and, if own_desc is set, its own
+ * file descriptor, so the methods of Socket work on it unchanged. The
+ * members of stats are only written by the thread of the context.
+ */
+typedef struct SocketContext {
+    Socket_t sock;
+    int own_desc;
+    SocketStats_t stats;
+} SocketContext_t;
+
+/**
+ * @memberof SocketContext
+ *
+ * Class constructor. Creates a context to inject packets through a Socket
+ * from one thread. The Socket must outlive it.
+ *
+ * @param sock A pointer to the socket.
+ * @param flags 0 or SOCKET_CONTEXT_OWN_DESC.
+ * @return A pointer to the newly allocated SocketContext or NULL.
+ */
+SocketContext_t * SocketContext_create(const Socket_t *sock, unsigned int flags);
+
+/**
+ * @memberof SocketContext
+ *
+ * Class destructor. Frees all the resources associated to a context.
+ *
+ * @param ctx A pointer to the context to be freed.
+ */
+void SocketContext_delete(SocketContext_t *ctx);
+
+/**
+ * @memberof SocketContext
+ *
+ * Same as Socket_inject() but using the resources of the context.
+ *
+ * @param ctx A pointer to the context.
+ * @param pack A pointer to the packet to inject.
+ * @return The number of bytes written into the network or -1 on error.
+ */
+int SocketContext_inject(SocketContext_t *ctx, const Packet_t *pack);
+
+/**
+ * @memberof SocketContext
+ *
+ * Same as Socket_injectBatch() but using the resources of the context.
+ *
+ * @param ctx A pointer to the context.
+ * @param packs An array of n pointers to the packets to be injected.
+ * @param n The number of packets in the batch.
+ * @param results An optional array of n elements (can be NULL), see
+ * Socket_injectBatch().
+ * @return The number of packets injected or -1 on error.
+ */
+int SocketContext_injectBatch(
+        SocketContext_t *ctx,
+        const Packet_t * const *packs,
+        unsigned int n,
+        int *results);
+
+/**
+ * @memberof SocketContext
+ *
+ * Reads the counters of a context. Can be called from any thread while the
+ * context is in use.
+ *
+ * @param ctx A pointer to the context.
+ * @param stats Pointer to where to copy the counters.
+ * @return 0 on success, -1 otherwise.
  */
-int Socket_inject(const Socket_t *sock, const Packet_t *pack);
+int SocketContext_getStats(const SocketContext_t *ctx, SocketStats_t *stats);
 
 #endif
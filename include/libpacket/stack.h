@@ -25,6 +25,8 @@
  * @brief File implementing a stack and its elements.
  */
 
+#include "libpacket/arena.h"
+
 /*--------------------------------- StackItem_t -----------------------------*/
 
 /**
@@ -42,16 +44,25 @@
  */
 typedef struct StackItem StackItem_t;
 
-/* The Stack_t implements a simple double-linked list, hence the prev and next
- * pointers.
- *
- * The owner pointer should point to an instance of an extending class.
- * Protocol (implemented in packet.h) would be an example.
+/**
+ * The item is currently pushed onto a stack. Set by Stack_push() and cleared
+ * by Stack_pop(), it's what keeps an item from being pushed twice.
+ */
+#define STACK_ITEM_STACKED (1 << 0)
+
+/**
+ * The stack holds a reference to the item, to be released along with the
+ * stack. Set on the copies of shared layers made by Packet_getLayerForWrite().
+ */
+#define STACK_ITEM_OWNED (1 << 1)
+
+/* The owner pointer should point to an instance of an extending class.
+ * Protocol (implemented in packet.h) would be an example. The member flags is
+ * a combination of STACK_ITEM_* values.
  */
 struct StackItem {
-    StackItem_t *prev;
-    StackItem_t *next;
     void *owner;
+    unsigned int flags;
 };
 
 /**
@@ -59,29 +70,35 @@ struct StackItem {
  *
  * StackItem_t constructor with parameters.
  *
- * @param prev The previous positional element to this one.
- * @param next The next positional element to this one.
  * @param owner A pointer to the instance who owns this StackItem_t, namely
  * the class that extends StackItem_t.
  * @return A pointer to the new StackItem_t instance or NULL.
  */
-StackItem_t * StackItem_createWithParams(
-        StackItem_t *prev,
-        StackItem_t *next,
-        void *owner);
+StackItem_t * StackItem_createWithParams(void *owner);
 
 /**
  * @memberof StackItem
  * 
  * Constructor with default parameters.
  *
- * This constructor returns a standalone StackItem_t instance, with prev and
- * next pointers pointing to NULL and nobody owns it.
+ * This constructor returns a standalone StackItem_t instance that nobody
+ * owns.
  *
  * @return A pointer to the new StackItem_t instance or NULL.
  */
 StackItem_t * StackItem_create(void);
 
+/**
+ * @memberof StackItem
+ *
+ * Same as StackItem_create() but the instance is allocated from an Arena. It
+ * must not be deleted, it's freed with the Arena.
+ *
+ * @param arena Pointer to the Arena where to allocate the instance.
+ * @return A pointer to the new StackItem_t instance or NULL.
+ */
+StackItem_t * StackItem_createInArena(Arena_t *arena);
+
 /**
  * @memberof StackItem
  *
@@ -114,6 +131,12 @@ void * StackItem_getOwner(const StackItem_t *item);
 
 /*---------------------------------- Stack_t --------------------------------*/
 
+/**
+ * Number of items a Stack holds without allocating. Packets rarely have more
+ * layers than this.
+ */
+#define STACK_INLINE_ITEMS (8)
+
 /**
  * @class Stack "libpacket/stack.h"
  * @brief Class implementing a simple stack.
@@ -128,39 +151,34 @@ void * StackItem_getOwner(const StackItem_t *item);
  */
 typedef struct Stack Stack_t;
 
-/* A Stack_t is list of double-linked StackItem_t. The bottom pointer points
- * to the first element of the stack and top points to the last element of the
- * stack. Here we understand "first" as "first inserted".
+/* A Stack_t is an array of pointers to StackItem_t. The member array points
+ * to inline_array until more than STACK_INLINE_ITEMS items are pushed, then to
+ * memory from the heap, or from arena if the stack was created in one. The
+ * first element, "first" understood as "first inserted", is at index 0.
  *
- * The member items is the current number of elements in the stack and
- * owner is a pointer to an intance of an extending class that owns this stack.
+ * The member items is the current number of elements in the stack, capacity
+ * the number of elements array can hold and owner is a pointer to an intance
+ * of an extending class that owns this stack.
  */
 typedef struct Stack {
-    StackItem_t *bottom;
-    StackItem_t *top;
+    StackItem_t **array;
     unsigned int items;
+    unsigned int capacity;
     void *owner;
+    Arena_t *arena;
+    StackItem_t *inline_array[STACK_INLINE_ITEMS];
 } Stack_t;
 
 /**
  * @memberof Stack
  *
- * Stack_t constructor with parameters.
- *
- * Please note that this method accepts the number of items in the stack. One
- * could create a stack in an unstable state and that's valid. Use it wisely.
+ * Stack_t constructor with parameters. The stack returned is empty.
  *
- * @param bottom A pointer to the first element of the stack.
- * @param top A pointer to the last element of the stack.
- * @param items The number of items in the stack.
- * @owner A pointer to an instance of an extending class that owns this stack.
+ * @param owner A pointer to an instance of an extending class that owns this
+ * stack.
  * @return A pointer to the newly allocated stack or NULL.
  */
-Stack_t * Stack_createWithParams(
-        StackItem_t *bottom,
-        StackItem_t *top,
-        unsigned int items,
-        void *owner);
+Stack_t * Stack_createWithParams(void *owner);
 
 /**
  * @memberof Stack
@@ -174,7 +192,20 @@ Stack_t * Stack_create(void);
 /**
  * @memberof Stack
  *
- * Frees the memory allocated by a previous call of a class constructor.
+ * Same as Stack_create() but the instance is allocated from an Arena, and so
+ * is the array of items if it outgrows STACK_INLINE_ITEMS. It must not be
+ * deleted, it's freed with the Arena.
+ *
+ * @param arena Pointer to the Arena where to allocate the instance.
+ * @return A pointer to the newly allocated Stack or NULL.
+ */
+Stack_t * Stack_createInArena(Arena_t *arena);
+
+/**
+ * @memberof Stack
+ *
+ * Frees the memory allocated by a previous call of a class constructor. The
+ * items still in the stack are not freed, they belong to whoever embeds them.
  *
  * @param stack The stack to be freed.
  */
@@ -183,14 +214,29 @@ void Stack_delete(Stack_t *stack);
 /**
  * @memberof Stack
  *
- * Pushes an item onto the stack.
+ * Pushes an item onto the stack. An item can only be in one stack at a time,
+ * pushing an item already stacked fails.
  *
  * @param stack The stack where to insert the item.
  * @param item The item to be pushed onto the stack.
- * @return 0 on success, -1 otherwise.
+ * @return 1 on success, 0 otherwise.
  */
 int Stack_push(Stack_t *stack, StackItem_t *item);
 
+/**
+ * @memberof Stack
+ *
+ * Pushes onto the stack all the items of another stack, in the same order.
+ * This is the only way an item can be in two stacks at once, both stacks
+ * share it. Popping it out from one of them clears its stacked flag for the
+ * other too, so shared items shouldn't be popped out.
+ *
+ * @param stack The stack where to insert the items.
+ * @param src The stack whose items are pushed.
+ * @return 1 on success, 0 otherwise, in which case stack isn't modified.
+ */
+int Stack_share(Stack_t *stack, const Stack_t *src);
+
 /**
  * @memberof Stack
  *
@@ -213,6 +259,17 @@ StackItem_t * Stack_pop(Stack_t *stack);
  */
 unsigned int Stack_numItems(const Stack_t *stack);
 
+/**
+ * @memberof Stack
+ *
+ * Gets the item at a given position, 0 being the first item pushed.
+ *
+ * @param stack The stack to get the item from.
+ * @param index The position of the item.
+ * @return A pointer to the item or NULL if index is out of bounds.
+ */
+StackItem_t * Stack_getItem(const Stack_t *stack, unsigned int index);
+
 /**
  * @memberof Stack
  *
@@ -0,0 +1,219 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef __LIBPACKET_TEMPLATE
+#define __LIBPACKET_TEMPLATE
+
+/**
+ * @file template.h
+ * @author David "Ole" Luengo
+ * @date 10 March 2018
+ * @brief File implementing compiled packets with patchable fields.
+ */
+
+#include <stdint.h>
+
+#include "libpacket/packet.h"
+
+#define TEMPLATE_NO_LAYER (~0u)
+#define TEMPLATE_MAX_CHECKSUMS (4)
+
+/**
+ * @struct TemplateField
+ * @brief A field of a Template, located by its absolute offset in the frame.
+ *
+ * The members layer and id identify where the field comes from. Fields added
+ * by hand with Template_addField() don't belong to any layer and have layer
+ * set to TEMPLATE_NO_LAYER.
+ *
+ * The member checksums holds the indexes of the checksum fields that cover
+ * this field, checksums_nr of them. Bit i of odd is set if the field starts
+ * at an odd offset from the start of the data covered by checksum i.
+ */
+typedef struct TemplateField {
+    unsigned int layer;
+    unsigned int id;
+    unsigned int offset;
+    unsigned int width;
+    unsigned int byte_order;
+    unsigned int flags;
+    int checksums[TEMPLATE_MAX_CHECKSUMS];
+    unsigned int checksums_nr;
+    unsigned int odd;
+} TemplateField_t;
+
+/**
+ * @struct TemplateLayer
+ * @brief Where a layer of the compiled Packet starts and which of its fields,
+ * if any, are checksums (-1 if none).
+ */
+typedef struct TemplateLayer {
+    unsigned int offset;
+    int checksum;
+    int payload_checksum;
+} TemplateLayer_t;
+
+/**
+ * @struct TemplatePatch
+ * @brief A value to be written into a field of a Template.
+ *
+ * The member field is the index returned by Template_getField() or
+ * Template_addField(). The value is given in host byte order and truncated
+ * to the width of the field.
+ */
+typedef struct TemplatePatch {
+    unsigned int field;
+    uint64_t value;
+} TemplatePatch_t;
+
+/**
+ * @class Template "libpacket/template.h"
+ * @brief Class implementing a pre-serialized Packet.
+ *
+ * Most of the time packets sent one after the other only differ in a couple
+ * of fields (ports, the IPv4 id, a sequence number in the payload...). A
+ * Template holds the wire representation of a Packet, computed once, and the
+ * list of fields that can change. Emitting a new packet is a copy of the
+ * frame followed by a store for every patched field, no matter how many
+ * layers the original Packet had.
+ *
+ * The frame of a Template never changes after Packet_compile(). If the
+ * original Packet changes, a new Template has to be compiled.
+ *
+ * Checksums are kept up to date incrementally (RFC 1624): patching a field
+ * updates the checksums covering it from the old and new values of the
+ * field, so changing a port of a jumbo UDP datagram doesn't mean going over
+ * its whole payload again.
+ */
+typedef struct Template Template_t;
+
+/* The member frame holds the size bytes of the compiled Packet, fields is an
+ * array of fields_nr fields that can be patched and layers an array with the
+ * layers_nr layers of the Packet.
+ */
+typedef struct Template {
+    uint8_t *frame;
+    unsigned int size;
+    TemplateField_t *fields;
+    unsigned int fields_nr;
+    TemplateLayer_t *layers;
+    unsigned int layers_nr;
+} Template_t;
+
+/**
+ * @memberof Packet
+ *
+ * Compiles a Packet into a Template. The fields of the Template are all the
+ * fields the layers of the Packet describe (see ProtocolField).
+ *
+ * @param pack Pointer to the Packet to compile.
+ * @return A pointer to the newly allocated Template or NULL.
+ */
+Template_t * Packet_compile(const Packet_t *pack);
+
+/**
+ * @memberof Template
+ *
+ * Class destructor. Frees all the resources associated to a Template.
+ *
+ * @param tmpl Pointer to the instance to destroy.
+ */
+void Template_delete(Template_t *tmpl);
+
+/**
+ * @memberof Template
+ *
+ * Looks for a field of one of the layers of the compiled Packet.
+ *
+ * @param tmpl Pointer to an instance of Template.
+ * @param layer The index of the layer in the Packet, 0 being the bottom.
+ * @param id The identifier of the field within its protocol (i.e.
+ * IPV4_FIELD_ID).
+ * @return The index of the field or -1 if it doesn't exist.
+ */
+int Template_getField(const Template_t *tmpl, unsigned int layer, unsigned int id);
+
+/**
+ * @memberof Template
+ *
+ * Adds a field that none of the layers describes, i.e. a sequence number in
+ * the payload. The field is assumed to be covered by the checksums covering
+ * the payloads of the layers it's in.
+ *
+ * @param tmpl Pointer to an instance of Template.
+ * @param offset The offset of the field in the frame.
+ * @param width The width of the field in bytes, from 1 to 8.
+ * @param byte_order PROTOCOL_FIELD_BIG_ENDIAN or PROTOCOL_FIELD_LITTLE_ENDIAN.
+ * @return The index of the new field or -1 on error.
+ */
+int Template_addField(
+        Template_t *tmpl,
+        unsigned int offset,
+        unsigned int width,
+        unsigned int byte_order);
+
+/**
+ * @memberof Template
+ *
+ * Getter of the member size.
+ *
+ * @param tmpl Pointer to an instance of Template.
+ * @return The size in bytes of the frames emitted by this Template.
+ */
+unsigned int Template_getSize(const Template_t *tmpl);
+
+/**
+ * @memberof Template
+ *
+ * Writes a new frame into buf: a copy of the compiled Packet with the patches
+ * applied.
+ *
+ * @param tmpl Pointer to an instance of Template.
+ * @param buf The buffer where to write the frame.
+ * @param size The length of the buffer.
+ * @param patches An array of patches to apply. Can be NULL if n is 0.
+ * @param n The number of patches.
+ * @return The number of bytes written into buf. If the buffer is too small or
+ * any patch is invalid nothing is written and 0 is returned.
+ */
+int Template_emit(
+        const Template_t *tmpl,
+        uint8_t *buf,
+        unsigned int size,
+        const TemplatePatch_t *patches,
+        unsigned int n);
+
+/**
+ * @memberof Template
+ *
+ * Applies patches to a frame previously emitted by this Template, in place.
+ * The checksums covering the patched fields are updated incrementally.
+ *
+ * @param tmpl Pointer to an instance of Template.
+ * @param frame The frame to patch, Template_getSize() bytes long.
+ * @param patches An array of patches to apply.
+ * @param n The number of patches.
+ * @return 0 on success, -1 otherwise. If any patch is invalid the frame
+ * isn't modified.
+ */
+int Template_patch(
+        const Template_t *tmpl,
+        uint8_t *frame,
+        const TemplatePatch_t *patches,
+        unsigned int n);
+
+#endif
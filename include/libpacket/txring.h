@@ -0,0 +1,129 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef __LIBPACKET_TXRING
+#define __LIBPACKET_TXRING
+
+/**
+ * @file txring.h
+ * @author David "Ole" Luengo
+ * @date 10 March 2018
+ * @brief File implementing a memory mapped transmission ring.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @class TxRing "libpacket/txring.h"
+ * @brief Class implementing a PACKET_TX_RING attached to a PACKET_RAW socket.
+ *
+ * A TxRing is a bunch of frames shared between libpacket and the kernel
+ * through mmap(). Instead of copying every packet into the kernel with
+ * sendto(), packets are written straight into a free frame of the ring, the
+ * frame is handed to the kernel and, once a burst of them is ready, the kernel
+ * is asked to send all of them with a single system call.
+ *
+ * The ring uses TPACKET_V2 frames, which are fixed in size. Each frame is
+ * frame_size bytes long, including the header the kernel uses to track it,
+ * so the biggest packet that fits in a frame is a bit smaller than that.
+ */
+typedef struct TxRing TxRing_t;
+
+/* The map member is the memory shared with the kernel, map_size bytes long.
+ * The ring is made of frame_nr frames of frame_size bytes each, grouped in
+ * blocks of block_size bytes that hold frames_per_block frames. The member
+ * head is the index of the next frame to be filled by us.
+ */
+typedef struct TxRing {
+    uint8_t *map;
+    size_t map_size;
+    unsigned int block_size;
+    unsigned int frames_per_block;
+    unsigned int frame_size;
+    unsigned int frame_nr;
+    unsigned int head;
+} TxRing_t;
+
+/**
+ * @memberof TxRing
+ *
+ * Class constructor. Sets up a transmission ring on a PACKET_RAW socket and
+ * maps it into memory.
+ *
+ * @param desc The descriptor of the socket where the ring is set up.
+ * @param frame_size The size in bytes of every frame of the ring. It must be
+ * a multiple of 16.
+ * @param frame_nr The number of frames of the ring.
+ * @return A pointer to the newly allocated TxRing or NULL.
+ */
+TxRing_t * TxRing_create(
+        int desc,
+        unsigned int frame_size,
+        unsigned int frame_nr);
+
+/**
+ * @memberof TxRing
+ *
+ * Class destructor. Unmaps the ring and frees the resources associated to
+ * it. The ring itself is released by the kernel once its socket is closed.
+ *
+ * @param ring Pointer to the instance to destroy.
+ */
+void TxRing_delete(TxRing_t *ring);
+
+/**
+ * @memberof TxRing
+ *
+ * Gets the next free frame of the ring. The frame doesn't change hands until
+ * TxRing_commit() is called, so calling this method again returns the same
+ * frame.
+ *
+ * @param ring Pointer to an instance of TxRing.
+ * @param size Output parameter where the maximum number of bytes that fit in
+ * the frame is written. Can be NULL.
+ * @return A pointer to where the packet has to be written or NULL if the
+ * kernel hasn't released the next frame yet.
+ */
+uint8_t * TxRing_getFrame(TxRing_t *ring, unsigned int *size);
+
+/**
+ * @memberof TxRing
+ *
+ * Hands the frame returned by TxRing_getFrame() to the kernel. The frame is
+ * not sent until TxRing_flush() is called.
+ *
+ * @param ring Pointer to an instance of TxRing.
+ * @param length The number of bytes written into the frame.
+ * @return 0 on success, -1 otherwise.
+ */
+int TxRing_commit(TxRing_t *ring, unsigned int length);
+
+/**
+ * @memberof TxRing
+ *
+ * Asks the kernel to send all the frames committed so far. This method
+ * doesn't wait for the frames to be sent.
+ *
+ * @param ring Pointer to an instance of TxRing.
+ * @param desc The descriptor of the socket the ring belongs to.
+ * @return 0 on success, 1 if the device queue is full and some frames were
+ * left in the ring, -1 otherwise.
+ */
+int TxRing_flush(TxRing_t *ring, int desc);
+
+#endif
@@ -37,12 +37,24 @@
  */
 typedef struct Udpv4Proto Udpv4Proto_t;
 
+/**
+ * @enum Udpv4Field
+ * @brief Identifiers of the patchable fields of Udpv4Proto (see
+ * ProtocolField).
+ */
+enum Udpv4Field {
+    UDPV4_FIELD_SPORT = 0,
+    UDPV4_FIELD_DPORT,
+    UDPV4_FIELD_LENGTH,
+    UDPV4_FIELD_CHECKSUM,
+};
+
 typedef struct Udpv4Proto {
+    Protocol_t base;
     uint16_t sport;
     uint16_t dport;
     uint16_t length;
     uint16_t checksum;
-    Protocol_t *proto_base;
 } Udpv4Proto_t;
 
 /**
@@ -55,15 +67,15 @@ typedef struct Udpv4Proto {
  * @param dport The destination port.
  * @param length The length of the UDPv4 packet, that is, the length of the
  * header + length of they payload.
- * @param checksum The value of the checksum (usually disable in UDPv4).
+ * @param checksum The value of the checksum or 0 to compute it when the
+ * Packet the datagram is stacked on is serialized.
  * @return A pointer to the newly allocated Udpv4Proto instance.
  */
 Udpv4Proto_t * Udpv4Proto_createWithParams(
         uint16_t sport,
         uint16_t dport,
         uint16_t length,
-        uint16_t checksum,
-        Protocol_t *proto_base);
+        uint16_t checksum);
 
 /**
  * @memberof Udpv4Proto
@@ -78,7 +90,31 @@ Udpv4Proto_t * Udpv4Proto_create(void);
 /**
  * @memberof Udpv4Proto
  *
- * Class destructor. Frees all the resources associated to this instance.
+ * Same as Udpv4Proto_create() but the instance, Protocol included, is allocated
+ * from an Arena. It must not be deleted, it's freed with the Arena.
+ *
+ * @param arena Pointer to the Arena where to allocate the instance.
+ * @return A pointer to the newly allocated Udpv4Proto instance or NULL.
+ */
+Udpv4Proto_t * Udpv4Proto_createInArena(Arena_t *arena);
+
+/**
+ * @memberof Udpv4Proto
+ *
+ * Copy constructor. Creates a new Udpv4Proto with the same members as another
+ * one, not stacked on any Packet.
+ *
+ * @param proto Pointer to the Udpv4Proto instance to copy.
+ * @return A pointer to the newly allocated Udpv4Proto instance or NULL.
+ */
+Udpv4Proto_t * Udpv4Proto_clone(const Udpv4Proto_t *proto);
+
+/**
+ * @memberof Udpv4Proto
+ *
+ * Class destructor. Frees all the resources associated to this instance. If
+ * the instance is shared by clones of a Packet (see Packet_clone()) it's only
+ * freed once they release it too.
  *
  * @param proto Pointer to a Udpv4Proto instance to be freed.
  */
@@ -113,11 +149,103 @@ int Udpv4Proto_getBitstream(
 /**
  * @memberof Udpv4Proto
  *
- * Getter of the member proto_base.
+ * Implements the finalize() behavior needed by the Protocol class.
+ *
+ * If the member checksum is 0 (the default) and the datagram is on top of
+ * IPv4, the checksum is computed over the pseudo header, the header and the
+ * payload. Otherwise the value of the member checksum is left as is. With
+ * PACKET_PARTIAL_CHECKSUM only the pseudo header is added (see
+ * ProtocolFinalize).
+ *
+ * @param proto Pointer to the Udpv4Proto instance to finalize.
+ * @param ctx Where the datagram ended up in the Packet.
+ * @return 0 on success, -1 otherwise.
+ */
+int Udpv4Proto_finalize(Udpv4Proto_t *proto, ProtocolFinalize_t *ctx);
+
+/**
+ * @memberof Udpv4Proto
+ *
+ * Tells if finalize() computes the checksum of the datagram, that is, if its
+ * member checksum is 0 and the layer below is an IPv4 header. Only then a
+ * partial checksum is left with PACKET_PARTIAL_CHECKSUM.
+ *
+ * @param proto Pointer to the Udpv4Proto instance.
+ * @param lower Pointer to the serialized layer below or NULL if there is none.
+ * @param lower_size The size in bytes of the layer below.
+ * @return 1 if the checksum is computed, 0 otherwise.
+ */
+int Udpv4Proto_hasComputedChecksum(
+        const Udpv4Proto_t *proto,
+        const uint8_t *lower,
+        unsigned int lower_size);
+
+/**
+ * @memberof Udpv4Proto
+ *
+ * Updates the checksum of an already serialized UDPv4 header after some of
+ * the bytes it covers changed, without going over the whole datagram again
+ * (RFC 1624). The bytes can belong to the header, the payload or the IPv4
+ * pseudo header. Datagrams without checksum (0) are left untouched.
+ *
+ * @param hdr Pointer to the serialized header. Its checksum is updated in
+ * place.
+ * @param offset The offset of the bytes that changed from the start of the
+ * header. For the fields of the pseudo header, their offset within the IPv4
+ * header.
+ * @param old The bytes before the change.
+ * @param new The bytes after the change.
+ * @param len The number of bytes that changed.
+ * @return 0 on success, -1 otherwise.
+ */
+int Udpv4Proto_updateChecksum(
+        uint8_t *hdr,
+        unsigned int offset,
+        const uint8_t *old,
+        const uint8_t *new,
+        unsigned int len);
+
+/**
+ * @memberof Udpv4Proto
+ *
+ * Getter of the Protocol embedded in the instance (member base).
  *
  * @param proto Pointer to the Udpv4Proto instance.
  * @return A pointer to the Protocol instance associated to this Udpv4Proto.
  */
 Protocol_t * Udpv4Proto_getProtoBase(const Udpv4Proto_t *proto);
 
+/**
+ * @memberof Udpv4Proto
+ *
+ * Setter of the member sport.
+ *
+ * @param proto Pointer to the instance to set its sport.
+ * @param port The source port.
+ * @return 0 on success, -1 otherwise.
+ */
+int Udpv4Proto_setSport(Udpv4Proto_t *proto, uint16_t port);
+
+/**
+ * @memberof Udpv4Proto
+ *
+ * Setter of the member dport.
+ *
+ * @param proto Pointer to the instance to set its dport.
+ * @param port The destination port.
+ * @return 0 on success, -1 otherwise.
+ */
+int Udpv4Proto_setDport(Udpv4Proto_t *proto, uint16_t port);
+
+/**
+ * @memberof Udpv4Proto
+ *
+ * Setter of the member length.
+ *
+ * @param proto Pointer to the instance to set its length.
+ * @param length The length of the header + length of the payload.
+ * @return 0 on success, -1 otherwise.
+ */
+int Udpv4Proto_setLength(Udpv4Proto_t *proto, uint16_t length);
+
 #endif
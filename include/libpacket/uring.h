@@ -0,0 +1,206 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+#ifndef __LIBPACKET_URING
+#define __LIBPACKET_URING
+
+/**
+ * @file uring.h
+ * @author David "Ole" Luengo
+ * @date 10 March 2018
+ * @brief File implementing asynchronous sends through io_uring.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * The socket is registered with the ring (IORING_REGISTER_FILES), so the
+ * kernel doesn't look it up on every send.
+ */
+#define URING_FLAG_FIXED_FILE (1 << 0)
+/**
+ * The frames are registered with the ring (IORING_REGISTER_BUFFERS) and sent
+ * with IORING_OP_WRITE_FIXED, so the kernel doesn't pin them on every send.
+ */
+#define URING_FLAG_FIXED_BUFFERS (1 << 1)
+
+/**
+ * Called for every completed send. The member seq is the number of frames
+ * committed to the Uring before this one and result is what the send
+ * returned, the number of bytes sent or a negative errno. It must not send
+ * through the same Uring.
+ */
+typedef void (*Uring_completionFunc_t)(void *arg, uint64_t seq, int result);
+
+/**
+ * @class Uring "libpacket/uring.h"
+ * @brief Class implementing asynchronous sends on a socket with io_uring.
+ *
+ * A Uring owns frame_nr frames of frame_size bytes and an io_uring instance
+ * of as many entries. Packets are written straight into a free frame, the
+ * frame is queued as a send on the submission queue and, once a burst of
+ * them is ready, the whole burst is submitted with a single system call that
+ * doesn't wait for any of them. The kernel reports every send on the
+ * completion queue, and only then the frame is recycled, so thousands of
+ * frames can be in flight without blocking.
+ *
+ * Completions are reaped by Uring_reap(), which can wait for them, and when
+ * no free frame is left. For each of them the completion callback is called,
+ * if there is one.
+ *
+ * The io_uring system calls are used directly, no liburing is needed.
+ */
+typedef struct Uring Uring_t;
+
+/* The sq_* and cq_* members point into the submission and completion queues
+ * shared with the kernel, mapped at sq_map and cq_map (the same mapping if
+ * the kernel supports it), and sqes is the array of submission entries. The
+ * member sq_cached is our copy of the tail of the submission queue and
+ * to_submit the number of entries queued but not submitted yet.
+ *
+ * The member free_frames is a stack of indexes of frames not in use, with
+ * free_nr elements on it, and seqs holds the sequence number of every frame
+ * in flight, seq being the next one. The members completed and errors count
+ * the sends reaped and the ones that failed. The member congested is set when
+ * a send failed because the device queue was full, for whoever wants to back
+ * off to clear it.
+ */
+typedef struct Uring {
+    int fd;
+    int desc;
+    unsigned int flags;
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;
+    size_t cq_map_size;
+    void *sqes;
+    size_t sqes_size;
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t *sq_array;
+    uint32_t sq_mask;
+    uint32_t sq_cached;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t cq_mask;
+    void *cqes;
+    unsigned int to_submit;
+    uint8_t *frames;
+    size_t frames_size;
+    unsigned int frame_size;
+    unsigned int frame_nr;
+    unsigned int *free_frames;
+    unsigned int free_nr;
+    uint64_t *seqs;
+    uint64_t seq;
+    Uring_completionFunc_t callback;
+    void *arg;
+    uint64_t completed;
+    uint64_t errors;
+    int congested;
+} Uring_t;
+
+/**
+ * @memberof Uring
+ *
+ * Class constructor. Sets up an io_uring instance and the frames to send
+ * through a socket.
+ *
+ * @param desc The descriptor of the socket, already bound, where to send.
+ * @param frame_size The size in bytes of every frame.
+ * @param frame_nr The number of frames, rounded up to a power of two.
+ * @param flags A combination of URING_FLAG_* values.
+ * @return A pointer to the newly allocated Uring or NULL.
+ */
+Uring_t * Uring_create(
+        int desc,
+        unsigned int frame_size,
+        unsigned int frame_nr,
+        unsigned int flags);
+
+/**
+ * @memberof Uring
+ *
+ * Class destructor. Waits for the frames in flight, tears down the io_uring
+ * instance and frees the frames.
+ *
+ * @param uring Pointer to the instance to destroy.
+ */
+void Uring_delete(Uring_t *uring);
+
+/**
+ * @memberof Uring
+ *
+ * Sets the function called for every completed send.
+ *
+ * @param uring Pointer to an instance of Uring.
+ * @param callback The function to call, NULL for none.
+ * @param arg Handed to callback as it is.
+ * @return 0 on success, -1 otherwise.
+ */
+int Uring_setCallback(Uring_t *uring, Uring_completionFunc_t callback, void *arg);
+
+/**
+ * @memberof Uring
+ *
+ * Gets a free frame. The frame doesn't change hands until Uring_commit() is
+ * called, so calling this method again returns the same frame.
+ *
+ * @param uring Pointer to an instance of Uring.
+ * @param size Output parameter where the size of the frame is written. Can
+ * be NULL.
+ * @return A pointer to where the packet has to be written or NULL if every
+ * frame is in flight.
+ */
+uint8_t * Uring_getFrame(Uring_t *uring, unsigned int *size);
+
+/**
+ * @memberof Uring
+ *
+ * Queues the send of the frame returned by Uring_getFrame(). It isn't
+ * submitted until Uring_flush() is called.
+ *
+ * @param uring Pointer to an instance of Uring.
+ * @param length The number of bytes written into the frame.
+ * @return 0 on success, -1 otherwise.
+ */
+int Uring_commit(Uring_t *uring, unsigned int length);
+
+/**
+ * @memberof Uring
+ *
+ * Submits all the sends queued so far, without waiting for them, and reaps
+ * the completions already available.
+ *
+ * @param uring Pointer to an instance of Uring.
+ * @return 0 on success, -1 otherwise.
+ */
+int Uring_flush(Uring_t *uring);
+
+/**
+ * @memberof Uring
+ *
+ * Reaps completions, waiting until at least min of them are available (no
+ * more than the frames in flight). Anything queued is submitted first.
+ *
+ * @param uring Pointer to an instance of Uring.
+ * @param min The number of completions to wait for, 0 not to wait.
+ * @return The number of frames still in flight or -1 on error.
+ */
+int Uring_reap(Uring_t *uring, unsigned int min);
+
+#endif
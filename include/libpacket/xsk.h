@@ -0,0 +1,163 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef __LIBPACKET_XSK
+#define __LIBPACKET_XSK
+
+/**
+ * @file xsk.h
+ * @author David "Ole" Luengo
+ * @date 10 March 2018
+ * @brief File implementing the transmission side of an AF_XDP socket.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @class XskRing "libpacket/xsk.h"
+ * @brief One of the single producer/single consumer rings shared with the
+ * kernel by an AF_XDP socket.
+ *
+ * The producer and consumer indexes are free running, the slot of an index
+ * is found by masking it with mask. We keep a copy of the index we own in
+ * cached so it's only written back to the shared memory when needed.
+ */
+typedef struct XskRing XskRing_t;
+
+typedef struct XskRing {
+    void *map;
+    size_t map_size;
+    uint32_t *producer;
+    uint32_t *consumer;
+    uint32_t *flags;
+    void *descs;
+    uint32_t size;
+    uint32_t mask;
+    uint32_t cached;
+} XskRing_t;
+
+/**
+ * @class Xsk "libpacket/xsk.h"
+ * @brief Class implementing the transmission side of an AF_XDP socket.
+ *
+ * An Xsk owns a UMEM, a chunk of memory registered with the kernel and split
+ * in frame_nr frames of frame_size bytes, and the rings used to exchange
+ * those frames with the kernel. Packets are written straight into a free
+ * frame of the UMEM, the frame is placed in the TX ring and, once the kernel
+ * is done with it, it comes back through the completion ring and is recycled.
+ *
+ * Only transmission is supported, so no XDP program needs to be attached to
+ * the interface. The fill ring is registered because the kernel requires it,
+ * but it's never used.
+ *
+ * Note that in copy (SKB) mode the kernel only sends frames while it's inside
+ * a system call, so one call is needed every few dozens of frames. Drivers
+ * supporting zero-copy mode drain the ring on their own.
+ */
+typedef struct Xsk Xsk_t;
+
+/* The member free_frames is a stack of UMEM addresses not in use, with
+ * free_nr elements on it.
+ */
+typedef struct Xsk {
+    uint8_t *umem;
+    size_t umem_size;
+    unsigned int frame_size;
+    unsigned int frame_nr;
+    uint64_t *free_frames;
+    unsigned int free_nr;
+    XskRing_t fill;
+    XskRing_t comp;
+    XskRing_t tx;
+} Xsk_t;
+
+/**
+ * @memberof Xsk
+ *
+ * Class constructor. Sets up the UMEM and the rings of an AF_XDP socket and
+ * binds it to a queue of an interface.
+ *
+ * @param desc The descriptor of an AF_XDP socket.
+ * @param ifindex The index of the interface where to inject.
+ * @param queue The queue of the interface to bind to.
+ * @param frame_size The size of every UMEM frame. A power of two between 2048
+ * and the page size.
+ * @param frame_nr The number of frames of the UMEM, rounded up to a power of
+ * two.
+ * @param flags Flags passed to bind(), usually XDP_COPY to force copy (SKB)
+ * mode, XDP_ZEROCOPY to force zero-copy mode or 0 to let the kernel choose.
+ * @return A pointer to the newly allocated Xsk or NULL.
+ */
+Xsk_t * Xsk_create(
+        int desc,
+        int ifindex,
+        unsigned int queue,
+        unsigned int frame_size,
+        unsigned int frame_nr,
+        unsigned int flags);
+
+/**
+ * @memberof Xsk
+ *
+ * Class destructor. Unmaps the rings and frees the UMEM. The socket itself
+ * has to be closed before calling this method, otherwise the kernel could
+ * still be using the UMEM.
+ *
+ * @param xsk Pointer to the instance to destroy.
+ */
+void Xsk_delete(Xsk_t *xsk);
+
+/**
+ * @memberof Xsk
+ *
+ * Gets a free frame where to write a packet. Frames released by the kernel
+ * are recycled here, without any system call. As in TxRing_getFrame(), the
+ * same frame is returned until Xsk_commit() is called.
+ *
+ * @param xsk Pointer to an instance of Xsk.
+ * @param size Output parameter where the size of the frame is written. Can
+ * be NULL.
+ * @return A pointer to where the packet has to be written or NULL if there
+ * are no free frames or the TX ring is full.
+ */
+uint8_t * Xsk_getFrame(Xsk_t *xsk, unsigned int *size);
+
+/**
+ * @memberof Xsk
+ *
+ * Places the frame returned by Xsk_getFrame() in the TX ring.
+ *
+ * @param xsk Pointer to an instance of Xsk.
+ * @param length The number of bytes written into the frame.
+ * @return 0 on success, -1 otherwise.
+ */
+int Xsk_commit(Xsk_t *xsk, unsigned int length);
+
+/**
+ * @memberof Xsk
+ *
+ * Wakes the kernel up to send the frames in the TX ring, but only if the
+ * kernel asked for it.
+ *
+ * @param xsk Pointer to an instance of Xsk.
+ * @param desc The descriptor of the AF_XDP socket.
+ * @return 0 on success, -1 otherwise.
+ */
+int Xsk_flush(Xsk_t *xsk, int desc);
+
+#endif
@@ -0,0 +1,133 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "libpacket/arena.h"
+
+#define ARENA_ROUND(x) (((x) + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1))
+#define ARENA_HEADER_SIZE ARENA_ROUND(sizeof(ArenaBlock_t))
+
+static ArenaBlock_t * ArenaBlock_create(size_t size) {
+    ArenaBlock_t *block;
+
+    block = aligned_alloc(ARENA_ALIGN, ARENA_ROUND(ARENA_HEADER_SIZE + size));
+    if (block == NULL) {
+        perror("aligned_alloc()");
+        goto end;
+    }
+
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+
+end:
+    return block;
+}
+
+static void * ArenaBlock_alloc(ArenaBlock_t *block, size_t size) {
+    void *ptr = NULL;
+
+    if (block->size - block->used >= size) {
+        ptr = (uint8_t *)block + ARENA_HEADER_SIZE + block->used;
+        block->used += size;
+    }
+
+    return ptr;
+}
+
+Arena_t * Arena_create(size_t block_size) {
+    Arena_t *arena;
+
+    arena = malloc(sizeof(Arena_t));
+    if (arena == NULL) {
+        perror("malloc()");
+        goto end;
+    }
+
+    arena->block_size = ARENA_ROUND(
+            block_size != 0? block_size: ARENA_DEFAULT_BLOCK_SIZE);
+    arena->first = arena->current = ArenaBlock_create(arena->block_size);
+    if (arena->first == NULL) {
+        free(arena);
+        arena = NULL;
+    }
+
+end:
+    return arena;
+}
+
+void Arena_delete(Arena_t *arena) {
+    ArenaBlock_t *block, *next;
+
+    if (arena != NULL) {
+        for (block = arena->first; block != NULL; block = next) {
+            next = block->next;
+            free(block);
+        }
+    }
+
+    free(arena);
+}
+
+void * Arena_alloc(Arena_t *arena, size_t size) {
+    ArenaBlock_t *block;
+    void *ptr = NULL;
+
+    if (arena == NULL) {
+        goto end;
+    }
+
+    size = ARENA_ROUND(size != 0? size: 1);
+    ptr = ArenaBlock_alloc(arena->current, size);
+    if (ptr != NULL) {
+        goto end;
+    }
+
+    // The blocks left by a reset come first.
+    block = arena->current->next;
+    if (block == NULL || block->size < size) {
+        block = ArenaBlock_create(
+                size > arena->block_size? size: arena->block_size);
+        if (block == NULL) {
+            goto end;
+        }
+
+        block->next = arena->current->next;
+        arena->current->next = block;
+    }
+
+    arena->current = block;
+    ptr = ArenaBlock_alloc(block, size);
+
+end:
+    return ptr;
+}
+
+void Arena_reset(Arena_t *arena) {
+    ArenaBlock_t *block;
+
+    if (arena != NULL) {
+        for (block = arena->first; block != NULL; block = block->next) {
+            block->used = 0;
+        }
+
+        arena->current = arena->first;
+    }
+}
@@ -0,0 +1,243 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <limits.h>
+
+#include "libpacket/batch.h"
+
+/* Makes room for capacity packets. The arrays keep their contents. */
+static int PacketBatch_reserve(PacketBatch_t *batch, unsigned int capacity) {
+    void *packs, *offsets, *lens, *bufs;
+    int ok = 0;
+
+    packs = realloc(batch->packs, sizeof(Packet_t *) * capacity);
+    if (packs != NULL) {
+        batch->packs = packs;
+    }
+
+    offsets = realloc(batch->offsets, sizeof(unsigned int) * capacity);
+    if (offsets != NULL) {
+        batch->offsets = offsets;
+    }
+
+    lens = realloc(batch->lens, sizeof(unsigned int) * capacity);
+    if (lens != NULL) {
+        batch->lens = lens;
+    }
+
+    bufs = realloc(batch->bufs, sizeof(uint8_t *) * capacity);
+    if (bufs != NULL) {
+        batch->bufs = bufs;
+    }
+
+    if (packs == NULL || offsets == NULL || lens == NULL || bufs == NULL) {
+        perror("realloc()");
+        goto end;
+    }
+
+    batch->capacity = capacity;
+    ok = 1;
+
+end:
+    return ok;
+}
+
+PacketBatch_t * PacketBatch_createWithParams(unsigned int capacity) {
+    PacketBatch_t *batch;
+
+    batch = malloc(sizeof(PacketBatch_t));
+    if (batch == NULL) {
+        perror("malloc()");
+        goto end;
+    }
+
+    batch->packs = NULL;
+    batch->packs_nr = 0;
+    batch->capacity = 0;
+    batch->offsets = NULL;
+    batch->lens = NULL;
+    batch->bufs = NULL;
+    batch->buf = NULL;
+    batch->buf_size = 0;
+    batch->length = 0;
+    batch->serialized = 0;
+
+    if (!PacketBatch_reserve(batch, capacity != 0? capacity: 1)) {
+        PacketBatch_delete(batch);
+        batch = NULL;
+    }
+
+end:
+    return batch;
+}
+
+PacketBatch_t * PacketBatch_create() {
+    return PacketBatch_createWithParams(PACKET_BATCH_DEFAULT_CAPACITY);
+}
+
+void PacketBatch_delete(PacketBatch_t *batch) {
+    if (batch != NULL) {
+        free(batch->packs);
+        free(batch->offsets);
+        free(batch->lens);
+        free(batch->bufs);
+        free(batch->buf);
+    }
+
+    free(batch);
+}
+
+int PacketBatch_add(PacketBatch_t *batch, const Packet_t *pack) {
+    int res = -1;
+
+    if (batch == NULL || pack == NULL) {
+        goto end;
+    }
+
+    if (batch->packs_nr == batch->capacity
+            && !PacketBatch_reserve(batch, batch->capacity * 2)) {
+        goto end;
+    }
+
+    batch->packs[batch->packs_nr++] = pack;
+    batch->serialized = 0;
+    res = 0;
+
+end:
+    return res;
+}
+
+void PacketBatch_clear(PacketBatch_t *batch) {
+    if (batch != NULL) {
+        batch->packs_nr = 0;
+        batch->length = 0;
+        batch->serialized = 0;
+    }
+}
+
+int PacketBatch_serialize(PacketBatch_t *batch, unsigned int flags) {
+    void *buf;
+    size_t buf_size, length = 0;
+    unsigned int i;
+    int res = -1;
+
+    if (batch == NULL) {
+        goto end;
+    }
+
+    batch->serialized = 0;
+
+    // Lay the packets out first, so the buffer is sized once.
+    for (i = 0; i < batch->packs_nr; i++) {
+        batch->offsets[i] = length;
+        batch->lens[i] = Packet_getSize(batch->packs[i]);
+        length += batch->lens[i];
+    }
+
+    if (length > INT_MAX) {
+        goto end;
+    }
+
+    if (length > batch->buf_size) {
+        free(batch->buf);
+        batch->buf = NULL;
+        batch->buf_size = 0;
+
+        // Round up, so the buffer doesn't grow by a few bytes every time.
+        buf_size = (length + PACKET_BATCH_ALIGN - 1)
+            & ~(size_t)(PACKET_BATCH_ALIGN - 1);
+        if (posix_memalign(&buf, PACKET_BATCH_ALIGN, buf_size) != 0) {
+            perror("posix_memalign()");
+            goto end;
+        }
+
+        batch->buf = buf;
+        batch->buf_size = buf_size;
+    }
+
+    // Every packet is written right where it goes, no copy in between.
+    for (i = 0; i < batch->packs_nr; i++) {
+        batch->bufs[i] = &batch->buf[batch->offsets[i]];
+        if (batch->lens[i] == 0) {
+            continue;
+        }
+
+        if (Packet_getBitstreamWithFlags(
+                    batch->packs[i],
+                    &batch->buf[batch->offsets[i]],
+                    batch->lens[i],
+                    flags) != (int)batch->lens[i]) {
+            goto end;
+        }
+    }
+
+    batch->length = length;
+    batch->serialized = 1;
+    res = length;
+
+end:
+    return res;
+}
+
+unsigned int PacketBatch_getNumPackets(const PacketBatch_t *batch) {
+    return batch != NULL? batch->packs_nr: 0;
+}
+
+const uint8_t * PacketBatch_getBuffer(
+        const PacketBatch_t *batch,
+        size_t *length) {
+    const uint8_t *buf = NULL;
+
+    if (batch != NULL && batch->serialized) {
+        buf = batch->buf;
+        if (length != NULL) {
+            *length = batch->length;
+        }
+    }
+
+    return buf;
+}
+
+const uint8_t * PacketBatch_getPacketData(
+        const PacketBatch_t *batch,
+        unsigned int index,
+        unsigned int *length) {
+    const uint8_t *data = NULL;
+
+    if (batch != NULL && batch->serialized && index < batch->packs_nr) {
+        data = batch->bufs[index];
+        if (length != NULL) {
+            *length = batch->lens[index];
+        }
+    }
+
+    return data;
+}
+
+const unsigned int * PacketBatch_getOffsets(const PacketBatch_t *batch) {
+    return batch != NULL && batch->serialized? batch->offsets: NULL;
+}
+
+const unsigned int * PacketBatch_getLengths(const PacketBatch_t *batch) {
+    return batch != NULL && batch->serialized? batch->lens: NULL;
+}
+
+const uint8_t * const * PacketBatch_getPackets(const PacketBatch_t *batch) {
+    return batch != NULL && batch->serialized? batch->bufs: NULL;
+}
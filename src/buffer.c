@@ -0,0 +1,114 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "libpacket/buffer.h"
+
+PacketBuffer_t * PacketBuffer_create(unsigned int headroom, unsigned int size) {
+    PacketBuffer_t *pb;
+
+    pb = malloc(sizeof(PacketBuffer_t));
+    if (pb == NULL) {
+        perror("malloc()");
+        goto end;
+    }
+
+    pb->size = headroom + size;
+    pb->head = malloc(sizeof(uint8_t) * pb->size);
+    if (pb->head == NULL) {
+        perror("malloc()");
+        free(pb);
+        pb = NULL;
+        goto end;
+    }
+
+    pb->data = pb->head + headroom;
+    pb->length = 0;
+
+end:
+    return pb;
+}
+
+void PacketBuffer_delete(PacketBuffer_t *pb) {
+    if (pb != NULL) {
+        free(pb->head);
+    }
+
+    free(pb);
+}
+
+int PacketBuffer_reset(PacketBuffer_t *pb, unsigned int headroom) {
+    int res = -1;
+
+    if (pb != NULL && headroom <= pb->size) {
+        pb->data = pb->head + headroom;
+        pb->length = 0;
+        res = 0;
+    }
+
+    return res;
+}
+
+uint8_t * PacketBuffer_push(PacketBuffer_t *pb, unsigned int len) {
+    if (pb == NULL || len > PacketBuffer_getHeadroom(pb)) {
+        return NULL;
+    }
+
+    pb->data -= len;
+    pb->length += len;
+    return pb->data;
+}
+
+uint8_t * PacketBuffer_put(PacketBuffer_t *pb, unsigned int len) {
+    uint8_t *tail;
+
+    if (pb == NULL || len > PacketBuffer_getTailroom(pb)) {
+        return NULL;
+    }
+
+    tail = pb->data + pb->length;
+    pb->length += len;
+    return tail;
+}
+
+uint8_t * PacketBuffer_pull(PacketBuffer_t *pb, unsigned int len) {
+    if (pb == NULL || len > pb->length) {
+        return NULL;
+    }
+
+    pb->data += len;
+    pb->length -= len;
+    return pb->data;
+}
+
+uint8_t * PacketBuffer_getData(const PacketBuffer_t *pb) {
+    return pb != NULL? pb->data: NULL;
+}
+
+unsigned int PacketBuffer_getLength(const PacketBuffer_t *pb) {
+    return pb != NULL? pb->length: 0;
+}
+
+unsigned int PacketBuffer_getHeadroom(const PacketBuffer_t *pb) {
+    return pb != NULL? pb->data - pb->head: 0;
+}
+
+unsigned int PacketBuffer_getTailroom(const PacketBuffer_t *pb) {
+    return pb != NULL? pb->size - PacketBuffer_getHeadroom(pb) - pb->length: 0;
+}
@@ -0,0 +1,214 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <string.h>
+#include <arpa/inet.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHECKSUM_X86
+#endif
+
+#include "libpacket/checksum.h"
+
+/* The kernels below add the buffer as native 32 bits words into 64 bits
+ * accumulators, so carries are never lost. Being a one's complement sum, the
+ * result is the same as adding big endian 16 bits words except for the byte
+ * order, which is fixed once at the end.
+ */
+typedef uint64_t (*Checksum_kernel_t)(const uint8_t *, unsigned int);
+
+static uint64_t Checksum_kernelScalar(const uint8_t *buf, unsigned int len) {
+    uint64_t sum = 0;
+    uint32_t word;
+    uint16_t half = 0;
+
+    while (len >= 4) {
+        memcpy(&word, buf, 4);
+        sum += word;
+        buf += 4;
+        len -= 4;
+    }
+
+    if (len >= 2) {
+        memcpy(&half, buf, 2);
+        sum += half;
+        buf += 2;
+        len -= 2;
+    }
+
+    if (len) {
+        half = 0;
+        memcpy(&half, buf, 1);
+        sum += half;
+    }
+
+    return sum;
+}
+
+#ifdef CHECKSUM_X86
+
+__attribute__((target("sse2")))
+static uint64_t Checksum_kernelSse2(const uint8_t *buf, unsigned int len) {
+    __m128i acc0 = _mm_setzero_si128(), acc1 = _mm_setzero_si128();
+    __m128i zero = _mm_setzero_si128(), data;
+    uint64_t lanes[4];
+
+    while (len >= 16) {
+        data = _mm_loadu_si128((const __m128i *)buf);
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(data, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(data, zero));
+        buf += 16;
+        len -= 16;
+    }
+
+    _mm_storeu_si128((__m128i *)&lanes[0], acc0);
+    _mm_storeu_si128((__m128i *)&lanes[2], acc1);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3]
+        + Checksum_kernelScalar(buf, len);
+}
+
+__attribute__((target("avx2")))
+static uint64_t Checksum_kernelAvx2(const uint8_t *buf, unsigned int len) {
+    __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+    __m256i zero = _mm256_setzero_si256(), data;
+    uint64_t lanes[8];
+
+    while (len >= 32) {
+        data = _mm256_loadu_si256((const __m256i *)buf);
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(data, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(data, zero));
+        buf += 32;
+        len -= 32;
+    }
+
+    _mm256_storeu_si256((__m256i *)&lanes[0], acc0);
+    _mm256_storeu_si256((__m256i *)&lanes[4], acc1);
+
+    // GCC doesn't clear the upper halves of the registers on its own here,
+    // and legacy SSE code running while they are dirty stalls, the SSE2
+    // kernel for the tail as well as the caller.
+    _mm256_zeroupper();
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3]
+        + lanes[4] + lanes[5] + lanes[6] + lanes[7]
+        + Checksum_kernelSse2(buf, len);
+}
+
+#endif
+
+static Checksum_kernel_t Checksum_selectKernel(void) {
+    Checksum_kernel_t kernel = Checksum_kernelScalar;
+
+#ifdef CHECKSUM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernel = Checksum_kernelAvx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        kernel = Checksum_kernelSse2;
+    }
+#endif
+
+    return kernel;
+}
+
+/* Several threads may race to set it, but all of them store the same value. */
+static Checksum_kernel_t checksum_kernel = NULL;
+
+uint32_t Checksum_partial(const uint8_t *buf, unsigned int len, uint32_t sum) {
+    Checksum_kernel_t kernel;
+    uint64_t native;
+
+    kernel = __atomic_load_n(&checksum_kernel, __ATOMIC_RELAXED);
+    if (kernel == NULL) {
+        kernel = Checksum_selectKernel();
+        __atomic_store_n(&checksum_kernel, kernel, __ATOMIC_RELAXED);
+    }
+
+    native = kernel(buf, len);
+    while (native >> 16) {
+        native = (native & 0xffff) + (native >> 16);
+    }
+
+    native = (uint64_t)sum + ntohs(native);
+    return (native & 0xffffffff) + (native >> 32);
+}
+
+uint32_t Checksum_combine(uint32_t sum, uint32_t partial, unsigned int offset) {
+    uint64_t total;
+    uint16_t folded;
+
+    folded = Checksum_fold(partial);
+    if (offset % 2) {
+        folded = folded << 8 | folded >> 8;
+    }
+
+    total = (uint64_t)sum + folded;
+    return (total & 0xffffffff) + (total >> 32);
+}
+
+uint16_t Checksum_fold(uint32_t sum) {
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+
+    return sum;
+}
+
+uint16_t Checksum_compute(const uint8_t *buf, unsigned int len) {
+    return ~Checksum_fold(Checksum_partial(buf, len, 0));
+}
+
+uint16_t Checksum_update(
+        uint16_t checksum,
+        const uint8_t *old,
+        const uint8_t *new,
+        unsigned int len,
+        int odd) {
+    uint32_t sum = (uint16_t)~checksum;
+    unsigned int i, shift;
+
+    // Every byte is either the high or the low half of a 16 bits word.
+    for (i = 0; i < len; i++) {
+        shift = (i + (odd? 1: 0)) % 2 == 0? 8: 0;
+        sum += (uint32_t)(uint8_t)~old[i] << shift;
+        sum += (uint32_t)new[i] << shift;
+    }
+
+    // The halves of the first and last words that didn't change still
+    // contribute with ~b + b to ~m + m'.
+    if (odd) {
+        sum += 0xff00;
+    }
+
+    if ((len + (odd? 1: 0)) % 2) {
+        sum += 0x00ff;
+    }
+
+    return ~Checksum_fold(sum);
+}
+
+uint16_t Checksum_update16(uint16_t checksum, uint16_t old, uint16_t new) {
+    uint32_t sum;
+
+    sum = (uint16_t)~checksum + (uint16_t)~old + new;
+    return ~Checksum_fold(sum);
+}
+
+uint16_t Checksum_update32(uint16_t checksum, uint32_t old, uint32_t new) {
+    checksum = Checksum_update16(checksum, old >> 16, new >> 16);
+    return Checksum_update16(checksum, old & 0xffff, new & 0xffff);
+}
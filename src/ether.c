@@ -22,55 +22,83 @@
 #include <arpa/inet.h>
 
 #include "libpacket/ether.h"
+#include "libpacket/pool.h"
 
 #define IPV4_TYPE (0x0800)
 #define ETHER_HEADER_LEN (14)
 
+static const ProtocolField_t ether_fields[] = {
+    {ETHER_FIELD_DADDR, 0, ADDR_LEN, PROTOCOL_FIELD_BIG_ENDIAN, 0},
+    {ETHER_FIELD_SADDR, ADDR_LEN, ADDR_LEN, PROTOCOL_FIELD_BIG_ENDIAN, 0},
+    {ETHER_FIELD_TYPE, ADDR_LEN*2, 2, PROTOCOL_FIELD_BIG_ENDIAN, 0},
+};
+
+static Pool_t ether_pool = POOL_INITIALIZER("EtherProto", sizeof(EtherProto_t));
+
+static const ProtocolOps_t ether_ops = {
+    .getSize = (Protocol_getSizeFunc_t)EtherProto_getSize,
+    .getBitstream = (Protocol_getBitstreamFunc_t)EtherProto_getBitstream,
+    .finalize = NULL,
+    .getData = NULL,
+    .clone = (Protocol_cloneFunc_t)EtherProto_clone,
+    .release = (Protocol_releaseFunc_t)EtherProto_delete,
+    .fields = ether_fields,
+    .fields_nr = sizeof(ether_fields) / sizeof(ether_fields[0]),
+    .type = PROTOCOL_TYPE_ETHER,
+};
+
+static void EtherProto_init(EtherProto_t *proto) {
+    Protocol_init(&proto->base, &ether_ops, proto);
+
+    //TODO: This have to change.
+    memcpy(proto->daddr, "\x00\x01\x02\x03\x04\x05", ADDR_LEN);
+    memcpy(proto->saddr, "\x06\x07\x08\x09\x0a\x0b", ADDR_LEN);
+    proto->type = IPV4_TYPE;
+}
+
 EtherProto_t * EtherProto_create() {
     EtherProto_t *proto;
-    int ok;
-    proto = malloc(sizeof(EtherProto_t));
-    if (proto == NULL) {
-        goto end;
+
+    proto = Pool_alloc(&ether_pool);
+    if (proto != NULL) {
+        EtherProto_init(proto);
     }
 
-    proto->proto_base = Protocol_create();
-    if (proto->proto_base == NULL) {
-        free(proto);
-        proto = NULL;
-        goto end;
+    return proto;
+}
+
+EtherProto_t * EtherProto_createInArena(Arena_t *arena) {
+    EtherProto_t *proto;
+
+    proto = Arena_alloc(arena, sizeof(EtherProto_t));
+    if (proto != NULL) {
+        EtherProto_init(proto);
     }
 
-    //TODO: Don't access members, create setters/getters.
-    proto->proto_base->getSize =
-        (Protocol_getSizeFunc_t)EtherProto_getSize;
-    proto->proto_base->getBitstream =
-        (Protocol_getBitstreamFunc_t)EtherProto_getBitstream;
-    ok = Protocol_setOwner(proto->proto_base, proto);
-    if (!ok) {
-        Protocol_delete(proto->proto_base);
-        proto->proto_base = NULL;
-        //TODO: Don't repeat code.
-        free(proto);
-        proto = NULL;
+    return proto;
+}
+
+EtherProto_t * EtherProto_clone(const EtherProto_t *proto) {
+    EtherProto_t *copy = NULL;
+
+    if (proto == NULL) {
         goto end;
     }
 
-    //TODO: This have to change.
-    memcpy(proto->daddr, "\x00\x01\x02\x03\x04\x05", ADDR_LEN);
-    memcpy(proto->saddr, "\x06\x07\x08\x09\x0a\x0b", ADDR_LEN);
-    proto->type = IPV4_TYPE;
+    copy = Pool_alloc(&ether_pool);
+    if (copy != NULL) {
+        *copy = *proto;
+        Protocol_init(&copy->base, proto->base.ops, copy);
+    }
 
 end:
-    return proto;
+    return copy;
 }
 
 void EtherProto_delete(EtherProto_t *proto) {
-    if (proto != NULL) {
-        Protocol_delete(proto->proto_base);
+    if (proto != NULL && Protocol_unref(&proto->base)) {
+        Pool_free(&ether_pool, proto);
     }
-
-    free(proto);
 }
 
 unsigned int EtherProto_getSize(const EtherProto_t *proto) {
@@ -98,6 +126,41 @@ end:
 }
 
 Protocol_t * EtherProto_getProtoBase(const EtherProto_t *proto) {
-    return proto != NULL? proto->proto_base: NULL;
+    return proto != NULL? (Protocol_t *)&proto->base: NULL;
 }
 
+int EtherProto_setDaddr(EtherProto_t *proto, const uint8_t *addr) {
+    int res = -1;
+
+    if (proto != NULL && addr != NULL) {
+        memcpy(proto->daddr, addr, ADDR_LEN);
+        Protocol_changed(&proto->base);
+        res = 0;
+    }
+
+    return res;
+}
+
+int EtherProto_setSaddr(EtherProto_t *proto, const uint8_t *addr) {
+    int res = -1;
+
+    if (proto != NULL && addr != NULL) {
+        memcpy(proto->saddr, addr, ADDR_LEN);
+        Protocol_changed(&proto->base);
+        res = 0;
+    }
+
+    return res;
+}
+
+int EtherProto_setType(EtherProto_t *proto, uint16_t type) {
+    int res = -1;
+
+    if (proto != NULL) {
+        proto->type = type;
+        Protocol_changed(&proto->base);
+        res = 0;
+    }
+
+    return res;
+}
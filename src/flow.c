@@ -0,0 +1,551 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FLOW_X86
+#endif
+
+#include "libpacket/flow.h"
+#include "libpacket/ipv4.h"
+#include "libpacket/udpv4.h"
+#include "libpacket/checksum.h"
+
+/* Makes room for capacity flows. The arrays keep their contents. */
+static int FlowTable_reserve(FlowTable_t *table, unsigned int capacity) {
+    void *saddr, *daddr, *sport, *dport, *id, *packets, *bytes;
+    int ok = 0;
+
+    saddr = realloc(table->saddr, sizeof(uint32_t) * capacity);
+    if (saddr != NULL) {
+        table->saddr = saddr;
+    }
+
+    daddr = realloc(table->daddr, sizeof(uint32_t) * capacity);
+    if (daddr != NULL) {
+        table->daddr = daddr;
+    }
+
+    sport = realloc(table->sport, sizeof(uint16_t) * capacity);
+    if (sport != NULL) {
+        table->sport = sport;
+    }
+
+    dport = realloc(table->dport, sizeof(uint16_t) * capacity);
+    if (dport != NULL) {
+        table->dport = dport;
+    }
+
+    id = realloc(table->id, sizeof(uint16_t) * capacity);
+    if (id != NULL) {
+        table->id = id;
+    }
+
+    packets = realloc(table->packets, sizeof(uint64_t) * capacity);
+    if (packets != NULL) {
+        table->packets = packets;
+    }
+
+    bytes = realloc(table->bytes, sizeof(uint64_t) * capacity);
+    if (bytes != NULL) {
+        table->bytes = bytes;
+    }
+
+    if (saddr == NULL
+            || daddr == NULL
+            || sport == NULL
+            || dport == NULL
+            || id == NULL
+            || packets == NULL
+            || bytes == NULL) {
+        perror("realloc()");
+        goto end;
+    }
+
+    table->capacity = capacity;
+    ok = 1;
+
+end:
+    return ok;
+}
+
+FlowTable_t * FlowTable_createWithParams(unsigned int capacity) {
+    FlowTable_t *table;
+
+    table = calloc(1, sizeof(FlowTable_t));
+    if (table == NULL) {
+        perror("calloc()");
+        goto end;
+    }
+
+    if (!FlowTable_reserve(table, capacity != 0? capacity: 1)) {
+        FlowTable_delete(table);
+        table = NULL;
+    }
+
+end:
+    return table;
+}
+
+FlowTable_t * FlowTable_create() {
+    return FlowTable_createWithParams(FLOW_TABLE_DEFAULT_CAPACITY);
+}
+
+void FlowTable_delete(FlowTable_t *table) {
+    if (table != NULL) {
+        free(table->saddr);
+        free(table->daddr);
+        free(table->sport);
+        free(table->dport);
+        free(table->id);
+        free(table->packets);
+        free(table->bytes);
+    }
+
+    free(table);
+}
+
+int FlowTable_add(
+        FlowTable_t *table,
+        uint32_t saddr,
+        uint32_t daddr,
+        uint16_t sport,
+        uint16_t dport) {
+    unsigned int i;
+    int index = -1;
+
+    if (table == NULL) {
+        goto end;
+    }
+
+    if (table->flows_nr == table->capacity
+            && !FlowTable_reserve(table, table->capacity * 2)) {
+        goto end;
+    }
+
+    i = table->flows_nr++;
+    table->saddr[i] = saddr;
+    table->daddr[i] = daddr;
+    table->sport[i] = sport;
+    table->dport[i] = dport;
+    table->id[i] = 0;
+    table->packets[i] = 0;
+    table->bytes[i] = 0;
+    index = i;
+
+end:
+    return index;
+}
+
+unsigned int FlowTable_getNumFlows(const FlowTable_t *table) {
+    return table != NULL? table->flows_nr: 0;
+}
+
+/* Reads a 16 bits big endian word. */
+static uint16_t FlowTable_read16(const uint8_t *buf) {
+    return buf[0] << 8 | buf[1];
+}
+
+/* Adds the one's complement of a word, that is, takes it out of a sum. */
+static uint32_t FlowTable_subtract(uint32_t sum, uint32_t word) {
+    return sum + (~word & 0xffff);
+}
+
+int FlowTable_setTemplate(
+        FlowTable_t *table,
+        const Template_t *tmpl,
+        unsigned int ipv4_layer) {
+    static const struct {
+        unsigned int layer;
+        unsigned int id;
+        unsigned int width;
+    } wanted[FLOW_FIELD_NR] = {
+        [FLOW_FIELD_SADDR] = {0, IPV4_FIELD_SADDR, 4},
+        [FLOW_FIELD_DADDR] = {0, IPV4_FIELD_DADDR, 4},
+        [FLOW_FIELD_SPORT] = {1, UDPV4_FIELD_SPORT, 2},
+        [FLOW_FIELD_DPORT] = {1, UDPV4_FIELD_DPORT, 2},
+        [FLOW_FIELD_ID] = {0, IPV4_FIELD_ID, 2},
+        [FLOW_FIELD_IPV4_CHECKSUM] = {0, IPV4_FIELD_CHECKSUM, 2},
+        [FLOW_FIELD_UDPV4_CHECKSUM] = {1, UDPV4_FIELD_CHECKSUM, 2},
+    };
+    const TemplateField_t *field;
+    const uint8_t *frame;
+    unsigned int i, start, offsets[FLOW_FIELD_NR];
+    uint32_t ipv4_sum, udpv4_sum, word;
+    int index, res = -1;
+
+    if (table == NULL || tmpl == NULL || ipv4_layer + 1 >= tmpl->layers_nr) {
+        goto end;
+    }
+
+    // The checksums are updated a word at a time, so the fields must be
+    // words aligned to the data the checksums cover.
+    for (i = 0; i < FLOW_FIELD_NR; i++) {
+        index = Template_getField(tmpl, ipv4_layer + wanted[i].layer, wanted[i].id);
+        if (index < 0) {
+            goto end;
+        }
+
+        field = &tmpl->fields[index];
+        if (field->width != wanted[i].width || field->odd != 0) {
+            goto end;
+        }
+
+        offsets[i] = field->offset;
+    }
+
+    // The IPv4 header is summed again, whatever its checksum says (0x0000 is
+    // a valid one). The UDP checksum covers the payload too, it's derived
+    // from the one of the Template.
+    frame = tmpl->frame;
+    start = tmpl->layers[ipv4_layer].offset;
+    ipv4_sum = Checksum_partial(
+            &frame[start],
+            tmpl->layers[ipv4_layer + 1].offset - start,
+            0);
+    ipv4_sum = FlowTable_subtract(
+            ipv4_sum,
+            FlowTable_read16(&frame[offsets[FLOW_FIELD_IPV4_CHECKSUM]]));
+    udpv4_sum = (uint16_t)~FlowTable_read16(&frame[offsets[FLOW_FIELD_UDPV4_CHECKSUM]]);
+
+    for (i = FLOW_FIELD_SADDR; i <= FLOW_FIELD_DADDR; i++) {
+        word = FlowTable_read16(&frame[offsets[i]]);
+        ipv4_sum = FlowTable_subtract(ipv4_sum, word);
+        udpv4_sum = FlowTable_subtract(udpv4_sum, word);
+        word = FlowTable_read16(&frame[offsets[i] + 2]);
+        ipv4_sum = FlowTable_subtract(ipv4_sum, word);
+        udpv4_sum = FlowTable_subtract(udpv4_sum, word);
+    }
+
+    for (i = FLOW_FIELD_SPORT; i <= FLOW_FIELD_DPORT; i++) {
+        udpv4_sum = FlowTable_subtract(
+                udpv4_sum,
+                FlowTable_read16(&frame[offsets[i]]));
+    }
+
+    ipv4_sum = FlowTable_subtract(
+            ipv4_sum,
+            FlowTable_read16(&frame[offsets[FLOW_FIELD_ID]]));
+
+    table->tmpl = tmpl;
+    memcpy(table->offsets, offsets, sizeof(offsets));
+    table->ipv4_base = Checksum_fold(ipv4_sum);
+    table->udpv4_base = Checksum_fold(udpv4_sum);
+    table->udpv4_checksum = udpv4_sum != 0xffff;
+    res = 0;
+
+end:
+    return res;
+}
+
+/*------------------------------ Kernels ------------------------------*/
+
+#define FLOW_CHUNK (8)
+
+/* The fields of a run of up to FLOW_CHUNK flows, ready to be stored into a
+ * frame: in network byte order, the 16 bits ones in the low half of each
+ * element.
+ */
+typedef struct FlowWords {
+    uint32_t saddr[FLOW_CHUNK];
+    uint32_t daddr[FLOW_CHUNK];
+    uint32_t sport[FLOW_CHUNK];
+    uint32_t dport[FLOW_CHUNK];
+    uint32_t id[FLOW_CHUNK];
+    uint32_t ipv4_checksum[FLOW_CHUNK];
+    uint32_t udpv4_checksum[FLOW_CHUNK];
+} FlowWords_t;
+
+typedef void (*FlowTable_kernel_t)(
+        const FlowTable_t *,
+        unsigned int,
+        unsigned int,
+        FlowWords_t *);
+
+static void FlowTable_kernelScalar(
+        const FlowTable_t *table,
+        unsigned int first,
+        unsigned int n,
+        FlowWords_t *words) {
+    uint32_t saddr, daddr, addrs;
+    uint16_t checksum;
+    unsigned int i, j;
+
+    for (j = 0; j < n; j++) {
+        i = first + j;
+        saddr = table->saddr[i];
+        daddr = table->daddr[i];
+        addrs = (saddr >> 16) + (saddr & 0xffff)
+            + (daddr >> 16) + (daddr & 0xffff);
+
+        words->saddr[j] = htonl(saddr);
+        words->daddr[j] = htonl(daddr);
+        words->sport[j] = htons(table->sport[i]);
+        words->dport[j] = htons(table->dport[i]);
+        words->id[j] = htons(table->id[i]);
+
+        checksum = ~Checksum_fold(table->ipv4_base + addrs + table->id[i]);
+        words->ipv4_checksum[j] = htons(checksum);
+
+        checksum = ~Checksum_fold(table->udpv4_base + addrs
+                + table->sport[i] + table->dport[i]);
+        words->udpv4_checksum[j] = htons(checksum != 0? checksum: 0xffff);
+    }
+}
+
+#ifdef FLOW_X86
+
+__attribute__((target("sse2")))
+static void FlowTable_kernelSse2(
+        const FlowTable_t *table,
+        unsigned int first,
+        unsigned int n,
+        FlowWords_t *words) {
+    const __m128i mask = _mm_set1_epi32(0xffff), zero = _mm_setzero_si128();
+    __m128i saddr, daddr, sport, dport, id, addrs, sum;
+    unsigned int j;
+
+    if (n != FLOW_CHUNK) {
+        FlowTable_kernelScalar(table, first, n, words);
+        return;
+    }
+
+#define SSE2_FOLD(x) \
+    ((x) = _mm_add_epi32(_mm_and_si128((x), mask), _mm_srli_epi32((x), 16)))
+#define SSE2_SWAP16(x) \
+    _mm_or_si128( \
+            _mm_slli_epi32(_mm_and_si128((x), _mm_set1_epi32(0xff)), 8), \
+            _mm_srli_epi32((x), 8))
+#define SSE2_SWAP32(x) \
+    _mm_or_si128( \
+            _mm_or_si128(_mm_slli_epi32((x), 24), _mm_srli_epi32((x), 24)), \
+            _mm_or_si128( \
+                _mm_and_si128(_mm_slli_epi32((x), 8), _mm_set1_epi32(0xff0000)), \
+                _mm_and_si128(_mm_srli_epi32((x), 8), _mm_set1_epi32(0xff00))))
+
+    for (j = 0; j < FLOW_CHUNK; j += 4) {
+        saddr = _mm_loadu_si128((const __m128i *)&table->saddr[first + j]);
+        daddr = _mm_loadu_si128((const __m128i *)&table->daddr[first + j]);
+        sport = _mm_unpacklo_epi16(
+                _mm_loadl_epi64((const __m128i *)&table->sport[first + j]),
+                zero);
+        dport = _mm_unpacklo_epi16(
+                _mm_loadl_epi64((const __m128i *)&table->dport[first + j]),
+                zero);
+        id = _mm_unpacklo_epi16(
+                _mm_loadl_epi64((const __m128i *)&table->id[first + j]),
+                zero);
+
+        addrs = _mm_add_epi32(
+                _mm_add_epi32(_mm_srli_epi32(saddr, 16), _mm_and_si128(saddr, mask)),
+                _mm_add_epi32(_mm_srli_epi32(daddr, 16), _mm_and_si128(daddr, mask)));
+
+        sum = _mm_add_epi32(
+                _mm_add_epi32(_mm_set1_epi32(table->ipv4_base), addrs),
+                id);
+        SSE2_FOLD(sum);
+        SSE2_FOLD(sum);
+        sum = _mm_xor_si128(sum, mask);
+        _mm_storeu_si128((__m128i *)&words->ipv4_checksum[j], SSE2_SWAP16(sum));
+
+        sum = _mm_add_epi32(
+                _mm_add_epi32(_mm_set1_epi32(table->udpv4_base), addrs),
+                _mm_add_epi32(sport, dport));
+        SSE2_FOLD(sum);
+        SSE2_FOLD(sum);
+        sum = _mm_xor_si128(sum, mask);
+        sum = _mm_or_si128(sum, _mm_and_si128(_mm_cmpeq_epi32(sum, zero), mask));
+        _mm_storeu_si128((__m128i *)&words->udpv4_checksum[j], SSE2_SWAP16(sum));
+
+        _mm_storeu_si128((__m128i *)&words->saddr[j], SSE2_SWAP32(saddr));
+        _mm_storeu_si128((__m128i *)&words->daddr[j], SSE2_SWAP32(daddr));
+        _mm_storeu_si128((__m128i *)&words->sport[j], SSE2_SWAP16(sport));
+        _mm_storeu_si128((__m128i *)&words->dport[j], SSE2_SWAP16(dport));
+        _mm_storeu_si128((__m128i *)&words->id[j], SSE2_SWAP16(id));
+    }
+
+#undef SSE2_FOLD
+#undef SSE2_SWAP16
+#undef SSE2_SWAP32
+}
+
+__attribute__((target("avx2")))
+static void FlowTable_kernelAvx2(
+        const FlowTable_t *table,
+        unsigned int first,
+        unsigned int n,
+        FlowWords_t *words) {
+    const __m256i mask = _mm256_set1_epi32(0xffff);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i swap32 = _mm256_setr_epi8(
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const __m256i swap16 = _mm256_setr_epi8(
+            1, 0, 2, 3, 5, 4, 6, 7, 9, 8, 10, 11, 13, 12, 14, 15,
+            1, 0, 2, 3, 5, 4, 6, 7, 9, 8, 10, 11, 13, 12, 14, 15);
+    __m256i saddr, daddr, sport, dport, id, addrs, sum;
+
+    if (n != FLOW_CHUNK) {
+        FlowTable_kernelScalar(table, first, n, words);
+        return;
+    }
+
+#define AVX2_FOLD(x) \
+    ((x) = _mm256_add_epi32(_mm256_and_si256((x), mask), _mm256_srli_epi32((x), 16)))
+
+    saddr = _mm256_loadu_si256((const __m256i *)&table->saddr[first]);
+    daddr = _mm256_loadu_si256((const __m256i *)&table->daddr[first]);
+    sport = _mm256_cvtepu16_epi32(
+            _mm_loadu_si128((const __m128i *)&table->sport[first]));
+    dport = _mm256_cvtepu16_epi32(
+            _mm_loadu_si128((const __m128i *)&table->dport[first]));
+    id = _mm256_cvtepu16_epi32(
+            _mm_loadu_si128((const __m128i *)&table->id[first]));
+
+    addrs = _mm256_add_epi32(
+            _mm256_add_epi32(_mm256_srli_epi32(saddr, 16), _mm256_and_si256(saddr, mask)),
+            _mm256_add_epi32(_mm256_srli_epi32(daddr, 16), _mm256_and_si256(daddr, mask)));
+
+    sum = _mm256_add_epi32(
+            _mm256_add_epi32(_mm256_set1_epi32(table->ipv4_base), addrs),
+            id);
+    AVX2_FOLD(sum);
+    AVX2_FOLD(sum);
+    sum = _mm256_xor_si256(sum, mask);
+    _mm256_storeu_si256(
+            (__m256i *)words->ipv4_checksum,
+            _mm256_shuffle_epi8(sum, swap16));
+
+    sum = _mm256_add_epi32(
+            _mm256_add_epi32(_mm256_set1_epi32(table->udpv4_base), addrs),
+            _mm256_add_epi32(sport, dport));
+    AVX2_FOLD(sum);
+    AVX2_FOLD(sum);
+    sum = _mm256_xor_si256(sum, mask);
+    sum = _mm256_or_si256(sum, _mm256_and_si256(_mm256_cmpeq_epi32(sum, zero), mask));
+    _mm256_storeu_si256(
+            (__m256i *)words->udpv4_checksum,
+            _mm256_shuffle_epi8(sum, swap16));
+
+    _mm256_storeu_si256((__m256i *)words->saddr, _mm256_shuffle_epi8(saddr, swap32));
+    _mm256_storeu_si256((__m256i *)words->daddr, _mm256_shuffle_epi8(daddr, swap32));
+    _mm256_storeu_si256((__m256i *)words->sport, _mm256_shuffle_epi8(sport, swap16));
+    _mm256_storeu_si256((__m256i *)words->dport, _mm256_shuffle_epi8(dport, swap16));
+    _mm256_storeu_si256((__m256i *)words->id, _mm256_shuffle_epi8(id, swap16));
+
+#undef AVX2_FOLD
+}
+
+#endif
+
+static FlowTable_kernel_t FlowTable_selectKernel(void) {
+    FlowTable_kernel_t kernel = FlowTable_kernelScalar;
+
+#ifdef FLOW_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernel = FlowTable_kernelAvx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        kernel = FlowTable_kernelSse2;
+    }
+#endif
+
+    return kernel;
+}
+
+/* Several threads may race to set it, but all of them store the same value. */
+static FlowTable_kernel_t flow_kernel = NULL;
+
+int FlowTable_emit(
+        FlowTable_t *table,
+        unsigned int first,
+        unsigned int n,
+        uint8_t *buf,
+        unsigned int size) {
+    FlowTable_kernel_t kernel;
+    FlowWords_t words;
+    const unsigned int *offsets;
+    uint8_t *frame;
+    uint16_t word;
+    unsigned int i, j, chunk, frame_size;
+    int res = -1;
+
+    if (table == NULL || table->tmpl == NULL || (buf == NULL && size != 0)) {
+        goto end;
+    }
+
+    kernel = __atomic_load_n(&flow_kernel, __ATOMIC_RELAXED);
+    if (kernel == NULL) {
+        kernel = FlowTable_selectKernel();
+        __atomic_store_n(&flow_kernel, kernel, __ATOMIC_RELAXED);
+    }
+
+    frame_size = table->tmpl->size;
+    offsets = table->offsets;
+    if (first > table->flows_nr) {
+        first = table->flows_nr;
+    }
+
+    if (n > table->flows_nr - first) {
+        n = table->flows_nr - first;
+    }
+
+    if (n > size / frame_size) {
+        n = size / frame_size;
+    }
+
+    frame = buf;
+    for (i = 0; i < n; i += chunk) {
+        chunk = n - i < FLOW_CHUNK? n - i: FLOW_CHUNK;
+        kernel(table, first + i, chunk, &words);
+
+        for (j = 0; j < chunk; j++) {
+            memcpy(frame, table->tmpl->frame, frame_size);
+            memcpy(&frame[offsets[FLOW_FIELD_SADDR]], &words.saddr[j], 4);
+            memcpy(&frame[offsets[FLOW_FIELD_DADDR]], &words.daddr[j], 4);
+            word = words.sport[j];
+            memcpy(&frame[offsets[FLOW_FIELD_SPORT]], &word, 2);
+            word = words.dport[j];
+            memcpy(&frame[offsets[FLOW_FIELD_DPORT]], &word, 2);
+            word = words.id[j];
+            memcpy(&frame[offsets[FLOW_FIELD_ID]], &word, 2);
+            word = words.ipv4_checksum[j];
+            memcpy(&frame[offsets[FLOW_FIELD_IPV4_CHECKSUM]], &word, 2);
+            if (table->udpv4_checksum) {
+                word = words.udpv4_checksum[j];
+                memcpy(&frame[offsets[FLOW_FIELD_UDPV4_CHECKSUM]], &word, 2);
+            }
+            frame += frame_size;
+        }
+    }
+
+    for (i = first; i < first + n; i++) {
+        table->id[i]++;
+        table->packets[i]++;
+        table->bytes[i] += frame_size;
+    }
+
+    res = n;
+
+end:
+    return res;
+}
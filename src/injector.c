@@ -0,0 +1,490 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "libpacket/injector.h"
+
+/* How many times the injecting thread finds the queue empty before going to
+ * sleep.
+ */
+#define INJECTOR_IDLE_SPINS (4096)
+
+static const InjectorParams_t default_params = {
+    .capacity = INJECTOR_DEFAULT_CAPACITY,
+    .burst = INJECTOR_DEFAULT_BURST,
+    .policy = INJECTOR_POLICY_BLOCK,
+    .cpu = -1,
+    .callback = NULL,
+};
+
+static inline void Injector_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/* Takes a ticket and fills in its slot. Returns 0 if the queue is full. */
+static int Injector_tryPush(Injector_t *inj, const InjectorRequest_t *req) {
+    InjectorSlot_t *slot;
+    unsigned long pos, seq;
+    int ok = 0;
+
+    pos = __atomic_load_n(&inj->tail, __ATOMIC_RELAXED);
+    for (;;) {
+        slot = &inj->slots[pos & inj->mask];
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if ((long)(seq - pos) < 0) {
+            goto end;
+        }
+
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n(
+                        &inj->tail,
+                        &pos,
+                        pos + 1,
+                        1,
+                        __ATOMIC_RELAXED,
+                        __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else {
+            pos = __atomic_load_n(&inj->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->req = *req;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    ok = 1;
+
+end:
+    return ok;
+}
+
+/* Whether the next slot of the injecting thread has been filled in. */
+static int Injector_isReady(const Injector_t *inj) {
+    const InjectorSlot_t *slot = &inj->slots[inj->head & inj->mask];
+
+    return __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == inj->head + 1;
+}
+
+/* The fences of Injector_wakeThread() and Injector_sleep() make sure either
+ * the submitter sees the injecting thread sleeping or the thread sees the
+ * new request before sleeping. Same for Injector_wakeWaiters() and the
+ * threads waiting for space.
+ */
+static void Injector_wakeThread(Injector_t *inj) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&inj->sleeping, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&inj->lock);
+        pthread_cond_signal(&inj->ready);
+        pthread_mutex_unlock(&inj->lock);
+    }
+}
+
+static void Injector_sleep(Injector_t *inj) {
+    pthread_mutex_lock(&inj->lock);
+    __atomic_store_n(&inj->sleeping, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!Injector_isReady(inj) && __atomic_load_n(&inj->running, __ATOMIC_RELAXED)) {
+        pthread_cond_wait(&inj->ready, &inj->lock);
+    }
+
+    __atomic_store_n(&inj->sleeping, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&inj->lock);
+}
+
+static void Injector_wakeWaiters(Injector_t *inj) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&inj->waiting, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&inj->lock);
+        pthread_cond_broadcast(&inj->space);
+        pthread_mutex_unlock(&inj->lock);
+    }
+}
+
+/* Sleeps on space until done(inj, arg) holds. */
+static void Injector_wait(
+        Injector_t *inj,
+        int (*done)(Injector_t *, const void *),
+        const void *arg) {
+    pthread_mutex_lock(&inj->lock);
+    __atomic_add_fetch(&inj->waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while (!done(inj, arg)) {
+        pthread_cond_wait(&inj->space, &inj->lock);
+    }
+
+    __atomic_sub_fetch(&inj->waiting, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&inj->lock);
+}
+
+static int Injector_pushed(Injector_t *inj, const void *req) {
+    return Injector_tryPush(inj, req);
+}
+
+static int Injector_flushed(Injector_t *inj, const void *target) {
+    unsigned long done = __atomic_load_n(&inj->done, __ATOMIC_ACQUIRE);
+
+    return (long)(done - *(const unsigned long *)target) >= 0;
+}
+
+static int Injector_push(Injector_t *inj, const InjectorRequest_t *req) {
+    int res = -1;
+
+    if (!Injector_tryPush(inj, req)) {
+        switch (inj->policy) {
+        case INJECTOR_POLICY_DROP:
+            __atomic_add_fetch(&inj->stats.dropped, 1, __ATOMIC_RELAXED);
+            goto end;
+        case INJECTOR_POLICY_SPIN:
+            while (!Injector_tryPush(inj, req)) {
+                Injector_relax();
+            }
+            break;
+        default:
+            Injector_wait(inj, Injector_pushed, req);
+            break;
+        }
+    }
+
+    Injector_wakeThread(inj);
+    res = 0;
+
+end:
+    return res;
+}
+
+/* Moves up to a burst of requests out of the queue, returns how many. */
+static unsigned int Injector_take(Injector_t *inj) {
+    InjectorSlot_t *slot;
+    unsigned int n = 0;
+
+    while (n < inj->burst && Injector_isReady(inj)) {
+        slot = &inj->slots[inj->head & inj->mask];
+        inj->reqs[n++] = slot->req;
+        __atomic_store_n(&slot->seq, inj->head + inj->mask + 1, __ATOMIC_RELEASE);
+        inj->head++;
+    }
+
+    return n;
+}
+
+/* Injects the n requests starting at first, all of them packets or all of
+ * them frames. A request refused by the kernel doesn't keep the following
+ * ones from being tried.
+ */
+static void Injector_injectRun(Injector_t *inj, unsigned int first, unsigned int n) {
+    int *results = &inj->results[first];
+    unsigned int i = 0;
+    int ret;
+
+    while (i < n) {
+        if (inj->packs[first] != NULL) {
+            ret = Socket_injectBatch(
+                    inj->sock,
+                    &inj->packs[first + i],
+                    n - i,
+                    &results[i]);
+        } else {
+            ret = Socket_injectRawBatch(
+                    inj->sock,
+                    &inj->bufs[first + i],
+                    &inj->lens[first + i],
+                    n - i,
+                    &results[i]);
+        }
+
+        i += ret > 0? ret: 0;
+        if (i < n) {
+            results[i++] = -1;
+        }
+    }
+}
+
+static void Injector_handle(Injector_t *inj, unsigned int n) {
+    uint64_t packets = 0, bytes = 0;
+    unsigned int i, first = 0;
+
+    for (i = 0; i < n; i++) {
+        inj->packs[i] = inj->reqs[i].pack;
+        inj->bufs[i] = inj->reqs[i].frame;
+        inj->lens[i] = inj->reqs[i].length;
+    }
+
+    for (i = 1; i <= n; i++) {
+        if (i == n || (inj->packs[i] == NULL) != (inj->packs[first] == NULL)) {
+            Injector_injectRun(inj, first, i - first);
+            first = i;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        if (inj->results[i] >= 0) {
+            packets++;
+            bytes += inj->results[i];
+        }
+    }
+
+    // Only this thread writes them, but others may read them at any time.
+    __atomic_store_n(
+            &inj->stats.packets,
+            inj->stats.packets + packets,
+            __ATOMIC_RELAXED);
+    __atomic_store_n(&inj->stats.bytes, inj->stats.bytes + bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(
+            &inj->stats.errors,
+            inj->stats.errors + n - packets,
+            __ATOMIC_RELAXED);
+
+    if (inj->callback != NULL) {
+        for (i = 0; i < n; i++) {
+            inj->callback(&inj->reqs[i], inj->results[i]);
+        }
+    }
+}
+
+static void * Injector_run(void *arg) {
+    Injector_t *inj = arg;
+    unsigned int n, idle = 0;
+    int running;
+
+    for (;;) {
+        // Read before taking, so nothing submitted before stopping is left
+        // behind.
+        running = __atomic_load_n(&inj->running, __ATOMIC_ACQUIRE);
+        n = Injector_take(inj);
+        if (n == 0) {
+            if (!running) {
+                break;
+            }
+
+            if (++idle < INJECTOR_IDLE_SPINS) {
+                Injector_relax();
+            } else {
+                Injector_sleep(inj);
+                idle = 0;
+            }
+            continue;
+        }
+
+        idle = 0;
+        Injector_wakeWaiters(inj);
+        Injector_handle(inj, n);
+        __atomic_store_n(&inj->done, inj->done + n, __ATOMIC_RELEASE);
+        Injector_wakeWaiters(inj);
+    }
+
+    return NULL;
+}
+
+/* Frees the memory of an Injector whose thread isn't running. */
+static void Injector_free(Injector_t *inj) {
+    free(inj->slots);
+    free(inj->reqs);
+    free(inj->packs);
+    free(inj->bufs);
+    free(inj->lens);
+    free(inj->results);
+    pthread_mutex_destroy(&inj->lock);
+    pthread_cond_destroy(&inj->ready);
+    pthread_cond_destroy(&inj->space);
+    free(inj);
+}
+
+Injector_t * Injector_createWithParams(
+        Socket_t *sock,
+        const InjectorParams_t *params) {
+    Injector_t *inj = NULL;
+    pthread_attr_t attr;
+    cpu_set_t cpus;
+    unsigned long capacity, i;
+    int ok = 0;
+
+    if (sock == NULL) {
+        goto end;
+    }
+
+    if (params == NULL) {
+        params = &default_params;
+    }
+
+    if (posix_memalign((void **)&inj, 64, sizeof(Injector_t))) {
+        perror("posix_memalign()");
+        inj = NULL;
+        goto end;
+    }
+
+    memset(inj, 0, sizeof(Injector_t));
+    pthread_mutex_init(&inj->lock, NULL);
+    pthread_cond_init(&inj->ready, NULL);
+    pthread_cond_init(&inj->space, NULL);
+
+    capacity = 2;
+    while (capacity < params->capacity) {
+        capacity <<= 1;
+    }
+
+    inj->sock = sock;
+    inj->mask = capacity - 1;
+    inj->burst = params->burst != 0? params->burst: INJECTOR_DEFAULT_BURST;
+    inj->policy = params->policy;
+    inj->callback = params->callback;
+
+    inj->slots = malloc(sizeof(InjectorSlot_t) * capacity);
+    inj->reqs = malloc(sizeof(InjectorRequest_t) * inj->burst);
+    inj->packs = malloc(sizeof(Packet_t *) * inj->burst);
+    inj->bufs = malloc(sizeof(uint8_t *) * inj->burst);
+    inj->lens = malloc(sizeof(unsigned int) * inj->burst);
+    inj->results = malloc(sizeof(int) * inj->burst);
+    if (inj->slots == NULL
+            || inj->reqs == NULL
+            || inj->packs == NULL
+            || inj->bufs == NULL
+            || inj->lens == NULL
+            || inj->results == NULL) {
+        perror("malloc()");
+        goto end;
+    }
+
+    for (i = 0; i < capacity; i++) {
+        inj->slots[i].seq = i;
+    }
+
+    pthread_attr_init(&attr);
+    if (params->cpu >= 0) {
+        CPU_ZERO(&cpus);
+        CPU_SET(params->cpu, &cpus);
+        if (pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus)) {
+            printf("%s: can't pin the thread to cpu %d\n", __FUNCTION__, params->cpu);
+            pthread_attr_destroy(&attr);
+            goto end;
+        }
+    }
+
+    inj->running = 1;
+    if (pthread_create(&inj->thread, &attr, Injector_run, inj)) {
+        printf("%s: can't create the injecting thread\n", __FUNCTION__);
+        pthread_attr_destroy(&attr);
+        goto end;
+    }
+
+    pthread_attr_destroy(&attr);
+    ok = 1;
+
+end:
+    if (!ok && inj != NULL) {
+        Injector_free(inj);
+        inj = NULL;
+    }
+
+    return inj;
+}
+
+Injector_t * Injector_create(Socket_t *sock) {
+    return Injector_createWithParams(sock, NULL);
+}
+
+void Injector_delete(Injector_t *inj) {
+    if (inj != NULL) {
+        pthread_mutex_lock(&inj->lock);
+        __atomic_store_n(&inj->running, 0, __ATOMIC_RELEASE);
+        pthread_cond_signal(&inj->ready);
+        pthread_mutex_unlock(&inj->lock);
+
+        pthread_join(inj->thread, NULL);
+        Injector_free(inj);
+    }
+}
+
+int Injector_submit(Injector_t *inj, const Packet_t *pack, void *arg) {
+    InjectorRequest_t req;
+    int res = -1;
+
+    if (inj == NULL || pack == NULL) {
+        goto end;
+    }
+
+    req.pack = pack;
+    req.frame = NULL;
+    req.length = 0;
+    req.arg = arg;
+    res = Injector_push(inj, &req);
+
+end:
+    return res;
+}
+
+int Injector_submitFrame(
+        Injector_t *inj,
+        const uint8_t *frame,
+        unsigned int length,
+        void *arg) {
+    InjectorRequest_t req;
+    int res = -1;
+
+    if (inj == NULL || frame == NULL || length == 0) {
+        goto end;
+    }
+
+    req.pack = NULL;
+    req.frame = frame;
+    req.length = length;
+    req.arg = arg;
+    res = Injector_push(inj, &req);
+
+end:
+    return res;
+}
+
+int Injector_flush(Injector_t *inj) {
+    unsigned long target;
+    int res = -1;
+
+    if (inj == NULL) {
+        goto end;
+    }
+
+    target = __atomic_load_n(&inj->tail, __ATOMIC_ACQUIRE);
+    Injector_wait(inj, Injector_flushed, &target);
+    res = 0;
+
+end:
+    return res;
+}
+
+int Injector_getStats(const Injector_t *inj, InjectorStats_t *stats) {
+    int res = -1;
+
+    if (inj == NULL || stats == NULL) {
+        goto end;
+    }
+
+    stats->packets = __atomic_load_n(&inj->stats.packets, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&inj->stats.bytes, __ATOMIC_RELAXED);
+    stats->errors = __atomic_load_n(&inj->stats.errors, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&inj->stats.dropped, __ATOMIC_RELAXED);
+    res = 0;
+
+end:
+    return res;
+}
@@ -20,24 +20,42 @@
 #include <arpa/inet.h>
 
 #include "libpacket/ipv4.h"
+#include "libpacket/pool.h"
+#include "libpacket/checksum.h"
 
-Ipv4Proto_t * Ipv4Proto_create() {
-    Ipv4Proto_t *proto;
-    int ok;
+static const ProtocolField_t ipv4_fields[] = {
+    {IPV4_FIELD_TOS, 1, 1, PROTOCOL_FIELD_BIG_ENDIAN, 0},
+    {IPV4_FIELD_LENGTH, 2, 2, PROTOCOL_FIELD_BIG_ENDIAN, 0},
+    {IPV4_FIELD_ID, 4, 2, PROTOCOL_FIELD_BIG_ENDIAN, 0},
+    {IPV4_FIELD_TTL, 8, 1, PROTOCOL_FIELD_BIG_ENDIAN, 0},
+    {IPV4_FIELD_PROTOCOL, 9, 1, PROTOCOL_FIELD_BIG_ENDIAN,
+        PROTOCOL_FIELD_PSEUDO_HEADER},
+    {IPV4_FIELD_CHECKSUM, 10, 2, PROTOCOL_FIELD_BIG_ENDIAN,
+        PROTOCOL_FIELD_CHECKSUM},
+    {IPV4_FIELD_SADDR, 12, 4, PROTOCOL_FIELD_BIG_ENDIAN,
+        PROTOCOL_FIELD_PSEUDO_HEADER},
+    {IPV4_FIELD_DADDR, 16, 4, PROTOCOL_FIELD_BIG_ENDIAN,
+        PROTOCOL_FIELD_PSEUDO_HEADER},
+};
 
-    proto = malloc(sizeof(Ipv4Proto_t));
-    if (proto == NULL) {
-        goto end;
-    }
+static Pool_t ipv4_pool = POOL_INITIALIZER("Ipv4Proto", sizeof(Ipv4Proto_t));
 
-    proto->proto_base = Protocol_create();
-    if (proto->proto_base == NULL) {
-        free(proto);
-        proto = NULL;
-        goto end;
-    }
+static const ProtocolOps_t ipv4_ops = {
+    .getSize = (Protocol_getSizeFunc_t)Ipv4Proto_getSize,
+    .getBitstream = (Protocol_getBitstreamFunc_t)Ipv4Proto_getBitstream,
+    .finalize = NULL,
+    .getData = NULL,
+    .clone = (Protocol_cloneFunc_t)Ipv4Proto_clone,
+    .release = (Protocol_releaseFunc_t)Ipv4Proto_delete,
+    .fields = ipv4_fields,
+    .fields_nr = sizeof(ipv4_fields) / sizeof(ipv4_fields[0]),
+    .type = PROTOCOL_TYPE_IPV4,
+};
+
+static void Ipv4Proto_init(Ipv4Proto_t *proto) {
+    Protocol_init(&proto->base, &ipv4_ops, proto);
 
-    //TODO: Use macros for these constants. Don't access Protocol_t members, use setters/getters.
+    //TODO: Use macros for these constants.
     proto->version = 4;
     proto->hdr_length = 5;
     proto->tos = 0;
@@ -46,35 +64,55 @@ Ipv4Proto_t * Ipv4Proto_create() {
     proto->flags = 0;
     proto->frag_off = 0;
     proto->ttl = 64;
-    proto->checksum = 0x1234;
+    proto->checksum = 0;
     proto->saddr = 0x11223344;
     proto->daddr = 0x55667788;
     proto->opts_padding = NULL;
+}
 
-    proto->proto_base->getSize =
-        (Protocol_getSizeFunc_t)Ipv4Proto_getSize;
-    proto->proto_base->getBitstream =
-        (Protocol_getBitstreamFunc_t)Ipv4Proto_getBitstream;
-    //TODO: Create Protocol_create(void *owner)
-    //TODO: Follow same approach as ether.
-    ok = Protocol_setOwner(proto->proto_base, proto);
-    if (!ok) {
-        Protocol_delete(proto->proto_base);
-        proto->proto_base = NULL;
-        free(proto);
-        proto = NULL;
+Ipv4Proto_t * Ipv4Proto_create() {
+    Ipv4Proto_t *proto;
+
+    proto = Pool_alloc(&ipv4_pool);
+    if (proto != NULL) {
+        Ipv4Proto_init(proto);
     }
 
-end:
     return proto;
 }
 
-void Ipv4Proto_delete(Ipv4Proto_t *proto) {
+Ipv4Proto_t * Ipv4Proto_createInArena(Arena_t *arena) {
+    Ipv4Proto_t *proto;
+
+    proto = Arena_alloc(arena, sizeof(Ipv4Proto_t));
     if (proto != NULL) {
-        free(proto->proto_base);
+        Ipv4Proto_init(proto);
     }
 
-    free(proto);
+    return proto;
+}
+
+Ipv4Proto_t * Ipv4Proto_clone(const Ipv4Proto_t *proto) {
+    Ipv4Proto_t *copy = NULL;
+
+    if (proto == NULL) {
+        goto end;
+    }
+
+    copy = Pool_alloc(&ipv4_pool);
+    if (copy != NULL) {
+        *copy = *proto;
+        Protocol_init(&copy->base, proto->base.ops, copy);
+    }
+
+end:
+    return copy;
+}
+
+void Ipv4Proto_delete(Ipv4Proto_t *proto) {
+    if (proto != NULL && Protocol_unref(&proto->base)) {
+        Pool_free(&ipv4_pool, proto);
+    }
 }
 
 unsigned int Ipv4Proto_getSize(const Ipv4Proto_t *proto) {
@@ -102,18 +140,49 @@ int Ipv4Proto_getBitstream(
     buf[1] = proto->tos;
     memcpy(&buf[2], &length, 2);
     memcpy(&buf[4], &id, 2);
-    buf[6] = proto->flags << 5 | proto->frag_off >> 11;
-    buf[7] = proto->frag_off & 0x1f;
+    buf[6] = proto->flags << 5 | proto->frag_off >> 8;
+    buf[7] = proto->frag_off & 0xff;
     buf[8] = proto->ttl;
     buf[9] = proto->proto;
     memcpy(&buf[10], &checksum, sizeof(checksum));
     memcpy(&buf[12], &saddr, sizeof(saddr));
     memcpy(&buf[16], &daddr, sizeof(daddr));
+
+    // The header checksum only covers the header, so it can be computed
+    // right away.
+    if (proto->checksum == 0) {
+        checksum = htons(Checksum_compute(buf, 20));
+        memcpy(&buf[10], &checksum, sizeof(checksum));
+    }
+
     return 20;
 }
 
+int Ipv4Proto_updateChecksum(
+        uint8_t *hdr,
+        unsigned int offset,
+        const uint8_t *old,
+        const uint8_t *new,
+        unsigned int len) {
+    uint16_t checksum;
+    int res = -1;
+
+    if (hdr == NULL || old == NULL || new == NULL) {
+        goto end;
+    }
+
+    checksum = hdr[10] << 8 | hdr[11];
+    checksum = Checksum_update(checksum, old, new, len, offset % 2);
+    hdr[10] = checksum >> 8;
+    hdr[11] = checksum & 0xff;
+    res = 0;
+
+end:
+    return res;
+}
+
 Protocol_t * Ipv4Proto_getProtoBase(const Ipv4Proto_t *proto) {
-    return proto->proto_base;
+    return proto != NULL? (Protocol_t *)&proto->base: NULL;
 }
 
 int Ipv4Proto_setLength(Ipv4Proto_t *proto, uint16_t length) {
@@ -121,6 +190,7 @@ int Ipv4Proto_setLength(Ipv4Proto_t *proto, uint16_t length) {
 
     if (proto != NULL) {
         proto->length = length;
+        Protocol_changed(&proto->base);
         res = 0;
     }
 
@@ -136,6 +206,7 @@ int Ipv4Proto_setProtocol(Ipv4Proto_t *proto, uint8_t proto_num) {
 
     if (proto != NULL) {
         proto->proto = proto_num;
+        Protocol_changed(&proto->base);
         res = 0;
     }
 
@@ -146,3 +217,50 @@ uint8_t Ipv4Proto_getProtocol(const Ipv4Proto_t *proto) {
     return proto != NULL? proto->proto: 0;
 }
 
+int Ipv4Proto_setId(Ipv4Proto_t *proto, uint16_t id) {
+    int res = -1;
+
+    if (proto != NULL) {
+        proto->id = id;
+        Protocol_changed(&proto->base);
+        res = 0;
+    }
+
+    return res;
+}
+
+int Ipv4Proto_setTtl(Ipv4Proto_t *proto, uint8_t ttl) {
+    int res = -1;
+
+    if (proto != NULL) {
+        proto->ttl = ttl;
+        Protocol_changed(&proto->base);
+        res = 0;
+    }
+
+    return res;
+}
+
+int Ipv4Proto_setSaddr(Ipv4Proto_t *proto, uint32_t addr) {
+    int res = -1;
+
+    if (proto != NULL) {
+        proto->saddr = addr;
+        Protocol_changed(&proto->base);
+        res = 0;
+    }
+
+    return res;
+}
+
+int Ipv4Proto_setDaddr(Ipv4Proto_t *proto, uint32_t addr) {
+    int res = -1;
+
+    if (proto != NULL) {
+        proto->daddr = addr;
+        Protocol_changed(&proto->base);
+        res = 0;
+    }
+
+    return res;
+}
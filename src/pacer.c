@@ -0,0 +1,386 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "libpacket/pacer.h"
+
+static const PacerParams_t default_params = {
+    .rate = 0,
+    .unit = PACER_UNIT_PPS,
+    .burst = PACER_DEFAULT_BURST,
+    .spin_ns = PACER_DEFAULT_SPIN_NS,
+    .ramp_ns = 0,
+    .ramp_rate = 0,
+};
+
+static inline void Pacer_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static uint64_t Pacer_clock(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Returns the time since the first packet, which is now if this is it. */
+static uint64_t Pacer_now(Pacer_t *pacer) {
+    if (!pacer->started) {
+        pacer->start = Pacer_clock();
+        pacer->started = 1;
+    }
+
+    return Pacer_clock() - pacer->start;
+}
+
+static double Pacer_getRate(const Pacer_t *pacer, double now) {
+    const PacerParams_t *params = &pacer->params;
+
+    if (params->ramp_ns == 0) {
+        return params->rate;
+    }
+
+    if (now >= params->ramp_ns) {
+        return params->ramp_rate;
+    }
+
+    return params->rate + (params->ramp_rate - params->rate) * now / params->ramp_ns;
+}
+
+/* Nanoseconds worth of units (packets or bits) at the rate of time now. */
+static double Pacer_getInterval(const Pacer_t *pacer, double units, double now) {
+    return units * 1e9 / Pacer_getRate(pacer, now);
+}
+
+/* What a frame of length bytes costs, in the unit of the rate. */
+static double Pacer_getCost(const Pacer_t *pacer, unsigned int length) {
+    return pacer->params.unit == PACER_UNIT_PPS? 1.0: length * 8.0;
+}
+
+/* How early a frame may go: the time the rest of the burst takes. */
+static double Pacer_getTolerance(
+        const Pacer_t *pacer,
+        unsigned int length,
+        double now) {
+    unsigned int burst = pacer->params.burst;
+
+    if (pacer->params.unit == PACER_UNIT_PPS) {
+        return Pacer_getInterval(pacer, burst - 1, now);
+    }
+
+    return burst > length? Pacer_getInterval(pacer, (burst - length) * 8.0, now): 0;
+}
+
+/* Returns the time a frame is scheduled for. Whatever wasn't used of the
+ * bucket beyond the burst is forgotten.
+ */
+static double Pacer_schedule(Pacer_t *pacer, unsigned int length, uint64_t now) {
+    double floor = (double)now - Pacer_getTolerance(pacer, length, now);
+
+    if (pacer->tat < floor) {
+        pacer->tat = floor;
+    }
+
+    return pacer->tat;
+}
+
+/* Sleeps until spin_ns before due and spins for the rest, now being the
+ * current time. Returns the time it woke up at.
+ */
+static uint64_t Pacer_sleep(Pacer_t *pacer, double due, uint64_t now) {
+    struct timespec ts;
+    uint64_t wake;
+
+    while (due - now > pacer->params.spin_ns) {
+        wake = pacer->start + (uint64_t)due - pacer->params.spin_ns;
+        ts.tv_sec = wake / 1000000000ull;
+        ts.tv_nsec = wake % 1000000000ull;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        now = Pacer_now(pacer);
+    }
+
+    while (now < due) {
+        Pacer_relax();
+        now = Pacer_now(pacer);
+    }
+
+    return now;
+}
+
+/* Releases a frame at time now if its time has come, the caller having asked
+ * for it at time asked. Returns 0 if it has to wait. The jitter is only
+ * measured if measured is set: a frame given a launch time goes when the
+ * qdisc sends it, not at time now.
+ */
+static int Pacer_admit(
+        Pacer_t *pacer,
+        unsigned int length,
+        uint64_t now,
+        uint64_t asked,
+        int measured) {
+    double due, jitter;
+
+    due = Pacer_schedule(pacer, length, asked);
+    if (due > now) {
+        return 0;
+    }
+
+    if (measured) {
+        jitter = (double)now - (due > asked? due: asked);
+        pacer->jitter_sum += jitter;
+        pacer->jitter_packets++;
+        if (jitter > pacer->jitter_max) {
+            pacer->jitter_max = jitter;
+        }
+    }
+
+    if (pacer->packets == 0) {
+        pacer->first = now;
+        pacer->first_length = length;
+    }
+
+    pacer->last = now;
+    pacer->packets++;
+    pacer->bytes += length;
+    pacer->tat += Pacer_getInterval(pacer, Pacer_getCost(pacer, length), due);
+    return 1;
+}
+
+Pacer_t * Pacer_createWithParams(const PacerParams_t *params) {
+    Pacer_t *pacer = NULL;
+
+    if (params == NULL
+            || params->rate <= 0
+            || (params->ramp_ns != 0 && params->ramp_rate <= 0)) {
+        printf("%s: invalid rate\n", __FUNCTION__);
+        goto end;
+    }
+
+    pacer = calloc(1, sizeof(Pacer_t));
+    if (pacer == NULL) {
+        perror("calloc()");
+        goto end;
+    }
+
+    pacer->params = *params;
+    if (pacer->params.burst == 0 && pacer->params.unit == PACER_UNIT_PPS) {
+        pacer->params.burst = PACER_DEFAULT_BURST;
+    }
+
+    if (pacer->params.spin_ns == 0) {
+        pacer->params.spin_ns = PACER_DEFAULT_SPIN_NS;
+    }
+
+end:
+    return pacer;
+}
+
+Pacer_t * Pacer_create(double pps) {
+    PacerParams_t params = default_params;
+
+    params.rate = pps;
+    return Pacer_createWithParams(&params);
+}
+
+void Pacer_delete(Pacer_t *pacer) {
+    free(pacer);
+}
+
+int Pacer_setRate(Pacer_t *pacer, double rate) {
+    int res = -1;
+
+    if (pacer == NULL || rate <= 0) {
+        goto end;
+    }
+
+    pacer->params.rate = rate;
+    pacer->params.ramp_ns = 0;
+    res = 0;
+
+end:
+    return res;
+}
+
+int Pacer_wait(Pacer_t *pacer, unsigned int length) {
+    uint64_t asked, now;
+    int res = -1;
+
+    if (pacer == NULL) {
+        goto end;
+    }
+
+    asked = Pacer_now(pacer);
+    now = Pacer_sleep(pacer, Pacer_schedule(pacer, length, asked), asked);
+    Pacer_admit(pacer, length, now, asked, 1);
+    res = 0;
+
+end:
+    return res;
+}
+
+int Pacer_inject(Pacer_t *pacer, Socket_t *sock, const Packet_t *pack) {
+    unsigned int length;
+    uint64_t asked, now;
+    int ret = -1;
+
+    if (pacer == NULL || sock == NULL || pack == NULL) {
+        goto end;
+    }
+
+    length = Packet_getSize(pack);
+    asked = Pacer_now(pacer);
+    now = Pacer_sleep(pacer, Pacer_schedule(pacer, length, asked), asked);
+
+    // A packet that isn't injected keeps its time for the next try.
+    ret = Socket_inject(sock, pack);
+    if (ret >= 0) {
+        Pacer_admit(pacer, length, now, asked, 1);
+    }
+
+end:
+    return ret;
+}
+
+int Pacer_injectAt(
+        Pacer_t *pacer,
+        Socket_t *sock,
+        const Packet_t *pack,
+        uint64_t lead_ns) {
+    unsigned int length;
+    uint64_t asked, now, launch, offset = 0;
+    double due;
+    int ret = -1;
+
+    if (pacer == NULL || sock == NULL || pack == NULL) {
+        goto end;
+    }
+
+    length = Packet_getSize(pack);
+    asked = Pacer_now(pacer);
+    due = Pacer_schedule(pacer, length, asked);
+    now = Pacer_sleep(pacer, due - lead_ns, asked);
+    launch = now;
+    if (launch < due) {
+        // Rounded up, the packet mustn't leave before its time.
+        launch = (uint64_t)due + 1;
+    }
+
+    // Launch times are read from the clock of the socket.
+    if (sock->txtime_clock != CLOCK_MONOTONIC) {
+        offset = Socket_getTime(sock) - Pacer_clock();
+    }
+
+    ret = Socket_injectAt(sock, pack, offset + pacer->start + launch);
+    if (ret >= 0) {
+        Pacer_admit(pacer, length, launch, asked, 0);
+    }
+
+end:
+    return ret;
+}
+
+int Pacer_injectBatch(
+        Pacer_t *pacer,
+        Socket_t *sock,
+        const Packet_t * const *packs,
+        unsigned int n,
+        int *results) {
+    unsigned int i, k, sent, done = 0;
+    uint64_t asked, now;
+    Pacer_t trial;
+    int ret = -1;
+
+    if (pacer == NULL || sock == NULL || packs == NULL) {
+        goto end;
+    }
+
+    while (done < n) {
+        asked = Pacer_now(pacer);
+        now = Pacer_sleep(
+                pacer,
+                Pacer_schedule(pacer, Packet_getSize(packs[done]), asked),
+                asked);
+
+        // Find out on a copy how many packets are due, and account only for
+        // the ones the socket takes.
+        trial = *pacer;
+        k = 0;
+        while (done + k < n
+                && Pacer_admit(&trial, Packet_getSize(packs[done + k]), now, asked, 1)) {
+            k++;
+        }
+
+        ret = Socket_injectBatch(
+                sock,
+                &packs[done],
+                k,
+                results != NULL? &results[done]: NULL);
+        if (ret < 0) {
+            break;
+        }
+
+        sent = ret;
+        for (i = 0; i < sent; i++) {
+            Pacer_admit(pacer, Packet_getSize(packs[done + i]), now, asked, 1);
+        }
+
+        done += sent;
+        if (sent < k) {
+            break;
+        }
+    }
+
+    for (i = done; results != NULL && i < n; i++) {
+        results[i] = -1;
+    }
+
+    ret = done;
+
+end:
+    return ret;
+}
+
+int Pacer_getStats(const Pacer_t *pacer, PacerStats_t *stats) {
+    int res = -1;
+
+    if (pacer == NULL || stats == NULL) {
+        goto end;
+    }
+
+    stats->packets = pacer->packets;
+    stats->bytes = pacer->bytes;
+    stats->elapsed_ns = pacer->last - pacer->first;
+    stats->pps = 0;
+    stats->bps = 0;
+    if (stats->elapsed_ns != 0) {
+        stats->pps = (pacer->packets - 1) * 1e9 / stats->elapsed_ns;
+        stats->bps = (pacer->bytes - pacer->first_length) * 8e9 / stats->elapsed_ns;
+    }
+
+    stats->jitter_avg_ns = pacer->jitter_packets != 0?
+        pacer->jitter_sum / pacer->jitter_packets: 0;
+    stats->jitter_max_ns = pacer->jitter_max;
+    res = 0;
+
+end:
+    return res;
+}
@@ -18,16 +18,64 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <assert.h>
 
 #include "libpacket/packet.h"
+#include "libpacket/checksum.h"
+#include "libpacket/pool.h"
+#include "libpacket/serializer.h"
 
 /*------------------------------ Protocol ------------------------------*/
 
-Protocol_t * Protocol_createWithParams(
-        Protocol_getSizeFunc_t getSize,
-        Protocol_getBitstreamFunc_t getBitstream,
-        StackItem_t *item,
-        void *owner) {
+/* The ops of a Protocol without an extending class, it has no bytes. */
+static unsigned int Protocol_getEmptySize(Protocol_t *proto) {
+    (void)proto;
+    return 0;
+}
+
+static int Protocol_getEmptyBitstream(
+        Protocol_t *proto,
+        uint8_t *buf,
+        unsigned int size) {
+    (void)proto;
+    (void)buf;
+    (void)size;
+    return 0;
+}
+
+static Protocol_t * Protocol_cloneEmpty(Protocol_t *proto) {
+    (void)proto;
+    return Protocol_create();
+}
+
+static const ProtocolOps_t protocol_empty_ops = {
+    .getSize = Protocol_getEmptySize,
+    .getBitstream = Protocol_getEmptyBitstream,
+    .finalize = NULL,
+    .getData = NULL,
+    .clone = Protocol_cloneEmpty,
+    .release = Protocol_delete,
+    .fields = NULL,
+    .fields_nr = 0,
+    .type = PROTOCOL_TYPE_OTHER,
+};
+
+void Protocol_init(Protocol_t *proto, const ProtocolOps_t *ops, void *owner) {
+    if (proto == NULL) {
+        return;
+    }
+
+    proto->item.owner = proto;
+    proto->item.flags = 0;
+    proto->ops = ops != NULL? ops: &protocol_empty_ops;
+    proto->owner = owner;
+    proto->packet = NULL;
+    proto->dirty = 0;
+    proto->refs = 1;
+}
+
+Protocol_t * Protocol_createWithParams(const ProtocolOps_t *ops, void *owner) {
     Protocol_t *proto;
 
     proto = malloc(sizeof(Protocol_t));
@@ -35,49 +83,43 @@ Protocol_t * Protocol_createWithParams(
         goto end;
     }
 
-    StackItem_setOwner(item, proto);
-    proto->item = item;
-    proto->getSize = NULL;
-    proto->getBitstream = NULL;
-    proto->owner = NULL;
+    Protocol_init(proto, ops, owner);
 
 end:
     return proto;
-
 }
 
 Protocol_t * Protocol_create() {
-    Protocol_createWithParams(
-            NULL,
-            NULL,
-            StackItem_create(),
-            NULL);
+    return Protocol_createWithParams(NULL, NULL);
 }
 
-void Protocol_delete(Protocol_t *proto) {
-    if (proto != NULL) {
-        StackItem_delete(proto->item);
-    }
+Protocol_t * Protocol_createInArena(Arena_t *arena) {
+    Protocol_t *proto;
 
-    free(proto);
+    proto = Arena_alloc(arena, sizeof(Protocol_t));
+    Protocol_init(proto, NULL, NULL);
+    return proto;
 }
 
-int Protocol_setItem(Protocol_t *proto, StackItem_t *item) {
-    int ok = 0;
-
-    if (proto == NULL) {
-        goto end;
+void Protocol_delete(Protocol_t *proto) {
+    if (Protocol_unref(proto)) {
+        free(proto);
     }
+}
 
-    proto->item = item;
-    ok = 1;
+void Protocol_ref(Protocol_t *proto) {
+    if (proto != NULL) {
+        __atomic_add_fetch(&proto->refs, 1, __ATOMIC_RELAXED);
+    }
+}
 
-end:
-    return ok;
+int Protocol_unref(Protocol_t *proto) {
+    return proto != NULL
+        && __atomic_sub_fetch(&proto->refs, 1, __ATOMIC_ACQ_REL) == 0;
 }
 
-StackItem_t * Protocol_getItem(const Protocol_t *proto) {
-    return proto != NULL? proto->item: NULL;
+StackItem_t * Protocol_getItem(Protocol_t *proto) {
+    return proto != NULL? &proto->item: NULL;
 }
 
 int Protocol_setOwner(Protocol_t *proto, void *owner) {
@@ -98,36 +140,73 @@ void * Protocol_getOwner(const Protocol_t *proto) {
     return proto != NULL? proto->owner: NULL;
 }
 
-int Protocol_setGetSize(Protocol_t *proto, Protocol_getSizeFunc_t func) {
+int Protocol_setOps(Protocol_t *proto, const ProtocolOps_t *ops) {
     int res = -1;
 
-    if (proto != NULL && func != NULL) {
-        proto->getSize = func;
+    if (proto != NULL) {
+        proto->ops = ops != NULL? ops: &protocol_empty_ops;
+        Protocol_changed(proto);
         res = 0;
     }
 
     return res;
 }
 
-Protocol_getSizeFunc_t Protocol_getGetSize(const Protocol_t *proto) {
-    return proto != NULL? proto->getSize: NULL;
+const ProtocolOps_t * Protocol_getOps(const Protocol_t *proto) {
+    return proto != NULL? proto->ops: NULL;
 }
 
-int Protocol_setGetBitstream(
-        Protocol_t *proto,
-        Protocol_getBitstreamFunc_t func) {
-    int res = -1;
+/* Returns the memory referenced by a Protocol or NULL if it has to be
+ * serialized.
+ */
+static const uint8_t * Protocol_data(const Protocol_t *proto) {
+    return proto != NULL && proto->ops->getData != NULL?
+        proto->ops->getData(Protocol_getOwner(proto)): NULL;
+}
 
-    if (proto != NULL && func != NULL) {
-        proto->getBitstream = func;
-        res = 0;
+/* Tells if the finalize() method of a Protocol needs the sum of its payload,
+ * that is, if it has a checksum covering its payload.
+ */
+static int Protocol_needsPayloadSum(const Protocol_t *proto) {
+    unsigned int i;
+
+    for (i = 0; proto != NULL && i < proto->ops->fields_nr; i++) {
+        if (proto->ops->fields[i].flags & PROTOCOL_FIELD_CHECKSUM_PAYLOAD) {
+            return 1;
+        }
     }
 
-    return res;
+    return 0;
 }
 
-Protocol_getBitstreamFunc_t Protocol_getGetBitstream(const Protocol_t *proto) {
-    return proto != NULL? proto->getBitstream: NULL;
+const ProtocolField_t * Protocol_getFields(
+        const Protocol_t *proto,
+        unsigned int *fields_nr) {
+    const ProtocolField_t *fields = NULL;
+
+    if (fields_nr != NULL) {
+        *fields_nr = 0;
+    }
+
+    if (proto != NULL) {
+        fields = proto->ops->fields;
+        if (fields_nr != NULL) {
+            *fields_nr = proto->ops->fields_nr;
+        }
+    }
+
+    return fields;
+}
+
+void Protocol_changed(Protocol_t *proto) {
+    if (proto != NULL) {
+        proto->dirty = 1;
+    }
+
+    if (proto != NULL && proto->packet != NULL) {
+        proto->packet->layout_valid = 0;
+        proto->packet->dirty = 1;
+    }
 }
 
 /*------------------------------ Packet ------------------------------*/
@@ -135,21 +214,44 @@ Protocol_getBitstreamFunc_t Protocol_getGetBitstream(const Protocol_t *proto) {
 
 //TODO: Right now Packet is accessing to the members of Stack, that needs to change.
 
+static Pool_t packet_pool = POOL_INITIALIZER("Packet", sizeof(Packet_t));
+
+static void Packet_init(Packet_t *pack, Stack_t *stack, Arena_t *arena) {
+    pack->stack = stack;
+    pack->size = 0;
+    pack->offsets = pack->inline_offsets;
+    pack->offsets_nr = STACK_INLINE_ITEMS;
+    pack->layout_valid = 0;
+    pack->arena = arena;
+    pack->image_mem = NULL;
+    pack->image_mem_size = 0;
+    pack->sums = NULL;
+    pack->image_offsets = NULL;
+    pack->image = NULL;
+    pack->image_size = 0;
+    pack->image_valid = 0;
+    pack->image_flags = 0;
+    pack->dirty = 0;
+    pack->serializer = NULL;
+    pack->owns_layers = 0;
+    pack->frozen = 0;
+}
+
 Packet_t * Packet_createWithParams(Stack_t *stack) {
     Packet_t *pack;
 
-    pack = malloc(sizeof(Packet_t));
+    pack = Pool_alloc(&packet_pool);
     if (pack == NULL) {
         goto end;
     }
 
     if (Stack_setOwner(stack, pack) != 0) {
-        free(pack);
+        Pool_free(&packet_pool, pack);
         pack = NULL;
         goto end;
     }
 
-    pack->stack = stack;
+    Packet_init(pack, stack, NULL);
 
 end:
     return pack;
@@ -159,47 +261,256 @@ Packet_t * Packet_create() {
     return Packet_createWithParams(Stack_create());
 }
 
+Packet_t * Packet_createInArena(Arena_t *arena) {
+    Packet_t *pack;
+    Stack_t *stack;
+
+    pack = Arena_alloc(arena, sizeof(Packet_t));
+    stack = Stack_createInArena(arena);
+    if (pack == NULL || stack == NULL) {
+        return NULL;
+    }
+
+    Stack_setOwner(stack, pack);
+    Packet_init(pack, stack, arena);
+    return pack;
+}
+
+/* Whether the Packet holds a reference to one of its layers: clones hold one
+ * to all of them, any Packet to the copies made by Packet_getLayerForWrite().
+ */
+static int Packet_holdsLayer(const Packet_t *pack, const Protocol_t *proto) {
+    return pack->owns_layers || (proto->item.flags & STACK_ITEM_OWNED);
+}
+
 void Packet_delete(Packet_t *pack) {
+    Protocol_t *proto;
+    unsigned int i;
+
+    // Even in an Arena the copies of shared layers come from their pools.
+    if (pack != NULL) {
+        for (i = 0; i < Stack_numItems(pack->stack); i++) {
+            proto = StackItem_getOwner(pack->stack->array[i]);
+            if (proto->packet == pack) {
+                proto->packet = NULL;
+            }
+
+            if (Packet_holdsLayer(pack, proto)) {
+                proto->ops->release(Protocol_getOwner(proto));
+            }
+        }
+    }
+
+    if (pack != NULL && pack->arena != NULL) {
+        return;
+    }
+
     if (pack != NULL) {
         Stack_delete(pack->stack);
+        if (pack->offsets != pack->inline_offsets) {
+            free(pack->offsets);
+        }
+        free(pack->image_mem);
+    }
+
+    Pool_free(&packet_pool, pack);
+}
+
+/* Makes room for the offsets of items layers. */
+static int Packet_reserveOffsets(Packet_t *pack, unsigned int items) {
+    unsigned int *offsets;
+    unsigned int nr;
+    int ok = 0;
+
+    while (items > pack->offsets_nr) {
+        // Arena memory can't grow, get a bigger array and leave the old one
+        // there. Same for the inline array.
+        nr = pack->offsets_nr * 2;
+        if (pack->arena != NULL) {
+            offsets = Arena_alloc(pack->arena, sizeof(unsigned int) * nr);
+        } else if (pack->offsets == pack->inline_offsets) {
+            offsets = malloc(sizeof(unsigned int) * nr);
+        } else {
+            offsets = realloc(pack->offsets, sizeof(unsigned int) * nr);
+        }
+
+        if (offsets == NULL) {
+            goto end;
+        }
+
+        if (pack->arena != NULL || pack->offsets == pack->inline_offsets) {
+            memcpy(offsets,
+                    pack->offsets,
+                    sizeof(unsigned int) * pack->offsets_nr);
+        }
+        pack->offsets = offsets;
+        pack->offsets_nr = nr;
     }
 
-    free(pack);
+    ok = 1;
+
+end:
+    return ok;
 }
 
 int Packet_stack(Packet_t *pack, Protocol_t *proto) {
     int ok = 0;
 
-    if (pack == NULL || pack->stack == NULL || proto == NULL) {
+    if (pack == NULL || pack->stack == NULL || proto == NULL || pack->frozen) {
+        goto end;
+    }
+
+    // Make room for the offset of the new layer now, so computing the
+    // layout never needs to allocate.
+    if (!Packet_reserveOffsets(pack, Stack_numItems(pack->stack) + 1)) {
         goto end;
     }
 
     ok = Stack_push(pack->stack, Protocol_getItem(proto));
+    if (ok && pack->owns_layers) {
+        Protocol_ref(proto);
+    }
+
+    if (ok) {
+        proto->packet = pack;
+        pack->layout_valid = 0;
+        pack->image_valid = 0;
+    }
 
 end:
     return ok;
 }
 
-unsigned int Packet_getSize(const Packet_t *pack) {
-    StackItem_t *iter;
-    Stack_t *stack;
+/* Walks the layers to compute the size of the Packet and the offset of each
+ * one of them. Even if pack is const, the cache is updated, but never the one
+ * of a frozen Packet: other threads are reading it, and Packet_freeze() left
+ * it up to date.
+ */
+static void Packet_updateLayout(const Packet_t *pack) {
+    Packet_t *cache = (Packet_t *)pack;
     Protocol_t *proto;
-    unsigned int total_size = 0;
+    unsigned int i, offset = 0;
 
-    if (pack == NULL || pack->stack == NULL) {
-        goto end;
-    }
+    assert(!pack->frozen);
 
-    stack = pack->stack;
-    for (iter = stack->bottom; iter != NULL; iter = iter->next) {
-        proto = StackItem_getOwner(iter);
+    for (i = 0; i < pack->stack->items; i++) {
+        cache->offsets[i] = offset;
+        proto = StackItem_getOwner(pack->stack->array[i]);
         if (proto != NULL) {
-            total_size += proto->getSize(proto);
+            offset += proto->ops->getSize(Protocol_getOwner(proto));
         } else {
             printf("%s: an owner of a StackItem_t shouldn't be NULL\n", __FUNCTION__);
         }
     }
 
+    cache->size = offset;
+    cache->serializer = Serializer_find(pack->stack->array, pack->stack->items);
+    cache->layout_valid = 1;
+}
+
+/* Returns the size of a layer of the Packet from its cached layout. */
+static unsigned int Packet_layerSize(const Packet_t *pack, unsigned int i) {
+    return (i + 1 < pack->stack->items?
+            pack->offsets[i + 1]: pack->size) - pack->offsets[i];
+}
+
+/* Calls the finalize() method of every layer, from the top to the bottom, on
+ * the wire representation of the Packet held in buf, followed by tail_size
+ * bytes of payload at tail that aren't part of the Packet (see
+ * Packet_encapsulate()).
+ *
+ * With gather set, the layers referencing memory (getData()) are read from
+ * there and the rest are packed one after the other in buf, as done by
+ * Packet_getIovec(). Referenced layers are never finalized, their memory
+ * isn't ours to write.
+ */
+static void Packet_finalize(
+        const Packet_t *pack,
+        uint8_t *buf,
+        int gather,
+        const uint8_t *tail,
+        unsigned int tail_size,
+        unsigned int flags) {
+    ProtocolFinalize_t ctx;
+    Protocol_t *proto, *lower;
+    const uint8_t *data, *lower_data;
+    uint32_t above = 0;
+    unsigned int i, size, skipped = 0;
+    int sum = 0;
+
+    // Bytes of referenced layers below the current one, the offset of a layer
+    // within buf is its offset in the Packet minus them.
+    for (i = 0; i < pack->stack->items; i++) {
+        proto = StackItem_getOwner(pack->stack->array[i]);
+        if (gather && Protocol_data(proto) != NULL) {
+            skipped += Packet_layerSize(pack, i);
+        }
+
+        if (!(flags & PACKET_PARTIAL_CHECKSUM)
+                && Protocol_needsPayloadSum(proto)) {
+            sum = 1;
+        }
+    }
+
+    if (sum && tail_size != 0) {
+        above = Checksum_combine(
+                0,
+                Checksum_partial(tail, tail_size, 0),
+                pack->size);
+    }
+
+    for (i = pack->stack->items; i-- > 0; ) {
+        proto = StackItem_getOwner(pack->stack->array[i]);
+        size = Packet_layerSize(pack, i);
+        data = gather? Protocol_data(proto): NULL;
+        if (data != NULL) {
+            skipped -= size;
+        }
+
+        if (data == NULL && proto != NULL && proto->ops->finalize != NULL) {
+            ctx.hdr = &buf[pack->offsets[i] - skipped];
+            ctx.hdr_size = size;
+            ctx.lower = NULL;
+            ctx.lower_size = 0;
+            if (i > 0) {
+                lower = StackItem_getOwner(pack->stack->array[i - 1]);
+                lower_data = gather? Protocol_data(lower): NULL;
+                ctx.lower = lower_data != NULL?
+                    lower_data: &buf[pack->offsets[i - 1] - skipped];
+                ctx.lower_size = Packet_layerSize(pack, i - 1);
+            }
+
+            ctx.payload_size = pack->size - pack->offsets[i] - size + tail_size;
+            ctx.payload_sum = sum? Checksum_combine(0, above, pack->offsets[i]): 0;
+            ctx.flags = flags;
+            proto->ops->finalize(Protocol_getOwner(proto), &ctx);
+        }
+
+        if (sum) {
+            above = Checksum_combine(
+                    above,
+                    Checksum_partial(
+                        data != NULL? data: &buf[pack->offsets[i] - skipped],
+                        size,
+                        0),
+                    pack->offsets[i]);
+        }
+    }
+}
+
+unsigned int Packet_getSize(const Packet_t *pack) {
+    unsigned int total_size = 0;
+
+    if (pack == NULL || pack->stack == NULL) {
+        goto end;
+    }
+
+    if (!pack->layout_valid) {
+        Packet_updateLayout(pack);
+    }
+
+    total_size = pack->size;
+
 end:
     return total_size;
 }
@@ -208,11 +519,17 @@ int Packet_getBitstream(
         const Packet_t *pack,
         uint8_t *buf,
         unsigned int size) {
-    StackItem_t *iter;
-    Stack_t *stack;
+    return Packet_getBitstreamWithFlags(pack, buf, size, 0);
+}
+
+int Packet_getBitstreamWithFlags(
+        const Packet_t *pack,
+        uint8_t *buf,
+        unsigned int size,
+        unsigned int flags) {
     Protocol_t *proto;
-    unsigned int current_offset = 0;
-    int ok = 0;
+    unsigned int i;
+    int written = 0;
 
     if (pack == NULL 
             || pack->stack == NULL
@@ -221,20 +538,499 @@ int Packet_getBitstream(
         goto end;
     }
 
-    stack = pack->stack;
-    for (iter = stack->bottom; iter != NULL; iter = iter->next) {
-        proto = StackItem_getOwner(iter);
+    i = Serializer_write(pack->serializer, pack->stack->array, buf);
+    for (; i < pack->stack->items; i++) {
+        proto = StackItem_getOwner(pack->stack->array[i]);
         if (proto != NULL) {
-            current_offset += proto->getBitstream(
+            proto->ops->getBitstream(
                     Protocol_getOwner(proto),
-                    &buf[current_offset],
-                    size - current_offset);
+                    &buf[pack->offsets[i]],
+                    size - pack->offsets[i]);
         } else {
             printf("%s: an owner of a StackItem_t shouldn't be NULL\n", __FUNCTION__);
         }
     }
 
+    Packet_finalize(pack, buf, 0, NULL, 0, flags);
+    written = pack->size;
+
+end:
+    return written;
+}
+
+/* Makes room in image_mem for the sums, the offsets and the image of the
+ * Packet. Its contents are lost.
+ */
+static int Packet_reserveImage(Packet_t *pack) {
+    size_t sums_size, offsets_size, size;
+    void *mem;
+    int ok = 0;
+
+    sums_size = sizeof(uint32_t) * pack->offsets_nr;
+    offsets_size = sizeof(unsigned int) * pack->offsets_nr;
+    size = sums_size + offsets_size + pack->size;
+    if (size > pack->image_mem_size) {
+        if (pack->arena != NULL) {
+            mem = Arena_alloc(pack->arena, size);
+        } else {
+            free(pack->image_mem);
+            mem = malloc(size);
+        }
+
+        if (mem == NULL) {
+            pack->image_mem = NULL;
+            pack->image_mem_size = 0;
+            goto end;
+        }
+
+        pack->image_mem = mem;
+        pack->image_mem_size = size;
+    }
+
+    pack->sums = pack->image_mem;
+    pack->image_offsets = (unsigned int *)((uint8_t *)pack->image_mem + sums_size);
+    pack->image = (uint8_t *)pack->image_mem + sums_size + offsets_size;
+    ok = 1;
+
 end:
     return ok;
 }
 
+/* Brings the image of the Packet up to date. Every layer whose dirty flag is
+ * set gets written again and its partial checksum computed again. When
+ * anything changed, layers with a finalize() method are dirtied as well, their
+ * checksum may cover what changed.
+ */
+static int Packet_refreshImage(Packet_t *pack, unsigned int flags) {
+    ProtocolFinalize_t ctx;
+    Protocol_t *proto;
+    uint32_t above = 0;
+    unsigned int i, size, items, fused;
+    int sum = 0, changed, res = -1;
+
+    assert(!pack->frozen);
+    items = pack->stack->items;
+    if (pack->image_valid && pack->image_flags != flags) {
+        pack->image_valid = 0;
+    }
+
+    if (pack->image_valid && !pack->dirty) {
+        return 0;
+    }
+
+    // A layer changing size moves the ones above it, write them all again.
+    // The layout may already be up to date (i.e. Packet_getSize() was called
+    // after the change), it's compared with the one of the image.
+    Packet_getSize(pack);
+    if (pack->image_valid
+            && (pack->size != pack->image_size
+                || memcmp(pack->offsets,
+                    pack->image_offsets,
+                    sizeof(unsigned int) * items) != 0)) {
+        pack->image_valid = 0;
+    }
+
+    if (!pack->image_valid && !Packet_reserveImage(pack)) {
+        goto end;
+    }
+
+    // Written from scratch, the bottom layers may go all at once.
+    fused = 0;
+    if (!pack->image_valid) {
+        fused = Serializer_write(
+                pack->serializer,
+                pack->stack->array,
+                pack->image);
+    }
+
+    changed = !pack->image_valid || pack->dirty;
+    for (i = 0; i < items; i++) {
+        proto = StackItem_getOwner(pack->stack->array[i]);
+        if (!pack->image_valid
+                || (changed && proto->ops->finalize != NULL)) {
+            proto->dirty = 1;
+        }
+
+        if (proto->dirty && i >= fused) {
+            proto->ops->getBitstream(
+                    Protocol_getOwner(proto),
+                    &pack->image[pack->offsets[i]],
+                    pack->size - pack->offsets[i]);
+        }
+
+        if (!(flags & PACKET_PARTIAL_CHECKSUM)
+                && Protocol_needsPayloadSum(proto)) {
+            sum = 1;
+        }
+    }
+
+    // As Packet_finalize(), top-down, but the sums of the layers that didn't
+    // change are already there.
+    for (i = items; i-- > 0; ) {
+        proto = StackItem_getOwner(pack->stack->array[i]);
+        size = Packet_layerSize(pack, i);
+        if (proto->dirty && proto->ops->finalize != NULL) {
+            ctx.hdr = &pack->image[pack->offsets[i]];
+            ctx.hdr_size = size;
+            ctx.lower = i > 0? &pack->image[pack->offsets[i - 1]]: NULL;
+            ctx.lower_size = i > 0? Packet_layerSize(pack, i - 1): 0;
+            ctx.payload_size = pack->size - pack->offsets[i] - size;
+            ctx.payload_sum = sum? Checksum_combine(0, above, pack->offsets[i]): 0;
+            ctx.flags = flags;
+            proto->ops->finalize(Protocol_getOwner(proto), &ctx);
+        }
+
+        if (proto->dirty) {
+            pack->sums[i] = Checksum_partial(
+                    &pack->image[pack->offsets[i]],
+                    size,
+                    0);
+            proto->dirty = 0;
+        }
+
+        if (sum) {
+            above = Checksum_combine(above, pack->sums[i], pack->offsets[i]);
+        }
+    }
+
+    memcpy(pack->image_offsets, pack->offsets, sizeof(unsigned int) * items);
+    pack->image_size = pack->size;
+    pack->image_valid = 1;
+    pack->image_flags = flags;
+    pack->dirty = 0;
+    res = 0;
+
+end:
+    return res;
+}
+
+const uint8_t * Packet_getImage(
+        const Packet_t *pack,
+        unsigned int flags,
+        unsigned int *size) {
+    // Not const for the cache, as documented in the header.
+    Packet_t *cache = (Packet_t *)pack;
+    const uint8_t *image = NULL;
+
+    if (pack == NULL || pack->stack == NULL) {
+        goto end;
+    }
+
+    // Frozen Packets are shared, they are never written.
+    if (pack->frozen) {
+        assert(pack->image_valid && pack->layout_valid);
+        if (flags != pack->image_flags) {
+            goto end;
+        }
+    } else if (Packet_refreshImage(cache, flags) != 0) {
+        goto end;
+    }
+
+    image = pack->image;
+    if (size != NULL) {
+        *size = pack->image_size;
+    }
+
+end:
+    return image;
+}
+
+int Packet_freeze(Packet_t *pack, unsigned int flags) {
+    int res = -1;
+
+    if (pack == NULL || pack->stack == NULL) {
+        goto end;
+    }
+
+    pack->frozen = 0;
+    if (Packet_refreshImage(pack, flags) != 0) {
+        goto end;
+    }
+
+    pack->frozen = 1;
+    res = 0;
+
+end:
+    return res;
+}
+
+void Packet_thaw(Packet_t *pack) {
+    if (pack != NULL) {
+        pack->frozen = 0;
+    }
+}
+
+int Packet_isFrozen(const Packet_t *pack) {
+    return pack != NULL && pack->frozen;
+}
+
+Packet_t * Packet_clone(const Packet_t *pack) {
+    Packet_t *cache = (Packet_t *)pack;
+    Packet_t *clone = NULL;
+    Protocol_t *proto;
+    unsigned int i, items;
+
+    if (pack == NULL || pack->stack == NULL) {
+        goto end;
+    }
+
+    items = pack->stack->items;
+    for (i = 0; i < items; i++) {
+        proto = StackItem_getOwner(pack->stack->array[i]);
+        if (proto->ops->clone == NULL || proto->ops->release == NULL) {
+            goto end;
+        }
+    }
+
+    // With the image up to date the shared layers are clean, the clone can
+    // start from a copy of it. A frozen Packet is always up to date.
+    if (!pack->frozen) {
+        Packet_refreshImage(cache, pack->image_valid? pack->image_flags: 0);
+    }
+    assert(!pack->frozen || (pack->image_valid && pack->layout_valid));
+
+    clone = Packet_create();
+    if (clone == NULL) {
+        goto end;
+    }
+
+    if (!Packet_reserveOffsets(clone, items)
+            || !Stack_share(clone->stack, pack->stack)) {
+        Packet_delete(clone);
+        clone = NULL;
+        goto end;
+    }
+
+    for (i = 0; i < items; i++) {
+        Protocol_ref(StackItem_getOwner(pack->stack->array[i]));
+    }
+    clone->owns_layers = 1;
+
+    memcpy(clone->offsets, pack->offsets, sizeof(unsigned int) * items);
+    clone->size = pack->size;
+    clone->serializer = pack->serializer;
+    clone->layout_valid = pack->layout_valid;
+
+    // Without an image of its own the clone writes it on first use.
+    if (pack->image_valid && Packet_reserveImage(clone)) {
+        memcpy(clone->sums, pack->sums, sizeof(uint32_t) * items);
+        memcpy(clone->image_offsets,
+                pack->image_offsets,
+                sizeof(unsigned int) * items);
+        memcpy(clone->image, pack->image, pack->image_size);
+        clone->image_size = pack->image_size;
+        clone->image_valid = 1;
+        clone->image_flags = pack->image_flags;
+    }
+
+end:
+    return clone;
+}
+
+int Packet_getIovec(
+        const Packet_t *pack,
+        struct iovec *iov,
+        unsigned int n,
+        uint8_t *buf,
+        unsigned int size) {
+    return Packet_getIovecWithFlags(pack, iov, n, buf, size, 0);
+}
+
+int Packet_getIovecWithFlags(
+        const Packet_t *pack,
+        struct iovec *iov,
+        unsigned int n,
+        uint8_t *buf,
+        unsigned int size,
+        unsigned int flags) {
+    Protocol_t *proto;
+    const uint8_t *data;
+    unsigned int i, length, used = 0, iov_nr = 0;
+    int res = -1;
+
+    if (pack == NULL
+            || pack->stack == NULL
+            || iov == NULL
+            || (buf == NULL && size != 0)) {
+        goto end;
+    }
+
+    for (i = 0; i < pack->stack->items; i++) {
+        if (Protocol_data(StackItem_getOwner(pack->stack->array[i])) != NULL) {
+            break;
+        }
+    }
+
+    if (i != 0 && i == pack->stack->items) {
+        data = Packet_getImage(pack, flags, &length);
+        if (data != NULL && n > 0) {
+            iov[0].iov_base = (void *)data;
+            iov[0].iov_len = length;
+            res = 1;
+        }
+        goto end;
+    }
+
+    Packet_getSize(pack);
+
+    for (i = 0; i < pack->stack->items; i++) {
+        proto = StackItem_getOwner(pack->stack->array[i]);
+        length = Packet_layerSize(pack, i);
+        if (length == 0) {
+            continue;
+        }
+
+        data = Protocol_data(proto);
+        if (data != NULL) {
+            if (iov_nr == n) {
+                goto end;
+            }
+
+            iov[iov_nr].iov_base = (void *)data;
+            iov[iov_nr].iov_len = length;
+            iov_nr++;
+            continue;
+        }
+
+        if (used + length > size) {
+            goto end;
+        }
+
+        proto->ops->getBitstream(Protocol_getOwner(proto), &buf[used], size - used);
+
+        // Extend the previous iovec if it ends right here.
+        if (iov_nr > 0
+                && (uint8_t *)iov[iov_nr - 1].iov_base
+                    + iov[iov_nr - 1].iov_len == &buf[used]) {
+            iov[iov_nr - 1].iov_len += length;
+        } else {
+            if (iov_nr == n) {
+                goto end;
+            }
+
+            iov[iov_nr].iov_base = &buf[used];
+            iov[iov_nr].iov_len = length;
+            iov_nr++;
+        }
+
+        used += length;
+    }
+
+    Packet_finalize(pack, buf, 1, NULL, 0, flags);
+    res = (int)iov_nr;
+
+end:
+    return res;
+}
+
+int Packet_encapsulate(const Packet_t *pack, PacketBuffer_t *pb) {
+    Protocol_t *proto;
+    const uint8_t *tail;
+    unsigned int i, size, tail_size;
+    int res = -1;
+
+    if (pack == NULL
+            || pack->stack == NULL
+            || pb == NULL
+            || Packet_getSize(pack) > PacketBuffer_getHeadroom(pb)) {
+        goto end;
+    }
+
+    tail = PacketBuffer_getData(pb);
+    tail_size = PacketBuffer_getLength(pb);
+
+    for (i = pack->stack->items; i-- > 0; ) {
+        proto = StackItem_getOwner(pack->stack->array[i]);
+        size = Packet_layerSize(pack, i);
+        if (proto != NULL && size != 0) {
+            proto->ops->getBitstream(
+                    Protocol_getOwner(proto),
+                    PacketBuffer_push(pb, size),
+                    size);
+        }
+    }
+
+    Packet_finalize(
+            pack,
+            PacketBuffer_getData(pb),
+            0,
+            tail,
+            tail_size,
+            0);
+    res = 0;
+
+end:
+    return res;
+}
+
+unsigned int Packet_getNumLayers(const Packet_t *pack) {
+    return pack != NULL? Stack_numItems(pack->stack): 0;
+}
+
+const Protocol_t * Packet_getLayer(const Packet_t *pack, unsigned int index) {
+    return pack != NULL?
+        StackItem_getOwner(Stack_getItem(pack->stack, index)): NULL;
+}
+
+Protocol_t * Packet_getLayerForWrite(Packet_t *pack, unsigned int index) {
+    Protocol_t *proto = NULL, *copy;
+
+    if (pack == NULL || pack->frozen) {
+        goto end;
+    }
+
+    proto = StackItem_getOwner(Stack_getItem(pack->stack, index));
+    if (proto == NULL) {
+        goto end;
+    }
+
+    // Shared with clones, or with the base Packet and the other clones, the
+    // layer is copied. The base Packet holds no reference to its own layers,
+    // only to the copy.
+    if (__atomic_load_n(&proto->refs, __ATOMIC_ACQUIRE) > 1) {
+        if (proto->ops->clone == NULL || proto->ops->release == NULL) {
+            proto = NULL;
+            goto end;
+        }
+
+        copy = proto->ops->clone(Protocol_getOwner(proto));
+        if (copy == NULL) {
+            proto = NULL;
+            goto end;
+        }
+
+        // Same bytes as the shared layer, the image is still good.
+        copy->item.flags |= STACK_ITEM_STACKED | STACK_ITEM_OWNED;
+        pack->stack->array[index] = Protocol_getItem(copy);
+        if (proto->packet == pack) {
+            proto->packet = NULL;
+        }
+
+        if (Packet_holdsLayer(pack, proto)) {
+            proto->ops->release(Protocol_getOwner(proto));
+        }
+        proto = copy;
+    }
+
+    proto->packet = pack;
+
+end:
+    return proto;
+}
+
+unsigned int Packet_getLayerOffset(const Packet_t *pack, unsigned int index) {
+    unsigned int offset = 0;
+
+    if (pack == NULL || index >= Stack_numItems(pack->stack)) {
+        goto end;
+    }
+
+    if (!pack->layout_valid) {
+        Packet_updateLayout(pack);
+    }
+
+    offset = pack->offsets[index];
+
+end:
+    return offset;
+}
@@ -0,0 +1,294 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "libpacket/pool.h"
+
+/* How many operations a thread does on a Pool before adding its statistics to
+ * the ones of the Pool.
+ */
+#define POOL_STATS_PERIOD (256)
+
+/* The first bytes of a free object link it to the next free one. The first
+ * object of a batch on the shared list also links it to the next batch and
+ * holds the number of objects of the batch.
+ */
+typedef struct PoolObject {
+    struct PoolObject *next;
+    struct PoolObject *batch;
+    unsigned int count;
+} PoolObject_t;
+
+/* The free list of a thread for one Pool, count objects starting at head,
+ * and the statistics the thread hasn't added to the Pool yet. The member
+ * level is allocs - frees and peak the maximum level reached since then.
+ */
+typedef struct PoolCache {
+    PoolObject_t *head;
+    unsigned int count;
+    unsigned int ops;
+    unsigned long allocs;
+    unsigned long hits;
+    unsigned long frees;
+    long level;
+    long peak;
+} PoolCache_t;
+
+static Pool_t *pools[POOL_MAX_NR];
+static unsigned int pools_nr;
+static pthread_mutex_t pools_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_key_t pool_key;
+static pthread_once_t pool_key_once = PTHREAD_ONCE_INIT;
+
+static __thread PoolCache_t pool_caches[POOL_MAX_NR];
+static __thread int pool_thread_ready;
+
+static void Pool_publish(Pool_t *pool, PoolCache_t *cache) {
+    unsigned long allocs, frees, high_water;
+    long in_use;
+
+    allocs = __atomic_add_fetch(&pool->allocs, cache->allocs, __ATOMIC_RELAXED);
+    frees = __atomic_add_fetch(&pool->frees, cache->frees, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&pool->hits, cache->hits, __ATOMIC_RELAXED);
+
+    // Objects in use when this thread was at its peak, give or take what the
+    // other threads haven't published yet.
+    in_use = (long)(allocs - frees) - cache->level + cache->peak;
+    cache->allocs = cache->hits = cache->frees = 0;
+    cache->level = cache->peak = 0;
+    cache->ops = 0;
+
+    high_water = __atomic_load_n(&pool->high_water, __ATOMIC_RELAXED);
+    while (in_use > 0
+            && (unsigned long)in_use > high_water
+            && !__atomic_compare_exchange_n(
+                &pool->high_water,
+                &high_water,
+                in_use,
+                1,
+                __ATOMIC_RELAXED,
+                __ATOMIC_RELAXED)) {
+    }
+}
+
+/* Moves all but keep objects of the free list of a thread to the shared list
+ * of the Pool, as a single batch. Only the objects moved are walked, at most
+ * POOL_CACHE_MAX/2 + 1 of them but when the thread exits.
+ */
+static void Pool_flush(Pool_t *pool, PoolCache_t *cache, unsigned int keep) {
+    PoolObject_t *batch, *last;
+    unsigned int i, count;
+
+    if (cache->count <= keep) {
+        return;
+    }
+
+    count = cache->count - keep;
+    batch = last = cache->head;
+    for (i = 1; i < count; i++) {
+        last = last->next;
+    }
+
+    cache->head = last->next;
+    cache->count = keep;
+    last->next = NULL;
+    batch->count = count;
+
+    pthread_mutex_lock(&pool->lock);
+    batch->batch = pool->shared;
+    pool->shared = batch;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* Takes a single batch from the shared list of the Pool, leaving the rest to
+ * the other threads. The free list of the thread must be empty.
+ */
+static void Pool_refill(Pool_t *pool, PoolCache_t *cache) {
+    PoolObject_t *batch;
+
+    pthread_mutex_lock(&pool->lock);
+    batch = pool->shared;
+    if (batch != NULL) {
+        pool->shared = batch->batch;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    cache->head = batch;
+    cache->count = batch != NULL? batch->count: 0;
+}
+
+/* Gives the free lists of an exiting thread to the pools. */
+static void Pool_threadExit(void *caches) {
+    PoolCache_t *cache = caches;
+    unsigned int i, nr;
+
+    nr = __atomic_load_n(&pools_nr, __ATOMIC_ACQUIRE);
+    for (i = 0; i < nr; i++) {
+        Pool_flush(pools[i], &cache[i], 0);
+        Pool_publish(pools[i], &cache[i]);
+    }
+}
+
+static void Pool_createKey(void) {
+    pthread_key_create(&pool_key, Pool_threadExit);
+}
+
+/* Gives the Pool an id, the first time it's used. */
+static unsigned int Pool_register(Pool_t *pool) {
+    unsigned int id;
+
+    pthread_mutex_lock(&pools_lock);
+    id = pool->id;
+    if (id == 0 && pools_nr < POOL_MAX_NR) {
+        pools[pools_nr] = pool;
+        id = pools_nr + 1;
+        __atomic_store_n(&pool->id, id, __ATOMIC_RELEASE);
+        __atomic_store_n(&pools_nr, id, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&pools_lock);
+
+    return id;
+}
+
+/* Returns the free list of the calling thread for a Pool or NULL if the Pool
+ * can't have one, then objects are just malloc()'ed and free()'d.
+ */
+static PoolCache_t * Pool_getCache(Pool_t *pool) {
+    unsigned int id;
+
+    id = __atomic_load_n(&pool->id, __ATOMIC_ACQUIRE);
+    if (id == 0 && (id = Pool_register(pool)) == 0) {
+        return NULL;
+    }
+
+    if (!pool_thread_ready) {
+        pthread_once(&pool_key_once, Pool_createKey);
+        pthread_setspecific(pool_key, pool_caches);
+        pool_thread_ready = 1;
+    }
+
+    return &pool_caches[id - 1];
+}
+
+void * Pool_alloc(Pool_t *pool) {
+    PoolCache_t *cache;
+    PoolObject_t *obj;
+
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    cache = Pool_getCache(pool);
+    if (cache == NULL) {
+        return malloc(pool->size);
+    }
+
+    if (cache->head == NULL) {
+        Pool_refill(pool, cache);
+    }
+
+    obj = cache->head;
+    if (obj != NULL) {
+        cache->head = obj->next;
+        cache->count--;
+        cache->hits++;
+    } else {
+        obj = malloc(pool->size < sizeof(PoolObject_t)?
+                sizeof(PoolObject_t): pool->size);
+    }
+
+    if (obj != NULL) {
+        cache->allocs++;
+        if (++cache->level > cache->peak) {
+            cache->peak = cache->level;
+        }
+    }
+
+    if (++cache->ops == POOL_STATS_PERIOD) {
+        Pool_publish(pool, cache);
+    }
+
+    return obj;
+}
+
+void Pool_free(Pool_t *pool, void *obj) {
+    PoolCache_t *cache;
+    PoolObject_t *free_obj = obj;
+
+    if (pool == NULL || obj == NULL) {
+        return;
+    }
+
+    cache = Pool_getCache(pool);
+    if (cache == NULL) {
+        free(obj);
+        return;
+    }
+
+    free_obj->next = cache->head;
+    cache->head = free_obj;
+    cache->count++;
+    cache->frees++;
+    cache->level--;
+
+    // Keeping half of them, alternating allocs and frees around the limit
+    // doesn't move objects back and forth.
+    if (cache->count > POOL_CACHE_MAX) {
+        Pool_flush(pool, cache, POOL_CACHE_MAX / 2);
+    }
+
+    if (++cache->ops == POOL_STATS_PERIOD) {
+        Pool_publish(pool, cache);
+    }
+}
+
+int Pool_getStats(const Pool_t *pool, PoolStats_t *stats) {
+    int res = -1;
+
+    if (pool == NULL || stats == NULL) {
+        goto end;
+    }
+
+    stats->allocs = __atomic_load_n(&pool->allocs, __ATOMIC_RELAXED);
+    stats->hits = __atomic_load_n(&pool->hits, __ATOMIC_RELAXED);
+    stats->frees = __atomic_load_n(&pool->frees, __ATOMIC_RELAXED);
+    stats->in_use = stats->allocs > stats->frees?
+        stats->allocs - stats->frees: 0;
+    stats->high_water = __atomic_load_n(&pool->high_water, __ATOMIC_RELAXED);
+    if (stats->high_water < stats->in_use) {
+        stats->high_water = stats->in_use;
+    }
+    res = 0;
+
+end:
+    return res;
+}
+
+const char * Pool_getName(const Pool_t *pool) {
+    return pool != NULL? pool->name: NULL;
+}
+
+unsigned int Pool_getNumPools() {
+    return __atomic_load_n(&pools_nr, __ATOMIC_ACQUIRE);
+}
+
+Pool_t * Pool_getPool(unsigned int index) {
+    return index < Pool_getNumPools()? pools[index]: NULL;
+}
@@ -0,0 +1,145 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "libpacket/raw.h"
+#include "libpacket/pool.h"
+#include "libpacket/packet.h"
+
+static Pool_t raw_pool = POOL_INITIALIZER("RawProto", sizeof(RawProto_t));
+
+static const ProtocolOps_t raw_ops = {
+    .getSize = (Protocol_getSizeFunc_t)RawProto_getSize,
+    .getBitstream = (Protocol_getBitstreamFunc_t)RawProto_getBitstream,
+    .finalize = NULL,
+    .getData = (Protocol_getDataFunc_t)RawProto_getData,
+    .clone = (Protocol_cloneFunc_t)RawProto_clone,
+    .release = (Protocol_releaseFunc_t)RawProto_delete,
+    .fields = NULL,
+    .fields_nr = 0,
+    .type = PROTOCOL_TYPE_RAW,
+};
+
+static void RawProto_init(
+        RawProto_t *proto,
+        const uint8_t *data,
+        unsigned int size) {
+    Protocol_init(&proto->base, &raw_ops, proto);
+    proto->data = data;
+    proto->size = data != NULL? size: 0;
+}
+
+RawProto_t * RawProto_createWithParams(
+        const uint8_t *data,
+        unsigned int size) {
+    RawProto_t *proto;
+
+    proto = Pool_alloc(&raw_pool);
+    if (proto == NULL) {
+        goto end;
+    }
+
+    RawProto_init(proto, data, size);
+
+end:
+    return proto;
+}
+
+RawProto_t * RawProto_create() {
+    return RawProto_createWithParams(NULL, 0);
+}
+
+RawProto_t * RawProto_createInArena(
+        Arena_t *arena,
+        const uint8_t *data,
+        unsigned int size) {
+    RawProto_t *proto;
+
+    proto = Arena_alloc(arena, sizeof(RawProto_t));
+    if (proto != NULL) {
+        RawProto_init(proto, data, size);
+    }
+
+    return proto;
+}
+
+RawProto_t * RawProto_clone(const RawProto_t *proto) {
+    RawProto_t *copy = NULL;
+
+    if (proto == NULL) {
+        goto end;
+    }
+
+    copy = Pool_alloc(&raw_pool);
+    if (copy != NULL) {
+        *copy = *proto;
+        Protocol_init(&copy->base, proto->base.ops, copy);
+    }
+
+end:
+    return copy;
+}
+
+void RawProto_delete(RawProto_t *proto) {
+    if (proto != NULL && Protocol_unref(&proto->base)) {
+        Pool_free(&raw_pool, proto);
+    }
+}
+
+unsigned int RawProto_getSize(const RawProto_t *proto) {
+    return proto != NULL? proto->size: 0;
+}
+
+int RawProto_getBitstream(RawProto_t *proto, uint8_t *buf, unsigned int size) {
+    int res = -1;
+
+    if (proto == NULL || buf == NULL || size < proto->size) {
+        goto end;
+    }
+
+    if (proto->size != 0) {
+        memcpy(buf, proto->data, proto->size);
+    }
+
+    res = proto->size;
+
+end:
+    return res;
+}
+
+const uint8_t * RawProto_getData(const RawProto_t *proto) {
+    return proto != NULL? proto->data: NULL;
+}
+
+int RawProto_setData(RawProto_t *proto, const uint8_t *data, unsigned int size) {
+    int res = -1;
+
+    if (proto != NULL) {
+        proto->data = data;
+        proto->size = data != NULL? size: 0;
+        Protocol_changed(&proto->base);
+        res = 0;
+    }
+
+    return res;
+}
+
+Protocol_t * RawProto_getProtoBase(const RawProto_t *proto) {
+    return proto != NULL? (Protocol_t *)&proto->base: NULL;
+}
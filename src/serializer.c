@@ -0,0 +1,167 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <string.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+
+#include "libpacket/serializer.h"
+#include "libpacket/ether.h"
+#include "libpacket/ipv4.h"
+#include "libpacket/udpv4.h"
+
+#define ETHER_HEADER_LEN (14)
+#define IPV4_HEADER_LEN (20)
+#define UDPV4_HEADER_LEN (8)
+
+/* Returns the instance of the extending class of the layer i. */
+static void * Serializer_layer(StackItem_t * const *items, unsigned int i) {
+    return Protocol_getOwner(StackItem_getOwner(items[i]));
+}
+
+static void Serializer_writeEther(const EtherProto_t *ether, uint8_t *buf) {
+    uint16_t type = htons(ether->type);
+
+    memcpy(buf, ether->daddr, ADDR_LEN);
+    memcpy(&buf[ADDR_LEN], ether->saddr, ADDR_LEN);
+    memcpy(&buf[ADDR_LEN * 2], &type, sizeof(type));
+}
+
+/* Builds the header in five words, the checksum is summed from them instead
+ * of reading the header back.
+ */
+static void Serializer_writeIpv4(const Ipv4Proto_t *ipv4, uint8_t *buf) {
+    uint32_t words[5];
+    uint64_t sum;
+    uint16_t checksum;
+
+    words[0] = htonl((uint32_t)ipv4->version << 28
+            | (uint32_t)ipv4->hdr_length << 24
+            | (uint32_t)ipv4->tos << 16
+            | ipv4->length);
+    words[1] = htonl((uint32_t)ipv4->id << 16
+            | (uint32_t)ipv4->flags << 13
+            | ipv4->frag_off);
+    words[2] = htonl((uint32_t)ipv4->ttl << 24
+            | (uint32_t)ipv4->proto << 16
+            | ipv4->checksum);
+    words[3] = htonl(ipv4->saddr);
+    words[4] = htonl(ipv4->daddr);
+
+    if (ipv4->checksum == 0) {
+        sum = (uint64_t)words[0] + words[1] + words[2] + words[3] + words[4];
+        while (sum >> 16) {
+            sum = (sum & 0xffff) + (sum >> 16);
+        }
+
+        // The sum is in memory order already, store it as it is.
+        checksum = ~sum;
+        memcpy((uint8_t *)&words[2] + 2, &checksum, sizeof(checksum));
+    }
+
+    memcpy(buf, words, sizeof(words));
+}
+
+static void Serializer_writeUdpv4(const Udpv4Proto_t *udpv4, uint8_t *buf) {
+    uint32_t words[2];
+
+    words[0] = htonl((uint32_t)udpv4->sport << 16 | udpv4->dport);
+    words[1] = htonl((uint32_t)udpv4->length << 16 | udpv4->checksum);
+    memcpy(buf, words, sizeof(words));
+}
+
+static void Serializer_writeEtherIpv4(StackItem_t * const *items, uint8_t *buf) {
+    Serializer_writeEther(Serializer_layer(items, 0), buf);
+    Serializer_writeIpv4(Serializer_layer(items, 1), &buf[ETHER_HEADER_LEN]);
+}
+
+static void Serializer_writeEtherIpv4Udpv4(
+        StackItem_t * const *items,
+        uint8_t *buf) {
+    Serializer_writeEther(Serializer_layer(items, 0), buf);
+    Serializer_writeIpv4(Serializer_layer(items, 1), &buf[ETHER_HEADER_LEN]);
+    Serializer_writeUdpv4(
+            Serializer_layer(items, 2),
+            &buf[ETHER_HEADER_LEN + IPV4_HEADER_LEN]);
+}
+
+/* Longest first, Serializer_find() takes the first match. */
+static const Serializer_t serializers[] = {
+    {
+        {PROTOCOL_TYPE_ETHER, PROTOCOL_TYPE_IPV4, PROTOCOL_TYPE_UDPV4},
+        {ETHER_HEADER_LEN, IPV4_HEADER_LEN, UDPV4_HEADER_LEN},
+        3,
+        ETHER_HEADER_LEN + IPV4_HEADER_LEN + UDPV4_HEADER_LEN,
+        Serializer_writeEtherIpv4Udpv4,
+    },
+    {
+        {PROTOCOL_TYPE_ETHER, PROTOCOL_TYPE_IPV4},
+        {ETHER_HEADER_LEN, IPV4_HEADER_LEN},
+        2,
+        ETHER_HEADER_LEN + IPV4_HEADER_LEN,
+        Serializer_writeEtherIpv4,
+    },
+};
+
+#define SERIALIZERS_NR (sizeof(serializers) / sizeof(serializers[0]))
+
+const Serializer_t * Serializer_find(
+        StackItem_t * const *items,
+        unsigned int items_nr) {
+    const Serializer_t *ser;
+    const Protocol_t *proto;
+    unsigned int i, j;
+
+    for (i = 0; items != NULL && i < SERIALIZERS_NR; i++) {
+        ser = &serializers[i];
+        if (items_nr < ser->layers_nr) {
+            continue;
+        }
+
+        for (j = 0; j < ser->layers_nr; j++) {
+            proto = StackItem_getOwner(items[j]);
+            if (proto == NULL
+                    || proto->ops->type != ser->types[j]
+                    || proto->ops->getSize(Protocol_getOwner(proto))
+                        != ser->sizes[j]) {
+                break;
+            }
+        }
+
+        if (j == ser->layers_nr) {
+            return ser;
+        }
+    }
+
+    return NULL;
+}
+
+unsigned int Serializer_write(
+        const Serializer_t *ser,
+        StackItem_t * const *items,
+        uint8_t *buf) {
+    if (ser == NULL || items == NULL || buf == NULL) {
+        return 0;
+    }
+
+    ser->write(items, buf);
+    return ser->layers_nr;
+}
+
+unsigned int Serializer_getSize(const Serializer_t *ser) {
+    return ser != NULL? ser->size: 0;
+}
@@ -15,6 +15,8 @@
  along with libpacket.  If not, see <http://www.gnu.org/licenses/>
 */
 
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -26,49 +28,254 @@
 #include <sys/ioctl.h>
 #include <net/if.h>
 #include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <linux/if_xdp.h>
+#include <linux/virtio_net.h>
+#include <linux/net_tstamp.h>
 
 #include "libpacket/socket.h"
 #include "libpacket/packet.h"
+#include "libpacket/udpv4.h"
 
-Socket_t * Socket_create(const char *ifname) {
+#ifndef VIRTIO_NET_HDR_GSO_UDP_L4
+#define VIRTIO_NET_HDR_GSO_UDP_L4 (5)
+#endif
+
+/* The biggest frame of a UDP datagram the kernel splits (GSO): an Ethernet
+ * header and 64KiB of IPv4, whatever the MTU. */
+#define GSO_MAX_FRAME_SIZE (ETH_HLEN + 65535)
+
+/* How long a congested socket first waits for the device queue to drain, and
+ * how long at most once it has waited again and again. */
+#define CONGESTION_WAIT_US (100)
+#define CONGESTION_WAIT_MAX_US (10000)
+
+static const SocketParams_t default_params = {
+    .backend = SOCKET_BACKEND_SENDTO,
+    .frame_size = SOCKET_DEFAULT_FRAME_SIZE,
+    .frame_nr = SOCKET_DEFAULT_FRAME_NR,
+    .queue = 0,
+    .xdp_flags = 0,
+    .scratch_size = 0,
+    .flags = 0,
+    .gso_size = 0,
+    .uring_flags = 0,
+    .completion = NULL,
+    .completion_arg = NULL,
+    .txtime_clock = CLOCK_MONOTONIC,
+    .txtime_flags = 0,
+};
+
+/* Returns the size of the biggest frame that can be sent through an
+ * interface, or 0 if it can't be found out.
+ */
+static unsigned int Socket_getMaxFrameSize(int desc, const char *ifname) {
+    struct ifreq ifr;
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifname, IFNAMSIZ-1);
+    if (ioctl(desc, SIOCGIFMTU, &ifr)) {
+        perror("ioctl()");
+        return 0;
+    }
+
+    return ifr.ifr_mtu + ETH_HLEN;
+}
+
+/* Hands the completions of the Uring to the callback of the socket, without
+ * the virtio_net_hdr.
+ */
+static void Socket_complete(void *arg, uint64_t seq, int result) {
+    const Socket_t *sock = arg;
+
+    if (result >= 0) {
+        result -= sock->vnet_hdr_len;
+    }
+
+    sock->completion(sock->completion_arg, seq, result);
+}
+
+/* Enables SO_TXTIME on desc with the clock and flags of sock. */
+static int Socket_setTxtime(int desc, const Socket_t *sock) {
+    struct sock_txtime txtime;
+
+    txtime.clockid = sock->txtime_clock;
+    txtime.flags = sock->txtime_flags;
+    if (setsockopt(desc, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime))) {
+        perror("setsockopt()");
+        return -1;
+    }
+
+    return 0;
+}
+
+Socket_t * Socket_createWithParams(
+        const char *ifname,
+        const SocketParams_t *params) {
     Socket_t *sock = NULL;
-    int desc, err, ok = 0;
-    struct ifreq ifindex;
-    struct sockaddr *addr;
+    int desc, err, val, ok = 0;
+    unsigned int ifindex;
 
     if (ifname == NULL) {
         printf("%s: ifname is NULL\n", __FUNCTION__);
         goto end;
     }
 
+    if (params == NULL) {
+        params = &default_params;
+    }
+
     sock = malloc(sizeof(Socket_t));
     if (sock == NULL) {
         perror("malloc()\n");
         goto end;
     }
 
-    desc = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    sock->desc = -1;
+    sock->backend = params->backend;
+    sock->ring = NULL;
+    sock->xsk = NULL;
+    sock->uring = NULL;
+    sock->completion = params->completion;
+    sock->completion_arg = params->completion_arg;
+    sock->scratch = NULL;
+    sock->scratch_size = 0;
+    sock->vnet_hdr_len = 0;
+    sock->gso_size = params->gso_size;
+    sock->nonblock = !!(params->flags & SOCKET_FLAG_NONBLOCK);
+    sock->congested = 0;
+    sock->backoff = CONGESTION_WAIT_US;
+    sock->txtime = 0;
+    sock->txtime_clock = CLOCK_MONOTONIC;
+    sock->txtime_flags = 0;
+
+    if (sock->backend == SOCKET_BACKEND_XDP) {
+        desc = socket(AF_XDP, SOCK_RAW, 0);
+    } else {
+        desc = socket(
+                AF_PACKET,
+                SOCK_RAW | (sock->nonblock? SOCK_NONBLOCK: 0),
+                htons(ETH_P_ALL));
+    }
+
     if (desc == -1) {
         perror("socket()");
         goto end;
     }
 
-    strncpy(ifindex.ifr_name, ifname, IFNAMSIZ-1);
-    err = ioctl(desc, SIOCGIFINDEX, &ifindex);
-    if (err) {
-        perror("ioctl()");
+    sock->desc = desc;
+    ifindex = if_nametoindex(ifname);
+    if (ifindex == 0) {
+        perror("if_nametoindex()");
         goto end;
     }
 
-    sock->desc = desc;
     memset(&sock->addr, 0, sizeof(sock->addr));
     sock->addr.sll_family = AF_PACKET;
-    sock->addr.sll_ifindex = ifindex.ifr_ifindex;
-    err = bind(desc,
-            (const struct sockaddr *)(&sock->addr),
-            sizeof(sock->addr));
-    if (err) {
-        perror("bind()");
+    sock->addr.sll_ifindex = ifindex;
+    if (sock->backend != SOCKET_BACKEND_XDP) {
+        err = bind(desc,
+                (const struct sockaddr *)(&sock->addr),
+                sizeof(sock->addr));
+        if (err) {
+            perror("bind()");
+            goto end;
+        }
+    }
+
+    // Must be enabled before setting up the ring.
+    if (params->flags & SOCKET_FLAG_VNET_HDR) {
+        if (sock->backend == SOCKET_BACKEND_XDP) {
+            printf("%s: XDP sockets have no vnet header\n", __FUNCTION__);
+            goto end;
+        }
+
+        val = 1;
+        err = setsockopt(desc, SOL_PACKET, PACKET_VNET_HDR, &val, sizeof(val));
+        if (err) {
+            perror("setsockopt()");
+            goto end;
+        }
+
+        sock->vnet_hdr_len = sizeof(struct virtio_net_hdr);
+    }
+
+    // A launch time applies to a whole sendmsg(), not to the frames of a ring.
+    if (params->flags & SOCKET_FLAG_TXTIME) {
+        if (sock->backend != SOCKET_BACKEND_SENDTO) {
+            printf("%s: launch times need the SENDTO backend\n", __FUNCTION__);
+            goto end;
+        }
+
+        sock->txtime_clock = params->txtime_clock;
+        sock->txtime_flags = params->txtime_flags;
+        if (Socket_setTxtime(desc, sock)) {
+            goto end;
+        }
+
+        sock->txtime = 1;
+    }
+
+    switch (sock->backend) {
+    case SOCKET_BACKEND_SENDTO:
+        sock->scratch_size = params->scratch_size;
+        if (sock->scratch_size == 0) {
+            sock->scratch_size = Socket_getMaxFrameSize(desc, ifname);
+            if (sock->scratch_size < SOCKET_MIN_SCRATCH_SIZE) {
+                sock->scratch_size = SOCKET_MIN_SCRATCH_SIZE;
+            }
+
+            if (sock->vnet_hdr_len != 0
+                    && sock->gso_size != 0
+                    && sock->scratch_size < GSO_MAX_FRAME_SIZE) {
+                sock->scratch_size = GSO_MAX_FRAME_SIZE;
+            }
+
+            sock->scratch_size += sock->vnet_hdr_len;
+        }
+
+        sock->scratch = malloc(sizeof(uint8_t) * sock->scratch_size);
+        if (sock->scratch == NULL) {
+            perror("malloc()");
+            goto end;
+        }
+        break;
+    case SOCKET_BACKEND_TXRING:
+        sock->ring = TxRing_create(desc, params->frame_size, params->frame_nr);
+        if (sock->ring == NULL) {
+            goto end;
+        }
+        break;
+    case SOCKET_BACKEND_XDP:
+        sock->xsk = Xsk_create(
+                desc,
+                ifindex,
+                params->queue,
+                params->frame_size,
+                params->frame_nr,
+                params->xdp_flags);
+        if (sock->xsk == NULL) {
+            goto end;
+        }
+        break;
+    case SOCKET_BACKEND_URING:
+        sock->uring = Uring_create(
+                desc,
+                params->frame_size,
+                params->frame_nr,
+                params->uring_flags);
+        if (sock->uring == NULL) {
+            goto end;
+        }
+
+        if (sock->completion != NULL) {
+            Uring_setCallback(sock->uring, Socket_complete, sock);
+        }
+        break;
+    default:
+        printf("%s: unknown backend %d\n", __FUNCTION__, sock->backend);
         goto end;
     }
 
@@ -76,61 +283,1073 @@ Socket_t * Socket_create(const char *ifname) {
 
 end:
     if (!ok && sock != NULL) {
-        free(sock);
+        Socket_delete(sock);
         sock = NULL;
     }
 
     return sock;
 }
 
+Socket_t * Socket_create(const char *ifname) {
+    return Socket_createWithParams(ifname, NULL);
+}
+
 void Socket_delete(Socket_t *sock) {
     if (sock != NULL) {
-        close(sock->desc);
+        if (sock->desc != -1) {
+            close(sock->desc);
+        }
+
+        TxRing_delete(sock->ring);
+        Xsk_delete(sock->xsk);
+        Uring_delete(sock->uring);
+        free(sock->scratch);
     }
 
     free(sock);
 }
 
-#define WRITE_RETRIES (3)
+/*------------------------------ Offload ------------------------------*/
+
+/* Returns a pointer to the length bytes at offset of the packet described by
+ * iov, or NULL if they aren't all in the same iovec.
+ */
+static const uint8_t * Socket_iovecAt(
+        const struct iovec *iov,
+        unsigned int iov_nr,
+        unsigned int offset,
+        unsigned int length) {
+    unsigned int i;
+
+    for (i = 0; i < iov_nr; i++) {
+        if (offset < iov[i].iov_len) {
+            return length <= iov[i].iov_len - offset?
+                (const uint8_t *)iov[i].iov_base + offset: NULL;
+        }
+
+        offset -= iov[i].iov_len;
+    }
+
+    return NULL;
+}
+
+/* Tells if the layer i of a packet, serialized with PACKET_PARTIAL_CHECKSUM
+ * into iov, was left with a partial checksum. A UDPv4 layer only is when
+ * finalize() computes its checksum, any other layer covering its payload is
+ * expected to (see ProtocolFinalize).
+ */
+static int Socket_hasPartialChecksum(
+        const Packet_t *pack,
+        unsigned int i,
+        const struct iovec *iov,
+        unsigned int iov_nr) {
+    const Protocol_t *proto = Packet_getLayer(pack, i);
+    unsigned int lower_size;
+    const uint8_t *lower;
+
+    if (proto->ops->type != PROTOCOL_TYPE_UDPV4) {
+        return 1;
+    }
+
+    if (i == 0) {
+        return 0;
+    }
+
+    lower_size = Packet_getLayerOffset(pack, i) - Packet_getLayerOffset(pack, i - 1);
+    lower = Socket_iovecAt(
+            iov,
+            iov_nr,
+            Packet_getLayerOffset(pack, i - 1),
+            lower_size);
+    return Udpv4Proto_hasComputedChecksum(
+            Protocol_getOwner(proto),
+            lower,
+            lower_size);
+}
+
+/* Writes the virtio_net_hdr of a packet, already serialized into iov, into
+ * buf. If the first layer covering its payload was left with a partial
+ * checksum, the kernel is asked to finish it and to split that payload in
+ * chunks of gso_size bytes if it is bigger. Otherwise the packet goes as it
+ * is, the kernel must not touch a checksum that is already final.
+ */
+static void Socket_fillVnetHdr(
+        const Socket_t *sock,
+        const Packet_t *pack,
+        const struct iovec *iov,
+        unsigned int iov_nr,
+        uint8_t *buf) {
+    struct virtio_net_hdr hdr;
+    const ProtocolField_t *fields = NULL;
+    unsigned int i, j, layers_nr, fields_nr = 0, end, payload;
+
+    memset(&hdr, 0, sizeof(hdr));
+
+    layers_nr = Packet_getNumLayers(pack);
+    for (i = 0; i < layers_nr; i++) {
+        fields = Protocol_getFields(Packet_getLayer(pack, i), &fields_nr);
+        for (j = 0; j < fields_nr; j++) {
+            if (fields[j].flags & PROTOCOL_FIELD_CHECKSUM_PAYLOAD) {
+                break;
+            }
+        }
+
+        if (j < fields_nr) {
+            break;
+        }
+    }
+
+    if (i < layers_nr && Socket_hasPartialChecksum(pack, i, iov, iov_nr)) {
+        end = i + 1 < layers_nr?
+            Packet_getLayerOffset(pack, i + 1): Packet_getSize(pack);
+        payload = Packet_getSize(pack) - end;
+
+        hdr.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        hdr.csum_start = Packet_getLayerOffset(pack, i);
+        hdr.csum_offset = fields[j].offset;
+        if (sock->gso_size != 0 && payload > sock->gso_size) {
+            hdr.gso_type = VIRTIO_NET_HDR_GSO_UDP_L4;
+            hdr.gso_size = sock->gso_size;
+            hdr.hdr_len = end;
+        }
+    }
+
+    memcpy(buf, &hdr, sizeof(hdr));
+}
+
+/* Writes a packet into buf, preceded by its virtio_net_hdr if the socket has
+ * them. Returns the number of bytes written or 0 if it doesn't fit.
+ */
+static unsigned int Socket_serialize(
+        const Socket_t *sock,
+        const Packet_t *pack,
+        uint8_t *buf,
+        unsigned int size) {
+    const uint8_t *image;
+    struct iovec iov;
+    unsigned int length;
+
+    unsigned int flags = sock->vnet_hdr_len != 0? PACKET_PARTIAL_CHECKSUM: 0;
+
+    // The image only has to be brought up to date, not written from scratch.
+    // A Packet frozen with other flags has no image for us, it's written
+    // without touching it.
+    image = Packet_getImage(pack, flags, &length);
+    if (image == NULL) {
+        length = Packet_getSize(pack);
+    }
+
+    if (length == 0 || length + sock->vnet_hdr_len > size) {
+        return 0;
+    }
+
+    if (image != NULL) {
+        memcpy(&buf[sock->vnet_hdr_len], image, length);
+    } else if (Packet_getBitstreamWithFlags(
+                pack,
+                &buf[sock->vnet_hdr_len],
+                length,
+                flags) <= 0) {
+        return 0;
+    }
+
+    if (sock->vnet_hdr_len != 0) {
+        iov.iov_base = &buf[sock->vnet_hdr_len];
+        iov.iov_len = length;
+        Socket_fillVnetHdr(sock, pack, &iov, 1, buf);
+    }
+
+    return sock->vnet_hdr_len + length;
+}
+
+/*------------------------------ Rings ------------------------------*/
+
+#define IS_RING(sock) \
+    ((sock)->backend == SOCKET_BACKEND_TXRING \
+     || (sock)->backend == SOCKET_BACKEND_XDP \
+     || (sock)->backend == SOCKET_BACKEND_URING)
+
+/* The TXRING, XDP and URING backends work the same way: get a free frame,
+ * write the packet into it, commit it and, at the end of the burst, kick the
+ * kernel.
+ */
+
+static uint8_t * Socket_tryFrame(const Socket_t *sock, unsigned int *size) {
+    switch (sock->backend) {
+    case SOCKET_BACKEND_XDP:
+        return Xsk_getFrame(sock->xsk, size);
+    case SOCKET_BACKEND_URING:
+        return Uring_getFrame(sock->uring, size);
+    default:
+        return TxRing_getFrame(sock->ring, size);
+    }
+}
+
+static int Socket_commitFrame(const Socket_t *sock, unsigned int length) {
+    switch (sock->backend) {
+    case SOCKET_BACKEND_XDP:
+        return Xsk_commit(sock->xsk, length);
+    case SOCKET_BACKEND_URING:
+        return Uring_commit(sock->uring, length);
+    default:
+        return TxRing_commit(sock->ring, length);
+    }
+}
 
-int Socket_inject(const Socket_t *sock, const Packet_t *pack) {
-    int ret = -1, tries, sent;
-    uint8_t *bitstream = NULL;
-    unsigned int bs_length;
+static int Socket_kick(const Socket_t *sock) {
+    switch (sock->backend) {
+    case SOCKET_BACKEND_XDP:
+        return Xsk_flush(sock->xsk, sock->desc);
+    case SOCKET_BACKEND_URING:
+        return Uring_flush(sock->uring);
+    default:
+        return TxRing_flush(sock->ring, sock->desc);
+    }
+}
+
+/*------------------------------ Back-pressure ------------------------------*/
+
+static int Socket_isCongested(const Socket_t *sock) {
+    return sock->congested
+        || (sock->backend == SOCKET_BACKEND_URING && sock->uring->congested);
+}
+
+/* Sleeps *delay microseconds and doubles *delay, up to
+ * CONGESTION_WAIT_MAX_US. If the *left microseconds, unless -1, are fewer it
+ * only sleeps those. What it slept is taken off *left. Returns 0 if it was cut
+ * short, 1 otherwise.
+ */
+static int Socket_backoff(unsigned int *delay, long *left) {
+    struct timespec ts;
+    long sleep = *delay;
+    int full = 1;
+
+    if (*left >= 0 && *left < sleep) {
+        sleep = *left;
+        full = 0;
+    }
+
+    ts.tv_sec = sleep / 1000000;
+    ts.tv_nsec = (sleep % 1000000) * 1000;
+    nanosleep(&ts, NULL);
+
+    if (*left >= 0) {
+        *left -= sleep;
+    }
+
+    if (full) {
+        *delay = *delay * 2 < CONGESTION_WAIT_MAX_US? *delay * 2: CONGESTION_WAIT_MAX_US;
+    }
+
+    return full;
+}
+
+/* A packet went through, the device queue isn't full anymore. */
+static void Socket_drained(Socket_t *sock) {
+    sock->backoff = CONGESTION_WAIT_US;
+}
+
+/* Whether a send that just failed has to be tried again. A full device queue
+ * (ENOBUFS) doesn't make the socket unwritable, so it's remembered for
+ * Socket_wait(), which a blocking socket calls right away.
+ */
+static int Socket_retry(Socket_t *sock) {
+    if (errno == EINTR) {
+        return 1;
+    }
+
+    if (errno == ENOBUFS) {
+        sock->congested = 1;
+        return !sock->nonblock && Socket_wait(sock, -1) > 0;
+    }
+
+    return 0;
+}
+
+int Socket_getDescriptor(const Socket_t *sock, short *events) {
+    int desc = -1;
+
+    if (sock == NULL) {
+        goto end;
+    }
+
+    // Frames of the Uring are freed by completions, not by the socket.
+    if (sock->backend == SOCKET_BACKEND_URING) {
+        desc = sock->uring->fd;
+        if (events != NULL) {
+            *events = POLLIN;
+        }
+        goto end;
+    }
+
+    desc = sock->desc;
+    if (events != NULL) {
+        *events = POLLOUT;
+    }
+
+end:
+    return desc;
+}
+
+int Socket_wait(Socket_t *sock, int timeout) {
+    unsigned int delay = CONGESTION_WAIT_US;
+    long left = timeout >= 0? timeout * 1000L: -1;
+    struct pollfd pfd;
+    int ret, res = -1;
+
+    if (sock == NULL) {
+        goto end;
+    }
+
+    // The kernel doesn't say when the queue drains, the longer it stays full
+    // the longer we sleep. Cut short by the timeout, it's still full.
+    if (Socket_isCongested(sock)) {
+        if (left == 0 || !Socket_backoff(&sock->backoff, &left)) {
+            res = 0;
+            goto end;
+        }
+
+        sock->congested = 0;
+        if (sock->backend == SOCKET_BACKEND_URING) {
+            sock->uring->congested = 0;
+        }
+        res = 1;
+        goto end;
+    }
+
+    // POLLOUT only says there is room in the socket buffer, not that a
+    // frame of the ring is free, so the ring is looked at every now and then.
+    if (sock->backend == SOCKET_BACKEND_TXRING) {
+        while (TxRing_getFrame(sock->ring, NULL) == NULL) {
+            if (left == 0) {
+                res = 0;
+                goto end;
+            }
+
+            Socket_backoff(&delay, &left);
+            if (Socket_kick(sock) == -1) {
+                goto end;
+            }
+        }
+
+        res = 1;
+        goto end;
+    }
+
+    if (sock->backend == SOCKET_BACKEND_URING
+            && sock->uring->free_nr != 0) {
+        res = 1;
+        goto end;
+    }
+
+    pfd.fd = Socket_getDescriptor(sock, &pfd.events);
+    pfd.revents = 0;
+    ret = poll(&pfd, 1, timeout);
+    if (ret == -1) {
+        if (errno != EINTR) {
+            perror("poll()");
+            goto end;
+        }
+        ret = 0;
+    }
+
+    if (ret > 0 && sock->backend == SOCKET_BACKEND_URING) {
+        ret = Uring_reap(sock->uring, 0) != -1 && sock->uring->free_nr != 0;
+    }
+
+    res = ret > 0;
+
+end:
+    return res;
+}
+
+/*------------------------------ Injection ------------------------------*/
+
+/* Returns the next free frame of the ring. If the ring is full, whatever is
+ * pending is flushed and we wait until the kernel releases a frame, unless the
+ * socket is non-blocking.
+ */
+static uint8_t * Socket_getFrame(Socket_t *sock, unsigned int *size) {
+    uint8_t *frame;
+    int ret;
+
+    frame = Socket_tryFrame(sock, size);
+    while (frame == NULL) {
+        ret = Socket_kick(sock);
+        if (ret == -1) {
+            break;
+        }
+
+        if (ret == 1) {
+            sock->congested = 1;
+        }
+
+        frame = Socket_tryFrame(sock, size);
+        if (frame != NULL) {
+            break;
+        }
+
+        if (sock->nonblock) {
+            errno = Socket_isCongested(sock)? ENOBUFS: EAGAIN;
+            break;
+        }
+
+        if (Socket_wait(sock, -1) == -1) {
+            break;
+        }
+
+        frame = Socket_tryFrame(sock, size);
+    }
+
+    return frame;
+}
+
+static int Socket_injectRing(
+        Socket_t *sock,
+        const Packet_t * const *packs,
+        const uint8_t * const *bufs,
+        const unsigned int *lens,
+        unsigned int n,
+        int *results) {
+    unsigned int i, size, length;
+    uint8_t *frame;
+    int err;
+
+    // Sends of the Uring fail long after being injected, so a blocking socket
+    // backs off before the next burst rather than feeding a full device.
+    if (!sock->nonblock
+            && Socket_isCongested(sock)
+            && Socket_wait(sock, -1) == -1) {
+        return 0;
+    }
+
+    for (i = 0; i < n; i++) {
+        frame = Socket_getFrame(sock, &size);
+        if (frame == NULL) {
+            break;
+        }
+
+        if (packs != NULL) {
+            length = Socket_serialize(sock, packs[i], frame, size);
+        } else {
+            length = sock->vnet_hdr_len + lens[i];
+            if (lens[i] != 0 && length <= size) {
+                memset(frame, 0, sock->vnet_hdr_len);
+                memcpy(&frame[sock->vnet_hdr_len], bufs[i], lens[i]);
+            } else {
+                length = 0;
+            }
+        }
+
+        if (length == 0) {
+            break;
+        }
+
+        Socket_commitFrame(sock, length);
+        if (results != NULL) {
+            results[i] = length - sock->vnet_hdr_len;
+        }
+    }
+
+    // Whatever stopped the burst is what the caller needs to see in errno.
+    err = errno;
+    if (Socket_kick(sock) == 1) {
+        sock->congested = 1;
+    }
+
+    if (i != 0 && !Socket_isCongested(sock)) {
+        Socket_drained(sock);
+    }
+    errno = err;
+    return i;
+}
+
+#define IOV_MAX_NR (64)
+
+/* Describes a packet with an iovec, its headers (and its virtio_net_hdr)
+ * serialized into the scratch buffer and the memory it references left where
+ * it is. If it takes too many iovec the whole packet is copied into the
+ * scratch buffer instead. Returns the number of iovec used or -1.
+ */
+static int Socket_gather(
+        Socket_t *sock,
+        const Packet_t *pack,
+        struct iovec *iov,
+        unsigned int n) {
+    unsigned int length, skip = sock->vnet_hdr_len;
+    int iov_nr;
+
+    if (Packet_getSize(pack) == 0 || skip >= sock->scratch_size) {
+        return -1;
+    }
+
+    iov_nr = Packet_getIovecWithFlags(
+            pack,
+            &iov[skip != 0],
+            n - (skip != 0),
+            &sock->scratch[skip],
+            sock->scratch_size - skip,
+            skip != 0? PACKET_PARTIAL_CHECKSUM: 0);
+    if (iov_nr >= 0 && skip != 0) {
+        Socket_fillVnetHdr(sock, pack, &iov[1], iov_nr, sock->scratch);
+        iov[0].iov_base = sock->scratch;
+        iov[0].iov_len = skip;
+    }
+
+    if (iov_nr >= 0) {
+        return iov_nr + (skip != 0);
+    }
+
+    length = Socket_serialize(sock, pack, sock->scratch, sock->scratch_size);
+    if (length == 0) {
+        return -1;
+    }
+
+    iov[0].iov_base = sock->scratch;
+    iov[0].iov_len = length;
+    return 1;
+}
+
+/* Room for the SCM_TXTIME control message of a send. */
+typedef union TxtimeControl {
+    char buf[CMSG_SPACE(sizeof(uint64_t))];
+    struct cmsghdr align;
+} TxtimeControl_t;
+
+/* Attaches the launch time txtime to msg, using control as its buffer. */
+static void Socket_attachTxtime(
+        struct msghdr *msg,
+        TxtimeControl_t *control,
+        uint64_t txtime) {
+    struct cmsghdr *cmsg;
+
+    msg->msg_control = control->buf;
+    msg->msg_controllen = sizeof(control->buf);
+    cmsg = CMSG_FIRSTHDR(msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_TXTIME;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+    memcpy(CMSG_DATA(cmsg), &txtime, sizeof(uint64_t));
+}
+
+/* Injects a single packet, at its launch time if txtime isn't NULL. */
+static int Socket_send(
+        Socket_t *sock,
+        const Packet_t *pack,
+        const uint64_t *txtime) {
+    struct iovec iov[IOV_MAX_NR];
+    TxtimeControl_t control;
+    struct msghdr msg;
+    int ret = -1, iov_nr, sent;
 
     if (sock == NULL || pack == NULL) {
         goto end;
     }
 
-    bs_length = Packet_getSize(pack);
-    if (bs_length == 0) {
+    if (IS_RING(sock)) {
+        if (Socket_injectRing(sock, &pack, NULL, NULL, 1, &ret) != 1) {
+            ret = -1;
+        }
         goto end;
     }
 
-    bitstream = malloc(sizeof(uint8_t) * bs_length);
-    if (bitstream == NULL) {
+    iov_nr = Socket_gather(sock, pack, iov, IOV_MAX_NR);
+    if (iov_nr <= 0) {
         goto end;
     }
 
-    Packet_getBitstream(pack, bitstream, bs_length);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = (void *)&sock->addr;
+    msg.msg_namelen = sizeof(sock->addr);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iov_nr;
+    if (txtime != NULL) {
+        Socket_attachTxtime(&msg, &control, *txtime);
+    }
 
-    tries = sent = 0;
     do {
-        sent = sendto(sock->desc,
-                bitstream + sent,
-                bs_length - sent,
-                0,
-                (struct sockaddr *)(&sock->addr),
-                sizeof(sock->addr));
-    } while (sent < bs_length && tries++ < WRITE_RETRIES);
+        sent = sendmsg(sock->desc, &msg, 0);
+    } while (sent == -1 && Socket_retry(sock));
+
+    if (sent == -1) {
+        goto end;
+    }
+
+    Socket_drained(sock);
+    ret = sent - sock->vnet_hdr_len;
+
+end:
+    return ret;
+}
+
+int Socket_inject(Socket_t *sock, const Packet_t *pack) {
+    return Socket_send(sock, pack, NULL);
+}
+
+int Socket_injectAt(Socket_t *sock, const Packet_t *pack, uint64_t txtime) {
+    int ret = -1;
+
+    if (sock != NULL && !sock->txtime) {
+        errno = EINVAL;
+        goto end;
+    }
+
+    ret = Socket_send(sock, pack, &txtime);
+
+end:
+    return ret;
+}
+
+uint64_t Socket_getTime(const Socket_t *sock) {
+    struct timespec ts;
+    uint64_t res = 0;
+
+    if (sock == NULL || clock_gettime(sock->txtime_clock, &ts)) {
+        goto end;
+    }
+
+    res = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+
+end:
+    return res;
+}
+
+#define BATCH_CHUNK (64)
+
+/* Asks for no offload at all, used to send raw buffers. */
+static const struct virtio_net_hdr no_offload;
+
+/* Sends a batch of buffers with sendmmsg(). If raw is set, the buffers don't
+ * carry a virtio_net_hdr and one asking for no offload is prepended when the
+ * socket needs it. If txtimes isn't NULL it holds the launch time of every
+ * buffer. Returns the number of buffers sent.
+ */
+static unsigned int Socket_sendBatch(
+        Socket_t *sock,
+        const uint8_t * const *bufs,
+        const unsigned int *lens,
+        const uint64_t *txtimes,
+        unsigned int n,
+        int *results,
+        int raw) {
+    struct mmsghdr msgs[BATCH_CHUNK];
+    struct iovec iovs[BATCH_CHUNK][2];
+    TxtimeControl_t controls[BATCH_CHUNK];
+    unsigned int i, j, chunk, done = 0;
+    int sent;
+
+    while (done < n) {
+        chunk = n - done < BATCH_CHUNK? n - done: BATCH_CHUNK;
+        memset(msgs, 0, sizeof(struct mmsghdr) * chunk);
+        for (i = 0; i < chunk; i++) {
+            j = 0;
+            if (raw && sock->vnet_hdr_len != 0) {
+                iovs[i][j].iov_base = (void *)&no_offload;
+                iovs[i][j].iov_len = sock->vnet_hdr_len;
+                j++;
+            }
+
+            iovs[i][j].iov_base = (void *)bufs[done + i];
+            iovs[i][j].iov_len = lens[done + i];
+            j++;
+            msgs[i].msg_hdr.msg_name = (void *)&sock->addr;
+            msgs[i].msg_hdr.msg_namelen = sizeof(sock->addr);
+            msgs[i].msg_hdr.msg_iov = iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = j;
+            if (txtimes != NULL) {
+                Socket_attachTxtime(
+                        &msgs[i].msg_hdr,
+                        &controls[i],
+                        txtimes[done + i]);
+            }
+        }
+
+        // sendmmsg() stops at the first message the kernel refuses and
+        // reports it only if it was the first one, so if the next round
+        // fails right away we are done.
+        sent = sendmmsg(sock->desc, msgs, chunk, 0);
+        if (sent == -1 && Socket_retry(sock)) {
+            continue;
+        }
+
+        if (sent <= 0) {
+            break;
+        }
+
+        for (i = 0; results != NULL && i < (unsigned int)sent; i++) {
+            results[done + i] = msgs[i].msg_len - sock->vnet_hdr_len;
+        }
+
+        Socket_drained(sock);
+        done += sent;
+    }
+
+    return done;
+}
+
+int Socket_injectRawBatch(
+        Socket_t *sock,
+        const uint8_t * const *bufs,
+        const unsigned int *lens,
+        unsigned int n,
+        int *results) {
+    unsigned int i, done = 0;
+    int ret = -1;
+
+    if (sock == NULL || bufs == NULL || lens == NULL) {
+        goto end;
+    }
+
+    if (IS_RING(sock)) {
+        done = Socket_injectRing(sock, NULL, bufs, lens, n, results);
+    } else {
+        done = Socket_sendBatch(sock, bufs, lens, NULL, n, results, 1);
+    }
+
+    for (i = done; results != NULL && i < n; i++) {
+        results[i] = -1;
+    }
+
+    // Nothing sent at all is an error, errno still says why.
+    ret = done == 0 && n != 0? -1: (int)done;
+
+end:
+    return ret;
+}
+
+/* Injects several packets, at their launch times if txtimes isn't NULL. */
+static int Socket_sendPackets(
+        Socket_t *sock,
+        const Packet_t * const *packs,
+        const uint64_t *txtimes,
+        unsigned int n,
+        int *results) {
+    const uint8_t *bufs[BATCH_CHUNK];
+    unsigned int lens[BATCH_CHUNK];
+    unsigned int i, chunk, offset, sent, done = 0;
+    int ret = -1;
+
+    if (sock == NULL || packs == NULL) {
+        goto end;
+    }
+
+    if (IS_RING(sock)) {
+        done = Socket_injectRing(sock, packs, NULL, NULL, n, results);
+        goto out;
+    }
+
+    while (done < n) {
+        offset = chunk = 0;
+        while (done + chunk < n && chunk < BATCH_CHUNK) {
+            lens[chunk] = Socket_serialize(
+                    sock,
+                    packs[done + chunk],
+                    &sock->scratch[offset],
+                    sock->scratch_size - offset);
+            if (lens[chunk] == 0) {
+                break;
+            }
+
+            bufs[chunk] = &sock->scratch[offset];
+            offset += lens[chunk];
+            chunk++;
+        }
+
+        // The next packet is empty or doesn't fit in the scratch buffer.
+        if (chunk == 0) {
+            errno = EMSGSIZE;
+            break;
+        }
+
+        sent = Socket_sendBatch(
+                sock,
+                bufs,
+                lens,
+                txtimes != NULL? &txtimes[done]: NULL,
+                chunk,
+                results != NULL? &results[done]: NULL,
+                0);
+        if (sent == 0) {
+            break;
+        }
+
+        done += sent;
+        if (sent < chunk) {
+            break;
+        }
+    }
+
+out:
+    for (i = done; results != NULL && i < n; i++) {
+        results[i] = -1;
+    }
+
+    // Nothing sent at all is an error, as in Socket_injectRawBatch().
+    ret = done == 0 && n != 0? -1: (int)done;
+
+end:
+    return ret;
+}
+
+int Socket_injectBatch(
+        Socket_t *sock,
+        const Packet_t * const *packs,
+        unsigned int n,
+        int *results) {
+    return Socket_sendPackets(sock, packs, NULL, n, results);
+}
+
+int Socket_injectBatchAt(
+        Socket_t *sock,
+        const Packet_t * const *packs,
+        const uint64_t *txtimes,
+        unsigned int n,
+        int *results) {
+    int ret = -1;
+
+    if (txtimes == NULL) {
+        goto end;
+    }
+
+    if (sock != NULL && !sock->txtime) {
+        errno = EINVAL;
+        goto end;
+    }
+
+    ret = Socket_sendPackets(sock, packs, txtimes, n, results);
+
+end:
+    return ret;
+}
+
+int Socket_injectPacketBatch(
+        Socket_t *sock,
+        PacketBatch_t *batch,
+        int *results) {
+    int ret = -1;
+
+    if (sock == NULL
+            || batch == NULL
+            || (!batch->serialized && PacketBatch_serialize(batch, 0) < 0)) {
+        goto end;
+    }
+
+    ret = Socket_injectRawBatch(
+            sock,
+            PacketBatch_getPackets(batch),
+            PacketBatch_getLengths(batch),
+            PacketBatch_getNumPackets(batch),
+            results);
+
+end:
+    return ret;
+}
+
+int Socket_flush(const Socket_t *sock) {
+    int res = -1;
+
+    if (sock == NULL) {
+        goto end;
+    }
+
+    res = 0;
+    if (IS_RING(sock)) {
+        res = Socket_kick(sock) == -1? -1: 0;
+    }
+
+end:
+    return res;
+}
+
+int Socket_reap(const Socket_t *sock, unsigned int min) {
+    int res = -1;
 
-    if (tries >= WRITE_RETRIES) {
-        ret = -1;
+    if (sock == NULL) {
         goto end;
     }
 
+    res = 0;
+    if (sock->backend == SOCKET_BACKEND_URING) {
+        res = Uring_reap(sock->uring, min);
+    }
+
+end:
+    return res;
+}
+
+/*------------------------------ Contexts ------------------------------*/
+
+/* Opens a file descriptor that only sends, bound to the same interface and
+ * with the same options as the one of sock. Returns it or -1.
+ */
+static int SocketContext_openDesc(const Socket_t *sock) {
+    int desc, val;
+
+    // Protocol 0, so the kernel doesn't hand it a copy of every frame.
+    desc = socket(AF_PACKET, SOCK_RAW | (sock->nonblock? SOCK_NONBLOCK: 0), 0);
+    if (desc == -1) {
+        perror("socket()");
+        return -1;
+    }
+
+    if (bind(desc, (const struct sockaddr *)&sock->addr, sizeof(sock->addr))) {
+        perror("bind()");
+        close(desc);
+        return -1;
+    }
+
+    val = 1;
+    if (sock->vnet_hdr_len != 0
+            && setsockopt(desc, SOL_PACKET, PACKET_VNET_HDR, &val, sizeof(val))) {
+        perror("setsockopt()");
+        close(desc);
+        return -1;
+    }
+
+    if (sock->txtime && Socket_setTxtime(desc, sock)) {
+        close(desc);
+        return -1;
+    }
+
+    return desc;
+}
+
+SocketContext_t * SocketContext_create(const Socket_t *sock, unsigned int flags) {
+    SocketContext_t *ctx = NULL;
+    int ok = 0;
+
+    if (sock == NULL) {
+        goto end;
+    }
+
+    if (sock->backend != SOCKET_BACKEND_SENDTO) {
+        printf("%s: only the SENDTO backend supports contexts\n", __FUNCTION__);
+        goto end;
+    }
+
+    ctx = calloc(1, sizeof(SocketContext_t));
+    if (ctx == NULL) {
+        perror("calloc()");
+        goto end;
+    }
+
+    ctx->sock = *sock;
+    ctx->sock.scratch = malloc(sizeof(uint8_t) * sock->scratch_size);
+    if (ctx->sock.scratch == NULL) {
+        perror("malloc()");
+        goto end;
+    }
+
+    if (flags & SOCKET_CONTEXT_OWN_DESC) {
+        ctx->sock.desc = SocketContext_openDesc(sock);
+        if (ctx->sock.desc == -1) {
+            goto end;
+        }
+        ctx->own_desc = 1;
+    }
+
+    ok = 1;
+
+end:
+    if (!ok && ctx != NULL) {
+        SocketContext_delete(ctx);
+        ctx = NULL;
+    }
+
+    return ctx;
+}
+
+void SocketContext_delete(SocketContext_t *ctx) {
+    if (ctx != NULL) {
+        if (ctx->own_desc) {
+            close(ctx->sock.desc);
+        }
+
+        free(ctx->sock.scratch);
+    }
+
+    free(ctx);
+}
+
+/* Only the thread of the context writes the counters, but others may read
+ * them at any time.
+ */
+static void SocketContext_count(
+        SocketContext_t *ctx,
+        uint64_t packets,
+        uint64_t bytes,
+        uint64_t errors) {
+    __atomic_store_n(
+            &ctx->stats.packets,
+            ctx->stats.packets + packets,
+            __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->stats.bytes, ctx->stats.bytes + bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(
+            &ctx->stats.errors,
+            ctx->stats.errors + errors,
+            __ATOMIC_RELAXED);
+}
+
+int SocketContext_inject(SocketContext_t *ctx, const Packet_t *pack) {
+    int ret = -1;
+
+    if (ctx == NULL) {
+        goto end;
+    }
+
+    ret = Socket_inject(&ctx->sock, pack);
+    if (ret >= 0) {
+        SocketContext_count(ctx, 1, ret, 0);
+    } else {
+        SocketContext_count(ctx, 0, 0, 1);
+    }
+
 end:
-    free(bitstream);
     return ret;
 }
 
+int SocketContext_injectBatch(
+        SocketContext_t *ctx,
+        const Packet_t * const *packs,
+        unsigned int n,
+        int *results) {
+    uint64_t bytes = 0;
+    unsigned int i;
+    int ret = -1;
+
+    if (ctx == NULL) {
+        goto end;
+    }
+
+    ret = Socket_injectBatch(&ctx->sock, packs, n, results);
+    if (ret < 0) {
+        SocketContext_count(ctx, 0, 0, n);
+        goto end;
+    }
+
+    for (i = 0; i < (unsigned int)ret; i++) {
+        bytes += results != NULL?
+            (unsigned int)results[i]: Packet_getSize(packs[i]);
+    }
+
+    SocketContext_count(ctx, ret, bytes, n - ret);
+
+end:
+    return ret;
+}
+
+int SocketContext_getStats(const SocketContext_t *ctx, SocketStats_t *stats) {
+    int res = -1;
+
+    if (ctx == NULL || stats == NULL) {
+        goto end;
+    }
+
+    stats->packets = __atomic_load_n(&ctx->stats.packets, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&ctx->stats.bytes, __ATOMIC_RELAXED);
+    stats->errors = __atomic_load_n(&ctx->stats.errors, __ATOMIC_RELAXED);
+    res = 0;
+
+end:
+    return res;
+}
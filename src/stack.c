@@ -16,15 +16,14 @@
 */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "libpacket/stack.h"
+#include "libpacket/pool.h"
 
 /*--------------------- StackItem methods --------------------------*/
 
-StackItem_t * StackItem_createWithParams(
-        StackItem_t *prev,
-        StackItem_t *next,
-        void *owner) {
+StackItem_t * StackItem_createWithParams(void *owner) {
     StackItem_t *item;
 
     item = malloc(sizeof(StackItem_t));
@@ -32,16 +31,27 @@ StackItem_t * StackItem_createWithParams(
         goto end;
     }
 
-    item->prev = prev;
-    item->next = next;
     item->owner = owner;
+    item->flags = 0;
 
 end:
     return item;
 }
 
 StackItem_t * StackItem_create() {
-    return StackItem_createWithParams(NULL, NULL, NULL);
+    return StackItem_createWithParams(NULL);
+}
+
+StackItem_t * StackItem_createInArena(Arena_t *arena) {
+    StackItem_t *item;
+
+    item = Arena_alloc(arena, sizeof(StackItem_t));
+    if (item != NULL) {
+        item->owner = NULL;
+        item->flags = 0;
+    }
+
+    return item;
 }
 
 void StackItem_delete(StackItem_t *item) {
@@ -68,52 +78,118 @@ void * StackItem_getOwner(const StackItem_t *item) {
 
 /*------------------------- Stack methods --------------------------*/
 
-Stack_t * Stack_create() {
+static Pool_t stack_pool = POOL_INITIALIZER("Stack", sizeof(Stack_t));
+
+static void Stack_init(Stack_t *stack, void *owner, Arena_t *arena) {
+    stack->array = stack->inline_array;
+    stack->items = 0;
+    stack->capacity = STACK_INLINE_ITEMS;
+    stack->owner = owner;
+    stack->arena = arena;
+}
+
+Stack_t * Stack_createWithParams(void *owner) {
     Stack_t *stack;
 
-    stack = malloc(sizeof(Stack_t));
-    if (stack == NULL) {
-        goto end;
+    stack = Pool_alloc(&stack_pool);
+    if (stack != NULL) {
+        Stack_init(stack, owner, NULL);
     }
 
-    stack->top = stack->bottom = NULL;
-    stack->items = 0;
+    return stack;
+}
+
+Stack_t * Stack_create() {
+    return Stack_createWithParams(NULL);
+}
+
+Stack_t * Stack_createInArena(Arena_t *arena) {
+    Stack_t *stack;
+
+    stack = Arena_alloc(arena, sizeof(Stack_t));
+    if (stack != NULL) {
+        Stack_init(stack, NULL, arena);
+    }
 
-end:
     return stack;
 }
 
 void Stack_delete(Stack_t *stack) {
-    StackItem_t *iter;
+    if (stack != NULL && stack->array != stack->inline_array) {
+        free(stack->array);
+    }
 
-    if (stack != NULL) {
-        for (iter = stack->bottom; iter != NULL; iter->next) {
-            StackItem_delete(iter);
-        }
+    Pool_free(&stack_pool, stack);
+}
+
+/* Doubles the capacity of the stack. Arena memory can't grow, so in that case
+ * a bigger array is taken and the old one is left there.
+ */
+static int Stack_grow(Stack_t *stack) {
+    StackItem_t **array;
+    unsigned int capacity = stack->capacity * 2;
+    int ok = 0;
+
+    if (stack->arena != NULL) {
+        array = Arena_alloc(stack->arena, sizeof(StackItem_t *) * capacity);
+    } else if (stack->array == stack->inline_array) {
+        array = malloc(sizeof(StackItem_t *) * capacity);
+    } else {
+        array = realloc(stack->array, sizeof(StackItem_t *) * capacity);
+    }
+
+    if (array == NULL) {
+        goto end;
+    }
+
+    if (stack->arena != NULL || stack->array == stack->inline_array) {
+        memcpy(array, stack->array, sizeof(StackItem_t *) * stack->items);
     }
 
-    free(stack);
+    stack->array = array;
+    stack->capacity = capacity;
+    ok = 1;
+
+end:
+    return ok;
 }
 
 int Stack_push(Stack_t *stack, StackItem_t *item) {
     int ret = 0;
 
-    if (stack == NULL || item == NULL || Stack_itemExists(stack, item)) {
+    if (stack == NULL || item == NULL || (item->flags & STACK_ITEM_STACKED)) {
         goto end;
     }
 
-    if (stack->items == 0) {
-        item->prev = NULL;
-        stack->bottom = stack->top = item;
-    } else {
-        item->prev = stack->top;
-        stack->top->next = item;
-        stack->top = item;
+    if (stack->items == stack->capacity && !Stack_grow(stack)) {
+        goto end;
+    }
+
+    stack->array[stack->items++] = item;
+    item->flags |= STACK_ITEM_STACKED;
+    ret = 1;
+
+end:
+    return ret;
+}
+
+int Stack_share(Stack_t *stack, const Stack_t *src) {
+    int ret = 0;
+
+    if (stack == NULL || src == NULL) {
+        goto end;
     }
 
-    item->next = NULL;
-    stack->items++;
+    while (stack->items + src->items > stack->capacity) {
+        if (!Stack_grow(stack)) {
+            goto end;
+        }
+    }
 
+    memcpy(&stack->array[stack->items],
+            src->array,
+            sizeof(StackItem_t *) * src->items);
+    stack->items += src->items;
     ret = 1;
 
 end:
@@ -127,13 +203,8 @@ StackItem_t * Stack_pop(Stack_t *stack) {
         goto end;
     }
 
-    item = stack->top;
-    stack->top = item->prev;
-    if (stack->items > 1) {
-        stack->top->next = NULL;
-    }
-
-    stack->items--;
+    item = stack->array[--stack->items];
+    item->flags &= ~STACK_ITEM_STACKED;
 
 end:
     return item;
@@ -152,16 +223,20 @@ end:
     return ret;
 }
 
+StackItem_t * Stack_getItem(const Stack_t *stack, unsigned int index) {
+    return stack != NULL && index < stack->items? stack->array[index]: NULL;
+}
+
 int Stack_itemExists(const Stack_t *stack, StackItem_t *item) {
-    StackItem_t *iter;
+    unsigned int i;
     int exists = 0;
 
-    if (stack == NULL || item == NULL || stack->items == 0) {
+    if (stack == NULL || item == NULL || !(item->flags & STACK_ITEM_STACKED)) {
         goto end;
     }
 
-    for (iter = stack->bottom; iter != NULL; iter = iter->next) {
-        if (iter == item) {
+    for (i = 0; i < stack->items; i++) {
+        if (stack->array[i] == item) {
             exists = 1;
             break;
         }
@@ -185,4 +260,3 @@ int Stack_setOwner(Stack_t *stack, void *owner) {
 void * Stack_getOwner(const Stack_t *stack) {
     return stack != NULL? stack->owner: NULL;
 }
-
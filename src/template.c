@@ -0,0 +1,354 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "libpacket/template.h"
+#include "libpacket/checksum.h"
+
+/* Adds the checksum field csum to the list of checksums covering field. */
+static void TemplateField_addChecksum(
+        TemplateField_t *field,
+        int csum,
+        unsigned int base) {
+    if (csum < 0 || field->checksums_nr == TEMPLATE_MAX_CHECKSUMS) {
+        return;
+    }
+
+    if ((field->offset - base) % 2) {
+        field->odd |= 1 << field->checksums_nr;
+    }
+
+    field->checksums[field->checksums_nr++] = csum;
+}
+
+/* Works out which checksums cover a field. A field is covered by the header
+ * checksum of its own layer and by the payload checksum of its own layer and
+ * of every layer below. Fields of the pseudo header are also covered by the
+ * payload checksum of their own layer a second time (i.e. the UDP length) or,
+ * if their layer has none, by the one of the layer right above.
+ */
+static void Template_linkChecksums(Template_t *tmpl, unsigned int index) {
+    TemplateField_t *field = &tmpl->fields[index];
+    TemplateLayer_t *layer;
+    unsigned int i;
+
+    field->checksums_nr = 0;
+    field->odd = 0;
+    if (field->flags & PROTOCOL_FIELD_CHECKSUM) {
+        return;
+    }
+
+    for (i = 0; i < tmpl->layers_nr; i++) {
+        layer = &tmpl->layers[i];
+        if (field->layer == TEMPLATE_NO_LAYER) {
+            if (layer->offset <= field->offset) {
+                TemplateField_addChecksum(field, layer->payload_checksum, layer->offset);
+            }
+        } else if (i == field->layer) {
+            TemplateField_addChecksum(field, layer->checksum, layer->offset);
+            TemplateField_addChecksum(field, layer->payload_checksum, layer->offset);
+            if (field->flags & PROTOCOL_FIELD_PSEUDO_HEADER) {
+                TemplateField_addChecksum(
+                        field,
+                        layer->payload_checksum,
+                        layer->offset);
+            }
+        } else if (i < field->layer) {
+            TemplateField_addChecksum(field, layer->payload_checksum, layer->offset);
+        } else if (i == field->layer + 1
+                && field->flags & PROTOCOL_FIELD_PSEUDO_HEADER
+                && tmpl->layers[field->layer].payload_checksum < 0) {
+            TemplateField_addChecksum(
+                    field,
+                    layer->payload_checksum,
+                    tmpl->layers[field->layer].offset);
+        }
+    }
+}
+
+Template_t * Packet_compile(const Packet_t *pack) {
+    Template_t *tmpl = NULL;
+    const ProtocolField_t *fields;
+    TemplateField_t *field;
+    unsigned int i, j, fields_nr, total = 0;
+    int ok = 0;
+
+    if (pack == NULL) {
+        goto end;
+    }
+
+    tmpl = calloc(1, sizeof(Template_t));
+    if (tmpl == NULL) {
+        goto end;
+    }
+
+    tmpl->layers_nr = Packet_getNumLayers(pack);
+    for (i = 0; i < tmpl->layers_nr; i++) {
+        Protocol_getFields(Packet_getLayer(pack, i), &fields_nr);
+        total += fields_nr;
+    }
+
+    tmpl->size = Packet_getSize(pack);
+    tmpl->frame = malloc(sizeof(uint8_t) * (tmpl->size > 0? tmpl->size: 1));
+    tmpl->fields = malloc(sizeof(TemplateField_t) * (total > 0? total: 1));
+    tmpl->layers = malloc(sizeof(TemplateLayer_t) * (tmpl->layers_nr > 0? tmpl->layers_nr: 1));
+    if (tmpl->frame == NULL || tmpl->fields == NULL || tmpl->layers == NULL) {
+        goto end;
+    }
+
+    if (Packet_getBitstream(pack, tmpl->frame, tmpl->size) != (int)tmpl->size) {
+        goto end;
+    }
+
+    for (i = 0; i < tmpl->layers_nr; i++) {
+        tmpl->layers[i].offset = Packet_getLayerOffset(pack, i);
+        tmpl->layers[i].checksum = -1;
+        tmpl->layers[i].payload_checksum = -1;
+
+        fields = Protocol_getFields(Packet_getLayer(pack, i), &fields_nr);
+        for (j = 0; j < fields_nr; j++) {
+            field = &tmpl->fields[tmpl->fields_nr];
+            field->layer = i;
+            field->id = fields[j].id;
+            field->offset = tmpl->layers[i].offset + fields[j].offset;
+            field->width = fields[j].width;
+            field->byte_order = fields[j].byte_order;
+            field->flags = fields[j].flags;
+            if (field->flags & PROTOCOL_FIELD_CHECKSUM_PAYLOAD) {
+                tmpl->layers[i].payload_checksum = tmpl->fields_nr;
+            } else if (field->flags & PROTOCOL_FIELD_CHECKSUM) {
+                tmpl->layers[i].checksum = tmpl->fields_nr;
+            }
+
+            tmpl->fields_nr++;
+        }
+    }
+
+    for (i = 0; i < tmpl->fields_nr; i++) {
+        Template_linkChecksums(tmpl, i);
+    }
+
+    ok = 1;
+
+end:
+    if (!ok && tmpl != NULL) {
+        Template_delete(tmpl);
+        tmpl = NULL;
+    }
+
+    return tmpl;
+}
+
+void Template_delete(Template_t *tmpl) {
+    if (tmpl != NULL) {
+        free(tmpl->frame);
+        free(tmpl->fields);
+        free(tmpl->layers);
+    }
+
+    free(tmpl);
+}
+
+int Template_getField(const Template_t *tmpl, unsigned int layer, unsigned int id) {
+    unsigned int i;
+    int index = -1;
+
+    if (tmpl == NULL) {
+        goto end;
+    }
+
+    for (i = 0; i < tmpl->fields_nr; i++) {
+        if (tmpl->fields[i].layer == layer && tmpl->fields[i].id == id) {
+            index = i;
+            break;
+        }
+    }
+
+end:
+    return index;
+}
+
+int Template_addField(
+        Template_t *tmpl,
+        unsigned int offset,
+        unsigned int width,
+        unsigned int byte_order) {
+    TemplateField_t *fields;
+    int index = -1;
+
+    if (tmpl == NULL
+            || width == 0
+            || width > sizeof(uint64_t)
+            || offset > tmpl->size
+            || width > tmpl->size - offset) {
+        goto end;
+    }
+
+    fields = realloc(tmpl->fields, sizeof(TemplateField_t) * (tmpl->fields_nr + 1));
+    if (fields == NULL) {
+        goto end;
+    }
+
+    tmpl->fields = fields;
+    fields[tmpl->fields_nr].layer = TEMPLATE_NO_LAYER;
+    fields[tmpl->fields_nr].id = 0;
+    fields[tmpl->fields_nr].offset = offset;
+    fields[tmpl->fields_nr].width = width;
+    fields[tmpl->fields_nr].byte_order = byte_order;
+    fields[tmpl->fields_nr].flags = 0;
+    Template_linkChecksums(tmpl, tmpl->fields_nr);
+    index = tmpl->fields_nr++;
+
+end:
+    return index;
+}
+
+unsigned int Template_getSize(const Template_t *tmpl) {
+    return tmpl != NULL? tmpl->size: 0;
+}
+
+/* Writes value into buf as a field of width bytes. The common widths are
+ * done with a single store.
+ */
+static void Template_store(
+        uint8_t *buf,
+        uint64_t value,
+        unsigned int width,
+        unsigned int byte_order) {
+    uint16_t value16;
+    uint32_t value32;
+    unsigned int i;
+
+    if (byte_order == PROTOCOL_FIELD_BIG_ENDIAN) {
+        switch (width) {
+        case 1:
+            buf[0] = value;
+            break;
+        case 2:
+            value16 = htons(value);
+            memcpy(buf, &value16, 2);
+            break;
+        case 4:
+            value32 = htonl(value);
+            memcpy(buf, &value32, 4);
+            break;
+        default:
+            for (i = 0; i < width; i++) {
+                buf[width - i - 1] = value >> (i * 8);
+            }
+            break;
+        }
+    } else {
+        for (i = 0; i < width; i++) {
+            buf[i] = value >> (i * 8);
+        }
+    }
+}
+
+int Template_emit(
+        const Template_t *tmpl,
+        uint8_t *buf,
+        unsigned int size,
+        const TemplatePatch_t *patches,
+        unsigned int n) {
+    unsigned int i;
+    int written = 0;
+
+    if (tmpl == NULL
+            || buf == NULL
+            || size < tmpl->size
+            || (patches == NULL && n > 0)) {
+        goto end;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (patches[i].field >= tmpl->fields_nr) {
+            goto end;
+        }
+    }
+
+    memcpy(buf, tmpl->frame, tmpl->size);
+    Template_patch(tmpl, buf, patches, n);
+    written = tmpl->size;
+
+end:
+    return written;
+}
+
+int Template_patch(
+        const Template_t *tmpl,
+        uint8_t *frame,
+        const TemplatePatch_t *patches,
+        unsigned int n) {
+    const TemplateField_t *field, *csum_field;
+    uint8_t old[sizeof(uint64_t)];
+    uint16_t csum;
+    unsigned int i, j;
+    int res = -1;
+
+    if (tmpl == NULL || frame == NULL || (patches == NULL && n > 0)) {
+        goto end;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (patches[i].field >= tmpl->fields_nr) {
+            goto end;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        field = &tmpl->fields[patches[i].field];
+        memcpy(old, &frame[field->offset], field->width);
+        Template_store(
+                &frame[field->offset],
+                patches[i].value,
+                field->width,
+                field->byte_order);
+
+        for (j = 0; j < field->checksums_nr; j++) {
+            csum_field = &tmpl->fields[field->checksums[j]];
+            csum = frame[csum_field->offset] << 8
+                | frame[csum_field->offset + 1];
+            if (csum == 0
+                    && csum_field->flags & PROTOCOL_FIELD_CHECKSUM_OPTIONAL) {
+                continue;
+            }
+
+            csum = Checksum_update(
+                    csum,
+                    old,
+                    &frame[field->offset],
+                    field->width,
+                    field->odd & (1 << j));
+            if (csum == 0
+                    && csum_field->flags & PROTOCOL_FIELD_CHECKSUM_OPTIONAL) {
+                csum = 0xffff;
+            }
+
+            frame[csum_field->offset] = csum >> 8;
+            frame[csum_field->offset + 1] = csum & 0xff;
+        }
+    }
+
+    res = 0;
+
+end:
+    return res;
+}
@@ -0,0 +1,192 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+
+#include "libpacket/txring.h"
+
+#define FRAME_DATA_OFFSET (TPACKET2_HDRLEN - sizeof(struct sockaddr_ll))
+
+TxRing_t * TxRing_create(
+        int desc,
+        unsigned int frame_size,
+        unsigned int frame_nr) {
+    TxRing_t *ring = NULL;
+    struct tpacket_req req;
+    unsigned int page_size, frames_per_block;
+    int version = TPACKET_V2;
+    int err, ok = 0;
+
+    if (frame_size <= FRAME_DATA_OFFSET
+            || frame_size % TPACKET_ALIGNMENT != 0
+            || frame_nr == 0) {
+        printf("%s: invalid ring geometry\n", __FUNCTION__);
+        goto end;
+    }
+
+    ring = malloc(sizeof(TxRing_t));
+    if (ring == NULL) {
+        perror("malloc()");
+        goto end;
+    }
+
+    ring->map = MAP_FAILED;
+
+    err = setsockopt(desc, SOL_PACKET, PACKET_VERSION, &version, sizeof(version));
+    if (err) {
+        perror("setsockopt(PACKET_VERSION)");
+        goto end;
+    }
+
+    // Blocks must be a multiple of the page size and hold whole frames.
+    page_size = sysconf(_SC_PAGESIZE);
+    if (frame_size <= page_size) {
+        frames_per_block = page_size / frame_size;
+        req.tp_block_size = page_size;
+    } else {
+        frames_per_block = 1;
+        req.tp_block_size = (frame_size + page_size - 1) / page_size * page_size;
+    }
+
+    req.tp_frame_size = frame_size;
+    req.tp_block_nr = (frame_nr + frames_per_block - 1) / frames_per_block;
+    req.tp_frame_nr = req.tp_block_nr * frames_per_block;
+    err = setsockopt(desc, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req));
+    if (err) {
+        perror("setsockopt(PACKET_TX_RING)");
+        goto end;
+    }
+
+    ring->map_size = (size_t)req.tp_block_size * req.tp_block_nr;
+    ring->map = mmap(
+            NULL,
+            ring->map_size,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED,
+            desc,
+            0);
+    if (ring->map == MAP_FAILED) {
+        perror("mmap()");
+        goto end;
+    }
+
+    ring->block_size = req.tp_block_size;
+    ring->frames_per_block = frames_per_block;
+    ring->frame_size = frame_size;
+    ring->frame_nr = req.tp_frame_nr;
+    ring->head = 0;
+    ok = 1;
+
+end:
+    if (!ok && ring != NULL) {
+        free(ring);
+        ring = NULL;
+    }
+
+    return ring;
+}
+
+void TxRing_delete(TxRing_t *ring) {
+    if (ring != NULL) {
+        munmap(ring->map, ring->map_size);
+    }
+
+    free(ring);
+}
+
+/* Frames don't cross block boundaries, so when a block holds more than one
+ * frame there can be some unused bytes at the end of it.
+ */
+static struct tpacket2_hdr * TxRing_getHeader(
+        const TxRing_t *ring,
+        unsigned int index) {
+    return (struct tpacket2_hdr *)(ring->map
+            + (size_t)(index / ring->frames_per_block) * ring->block_size
+            + (index % ring->frames_per_block) * ring->frame_size);
+}
+
+uint8_t * TxRing_getFrame(TxRing_t *ring, unsigned int *size) {
+    struct tpacket2_hdr *hdr;
+    uint8_t *frame = NULL;
+
+    if (ring == NULL) {
+        goto end;
+    }
+
+    hdr = TxRing_getHeader(ring, ring->head);
+    switch (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE)) {
+    case TP_STATUS_AVAILABLE:
+    case TP_STATUS_WRONG_FORMAT:
+        frame = (uint8_t *)hdr + FRAME_DATA_OFFSET;
+        if (size != NULL) {
+            *size = ring->frame_size - FRAME_DATA_OFFSET;
+        }
+        break;
+    default:
+        break;
+    }
+
+end:
+    return frame;
+}
+
+int TxRing_commit(TxRing_t *ring, unsigned int length) {
+    struct tpacket2_hdr *hdr;
+    int res = -1;
+
+    if (ring == NULL || length > ring->frame_size - FRAME_DATA_OFFSET) {
+        goto end;
+    }
+
+    hdr = TxRing_getHeader(ring, ring->head);
+    hdr->tp_len = length;
+    __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+    ring->head = (ring->head + 1) % ring->frame_nr;
+    res = 0;
+
+end:
+    return res;
+}
+
+int TxRing_flush(TxRing_t *ring, int desc) {
+    int res = -1;
+
+    if (ring == NULL) {
+        goto end;
+    }
+
+    // A full device queue is not an error, the frames stay in the ring and
+    // go out with the next flush.
+    res = 0;
+    if (send(desc, NULL, 0, MSG_DONTWAIT) == -1) {
+        if (errno != EAGAIN && errno != ENOBUFS) {
+            perror("send()");
+            res = -1;
+            goto end;
+        }
+        res = 1;
+    }
+
+end:
+    return res;
+}
@@ -20,50 +20,104 @@
 #include <arpa/inet.h>
 
 #include "libpacket/udpv4.h"
+#include "libpacket/pool.h"
 #include "libpacket/packet.h"
+#include "libpacket/checksum.h"
 
 #define UDPV4_HEADER_LEN (8)
 
+static const ProtocolField_t udpv4_fields[] = {
+    {UDPV4_FIELD_SPORT, 0, 2, PROTOCOL_FIELD_BIG_ENDIAN, 0},
+    {UDPV4_FIELD_DPORT, 2, 2, PROTOCOL_FIELD_BIG_ENDIAN, 0},
+    {UDPV4_FIELD_LENGTH, 4, 2, PROTOCOL_FIELD_BIG_ENDIAN,
+        PROTOCOL_FIELD_PSEUDO_HEADER},
+    {UDPV4_FIELD_CHECKSUM, 6, 2, PROTOCOL_FIELD_BIG_ENDIAN,
+        PROTOCOL_FIELD_CHECKSUM
+            | PROTOCOL_FIELD_CHECKSUM_PAYLOAD
+            | PROTOCOL_FIELD_CHECKSUM_OPTIONAL},
+};
+
+static Pool_t udpv4_pool = POOL_INITIALIZER("Udpv4Proto", sizeof(Udpv4Proto_t));
+
+static const ProtocolOps_t udpv4_ops = {
+    .getSize = (Protocol_getSizeFunc_t)Udpv4Proto_getSize,
+    .getBitstream = (Protocol_getBitstreamFunc_t)Udpv4Proto_getBitstream,
+    .finalize = (Protocol_finalizeFunc_t)Udpv4Proto_finalize,
+    .getData = NULL,
+    .clone = (Protocol_cloneFunc_t)Udpv4Proto_clone,
+    .release = (Protocol_releaseFunc_t)Udpv4Proto_delete,
+    .fields = udpv4_fields,
+    .fields_nr = sizeof(udpv4_fields) / sizeof(udpv4_fields[0]),
+    .type = PROTOCOL_TYPE_UDPV4,
+};
+
+static void Udpv4Proto_init(
+        Udpv4Proto_t *proto,
+        uint16_t sport,
+        uint16_t dport,
+        uint16_t length,
+        uint16_t checksum) {
+    Protocol_init(&proto->base, &udpv4_ops, proto);
+    proto->sport = sport;
+    proto->dport = dport;
+    proto->length = length;
+    proto->checksum = checksum;
+}
+
 Udpv4Proto_t * Udpv4Proto_createWithParams(
         uint16_t sport,
         uint16_t dport,
         uint16_t length,
-        uint16_t checksum,
-        Protocol_t *proto_base) {
+        uint16_t checksum) {
     Udpv4Proto_t *proto;
 
-    proto = malloc(sizeof(Udpv4Proto_t));
+    proto = Pool_alloc(&udpv4_pool);
     if (proto == NULL) {
         goto end;
     }
 
-    proto->proto_base = proto_base;
-    if (proto_base != NULL) {
-        Protocol_setOwner(proto_base, proto);
-        Protocol_setGetSize(
-                proto_base,
-                (Protocol_getSizeFunc_t)Udpv4Proto_getSize);
-        Protocol_setGetBitstream(
-                proto_base,
-                (Protocol_getBitstreamFunc_t)Udpv4Proto_getBitstream);
-    }
-
-    proto->sport = sport;
-    proto->dport = dport;
-    proto->length = length;
-    proto->checksum = checksum;
+    Udpv4Proto_init(proto, sport, dport, length, checksum);
 
 end:
     return proto;
 }
 
 Udpv4Proto_t * Udpv4Proto_create() {
-    return Udpv4Proto_createWithParams(
-            0,
-            0,
-            UDPV4_HEADER_LEN,
-            0,
-            Protocol_create());
+    return Udpv4Proto_createWithParams(0, 0, UDPV4_HEADER_LEN, 0);
+}
+
+Udpv4Proto_t * Udpv4Proto_createInArena(Arena_t *arena) {
+    Udpv4Proto_t *proto;
+
+    proto = Arena_alloc(arena, sizeof(Udpv4Proto_t));
+    if (proto != NULL) {
+        Udpv4Proto_init(proto, 0, 0, UDPV4_HEADER_LEN, 0);
+    }
+
+    return proto;
+}
+
+Udpv4Proto_t * Udpv4Proto_clone(const Udpv4Proto_t *proto) {
+    Udpv4Proto_t *copy = NULL;
+
+    if (proto == NULL) {
+        goto end;
+    }
+
+    copy = Pool_alloc(&udpv4_pool);
+    if (copy != NULL) {
+        *copy = *proto;
+        Protocol_init(&copy->base, proto->base.ops, copy);
+    }
+
+end:
+    return copy;
+}
+
+void Udpv4Proto_delete(Udpv4Proto_t *proto) {
+    if (proto != NULL && Protocol_unref(&proto->base)) {
+        Pool_free(&udpv4_pool, proto);
+    }
 }
 
 unsigned int Udpv4Proto_getSize(const Udpv4Proto_t *proto) {
@@ -93,12 +147,132 @@ int Udpv4Proto_getBitstream(
     memcpy(buf+2, &dport, 2);
     memcpy(buf+4, &length, 2);
     memcpy(buf+6, &checksum, 2);
+    res = UDPV4_HEADER_LEN;
+
+end:
+    return res;
+}
+
+int Udpv4Proto_finalize(Udpv4Proto_t *proto, ProtocolFinalize_t *ctx) {
+    uint32_t sum;
+    uint16_t checksum;
+    int res = -1;
+
+    if (proto == NULL || ctx == NULL || ctx->hdr_size < UDPV4_HEADER_LEN) {
+        goto end;
+    }
+
+    res = 0;
+    if (!Udpv4Proto_hasComputedChecksum(proto, ctx->lower, ctx->lower_size)) {
+        goto end;
+    }
+
+    sum = Checksum_partial(&ctx->lower[12], 8, 0);
+    sum += ctx->lower[9];
+    sum += ctx->hdr[4] << 8 | ctx->hdr[5];
+    if (ctx->flags & PACKET_PARTIAL_CHECKSUM) {
+        checksum = Checksum_fold(sum);
+        goto store;
+    }
+
+    ctx->hdr[6] = ctx->hdr[7] = 0;
+    sum = Checksum_partial(ctx->hdr, ctx->hdr_size, sum);
+    sum = Checksum_combine(sum, ctx->payload_sum, 0);
+
+    checksum = ~Checksum_fold(sum);
+    if (checksum == 0) {
+        checksum = 0xffff;
+    }
+
+store:
+    ctx->hdr[6] = checksum >> 8;
+    ctx->hdr[7] = checksum & 0xff;
+
+end:
+    return res;
+}
+
+int Udpv4Proto_hasComputedChecksum(
+        const Udpv4Proto_t *proto,
+        const uint8_t *lower,
+        unsigned int lower_size) {
+    // Only datagrams on top of IPv4 get a checksum, the pseudo header comes
+    // from the IPv4 header below.
+    return proto != NULL
+        && proto->checksum == 0
+        && lower != NULL
+        && lower_size >= 20
+        && lower[0] >> 4 == 4;
+}
+
+int Udpv4Proto_updateChecksum(
+        uint8_t *hdr,
+        unsigned int offset,
+        const uint8_t *old,
+        const uint8_t *new,
+        unsigned int len) {
+    uint16_t checksum;
+    int res = -1;
+
+    if (hdr == NULL || old == NULL || new == NULL) {
+        goto end;
+    }
+
+    // A checksum of 0 means the sender didn't compute it, keep it that way.
+    // A computed checksum of 0 is sent as 0xffff instead.
+    checksum = hdr[6] << 8 | hdr[7];
+    if (checksum != 0) {
+        checksum = Checksum_update(checksum, old, new, len, offset % 2);
+        if (checksum == 0) {
+            checksum = 0xffff;
+        }
+
+        hdr[6] = checksum >> 8;
+        hdr[7] = checksum & 0xff;
+    }
+
+    res = 0;
 
 end:
     return res;
 }
 
 Protocol_t * Udpv4Proto_getProtoBase(const Udpv4Proto_t *proto) {
-    return proto != NULL? proto->proto_base: NULL;
+    return proto != NULL? (Protocol_t *)&proto->base: NULL;
+}
+
+int Udpv4Proto_setSport(Udpv4Proto_t *proto, uint16_t port) {
+    int res = -1;
+
+    if (proto != NULL) {
+        proto->sport = port;
+        Protocol_changed(&proto->base);
+        res = 0;
+    }
+
+    return res;
 }
 
+int Udpv4Proto_setDport(Udpv4Proto_t *proto, uint16_t port) {
+    int res = -1;
+
+    if (proto != NULL) {
+        proto->dport = port;
+        Protocol_changed(&proto->base);
+        res = 0;
+    }
+
+    return res;
+}
+
+int Udpv4Proto_setLength(Udpv4Proto_t *proto, uint16_t length) {
+    int res = -1;
+
+    if (proto != NULL) {
+        proto->length = length;
+        Protocol_changed(&proto->base);
+        res = 0;
+    }
+
+    return res;
+}
@@ -0,0 +1,421 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "libpacket/uring.h"
+
+static unsigned int roundPowerOfTwo(unsigned int n) {
+    unsigned int res = 1;
+
+    while (res < n) {
+        res <<= 1;
+    }
+
+    return res;
+}
+
+static void * Uring_map(int fd, size_t size, off_t offset) {
+    void *map;
+
+    map = mmap(
+            NULL,
+            size,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE,
+            fd,
+            offset);
+    if (map == MAP_FAILED) {
+        perror("mmap()");
+        map = NULL;
+    }
+
+    return map;
+}
+
+/* Maps the queues shared with the kernel. */
+static int Uring_mapQueues(Uring_t *uring, const struct io_uring_params *params) {
+    uint8_t *sq, *cq;
+    int res = -1;
+
+    uring->sq_map_size = params->sq_off.array
+        + params->sq_entries * sizeof(uint32_t);
+    uring->cq_map_size = params->cq_off.cqes
+        + params->cq_entries * sizeof(struct io_uring_cqe);
+
+    if (params->features & IORING_FEAT_SINGLE_MMAP) {
+        if (uring->cq_map_size > uring->sq_map_size) {
+            uring->sq_map_size = uring->cq_map_size;
+        }
+        uring->cq_map_size = 0;
+    }
+
+    uring->sq_map = Uring_map(uring->fd, uring->sq_map_size, IORING_OFF_SQ_RING);
+    if (uring->sq_map == NULL) {
+        goto end;
+    }
+
+    if (uring->cq_map_size != 0) {
+        uring->cq_map = Uring_map(uring->fd, uring->cq_map_size, IORING_OFF_CQ_RING);
+        if (uring->cq_map == NULL) {
+            goto end;
+        }
+    }
+
+    uring->sqes_size = params->sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes = Uring_map(uring->fd, uring->sqes_size, IORING_OFF_SQES);
+    if (uring->sqes == NULL) {
+        goto end;
+    }
+
+    sq = uring->sq_map;
+    cq = uring->cq_map != NULL? uring->cq_map: uring->sq_map;
+    uring->sq_head = (uint32_t *)(sq + params->sq_off.head);
+    uring->sq_tail = (uint32_t *)(sq + params->sq_off.tail);
+    uring->sq_array = (uint32_t *)(sq + params->sq_off.array);
+    uring->sq_mask = *(uint32_t *)(sq + params->sq_off.ring_mask);
+    uring->sq_cached = *uring->sq_tail;
+    uring->cq_head = (uint32_t *)(cq + params->cq_off.head);
+    uring->cq_tail = (uint32_t *)(cq + params->cq_off.tail);
+    uring->cq_mask = *(uint32_t *)(cq + params->cq_off.ring_mask);
+    uring->cqes = cq + params->cq_off.cqes;
+    res = 0;
+
+end:
+    return res;
+}
+
+/* Submits what is queued and, if min isn't 0, waits for min completions. A
+ * busy kernel isn't an error, whatever wasn't submitted is left for the next
+ * call.
+ */
+static int Uring_enter(Uring_t *uring, unsigned int min) {
+    int ret, res = -1;
+
+    do {
+        ret = syscall(
+                __NR_io_uring_enter,
+                uring->fd,
+                uring->to_submit,
+                min,
+                min != 0? IORING_ENTER_GETEVENTS: 0,
+                NULL,
+                0);
+    } while (ret == -1 && errno == EINTR);
+
+    if (ret == -1) {
+        if (errno != EAGAIN && errno != EBUSY) {
+            perror("io_uring_enter()");
+            goto end;
+        }
+        ret = 0;
+    }
+
+    uring->to_submit -= ret;
+    res = 0;
+
+end:
+    return res;
+}
+
+Uring_t * Uring_create(
+        int desc,
+        unsigned int frame_size,
+        unsigned int frame_nr,
+        unsigned int flags) {
+    Uring_t *uring = NULL;
+    struct io_uring_params params;
+    struct iovec iov;
+    unsigned int i;
+    int ok = 0;
+
+    uring = calloc(1, sizeof(Uring_t));
+    if (uring == NULL) {
+        perror("calloc()");
+        goto end;
+    }
+
+    frame_nr = roundPowerOfTwo(frame_nr);
+    uring->fd = -1;
+    uring->desc = desc;
+    uring->flags = flags;
+    uring->frame_size = frame_size;
+    uring->frame_nr = frame_nr;
+
+    // The completion queue is twice as big, so it can't overflow even with
+    // every frame in flight.
+    memset(&params, 0, sizeof(params));
+    uring->fd = syscall(__NR_io_uring_setup, frame_nr, &params);
+    if (uring->fd == -1) {
+        perror("io_uring_setup()");
+        goto end;
+    }
+
+    if (Uring_mapQueues(uring, &params)) {
+        goto end;
+    }
+
+    uring->frames_size = (size_t)frame_size * frame_nr;
+    uring->frames = mmap(
+            NULL,
+            uring->frames_size,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,
+            -1,
+            0);
+    if (uring->frames == MAP_FAILED) {
+        perror("mmap()");
+        uring->frames = NULL;
+        goto end;
+    }
+
+    uring->free_frames = malloc(sizeof(unsigned int) * frame_nr);
+    uring->seqs = malloc(sizeof(uint64_t) * frame_nr);
+    if (uring->free_frames == NULL || uring->seqs == NULL) {
+        perror("malloc()");
+        goto end;
+    }
+
+    // Popped from the end, so frames are used in order at first.
+    for (i = 0; i < frame_nr; i++) {
+        uring->free_frames[i] = frame_nr - 1 - i;
+    }
+
+    uring->free_nr = frame_nr;
+
+    if ((flags & URING_FLAG_FIXED_FILE)
+            && syscall(
+                __NR_io_uring_register,
+                uring->fd,
+                IORING_REGISTER_FILES,
+                &desc,
+                1)) {
+        perror("io_uring_register(IORING_REGISTER_FILES)");
+        goto end;
+    }
+
+    iov.iov_base = uring->frames;
+    iov.iov_len = uring->frames_size;
+    if ((flags & URING_FLAG_FIXED_BUFFERS)
+            && syscall(
+                __NR_io_uring_register,
+                uring->fd,
+                IORING_REGISTER_BUFFERS,
+                &iov,
+                1)) {
+        perror("io_uring_register(IORING_REGISTER_BUFFERS)");
+        goto end;
+    }
+
+    ok = 1;
+
+end:
+    if (!ok && uring != NULL) {
+        Uring_delete(uring);
+        uring = NULL;
+    }
+
+    return uring;
+}
+
+void Uring_delete(Uring_t *uring) {
+    if (uring != NULL) {
+        // The kernel may still be reading frames in flight.
+        while (uring->free_nr != uring->frame_nr
+                && uring->fd != -1
+                && Uring_reap(uring, uring->frame_nr) > 0) {
+        }
+
+        if (uring->sqes != NULL) {
+            munmap(uring->sqes, uring->sqes_size);
+        }
+
+        if (uring->cq_map != NULL) {
+            munmap(uring->cq_map, uring->cq_map_size);
+        }
+
+        if (uring->sq_map != NULL) {
+            munmap(uring->sq_map, uring->sq_map_size);
+        }
+
+        if (uring->fd != -1) {
+            close(uring->fd);
+        }
+
+        if (uring->frames != NULL) {
+            munmap(uring->frames, uring->frames_size);
+        }
+
+        free(uring->free_frames);
+        free(uring->seqs);
+    }
+
+    free(uring);
+}
+
+int Uring_setCallback(Uring_t *uring, Uring_completionFunc_t callback, void *arg) {
+    int res = -1;
+
+    if (uring == NULL) {
+        goto end;
+    }
+
+    uring->callback = callback;
+    uring->arg = arg;
+    res = 0;
+
+end:
+    return res;
+}
+
+uint8_t * Uring_getFrame(Uring_t *uring, unsigned int *size) {
+    uint8_t *frame = NULL;
+
+    if (uring == NULL) {
+        goto end;
+    }
+
+    if (uring->free_nr == 0) {
+        Uring_reap(uring, 0);
+    }
+
+    if (uring->free_nr == 0) {
+        goto end;
+    }
+
+    frame = &uring->frames[
+        (size_t)uring->free_frames[uring->free_nr - 1] * uring->frame_size];
+    if (size != NULL) {
+        *size = uring->frame_size;
+    }
+
+end:
+    return frame;
+}
+
+int Uring_commit(Uring_t *uring, unsigned int length) {
+    struct io_uring_sqe *sqe;
+    unsigned int index, slot;
+    int res = -1;
+
+    if (uring == NULL || uring->free_nr == 0 || length > uring->frame_size) {
+        goto end;
+    }
+
+    index = uring->free_frames[--uring->free_nr];
+    slot = uring->sq_cached & uring->sq_mask;
+    sqe = &((struct io_uring_sqe *)uring->sqes)[slot];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+    // A write on a socket is a send() without flags, and only writes can
+    // use registered buffers. The offset must be 0 for sockets.
+    if (uring->flags & URING_FLAG_FIXED_BUFFERS) {
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->buf_index = 0;
+    } else {
+        sqe->opcode = IORING_OP_SEND;
+    }
+
+    if (uring->flags & URING_FLAG_FIXED_FILE) {
+        sqe->fd = 0;
+        sqe->flags = IOSQE_FIXED_FILE;
+    } else {
+        sqe->fd = uring->desc;
+    }
+
+    sqe->addr = (uint64_t)(uintptr_t)&uring->frames[(size_t)index * uring->frame_size];
+    sqe->len = length;
+    sqe->user_data = index;
+
+    uring->seqs[index] = uring->seq++;
+    uring->sq_array[slot] = slot;
+    __atomic_store_n(uring->sq_tail, ++uring->sq_cached, __ATOMIC_RELEASE);
+    uring->to_submit++;
+    res = 0;
+
+end:
+    return res;
+}
+
+int Uring_flush(Uring_t *uring) {
+    int res = -1;
+
+    if (uring == NULL) {
+        goto end;
+    }
+
+    res = Uring_reap(uring, 0) < 0? -1: 0;
+
+end:
+    return res;
+}
+
+int Uring_reap(Uring_t *uring, unsigned int min) {
+    struct io_uring_cqe *cqe;
+    unsigned int in_flight, index;
+    uint32_t head, tail;
+    int res = -1;
+
+    if (uring == NULL) {
+        goto end;
+    }
+
+    in_flight = uring->frame_nr - uring->free_nr;
+    if (min > in_flight) {
+        min = in_flight;
+    }
+
+    head = *uring->cq_head;
+    tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+    if (uring->to_submit != 0 || tail - head < min) {
+        if (Uring_enter(uring, tail - head < min? min: 0)) {
+            goto end;
+        }
+
+        tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+    }
+
+    while (head != tail) {
+        cqe = &((struct io_uring_cqe *)uring->cqes)[head & uring->cq_mask];
+        index = cqe->user_data;
+        uring->free_frames[uring->free_nr++] = index;
+        uring->completed++;
+        if (cqe->res < 0) {
+            uring->errors++;
+            uring->congested |= cqe->res == -ENOBUFS;
+        }
+
+        if (uring->callback != NULL) {
+            uring->callback(uring->arg, uring->seqs[index], cqe->res);
+        }
+
+        head++;
+    }
+
+    __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+    res = uring->frame_nr - uring->free_nr;
+
+end:
+    return res;
+}
@@ -0,0 +1,292 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/if_xdp.h>
+
+#include "libpacket/xsk.h"
+
+static unsigned int roundPowerOfTwo(unsigned int n) {
+    unsigned int res = 1;
+
+    while (res < n) {
+        res <<= 1;
+    }
+
+    return res;
+}
+
+static int XskRing_map(
+        XskRing_t *ring,
+        int desc,
+        const struct xdp_ring_offset *off,
+        uint32_t size,
+        size_t desc_size,
+        off_t pgoff) {
+    int res = -1;
+
+    ring->map_size = off->desc + size * desc_size;
+    ring->map = mmap(
+            NULL,
+            ring->map_size,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE,
+            desc,
+            pgoff);
+    if (ring->map == MAP_FAILED) {
+        perror("mmap()");
+        ring->map = NULL;
+        goto end;
+    }
+
+    ring->producer = (uint32_t *)((uint8_t *)ring->map + off->producer);
+    ring->consumer = (uint32_t *)((uint8_t *)ring->map + off->consumer);
+    ring->flags = (uint32_t *)((uint8_t *)ring->map + off->flags);
+    ring->descs = (uint8_t *)ring->map + off->desc;
+    ring->size = size;
+    ring->mask = size - 1;
+    ring->cached = 0;
+    res = 0;
+
+end:
+    return res;
+}
+
+static void XskRing_unmap(XskRing_t *ring) {
+    if (ring->map != NULL) {
+        munmap(ring->map, ring->map_size);
+    }
+}
+
+/* Moves the frames the kernel is done with back to the free stack. */
+static void Xsk_recycle(Xsk_t *xsk) {
+    uint32_t producer;
+    uint64_t *addrs = xsk->comp.descs;
+
+    producer = __atomic_load_n(xsk->comp.producer, __ATOMIC_ACQUIRE);
+    while (xsk->comp.cached != producer) {
+        xsk->free_frames[xsk->free_nr++] =
+            addrs[xsk->comp.cached++ & xsk->comp.mask];
+    }
+
+    __atomic_store_n(xsk->comp.consumer, xsk->comp.cached, __ATOMIC_RELEASE);
+}
+
+Xsk_t * Xsk_create(
+        int desc,
+        int ifindex,
+        unsigned int queue,
+        unsigned int frame_size,
+        unsigned int frame_nr,
+        unsigned int flags) {
+    Xsk_t *xsk = NULL;
+    struct xdp_umem_reg umem_reg = {0};
+    struct xdp_mmap_offsets off;
+    struct sockaddr_xdp addr = {0};
+    socklen_t optlen;
+    unsigned int i;
+    int err, ok = 0;
+
+    xsk = calloc(1, sizeof(Xsk_t));
+    if (xsk == NULL) {
+        perror("calloc()");
+        goto end;
+    }
+
+    frame_nr = roundPowerOfTwo(frame_nr);
+    xsk->frame_size = frame_size;
+    xsk->frame_nr = frame_nr;
+    xsk->umem_size = (size_t)frame_size * frame_nr;
+    xsk->umem = mmap(
+            NULL,
+            xsk->umem_size,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,
+            -1,
+            0);
+    if (xsk->umem == MAP_FAILED) {
+        perror("mmap()");
+        xsk->umem = NULL;
+        goto end;
+    }
+
+    xsk->free_frames = malloc(sizeof(uint64_t) * frame_nr);
+    if (xsk->free_frames == NULL) {
+        perror("malloc()");
+        goto end;
+    }
+
+    for (i = 0; i < frame_nr; i++) {
+        xsk->free_frames[i] = (uint64_t)i * frame_size;
+    }
+
+    xsk->free_nr = frame_nr;
+
+    umem_reg.addr = (uint64_t)(uintptr_t)xsk->umem;
+    umem_reg.len = xsk->umem_size;
+    umem_reg.chunk_size = frame_size;
+    umem_reg.headroom = 0;
+    err = setsockopt(desc, SOL_XDP, XDP_UMEM_REG, &umem_reg, sizeof(umem_reg));
+    if (err) {
+        perror("setsockopt(XDP_UMEM_REG)");
+        goto end;
+    }
+
+    // The completion ring must be able to hold every frame in flight.
+    err = setsockopt(desc, SOL_XDP, XDP_UMEM_FILL_RING, &frame_nr, sizeof(frame_nr))
+        || setsockopt(desc, SOL_XDP, XDP_UMEM_COMPLETION_RING, &frame_nr, sizeof(frame_nr))
+        || setsockopt(desc, SOL_XDP, XDP_TX_RING, &frame_nr, sizeof(frame_nr));
+    if (err) {
+        perror("setsockopt(XDP_*_RING)");
+        goto end;
+    }
+
+    optlen = sizeof(off);
+    err = getsockopt(desc, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen);
+    if (err) {
+        perror("getsockopt(XDP_MMAP_OFFSETS)");
+        goto end;
+    }
+
+    if (XskRing_map(&xsk->fill, desc, &off.fr, frame_nr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING)
+            || XskRing_map(&xsk->comp, desc, &off.cr, frame_nr, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING)
+            || XskRing_map(&xsk->tx, desc, &off.tx, frame_nr, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING)) {
+        goto end;
+    }
+
+    addr.sxdp_family = AF_XDP;
+    addr.sxdp_flags = flags | XDP_USE_NEED_WAKEUP;
+    addr.sxdp_ifindex = ifindex;
+    addr.sxdp_queue_id = queue;
+    err = bind(desc, (const struct sockaddr *)&addr, sizeof(addr));
+    if (err) {
+        perror("bind()");
+        goto end;
+    }
+
+    ok = 1;
+
+end:
+    if (!ok && xsk != NULL) {
+        Xsk_delete(xsk);
+        xsk = NULL;
+    }
+
+    return xsk;
+}
+
+void Xsk_delete(Xsk_t *xsk) {
+    if (xsk != NULL) {
+        XskRing_unmap(&xsk->fill);
+        XskRing_unmap(&xsk->comp);
+        XskRing_unmap(&xsk->tx);
+        if (xsk->umem != NULL) {
+            munmap(xsk->umem, xsk->umem_size);
+        }
+
+        free(xsk->free_frames);
+    }
+
+    free(xsk);
+}
+
+uint8_t * Xsk_getFrame(Xsk_t *xsk, unsigned int *size) {
+    uint8_t *frame = NULL;
+    uint32_t consumer;
+
+    if (xsk == NULL) {
+        goto end;
+    }
+
+    if (xsk->free_nr == 0) {
+        Xsk_recycle(xsk);
+    }
+
+    consumer = __atomic_load_n(xsk->tx.consumer, __ATOMIC_ACQUIRE);
+    if (xsk->free_nr == 0 || xsk->tx.cached - consumer >= xsk->tx.size) {
+        goto end;
+    }
+
+    frame = xsk->umem + xsk->free_frames[xsk->free_nr - 1];
+    if (size != NULL) {
+        *size = xsk->frame_size;
+    }
+
+end:
+    return frame;
+}
+
+int Xsk_commit(Xsk_t *xsk, unsigned int length) {
+    struct xdp_desc *descs;
+    int res = -1;
+
+    if (xsk == NULL || xsk->free_nr == 0 || length > xsk->frame_size) {
+        goto end;
+    }
+
+    descs = xsk->tx.descs;
+    descs[xsk->tx.cached & xsk->tx.mask].addr =
+        xsk->free_frames[--xsk->free_nr];
+    descs[xsk->tx.cached & xsk->tx.mask].len = length;
+    descs[xsk->tx.cached & xsk->tx.mask].options = 0;
+    __atomic_store_n(xsk->tx.producer, ++xsk->tx.cached, __ATOMIC_RELEASE);
+    res = 0;
+
+end:
+    return res;
+}
+
+int Xsk_flush(Xsk_t *xsk, int desc) {
+    uint32_t before, after;
+    int res = -1;
+
+    if (xsk == NULL) {
+        goto end;
+    }
+
+    // In copy mode every wake up only sends a limited number of frames, so
+    // keep going while the kernel makes progress.
+    do {
+        if (!(__atomic_load_n(xsk->tx.flags, __ATOMIC_ACQUIRE)
+                    & XDP_RING_NEED_WAKEUP)) {
+            break;
+        }
+
+        before = __atomic_load_n(xsk->tx.consumer, __ATOMIC_ACQUIRE);
+        if (sendto(desc, NULL, 0, MSG_DONTWAIT, NULL, 0) == -1
+                && errno != EAGAIN
+                && errno != EBUSY
+                && errno != ENOBUFS
+                && errno != ENETDOWN) {
+            perror("sendto()");
+            goto end;
+        }
+
+        after = __atomic_load_n(xsk->tx.consumer, __ATOMIC_ACQUIRE);
+    } while (after != before && after != xsk->tx.cached);
+
+    Xsk_recycle(xsk);
+    res = 0;
+
+end:
+    return res;
+}
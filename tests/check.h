@@ -0,0 +1,41 @@
+/* 
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef __LIBPACKET_TESTS_CHECK
+#define __LIBPACKET_TESTS_CHECK
+
+/* The bare minimum to write the tests: CHECK() reports a failed condition
+ * and keeps going, CHECK_RESULT() is what main() returns.
+ */
+
+#include <stdio.h>
+
+static int check_failures;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            check_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_RESULT(name) \
+    (printf("%s: %s\n", (name), check_failures == 0? "ok": "FAILED"), \
+     check_failures != 0)
+
+#endif
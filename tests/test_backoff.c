@@ -0,0 +1,130 @@
+/*
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/* Waits on a non-blocking Socket of the loopback interface as an application
+ * does after an injection failed with ENOBUFS. The loopback interface never
+ * refuses a frame, so the congestion such a failure leaves is set by hand.
+ * Every wait must sleep twice as long as the previous one, up to a cap, a
+ * timeout must cut it short, and a packet going through must start it over.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <net/ethernet.h>
+
+#include "libpacket/socket.h"
+#include "libpacket/packet.h"
+#include "libpacket/ether.h"
+#include "libpacket/raw.h"
+
+#include "check.h"
+
+#define WAITS (20)
+
+/* Microseconds elapsed since start. */
+static long elapsed(const struct timespec *start) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000L
+        + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+int main() {
+    static const uint8_t payload[46] = "libpacket backoff";
+    const Packet_t *packs[1];
+    SocketParams_t params;
+    struct timespec start;
+    EtherProto_t *ether;
+    RawProto_t *raw;
+    Packet_t *pack;
+    Socket_t *sock;
+    unsigned int i, first, backoff;
+
+    memset(&params, 0, sizeof(params));
+    params.backend = SOCKET_BACKEND_SENDTO;
+    params.flags = SOCKET_FLAG_NONBLOCK;
+    sock = Socket_createWithParams("lo", &params);
+    if (sock == NULL) {
+        printf("backoff: skipped, can't inject on lo (%s)\n", strerror(errno));
+        return 0;
+    }
+
+    pack = Packet_create();
+    ether = EtherProto_create();
+    raw = RawProto_createWithParams(payload, sizeof(payload));
+    Packet_stack(pack, EtherProto_getProtoBase(ether));
+    Packet_stack(pack, RawProto_getProtoBase(raw));
+    EtherProto_setType(ether, 0x88b5);
+    packs[0] = pack;
+
+    // Nothing refused yet, the socket is writable.
+    CHECK(!sock->congested);
+    CHECK(Socket_wait(sock, 0) == 1);
+    first = sock->backoff;
+    CHECK(first > 0);
+
+    // Not waiting at all, it's still congested.
+    sock->congested = 1;
+    CHECK(Socket_wait(sock, 0) == 0);
+    CHECK(sock->congested);
+    CHECK(sock->backoff == first);
+
+    // The queue stays full, every wait is twice as long until the cap.
+    for (i = 0; i < WAITS; i++) {
+        backoff = sock->backoff;
+        sock->congested = 1;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        CHECK(Socket_wait(sock, -1) == 1);
+        CHECK(elapsed(&start) >= backoff);
+        CHECK(!sock->congested);
+        CHECK(sock->backoff >= backoff && sock->backoff <= backoff * 2);
+        if (i == 0) {
+            CHECK(sock->backoff == first * 2);
+        }
+    }
+    CHECK(sock->backoff > first);
+    CHECK(sock->backoff <= 1000000);
+
+    // A timeout shorter than the backoff returns early, still congested.
+    backoff = sock->backoff;
+    sock->congested = 1;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHECK(Socket_wait(sock, 1) == 0);
+    CHECK(elapsed(&start) >= 1000);
+    CHECK(elapsed(&start) < backoff);
+    CHECK(sock->congested);
+    CHECK(sock->backoff == backoff);
+
+    // A packet that goes through starts the backoff over.
+    sock->congested = 0;
+    CHECK(Socket_inject(sock, pack) == (int)Packet_getSize(pack));
+    CHECK(sock->backoff == first);
+
+    sock->congested = 1;
+    CHECK(Socket_wait(sock, -1) == 1);
+    CHECK(sock->backoff == first * 2);
+    CHECK(Socket_injectBatch(sock, packs, 1, NULL) == 1);
+    CHECK(sock->backoff == first);
+
+    Packet_delete(pack);
+    EtherProto_delete(ether);
+    RawProto_delete(raw);
+    Socket_delete(sock);
+    return CHECK_RESULT("backoff");
+}
@@ -0,0 +1,262 @@
+/*
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/* Serializes a PacketBatch of Ether - IPv4 - UDPv4 - payload Packets of
+ * different sizes and checks that every one of them lies back to back in the
+ * buffer of the batch, as Packet_getBitstream() writes it. Payloads grow and
+ * shrink between bursts. The batch is then injected on the loopback
+ * interface, where every packet must be captured as it lies in the batch.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+
+#include "libpacket/batch.h"
+#include "libpacket/socket.h"
+#include "libpacket/packet.h"
+#include "libpacket/ether.h"
+#include "libpacket/ipv4.h"
+#include "libpacket/udpv4.h"
+#include "libpacket/raw.h"
+
+#include "check.h"
+
+#define PACKETS (5)
+#define FRAME_MAX (2048)
+
+typedef struct Flow {
+    Packet_t *pack;
+    EtherProto_t *ether;
+    Ipv4Proto_t *ipv4;
+    Udpv4Proto_t *udpv4;
+    RawProto_t *raw;
+} Flow_t;
+
+static uint8_t payload[1400];
+
+/* Gives the payload of a flow length bytes and fixes the lengths below it. */
+static void set_payload(Flow_t *flow, unsigned int length) {
+    RawProto_setData(flow->raw, payload, length);
+    Udpv4Proto_setLength(flow->udpv4, UDPV4_HEADER_LEN + length);
+    Ipv4Proto_setLength(flow->ipv4, 20 + UDPV4_HEADER_LEN + length);
+}
+
+static void create_flow(Flow_t *flow, unsigned int index) {
+    flow->pack = Packet_create();
+    flow->ether = EtherProto_create();
+    flow->ipv4 = Ipv4Proto_create();
+    flow->udpv4 = Udpv4Proto_create();
+    flow->raw = RawProto_create();
+    Packet_stack(flow->pack, EtherProto_getProtoBase(flow->ether));
+    Packet_stack(flow->pack, Ipv4Proto_getProtoBase(flow->ipv4));
+    Packet_stack(flow->pack, Udpv4Proto_getProtoBase(flow->udpv4));
+    Packet_stack(flow->pack, RawProto_getProtoBase(flow->raw));
+    EtherProto_setType(flow->ether, ETHERTYPE_IP);
+    Ipv4Proto_setProtocol(flow->ipv4, 17);
+    Ipv4Proto_setSaddr(flow->ipv4, 0x0a000001 + index);
+    Udpv4Proto_setSport(flow->udpv4, 1000 + index);
+    set_payload(flow, 1 + index * 37);
+}
+
+static void delete_flow(Flow_t *flow) {
+    Packet_delete(flow->pack);
+    EtherProto_delete(flow->ether);
+    Ipv4Proto_delete(flow->ipv4);
+    Udpv4Proto_delete(flow->udpv4);
+    RawProto_delete(flow->raw);
+}
+
+/* Serializes the batch with flags and checks every packet in it. */
+static void check_batch(PacketBatch_t *batch, Flow_t *flows, unsigned int flags) {
+    uint8_t expected[FRAME_MAX];
+    const unsigned int *offsets, *lens;
+    const uint8_t * const *bufs;
+    const uint8_t *buf, *data;
+    unsigned int i, length, total = 0;
+    size_t buf_length = 0;
+    int size;
+
+    size = PacketBatch_serialize(batch, flags);
+    buf = PacketBatch_getBuffer(batch, &buf_length);
+    offsets = PacketBatch_getOffsets(batch);
+    lens = PacketBatch_getLengths(batch);
+    bufs = PacketBatch_getPackets(batch);
+    CHECK(size > 0 && buf != NULL && offsets != NULL && lens != NULL && bufs != NULL);
+    if (size <= 0 || buf == NULL || offsets == NULL || lens == NULL || bufs == NULL) {
+        return;
+    }
+
+    CHECK((size_t)size == buf_length);
+    CHECK(((uintptr_t)buf % PACKET_BATCH_ALIGN) == 0);
+    for (i = 0; i < PACKETS; i++) {
+        size = Packet_getBitstreamWithFlags(
+                flows[i].pack,
+                expected,
+                sizeof(expected),
+                flags);
+        data = PacketBatch_getPacketData(batch, i, &length);
+        CHECK(size == (int)length);
+        CHECK(offsets[i] == total);
+        CHECK(bufs[i] == &buf[total]);
+        CHECK(data == bufs[i]);
+        CHECK(length == Packet_getSize(flows[i].pack));
+        CHECK(lens[i] == length);
+        CHECK(data != NULL && memcmp(data, expected, length) == 0);
+        total += length;
+    }
+
+    CHECK(total == buf_length);
+}
+
+/* Opens a raw socket capturing the IPv4 frames received on the loopback
+ * interface. Returns it or -1.
+ */
+static int open_capture(void) {
+    struct sockaddr_ll addr;
+    struct timeval tv;
+    int desc;
+
+    desc = socket(AF_PACKET, SOCK_RAW, htons(ETHERTYPE_IP));
+    if (desc == -1) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETHERTYPE_IP);
+    addr.sll_ifindex = if_nametoindex("lo");
+    tv.tv_sec = 0;
+    tv.tv_usec = 200000;
+    if (setsockopt(desc, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv))
+            || bind(desc, (struct sockaddr *)&addr, sizeof(addr))) {
+        close(desc);
+        return -1;
+    }
+
+    return desc;
+}
+
+/* Whether a frame comes from one of the flows, by its source address. */
+static int from_flows(const uint8_t *frame, ssize_t len) {
+    const uint8_t *saddr = &frame[ETH_HLEN + 12];
+
+    return len >= ETH_HLEN + 20
+        && saddr[0] == 10 && saddr[1] == 0 && saddr[2] == 0
+        && saddr[3] >= 1 && saddr[3] <= PACKETS;
+}
+
+/* Injects the batch and checks every packet of it is captured, in order.
+ * Other frames on the interface are skipped.
+ */
+static void check_injected(Socket_t *sock, int capture, PacketBatch_t *batch) {
+    uint8_t frame[FRAME_MAX];
+    const uint8_t *data;
+    int results[PACKETS];
+    unsigned int i, length;
+    ssize_t len;
+
+    CHECK(Socket_injectPacketBatch(sock, batch, results) == PACKETS);
+    for (i = 0; i < PACKETS; i++) {
+        data = PacketBatch_getPacketData(batch, i, &length);
+        CHECK(data != NULL && results[i] == (int)length);
+        do {
+            len = recv(capture, frame, sizeof(frame), 0);
+        } while (len > 0 && !from_flows(frame, len));
+
+        CHECK(data != NULL && len == (ssize_t)length);
+        CHECK(data != NULL
+                && len == (ssize_t)length
+                && memcmp(frame, data, length) == 0);
+    }
+}
+
+int main() {
+    Flow_t flows[PACKETS];
+    PacketBatch_t *batch;
+    Socket_t *sock;
+    unsigned int i;
+    int capture;
+
+    memset(payload, 0xa5, sizeof(payload));
+
+    // Smaller than needed, it has to grow too.
+    batch = PacketBatch_createWithParams(2);
+    CHECK(batch != NULL);
+    for (i = 0; i < PACKETS; i++) {
+        create_flow(&flows[i], i);
+        CHECK(PacketBatch_add(batch, flows[i].pack) == 0);
+    }
+    CHECK(PacketBatch_getNumPackets(batch) == PACKETS);
+    CHECK(PacketBatch_getBuffer(batch, NULL) == NULL);
+
+    check_batch(batch, flows, 0);
+
+    // One grows past the buffer, as Socket and Pacer do, the size is asked
+    // for before the next burst.
+    set_payload(&flows[1], sizeof(payload));
+    Packet_getSize(flows[1].pack);
+    check_batch(batch, flows, 0);
+
+    // Another one shrinks, the packets above it move down.
+    set_payload(&flows[3], 3);
+    Udpv4Proto_setDport(flows[0].udpv4, 53);
+    check_batch(batch, flows, 0);
+    check_batch(batch, flows, PACKET_PARTIAL_CHECKSUM);
+
+    capture = open_capture();
+    sock = capture != -1? Socket_create("lo"): NULL;
+    if (sock != NULL) {
+        check_injected(sock, capture, batch);
+
+        // Not serialized, it's serialized when injected.
+        set_payload(&flows[2], 600);
+        PacketBatch_clear(batch);
+        for (i = 0; i < PACKETS; i++) {
+            CHECK(PacketBatch_add(batch, flows[i].pack) == 0);
+        }
+        check_injected(sock, capture, batch);
+        check_batch(batch, flows, 0);
+        Socket_delete(sock);
+    } else {
+        printf("batch: can't inject on lo, only serializing (%s)\n", strerror(errno));
+    }
+
+    if (capture != -1) {
+        close(capture);
+    }
+
+    // Adding a packet unserializes the batch.
+    CHECK(PacketBatch_add(batch, flows[0].pack) == 0);
+    CHECK(PacketBatch_getPackets(batch) == NULL);
+
+    PacketBatch_clear(batch);
+    CHECK(PacketBatch_getNumPackets(batch) == 0);
+    CHECK(PacketBatch_serialize(batch, 0) == 0);
+
+    PacketBatch_delete(batch);
+    for (i = 0; i < PACKETS; i++) {
+        delete_flow(&flows[i]);
+    }
+    return CHECK_RESULT("batch");
+}
@@ -0,0 +1,141 @@
+/*
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/* Clones an Ether - IPv4 - UDPv4 - payload Packet twice and changes a layer
+ * of one clone. Only that clone must see the change, in its image as well as
+ * in a fresh serialization, while the base Packet and the other clone keep
+ * sharing the layer untouched. The base Packet then changes the same layer,
+ * which must not reach the other clone either.
+ */
+
+#include <string.h>
+#include <net/ethernet.h>
+
+#include "libpacket/packet.h"
+#include "libpacket/ether.h"
+#include "libpacket/ipv4.h"
+#include "libpacket/udpv4.h"
+#include "libpacket/raw.h"
+
+#include "check.h"
+
+#define PAYLOAD_LEN (26)
+
+/* Checks the image of pack, and pack serialized again, against expected. */
+static void check_frame(const Packet_t *pack, const uint8_t *expected, int size) {
+    uint8_t frame[128];
+    const uint8_t *image;
+    unsigned int image_size = 0;
+
+    image = Packet_getImage(pack, 0, &image_size);
+    CHECK(image != NULL && (int)image_size == size);
+    CHECK(image != NULL && memcmp(image, expected, size) == 0);
+    CHECK(Packet_getBitstream(pack, frame, sizeof(frame)) == size);
+    CHECK(memcmp(frame, expected, size) == 0);
+}
+
+int main() {
+    static const uint8_t payload[PAYLOAD_LEN] = "the payload of the clones";
+    uint8_t base_frame[128], changed_frame[128];
+    EtherProto_t *ether;
+    Ipv4Proto_t *ipv4;
+    Udpv4Proto_t *udpv4;
+    RawProto_t *raw;
+    Packet_t *pack, *changed, *untouched;
+    Protocol_t *layer, *base_layer;
+    int size;
+
+    pack = Packet_create();
+    ether = EtherProto_create();
+    ipv4 = Ipv4Proto_create();
+    udpv4 = Udpv4Proto_createWithParams(
+            1234,
+            5678,
+            UDPV4_HEADER_LEN + PAYLOAD_LEN,
+            0);
+    raw = RawProto_createWithParams(payload, PAYLOAD_LEN);
+    CHECK(pack != NULL && ether != NULL && ipv4 != NULL && udpv4 != NULL && raw != NULL);
+
+    Packet_stack(pack, EtherProto_getProtoBase(ether));
+    Packet_stack(pack, Ipv4Proto_getProtoBase(ipv4));
+    Packet_stack(pack, Udpv4Proto_getProtoBase(udpv4));
+    Packet_stack(pack, RawProto_getProtoBase(raw));
+    EtherProto_setType(ether, ETHERTYPE_IP);
+    Ipv4Proto_setProtocol(ipv4, 17);
+    Ipv4Proto_setLength(ipv4, 20 + UDPV4_HEADER_LEN + PAYLOAD_LEN);
+
+    // The frame expected from the changed clone, before there is any clone.
+    Udpv4Proto_setSport(udpv4, 4242);
+    size = Packet_getBitstream(pack, changed_frame, sizeof(changed_frame));
+    Udpv4Proto_setSport(udpv4, 1234);
+    CHECK(size > 0);
+    CHECK(Packet_getBitstream(pack, base_frame, sizeof(base_frame)) == size);
+    CHECK(memcmp(base_frame, changed_frame, size) != 0);
+
+    // Not shared yet, it's written in place.
+    CHECK(Packet_getLayerForWrite(pack, 2) == Udpv4Proto_getProtoBase(udpv4));
+
+    changed = Packet_clone(pack);
+    untouched = Packet_clone(pack);
+    CHECK(changed != NULL && untouched != NULL);
+    CHECK(Packet_getLayer(changed, 2) == Packet_getLayer(pack, 2));
+
+    // Copied on write, the base Packet and the other clone keep the layer.
+    layer = Packet_getLayerForWrite(changed, 2);
+    CHECK(layer != NULL);
+    CHECK(layer != Udpv4Proto_getProtoBase(udpv4));
+    CHECK(Packet_getLayer(changed, 2) == layer);
+    CHECK(Packet_getLayer(untouched, 2) == Udpv4Proto_getProtoBase(udpv4));
+    if (layer != NULL) {
+        Udpv4Proto_setSport(Protocol_getOwner(layer), 4242);
+    }
+
+    check_frame(changed, changed_frame, size);
+    check_frame(untouched, base_frame, size);
+    check_frame(pack, base_frame, size);
+
+    // The layer already copied isn't copied again.
+    CHECK(Packet_getLayerForWrite(changed, 2) == layer);
+
+    // Written through the base Packet, the layer it shares with the other
+    // clone is copied as well, the one of the application is left alone.
+    base_layer = Packet_getLayerForWrite(pack, 2);
+    CHECK(base_layer != NULL);
+    CHECK(base_layer != Udpv4Proto_getProtoBase(udpv4));
+    CHECK(Packet_getLayer(untouched, 2) == Udpv4Proto_getProtoBase(udpv4));
+    if (base_layer != NULL) {
+        Udpv4Proto_setSport(Protocol_getOwner(base_layer), 4242);
+    }
+
+    check_frame(pack, changed_frame, size);
+    check_frame(untouched, base_frame, size);
+    CHECK(udpv4->sport == 1234);
+    CHECK(Packet_getLayerForWrite(pack, 2) == base_layer);
+
+    // The clones outlive the base Packet and its layers.
+    Packet_delete(pack);
+    EtherProto_delete(ether);
+    Ipv4Proto_delete(ipv4);
+    Udpv4Proto_delete(udpv4);
+    RawProto_delete(raw);
+    check_frame(changed, changed_frame, size);
+    check_frame(untouched, base_frame, size);
+
+    Packet_delete(changed);
+    Packet_delete(untouched);
+    return CHECK_RESULT("clone");
+}
@@ -0,0 +1,157 @@
+/*
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/* Injects a frozen Packet on the loopback interface from several threads at
+ * once, each one through a SocketContext of the same Socket, half of them
+ * with a file descriptor of their own. Every context must count every packet
+ * and byte it injected, and no error.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <net/ethernet.h>
+
+#include "libpacket/socket.h"
+#include "libpacket/packet.h"
+#include "libpacket/ether.h"
+#include "libpacket/ipv4.h"
+#include "libpacket/udpv4.h"
+#include "libpacket/raw.h"
+
+#include "check.h"
+
+#define THREADS (4)
+#define ROUNDS (200)
+#define BATCH (8)
+#define PAYLOAD_LEN (32)
+
+typedef struct Worker {
+    pthread_t thread;
+    SocketContext_t *ctx;
+    const Packet_t *pack;
+    int failed;
+} Worker_t;
+
+/* Injects the Packet one at a time and in batches, ROUNDS times each. */
+static void * work(void *arg) {
+    Worker_t *worker = arg;
+    const Packet_t *packs[BATCH];
+    int results[BATCH];
+    unsigned int i, j, size;
+
+    size = Packet_getSize(worker->pack);
+    for (i = 0; i < BATCH; i++) {
+        packs[i] = worker->pack;
+    }
+
+    for (i = 0; i < ROUNDS; i++) {
+        if (SocketContext_inject(worker->ctx, worker->pack) != (int)size) {
+            worker->failed = 1;
+        }
+
+        if (SocketContext_injectBatch(worker->ctx, packs, BATCH, results) != BATCH) {
+            worker->failed = 1;
+        }
+
+        for (j = 0; j < BATCH; j++) {
+            if (results[j] != (int)size) {
+                worker->failed = 1;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+int main() {
+    static const uint8_t payload[PAYLOAD_LEN] = "libpacket context";
+    Worker_t workers[THREADS];
+    SocketStats_t stats;
+    EtherProto_t *ether;
+    Ipv4Proto_t *ipv4;
+    Udpv4Proto_t *udpv4;
+    RawProto_t *raw;
+    Packet_t *pack;
+    Socket_t *sock;
+    unsigned int i, size;
+
+    sock = Socket_create("lo");
+    if (sock == NULL) {
+        printf("context: skipped, can't inject on lo (%s)\n", strerror(errno));
+        return 0;
+    }
+
+    pack = Packet_create();
+    ether = EtherProto_create();
+    ipv4 = Ipv4Proto_create();
+    udpv4 = Udpv4Proto_createWithParams(
+            1234,
+            5678,
+            UDPV4_HEADER_LEN + PAYLOAD_LEN,
+            0);
+    raw = RawProto_createWithParams(payload, PAYLOAD_LEN);
+    Packet_stack(pack, EtherProto_getProtoBase(ether));
+    Packet_stack(pack, Ipv4Proto_getProtoBase(ipv4));
+    Packet_stack(pack, Udpv4Proto_getProtoBase(udpv4));
+    Packet_stack(pack, RawProto_getProtoBase(raw));
+    EtherProto_setType(ether, ETHERTYPE_IP);
+    Ipv4Proto_setProtocol(ipv4, 17);
+    Ipv4Proto_setLength(ipv4, 20 + UDPV4_HEADER_LEN + PAYLOAD_LEN);
+    CHECK(Packet_freeze(pack, 0) == 0);
+
+    // The threads only read what freezing filled.
+    CHECK(pack->layout_valid && pack->image_valid && !pack->dirty);
+    size = Packet_getSize(pack);
+
+    for (i = 0; i < THREADS; i++) {
+        workers[i].ctx = SocketContext_create(
+                sock,
+                i % 2 != 0? SOCKET_CONTEXT_OWN_DESC: 0);
+        workers[i].pack = pack;
+        workers[i].failed = 0;
+        CHECK(workers[i].ctx != NULL);
+    }
+
+    for (i = 0; i < THREADS; i++) {
+        if (workers[i].ctx != NULL) {
+            CHECK(pthread_create(&workers[i].thread, NULL, work, &workers[i]) == 0);
+        }
+    }
+
+    for (i = 0; i < THREADS; i++) {
+        if (workers[i].ctx == NULL) {
+            continue;
+        }
+
+        pthread_join(workers[i].thread, NULL);
+        CHECK(!workers[i].failed);
+        CHECK(SocketContext_getStats(workers[i].ctx, &stats) == 0);
+        CHECK(stats.packets == ROUNDS * (1 + BATCH));
+        CHECK(stats.bytes == (uint64_t)ROUNDS * (1 + BATCH) * size);
+        CHECK(stats.errors == 0);
+        SocketContext_delete(workers[i].ctx);
+    }
+
+    Packet_delete(pack);
+    EtherProto_delete(ether);
+    Ipv4Proto_delete(ipv4);
+    Udpv4Proto_delete(udpv4);
+    RawProto_delete(raw);
+    Socket_delete(sock);
+    return CHECK_RESULT("context");
+}
@@ -0,0 +1,150 @@
+/*
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/* Emits the frames of a FlowTable from the Template of an Ether - IPv4 -
+ * UDPv4 - payload Packet and checks every one of them, checksums included,
+ * against the Packet serialized with the fields of the flow set through the
+ * setters. There are more flows than the SIMD kernels take at once, and the
+ * IPv4 ids go up between runs. A Template with an IPv4 checksum of 0x0000,
+ * a valid one, must be taken as well.
+ */
+
+#include <string.h>
+#include <net/ethernet.h>
+
+#include "libpacket/flow.h"
+#include "libpacket/packet.h"
+#include "libpacket/template.h"
+#include "libpacket/ether.h"
+#include "libpacket/ipv4.h"
+#include "libpacket/udpv4.h"
+#include "libpacket/raw.h"
+
+#include "check.h"
+
+#define FLOWS (19)
+#define PAYLOAD_LEN (37)
+#define FRAME_MAX (128)
+
+static Packet_t *pack;
+static Ipv4Proto_t *ipv4;
+static Udpv4Proto_t *udpv4;
+
+/* Emits the flows of table from first on, n of them, with tmpl and checks
+ * their frames and that their IPv4 ids went up.
+ */
+static void check_flows(
+        FlowTable_t *table,
+        const Template_t *tmpl,
+        unsigned int first,
+        unsigned int n) {
+    static uint8_t frames[FLOWS * FRAME_MAX];
+    uint8_t expected[FRAME_MAX];
+    uint16_t ids[FLOWS];
+    unsigned int i, size;
+
+    size = Template_getSize(tmpl);
+    memcpy(ids, &table->id[first], sizeof(uint16_t) * n);
+    CHECK(FlowTable_emit(table, first, n, frames, sizeof(frames)) == (int)n);
+    for (i = 0; i < n; i++) {
+        Ipv4Proto_setSaddr(ipv4, table->saddr[first + i]);
+        Ipv4Proto_setDaddr(ipv4, table->daddr[first + i]);
+        Ipv4Proto_setId(ipv4, ids[i]);
+        Udpv4Proto_setSport(udpv4, table->sport[first + i]);
+        Udpv4Proto_setDport(udpv4, table->dport[first + i]);
+        CHECK(Packet_getBitstream(pack, expected, sizeof(expected)) == (int)size);
+        CHECK(memcmp(&frames[i * size], expected, size) == 0);
+        CHECK(table->id[first + i] == (uint16_t)(ids[i] + 1));
+    }
+}
+
+int main() {
+    static const uint8_t payload[PAYLOAD_LEN] = "a payload of an odd number of bytes";
+    uint8_t frame[FRAME_MAX];
+    EtherProto_t *ether;
+    RawProto_t *raw;
+    Template_t *tmpl;
+    FlowTable_t *table;
+    unsigned int i;
+    uint32_t id;
+
+    pack = Packet_create();
+    ether = EtherProto_create();
+    ipv4 = Ipv4Proto_create();
+    udpv4 = Udpv4Proto_create();
+    raw = RawProto_createWithParams(payload, PAYLOAD_LEN);
+    Packet_stack(pack, EtherProto_getProtoBase(ether));
+    Packet_stack(pack, Ipv4Proto_getProtoBase(ipv4));
+    Packet_stack(pack, Udpv4Proto_getProtoBase(udpv4));
+    Packet_stack(pack, RawProto_getProtoBase(raw));
+    EtherProto_setType(ether, ETHERTYPE_IP);
+    Ipv4Proto_setProtocol(ipv4, 17);
+    Ipv4Proto_setLength(ipv4, 20 + UDPV4_HEADER_LEN + PAYLOAD_LEN);
+    Udpv4Proto_setLength(udpv4, UDPV4_HEADER_LEN + PAYLOAD_LEN);
+
+    table = FlowTable_createWithParams(4);
+    CHECK(table != NULL);
+    for (i = 0; i < FLOWS; i++) {
+        CHECK(FlowTable_add(
+                table,
+                0x0a000001 + i * 0x01010101,
+                0xc0a80101 + i * 7,
+                1024 + i * 4099,
+                53 + i) == (int)i);
+    }
+    CHECK(FlowTable_getNumFlows(table) == FLOWS);
+
+    tmpl = Packet_compile(pack);
+    CHECK(tmpl != NULL);
+    CHECK(FlowTable_setTemplate(table, tmpl, 1) == 0);
+    check_flows(table, tmpl, 0, FLOWS);
+    check_flows(table, tmpl, 0, FLOWS);
+
+    // Runs not starting at a multiple of what the kernels take at once.
+    check_flows(table, tmpl, 3, 9);
+    check_flows(table, tmpl, 12, 7);
+    CHECK(table->packets[0] == 2 && table->packets[3] == 3);
+    CHECK(table->bytes[3] == 3 * Template_getSize(tmpl));
+
+    // An IPv4 id giving the header of the Template a checksum of 0x0000.
+    for (id = 0; id <= 0xffff; id++) {
+        Ipv4Proto_setId(ipv4, id);
+        Packet_getBitstream(pack, frame, sizeof(frame));
+        if (frame[ETH_HLEN + 10] == 0 && frame[ETH_HLEN + 11] == 0) {
+            break;
+        }
+    }
+    CHECK(id <= 0xffff);
+
+    Template_delete(tmpl);
+    tmpl = Packet_compile(pack);
+    CHECK(tmpl != NULL);
+    CHECK(FlowTable_setTemplate(table, tmpl, 1) == 0);
+    check_flows(table, tmpl, 0, FLOWS);
+
+    // The layers on top of IPv4 aren't UDPv4.
+    CHECK(FlowTable_setTemplate(table, tmpl, 0) == -1);
+
+    FlowTable_delete(table);
+    Template_delete(tmpl);
+    Packet_delete(pack);
+    EtherProto_delete(ether);
+    Ipv4Proto_delete(ipv4);
+    Udpv4Proto_delete(udpv4);
+    RawProto_delete(raw);
+    return CHECK_RESULT("flow");
+}
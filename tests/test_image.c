@@ -0,0 +1,135 @@
+/*
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/* Changes the layers of an Ether - IPv4 - UDPv4 - payload - trailer Packet
+ * between calls to Packet_getImage() and checks the image, which only gets
+ * the layers that changed written again, against the Packet serialized from
+ * scratch. Layers change size too, with Packet_getSize() called in between as
+ * the Socket does, so the layout is already up to date when the image is.
+ */
+
+#include <string.h>
+#include <net/ethernet.h>
+
+#include "libpacket/packet.h"
+#include "libpacket/ether.h"
+#include "libpacket/ipv4.h"
+#include "libpacket/udpv4.h"
+#include "libpacket/raw.h"
+
+#include "check.h"
+
+#define FRAME_MAX (2048)
+
+static Packet_t *pack;
+static Ipv4Proto_t *ipv4;
+static Udpv4Proto_t *udpv4;
+static RawProto_t *payload;
+static RawProto_t *trailer;
+
+/* Sets the lengths of IPv4 and UDPv4 for the current payload. */
+static void set_lengths(void) {
+    unsigned int length;
+
+    length = RawProto_getSize(payload) + RawProto_getSize(trailer);
+    Udpv4Proto_setLength(udpv4, UDPV4_HEADER_LEN + length);
+    Ipv4Proto_setLength(ipv4, 20 + UDPV4_HEADER_LEN + length);
+}
+
+/* Compares the image of the Packet, taken with flags, with the Packet
+ * serialized from scratch.
+ */
+static void check_image(unsigned int flags) {
+    static uint8_t expected[FRAME_MAX];
+    const uint8_t *image;
+    unsigned int size = 0;
+    int length;
+
+    length = Packet_getBitstreamWithFlags(pack, expected, sizeof(expected), flags);
+    CHECK(length > 0);
+    CHECK((unsigned int)length == Packet_getSize(pack));
+
+    image = Packet_getImage(pack, flags, &size);
+    CHECK(image != NULL);
+    CHECK(size == (unsigned int)length);
+    CHECK(image != NULL && memcmp(image, expected, length) == 0);
+}
+
+int main() {
+    static uint8_t big[1400];
+    static const uint8_t small[16] = "a small payload";
+    static const uint8_t tail[8] = "trailer";
+    EtherProto_t *ether;
+
+    memset(big, 0x5a, sizeof(big));
+
+    pack = Packet_create();
+    ether = EtherProto_create();
+    ipv4 = Ipv4Proto_create();
+    udpv4 = Udpv4Proto_create();
+    payload = RawProto_createWithParams(small, sizeof(small));
+    trailer = RawProto_createWithParams(tail, sizeof(tail));
+    CHECK(pack != NULL && ether != NULL && ipv4 != NULL && udpv4 != NULL);
+    CHECK(payload != NULL && trailer != NULL);
+
+    Packet_stack(pack, EtherProto_getProtoBase(ether));
+    Packet_stack(pack, Ipv4Proto_getProtoBase(ipv4));
+    Packet_stack(pack, Udpv4Proto_getProtoBase(udpv4));
+    Packet_stack(pack, RawProto_getProtoBase(payload));
+    Packet_stack(pack, RawProto_getProtoBase(trailer));
+    EtherProto_setType(ether, ETHERTYPE_IP);
+    Ipv4Proto_setProtocol(ipv4, 17);
+    set_lengths();
+    check_image(0);
+
+    // Fields of a fixed size, only their layer and the checksums change.
+    Udpv4Proto_setSport(udpv4, 4242);
+    check_image(0);
+    Ipv4Proto_setSaddr(ipv4, 0x0a000001);
+    check_image(0);
+
+    // The payload grows, with the layout computed before the image.
+    RawProto_setData(payload, big, sizeof(big));
+    set_lengths();
+    Packet_getSize(pack);
+    check_image(0);
+
+    // It shrinks and the trailer above it moves down.
+    RawProto_setData(payload, small, 5);
+    set_lengths();
+    Packet_getSize(pack);
+    check_image(0);
+
+    // Same without asking for the layout first.
+    RawProto_setData(payload, big, 64);
+    set_lengths();
+    check_image(0);
+
+    // Other flags write the whole image again.
+    check_image(PACKET_PARTIAL_CHECKSUM);
+    Udpv4Proto_setDport(udpv4, 53);
+    check_image(PACKET_PARTIAL_CHECKSUM);
+    check_image(0);
+
+    Packet_delete(pack);
+    EtherProto_delete(ether);
+    Ipv4Proto_delete(ipv4);
+    Udpv4Proto_delete(udpv4);
+    RawProto_delete(payload);
+    RawProto_delete(trailer);
+    return CHECK_RESULT("image");
+}
@@ -0,0 +1,179 @@
+/*
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/* Injects batches on the loopback interface through every batch entry point
+ * of Socket and checks what they report: the number of packets injected,
+ * the results of every one of them and -1 with errno set when none could be.
+ * A frame shorter than an Ethernet header is refused by the kernel, a packet
+ * bigger than the scratch buffer can't even be serialized.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <net/ethernet.h>
+
+#include "libpacket/socket.h"
+#include "libpacket/packet.h"
+#include "libpacket/ether.h"
+#include "libpacket/raw.h"
+
+#include "check.h"
+
+#define BATCH (3)
+
+static uint8_t big[SOCKET_MIN_SCRATCH_SIZE * 2];
+
+typedef struct Frame {
+    Packet_t *pack;
+    EtherProto_t *ether;
+    RawProto_t *raw;
+} Frame_t;
+
+/* A frame of size bytes, without the Ethernet header if size is smaller. */
+static void create_frame(Frame_t *frame, unsigned int size) {
+    frame->pack = Packet_create();
+    frame->ether = NULL;
+    if (size >= ETH_HLEN) {
+        frame->ether = EtherProto_create();
+        EtherProto_setType(frame->ether, 0x88b5);
+        Packet_stack(frame->pack, EtherProto_getProtoBase(frame->ether));
+        size -= ETH_HLEN;
+    }
+
+    frame->raw = RawProto_createWithParams(big, size);
+    Packet_stack(frame->pack, RawProto_getProtoBase(frame->raw));
+}
+
+static void delete_frame(Frame_t *frame) {
+    Packet_delete(frame->pack);
+    EtherProto_delete(frame->ether);
+    RawProto_delete(frame->raw);
+}
+
+/* Injects packs with entry, 0 for Socket_injectBatch(), 1 for
+ * Socket_injectBatchAt() and 2 for Socket_injectRawBatch(), and checks that
+ * the first injected ones were, and the rest weren't.
+ */
+static void check_batch(
+        Socket_t *sock,
+        int entry,
+        const Packet_t * const *packs,
+        unsigned int n,
+        int injected,
+        int error) {
+    static uint8_t frames[BATCH][256];
+    const uint8_t *bufs[BATCH];
+    unsigned int lens[BATCH];
+    uint64_t txtimes[BATCH];
+    int results[BATCH];
+    unsigned int i;
+    int ret;
+
+    for (i = 0; i < n; i++) {
+        txtimes[i] = Socket_getTime(sock);
+        results[i] = 0;
+        lens[i] = Packet_getBitstream(packs[i], frames[i], sizeof(frames[i]));
+        bufs[i] = frames[i];
+    }
+
+    errno = 0;
+    if (entry == 0) {
+        ret = Socket_injectBatch(sock, packs, n, results);
+    } else if (entry == 1) {
+        ret = Socket_injectBatchAt(sock, packs, txtimes, n, results);
+    } else {
+        ret = Socket_injectRawBatch(sock, bufs, lens, n, results);
+    }
+
+    CHECK(ret == (injected != 0? injected: -1));
+    if (injected == 0) {
+        CHECK(errno == error);
+    }
+
+    for (i = 0; i < n; i++) {
+        if ((int)i < injected) {
+            CHECK(results[i] == (int)Packet_getSize(packs[i]));
+        } else {
+            CHECK(results[i] == -1);
+        }
+    }
+}
+
+int main() {
+    const Packet_t *packs[BATCH];
+    SocketParams_t params;
+    Socket_t *sock, *timed;
+    Frame_t good, shorter, bigger;
+    uint64_t txtime = 0;
+    int entry;
+
+    sock = Socket_create("lo");
+    if (sock == NULL) {
+        printf("inject: skipped, can't inject on lo (%s)\n", strerror(errno));
+        return 0;
+    }
+
+    memset(&params, 0, sizeof(params));
+    params.backend = SOCKET_BACKEND_SENDTO;
+    params.flags = SOCKET_FLAG_TXTIME;
+    params.txtime_clock = CLOCK_MONOTONIC;
+    timed = Socket_createWithParams("lo", &params);
+    CHECK(timed != NULL);
+
+    create_frame(&good, 64);
+    create_frame(&shorter, 5);
+    create_frame(&bigger, sizeof(big));
+
+    for (entry = 0; entry < 3; entry++) {
+        Socket_t *s = entry == 1? timed: sock;
+
+        if (s == NULL) {
+            continue;
+        }
+
+        packs[0] = packs[1] = packs[2] = good.pack;
+        check_batch(s, entry, packs, BATCH, BATCH, 0);
+
+        // The kernel refuses the first one, nothing is sent.
+        packs[0] = shorter.pack;
+        check_batch(s, entry, packs, BATCH, 0, EINVAL);
+
+        // It refuses the second one, the first one went.
+        packs[0] = good.pack;
+        packs[1] = shorter.pack;
+        check_batch(s, entry, packs, BATCH, 1, 0);
+    }
+
+    // Too big for the scratch buffer, it can't be serialized at all.
+    packs[0] = bigger.pack;
+    packs[1] = good.pack;
+    CHECK(Socket_injectBatch(sock, packs, 2, NULL) == -1);
+    CHECK(errno == EMSGSIZE);
+
+    // Launch times need a socket supporting them.
+    packs[0] = good.pack;
+    CHECK(Socket_injectBatchAt(sock, packs, &txtime, 1, NULL) == -1);
+    CHECK(errno == EINVAL);
+
+    delete_frame(&good);
+    delete_frame(&shorter);
+    delete_frame(&bigger);
+    Socket_delete(timed);
+    Socket_delete(sock);
+    return CHECK_RESULT("inject");
+}
@@ -0,0 +1,501 @@
+/*
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/* Injects through an Injector on the loopback interface, over the SENDTO
+ * and the TXRING backends. Several threads submit packets and frames at once
+ * into a small queue, and every request must have its callback called once,
+ * with its result, by the time Injector_flush() returns. The injecting
+ * thread is held in a callback to fill the queue up: a DROP Injector must
+ * refuse what doesn't fit, a BLOCK one must keep the submitter waiting until
+ * there is room, and so must Injector_flush(). Frames submitted by a single
+ * thread must be captured in order.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+
+#include "libpacket/injector.h"
+#include "libpacket/socket.h"
+#include "libpacket/packet.h"
+#include "libpacket/ether.h"
+#include "libpacket/raw.h"
+
+#include "check.h"
+
+#define FRAME_LEN (60)
+#define ETHERTYPE_TEST (0x88b5)
+#define CAPACITY (4)
+#define SUBMITTERS (4)
+#define REQUESTS (500)
+
+/* What the callback was told about a request. */
+typedef struct Record {
+    int calls;
+    int result;
+} Record_t;
+
+/* A submitter thread and its requests, every other one the Packet. */
+typedef struct Submitter {
+    Injector_t *inj;
+    uint8_t frame[FRAME_LEN];
+    Record_t records[REQUESTS];
+    int failures;
+} Submitter_t;
+
+/* A thread submitting a single frame or flushing, and whether it returned. */
+typedef struct Waiter {
+    Injector_t *inj;
+    const uint8_t *frame;
+    Record_t *record;
+    int returned;
+} Waiter_t;
+
+static Submitter_t submitters[SUBMITTERS];
+
+/* Frozen, submitted by every submitter at once. */
+static Packet_t *pack;
+
+/* The callback holds the injecting thread while hold is set, telling it's
+ * been reached through held.
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int hold;
+static int held;
+
+static void callback(const InjectorRequest_t *req, int result) {
+    Record_t *record = req->arg;
+
+    record->calls++;
+    record->result = result;
+
+    pthread_mutex_lock(&lock);
+    held = hold;
+    pthread_cond_broadcast(&cond);
+    while (hold) {
+        pthread_cond_wait(&cond, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/* Submits a frame with the callback holding the injecting thread, and waits
+ * until it does.
+ */
+static void hold_thread(Injector_t *inj, const uint8_t *frame, Record_t *record) {
+    pthread_mutex_lock(&lock);
+    hold = 1;
+    held = 0;
+    pthread_mutex_unlock(&lock);
+
+    CHECK(Injector_submitFrame(inj, frame, FRAME_LEN, record) == 0);
+
+    pthread_mutex_lock(&lock);
+    while (!held) {
+        pthread_cond_wait(&cond, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+static void release_thread(void) {
+    pthread_mutex_lock(&lock);
+    hold = 0;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
+}
+
+/* Opens a raw socket capturing the frames of ETHERTYPE_TEST on the loopback
+ * interface. Returns it or -1.
+ */
+static int open_capture(void) {
+    struct sockaddr_ll addr;
+    struct timeval tv;
+    int desc;
+
+    desc = socket(AF_PACKET, SOCK_RAW, htons(ETHERTYPE_TEST));
+    if (desc == -1) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETHERTYPE_TEST);
+    addr.sll_ifindex = if_nametoindex("lo");
+    tv.tv_sec = 0;
+    tv.tv_usec = 200000;
+    if (setsockopt(desc, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv))
+            || bind(desc, (struct sockaddr *)&addr, sizeof(addr))) {
+        close(desc);
+        return -1;
+    }
+
+    return desc;
+}
+
+/* Receives every frame captured until nothing comes for a while. */
+static unsigned int drain(int capture) {
+    uint8_t frame[2048];
+    unsigned int n = 0;
+
+    while (recv(capture, frame, sizeof(frame), 0) > 0) {
+        n++;
+    }
+
+    return n;
+}
+
+/* Writes a frame numbered seq into frame. */
+static void fill(uint8_t *frame, unsigned int seq) {
+    memset(frame, 0, FRAME_LEN);
+    frame[12] = ETHERTYPE_TEST >> 8;
+    frame[13] = ETHERTYPE_TEST & 0xff;
+    frame[14] = seq >> 8;
+    frame[15] = seq & 0xff;
+}
+
+static void sleep_ms(long ms) {
+    struct timespec ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000;
+    nanosleep(&ts, NULL);
+}
+
+static void * submit(void *arg) {
+    Submitter_t *sub = arg;
+    unsigned int i;
+    int ret;
+
+    for (i = 0; i < REQUESTS; i++) {
+        if (i % 2 == 0) {
+            ret = Injector_submit(sub->inj, pack, &sub->records[i]);
+        } else {
+            ret = Injector_submitFrame(
+                    sub->inj,
+                    sub->frame,
+                    FRAME_LEN,
+                    &sub->records[i]);
+        }
+
+        sub->failures += ret != 0;
+    }
+
+    return NULL;
+}
+
+static void * submit_one(void *arg) {
+    Waiter_t *waiter = arg;
+
+    if (Injector_submitFrame(
+                waiter->inj,
+                waiter->frame,
+                FRAME_LEN,
+                waiter->record) == 0) {
+        __atomic_store_n(&waiter->returned, 1, __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+static void * flush(void *arg) {
+    Waiter_t *waiter = arg;
+
+    if (Injector_flush(waiter->inj) == 0) {
+        __atomic_store_n(&waiter->returned, 1, __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+static Injector_t * create_injector(Socket_t *sock, InjectorPolicy_t policy) {
+    InjectorParams_t params;
+
+    memset(&params, 0, sizeof(params));
+    params.capacity = CAPACITY;
+    params.burst = 1;
+    params.policy = policy;
+    params.cpu = -1;
+    params.callback = callback;
+    return Injector_createWithParams(sock, &params);
+}
+
+/* Checks the counters of inj, along with what every record was told. */
+static void check_stats(
+        Injector_t *inj,
+        const Record_t *records,
+        unsigned int n,
+        uint64_t packets,
+        uint64_t dropped) {
+    InjectorStats_t stats;
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+        CHECK(records[i].calls == 1 && records[i].result == FRAME_LEN);
+    }
+
+    CHECK(Injector_getStats(inj, &stats) == 0);
+    CHECK(stats.packets == packets);
+    CHECK(stats.bytes == packets * FRAME_LEN);
+    CHECK(stats.errors == 0);
+    CHECK(stats.dropped == dropped);
+}
+
+/* Several threads submitting at once into a queue much smaller than what
+ * they submit.
+ */
+static void check_submitters(Socket_t *sock, int capture) {
+    pthread_t threads[SUBMITTERS];
+    Injector_t *inj;
+    unsigned int i, j;
+
+    inj = create_injector(sock, INJECTOR_POLICY_BLOCK);
+    CHECK(inj != NULL);
+    if (inj == NULL) {
+        return;
+    }
+
+    for (i = 0; i < SUBMITTERS; i++) {
+        memset(submitters[i].records, 0, sizeof(submitters[i].records));
+        submitters[i].inj = inj;
+        submitters[i].failures = 0;
+        CHECK(pthread_create(&threads[i], NULL, submit, &submitters[i]) == 0);
+    }
+
+    for (i = 0; i < SUBMITTERS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    CHECK(Injector_flush(inj) == 0);
+
+    for (i = 0; i < SUBMITTERS; i++) {
+        CHECK(submitters[i].failures == 0);
+        for (j = 0; j < REQUESTS; j++) {
+            CHECK(submitters[i].records[j].calls == 1);
+            CHECK(submitters[i].records[j].result == FRAME_LEN);
+        }
+    }
+    check_stats(inj, NULL, 0, SUBMITTERS * REQUESTS, 0);
+
+    Injector_delete(inj);
+    drain(capture);
+}
+
+/* A single submitter, the frames are captured in the order submitted. */
+static void check_order(Socket_t *sock, int capture) {
+    static uint8_t frames[CAPACITY * 4][FRAME_LEN];
+    Record_t records[CAPACITY * 4];
+    uint8_t frame[2048];
+    Injector_t *inj;
+    unsigned int i;
+    ssize_t len;
+
+    inj = create_injector(sock, INJECTOR_POLICY_BLOCK);
+    CHECK(inj != NULL);
+    if (inj == NULL) {
+        return;
+    }
+
+    memset(records, 0, sizeof(records));
+    for (i = 0; i < CAPACITY * 4; i++) {
+        fill(frames[i], i);
+        CHECK(Injector_submitFrame(inj, frames[i], FRAME_LEN, &records[i]) == 0);
+    }
+    CHECK(Injector_flush(inj) == 0);
+    check_stats(inj, records, CAPACITY * 4, CAPACITY * 4, 0);
+
+    for (i = 0; i < CAPACITY * 4; i++) {
+        len = recv(capture, frame, sizeof(frame), 0);
+        CHECK(len == FRAME_LEN && memcmp(frame, frames[i], FRAME_LEN) == 0);
+    }
+    CHECK(drain(capture) == 0);
+
+    Injector_delete(inj);
+}
+
+/* A full queue with the DROP policy. */
+static void check_drop(Socket_t *sock, int capture) {
+    Record_t records[CAPACITY + 2];
+    uint8_t frame[FRAME_LEN];
+    Injector_t *inj;
+    unsigned int i;
+
+    inj = create_injector(sock, INJECTOR_POLICY_DROP);
+    CHECK(inj != NULL);
+    if (inj == NULL) {
+        return;
+    }
+
+    fill(frame, 0);
+    memset(records, 0, sizeof(records));
+    hold_thread(inj, frame, &records[0]);
+    for (i = 1; i <= CAPACITY; i++) {
+        CHECK(Injector_submitFrame(inj, frame, FRAME_LEN, &records[i]) == 0);
+    }
+    CHECK(Injector_submitFrame(inj, frame, FRAME_LEN, &records[i]) == -1);
+    release_thread();
+
+    CHECK(Injector_flush(inj) == 0);
+    CHECK(records[CAPACITY + 1].calls == 0);
+    check_stats(inj, records, CAPACITY + 1, CAPACITY + 1, 1);
+    CHECK(drain(capture) == CAPACITY + 1);
+
+    Injector_delete(inj);
+}
+
+/* A full queue with the BLOCK policy, the submitter waits for room and a
+ * flush for everything submitted so far.
+ */
+static void check_block(Socket_t *sock, int capture) {
+    Record_t records[CAPACITY + 2];
+    uint8_t frame[FRAME_LEN];
+    Waiter_t submitter, flusher;
+    pthread_t threads[2];
+    Injector_t *inj;
+    unsigned int i;
+
+    inj = create_injector(sock, INJECTOR_POLICY_BLOCK);
+    CHECK(inj != NULL);
+    if (inj == NULL) {
+        return;
+    }
+
+    fill(frame, 0);
+    memset(records, 0, sizeof(records));
+    hold_thread(inj, frame, &records[0]);
+    for (i = 1; i <= CAPACITY; i++) {
+        CHECK(Injector_submitFrame(inj, frame, FRAME_LEN, &records[i]) == 0);
+    }
+
+    memset(&submitter, 0, sizeof(submitter));
+    submitter.inj = inj;
+    submitter.frame = frame;
+    submitter.record = &records[CAPACITY + 1];
+    CHECK(pthread_create(&threads[0], NULL, submit_one, &submitter) == 0);
+    memset(&flusher, 0, sizeof(flusher));
+    flusher.inj = inj;
+    CHECK(pthread_create(&threads[1], NULL, flush, &flusher) == 0);
+
+    sleep_ms(50);
+    CHECK(!__atomic_load_n(&submitter.returned, __ATOMIC_ACQUIRE));
+    CHECK(!__atomic_load_n(&flusher.returned, __ATOMIC_ACQUIRE));
+    CHECK(records[1].calls == 0);
+    release_thread();
+
+    pthread_join(threads[0], NULL);
+    pthread_join(threads[1], NULL);
+    CHECK(submitter.returned && flusher.returned);
+    CHECK(Injector_flush(inj) == 0);
+    check_stats(inj, records, CAPACITY + 2, CAPACITY + 2, 0);
+    CHECK(drain(capture) == CAPACITY + 2);
+
+    Injector_delete(inj);
+}
+
+/* Deleted right away, what was submitted is injected first. */
+static void check_delete(Socket_t *sock, int capture) {
+    Record_t records[CAPACITY];
+    uint8_t frame[FRAME_LEN];
+    Injector_t *inj;
+    unsigned int i;
+
+    inj = create_injector(sock, INJECTOR_POLICY_BLOCK);
+    CHECK(inj != NULL);
+    if (inj == NULL) {
+        return;
+    }
+
+    fill(frame, 0);
+    memset(records, 0, sizeof(records));
+    for (i = 0; i < CAPACITY; i++) {
+        CHECK(Injector_submitFrame(inj, frame, FRAME_LEN, &records[i]) == 0);
+    }
+
+    Injector_delete(inj);
+    for (i = 0; i < CAPACITY; i++) {
+        CHECK(records[i].calls == 1 && records[i].result == FRAME_LEN);
+    }
+    CHECK(drain(capture) == CAPACITY);
+}
+
+int main() {
+    static const SocketBackend_t backends[] = {
+        SOCKET_BACKEND_SENDTO,
+        SOCKET_BACKEND_TXRING,
+    };
+    SocketParams_t params;
+    EtherProto_t *ether;
+    RawProto_t *raw;
+    Socket_t *sock;
+    unsigned int i;
+    int capture;
+
+    capture = open_capture();
+    if (capture == -1) {
+        printf("injector: skipped, can't capture on lo (%s)\n", strerror(errno));
+        return 0;
+    }
+
+    for (i = 0; i < SUBMITTERS; i++) {
+        fill(submitters[i].frame, i);
+    }
+
+    pack = Packet_create();
+    ether = EtherProto_create();
+    raw = RawProto_createWithParams(
+            &submitters[0].frame[ETH_HLEN],
+            FRAME_LEN - ETH_HLEN);
+    Packet_stack(pack, EtherProto_getProtoBase(ether));
+    Packet_stack(pack, RawProto_getProtoBase(raw));
+    EtherProto_setType(ether, ETHERTYPE_TEST);
+    CHECK(Packet_freeze(pack, 0) == 0);
+
+    CHECK(Injector_create(NULL) == NULL);
+    CHECK(Injector_submitFrame(NULL, submitters[0].frame, FRAME_LEN, NULL) == -1);
+    CHECK(Injector_flush(NULL) == -1);
+
+    for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        memset(&params, 0, sizeof(params));
+        params.backend = backends[i];
+        params.frame_size = SOCKET_DEFAULT_FRAME_SIZE;
+        params.frame_nr = SOCKET_DEFAULT_FRAME_NR;
+        sock = Socket_createWithParams("lo", &params);
+        CHECK(sock != NULL);
+        if (sock == NULL) {
+            continue;
+        }
+
+        check_submitters(sock, capture);
+        check_order(sock, capture);
+        check_drop(sock, capture);
+        check_block(sock, capture);
+        check_delete(sock, capture);
+        Socket_delete(sock);
+    }
+
+    Packet_delete(pack);
+    EtherProto_delete(ether);
+    RawProto_delete(raw);
+    close(capture);
+    return CHECK_RESULT("injector");
+}
@@ -0,0 +1,296 @@
+/*
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/* Paces frames with Pacer_wait(), no socket involved, and checks the token
+ * bucket: it starts empty, a burst goes at once after being idle but no more
+ * than that is saved up, a frame is never released before its time, and the
+ * rate, in packets or in bits per second, follows a ramp and a change of
+ * rate. The statistics must add up. The packets of Pacer_injectBatch() on the loopback
+ * interface must be paced the same way, the test of it being skipped
+ * without CAP_NET_RAW.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <net/ethernet.h>
+
+#include "libpacket/pacer.h"
+#include "libpacket/socket.h"
+#include "libpacket/packet.h"
+#include "libpacket/ether.h"
+#include "libpacket/raw.h"
+
+#include "check.h"
+
+#define FRAME_LEN (1000)
+#define BATCH (10)
+
+static uint64_t clock_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sleep_ms(long ms) {
+    struct timespec ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000;
+    nanosleep(&ts, NULL);
+}
+
+static Pacer_t * create_pacer(
+        double rate,
+        PacerUnit_t unit,
+        unsigned int burst,
+        uint64_t ramp_ns,
+        double ramp_rate) {
+    PacerParams_t params;
+
+    memset(&params, 0, sizeof(params));
+    params.rate = rate;
+    params.unit = unit;
+    params.burst = burst;
+    params.ramp_ns = ramp_ns;
+    params.ramp_rate = ramp_rate;
+    return Pacer_createWithParams(&params);
+}
+
+/* Waits for n frames, returns how long it took in nanoseconds. */
+static uint64_t wait_frames(Pacer_t *pacer, unsigned int n, unsigned int length) {
+    uint64_t start = clock_ns();
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+        CHECK(Pacer_wait(pacer, length) == 0);
+    }
+
+    return clock_ns() - start;
+}
+
+/* Checks the statistics of n frames of length bytes paced at pps. */
+static void check_stats(
+        const Pacer_t *pacer,
+        unsigned int n,
+        unsigned int length,
+        double pps) {
+    PacerStats_t stats;
+
+    CHECK(Pacer_getStats(pacer, &stats) == 0);
+    CHECK(stats.packets == n);
+    CHECK(stats.bytes == (uint64_t)n * length);
+
+    // Never faster than the rate, a loaded machine may make it slower.
+    CHECK(stats.elapsed_ns >= (uint64_t)((n - 1) * 1e9 / pps) - 1);
+    CHECK(stats.pps <= pps * 1.001 && stats.pps > pps * 0.5);
+    CHECK(stats.bps <= pps * length * 8 * 1.001 && stats.bps > pps * length * 4);
+    CHECK(stats.jitter_avg_ns >= 0 && stats.jitter_max_ns >= stats.jitter_avg_ns);
+}
+
+static void check_burst(void) {
+    Pacer_t *pacer;
+    uint64_t elapsed;
+
+    // The bucket starts empty, the first frames go at the rate.
+    pacer = Pacer_create(1000);
+    CHECK(pacer != NULL && pacer->params.burst == PACER_DEFAULT_BURST);
+    if (pacer == NULL) {
+        return;
+    }
+
+    elapsed = wait_frames(pacer, 5, FRAME_LEN);
+    CHECK(elapsed >= 4000000);
+
+    // Once idle, the default burst goes at once, the frames after it at the
+    // rate again.
+    sleep_ms(50);
+    elapsed = wait_frames(pacer, PACER_DEFAULT_BURST, FRAME_LEN);
+    CHECK(elapsed < (PACER_DEFAULT_BURST - 1) * 1000000);
+    elapsed = wait_frames(pacer, 10, FRAME_LEN);
+    CHECK(elapsed >= 9000000);
+    Pacer_delete(pacer);
+
+    // Idle for longer than a burst, only a burst was saved up: the first
+    // frame after it goes right away and finds burst - 1 frames worth of
+    // time before the next one.
+    pacer = create_pacer(100, PACER_UNIT_PPS, 4, 0, 0);
+    CHECK(pacer != NULL);
+    if (pacer == NULL) {
+        return;
+    }
+
+    wait_frames(pacer, 2, FRAME_LEN);
+    sleep_ms(100);
+    wait_frames(pacer, 1, FRAME_LEN);
+    CHECK(pacer->tat > pacer->last - 2e7 - 1 && pacer->tat < pacer->last - 2e7 + 1);
+    wait_frames(pacer, 3, FRAME_LEN);
+    CHECK(pacer->tat > pacer->last);
+    elapsed = wait_frames(pacer, 3, FRAME_LEN);
+    CHECK(elapsed >= 29000000);
+    Pacer_delete(pacer);
+}
+
+static void check_rate(void) {
+    Pacer_t *pacer;
+    double tat;
+
+    // Without a burst every frame waits for its time.
+    pacer = create_pacer(2000, PACER_UNIT_PPS, 1, 0, 0);
+    CHECK(pacer != NULL);
+    if (pacer == NULL) {
+        return;
+    }
+
+    wait_frames(pacer, 40, FRAME_LEN);
+    check_stats(pacer, 40, FRAME_LEN, 2000);
+    Pacer_delete(pacer);
+
+    // Counting bits, a frame of FRAME_LEN bytes takes a millisecond, and the
+    // burst defaults to a single frame.
+    pacer = create_pacer(FRAME_LEN * 8 * 1000, PACER_UNIT_BPS, 0, 0, 0);
+    CHECK(pacer != NULL);
+    if (pacer == NULL) {
+        return;
+    }
+
+    wait_frames(pacer, 20, FRAME_LEN);
+    check_stats(pacer, 20, FRAME_LEN, 1000);
+    Pacer_delete(pacer);
+
+    // Half the frame, half the time. The burst leaves room for late wake
+    // ups, the time of a frame only depends on its length.
+    pacer = create_pacer(FRAME_LEN * 8 * 1000, PACER_UNIT_BPS, FRAME_LEN * 10, 0, 0);
+    CHECK(pacer != NULL);
+    if (pacer == NULL) {
+        return;
+    }
+
+    wait_frames(pacer, 1, FRAME_LEN);
+    tat = pacer->tat;
+    wait_frames(pacer, 1, FRAME_LEN / 2);
+    CHECK(pacer->tat - tat > 0.5e6 - 1 && pacer->tat - tat < 0.5e6 + 1);
+    tat = pacer->tat;
+    wait_frames(pacer, 1, FRAME_LEN);
+    CHECK(pacer->tat - tat > 1e6 - 1 && pacer->tat - tat < 1e6 + 1);
+    Pacer_delete(pacer);
+}
+
+static void check_ramp(void) {
+    double tat, interval, previous = 1e9;
+    Pacer_t *pacer;
+    unsigned int i;
+
+    // From 1000 to 4000 pps in 100ms, every interval is shorter, down to
+    // the one of the final rate. The burst leaves room for late wake ups.
+    pacer = create_pacer(1000, PACER_UNIT_PPS, 64, 100000000, 4000);
+    CHECK(pacer != NULL);
+    if (pacer == NULL) {
+        return;
+    }
+
+    for (i = 0; i < 400; i++) {
+        tat = pacer->tat;
+        CHECK(Pacer_wait(pacer, FRAME_LEN) == 0);
+        if (i == 0) {
+            continue;
+        }
+
+        interval = pacer->tat - tat;
+        CHECK(interval <= previous + 1 && interval >= 0.25e6 - 1);
+        previous = interval;
+    }
+    CHECK(pacer->last >= 100000000);
+    CHECK(previous > 0.25e6 - 1 && previous < 0.25e6 + 1);
+
+    // A new rate ends the ramp.
+    CHECK(Pacer_setRate(pacer, 0) == -1);
+    CHECK(Pacer_setRate(pacer, 500) == 0);
+    CHECK(pacer->params.ramp_ns == 0);
+    wait_frames(pacer, 1, FRAME_LEN);
+    tat = pacer->tat;
+    wait_frames(pacer, 1, FRAME_LEN);
+    CHECK(pacer->tat - tat > 2e6 - 1 && pacer->tat - tat < 2e6 + 1);
+    Pacer_delete(pacer);
+}
+
+/* Paces batches on the loopback interface. */
+static void check_batch(void) {
+    static const uint8_t payload[FRAME_LEN - ETH_HLEN];
+    const Packet_t *packs[BATCH];
+    int results[BATCH];
+    EtherProto_t *ether;
+    RawProto_t *raw;
+    Packet_t *pack;
+    Pacer_t *pacer;
+    Socket_t *sock;
+    uint64_t elapsed;
+    unsigned int i;
+
+    sock = Socket_create("lo");
+    if (sock == NULL) {
+        printf("pacer: can't inject on lo, only waiting (%s)\n", strerror(errno));
+        return;
+    }
+
+    pack = Packet_create();
+    ether = EtherProto_create();
+    raw = RawProto_createWithParams(payload, sizeof(payload));
+    Packet_stack(pack, EtherProto_getProtoBase(ether));
+    Packet_stack(pack, RawProto_getProtoBase(raw));
+    EtherProto_setType(ether, 0x88b5);
+    for (i = 0; i < BATCH; i++) {
+        packs[i] = pack;
+    }
+
+    // A burst of half the batch goes at once, the rest one by one.
+    pacer = create_pacer(1000, PACER_UNIT_PPS, BATCH / 2, 0, 0);
+    CHECK(pacer != NULL);
+    if (pacer != NULL) {
+        elapsed = clock_ns();
+        CHECK(Pacer_injectBatch(pacer, sock, packs, BATCH, results) == BATCH);
+        elapsed = clock_ns() - elapsed;
+        CHECK(elapsed >= (BATCH - BATCH / 2) * 1000000 - 1000000);
+        for (i = 0; i < BATCH; i++) {
+            CHECK(results[i] == FRAME_LEN);
+        }
+
+        CHECK(pacer->packets == BATCH && pacer->bytes == BATCH * FRAME_LEN);
+        CHECK(Pacer_inject(pacer, sock, pack) == FRAME_LEN);
+        CHECK(pacer->packets == BATCH + 1);
+        Pacer_delete(pacer);
+    }
+
+    Packet_delete(pack);
+    EtherProto_delete(ether);
+    RawProto_delete(raw);
+    Socket_delete(sock);
+}
+
+int main() {
+    CHECK(Pacer_create(0) == NULL);
+    CHECK(Pacer_create(-1) == NULL);
+    CHECK(create_pacer(1000, PACER_UNIT_PPS, 0, 1000000, 0) == NULL);
+    CHECK(Pacer_wait(NULL, FRAME_LEN) == -1);
+
+    check_burst();
+    check_rate();
+    check_ramp();
+    check_batch();
+    return CHECK_RESULT("pacer");
+}
@@ -0,0 +1,232 @@
+/*
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/* Allocates and frees objects of a Pool from several threads. Objects freed
+ * by a thread other than the one that allocated them must go through the
+ * shared list and be handed out again, even after that thread exited, and
+ * never to two threads at once. Every thread stamps the objects it holds and
+ * checks the stamps before giving them back. The statistics must add up
+ * once every thread is gone.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "libpacket/pool.h"
+
+#include "check.h"
+
+#define OBJECT_SIZE (48)
+#define OBJECTS (500)
+#define THREADS (4)
+#define ROUNDS (200)
+#define HELD (100)
+
+static Pool_t pool = POOL_INITIALIZER("test", OBJECT_SIZE);
+
+static void *objects[OBJECTS];
+
+/* Objects passed from one thread to the next, protected by lock. */
+static void *stash[THREADS * HELD];
+static unsigned int stash_nr;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The checks failed by the threads, CHECK() isn't thread safe. */
+static unsigned long thread_failures;
+
+static void stamp(void *obj, uintptr_t value) {
+    uintptr_t *words = obj;
+    unsigned int i;
+
+    for (i = 0; i < OBJECT_SIZE / sizeof(uintptr_t); i++) {
+        words[i] = value + i;
+    }
+}
+
+static int stamped(const void *obj, uintptr_t value) {
+    const uintptr_t *words = obj;
+    unsigned int i;
+
+    for (i = 0; i < OBJECT_SIZE / sizeof(uintptr_t); i++) {
+        if (words[i] != value + i) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void * alloc_all(void *arg) {
+    unsigned int i;
+
+    (void)arg;
+    for (i = 0; i < OBJECTS; i++) {
+        objects[i] = Pool_alloc(&pool);
+        if (objects[i] != NULL) {
+            stamp(objects[i], i);
+        }
+    }
+
+    return NULL;
+}
+
+static void * free_all(void *arg) {
+    unsigned int i;
+
+    (void)arg;
+    for (i = 0; i < OBJECTS; i++) {
+        if (!stamped(objects[i], i)) {
+            __atomic_add_fetch(&thread_failures, 1, __ATOMIC_RELAXED);
+        }
+
+        Pool_free(&pool, objects[i]);
+    }
+
+    return NULL;
+}
+
+/* Holds HELD objects at a time, gives half of them to the next thread through
+ * the stash and frees the rest, along with whatever it took from the stash.
+ */
+static void * churn(void *arg) {
+    uintptr_t value = (uintptr_t)arg << 24;
+    void *held[HELD], *taken[HELD];
+    unsigned int i, round, taken_nr;
+
+    for (round = 0; round < ROUNDS; round++) {
+        for (i = 0; i < HELD; i++) {
+            held[i] = Pool_alloc(&pool);
+            if (held[i] == NULL) {
+                __atomic_add_fetch(&thread_failures, 1, __ATOMIC_RELAXED);
+                return NULL;
+            }
+
+            stamp(held[i], value + i * 16);
+        }
+
+        for (i = 0; i < HELD; i++) {
+            if (!stamped(held[i], value + i * 16)) {
+                __atomic_add_fetch(&thread_failures, 1, __ATOMIC_RELAXED);
+            }
+
+            stamp(held[i], 0);
+        }
+
+        pthread_mutex_lock(&lock);
+        taken_nr = stash_nr < HELD / 2? stash_nr: HELD / 2;
+        stash_nr -= taken_nr;
+        memcpy(taken, &stash[stash_nr], sizeof(void *) * taken_nr);
+        memcpy(&stash[stash_nr], held, sizeof(void *) * (HELD / 2));
+        stash_nr += HELD / 2;
+        pthread_mutex_unlock(&lock);
+
+        for (i = HELD / 2; i < HELD; i++) {
+            Pool_free(&pool, held[i]);
+        }
+
+        for (i = 0; i < taken_nr; i++) {
+            if (!stamped(taken[i], 0)) {
+                __atomic_add_fetch(&thread_failures, 1, __ATOMIC_RELAXED);
+            }
+
+            Pool_free(&pool, taken[i]);
+        }
+    }
+
+    return NULL;
+}
+
+static void run(void * (*routine)(void *), unsigned int nr) {
+    pthread_t threads[THREADS];
+    unsigned int i;
+
+    for (i = 0; i < nr; i++) {
+        CHECK(pthread_create(
+                &threads[i],
+                NULL,
+                routine,
+                (void *)(uintptr_t)(i + 1)) == 0);
+    }
+
+    for (i = 0; i < nr; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+int main() {
+    static void *first[OBJECTS];
+    PoolStats_t stats;
+    unsigned int i, j, found;
+
+    // Allocated by a thread, freed by another one, both gone.
+    run(alloc_all, 1);
+    for (i = 0; i < OBJECTS; i++) {
+        CHECK(objects[i] != NULL);
+        for (j = 0; j < i; j++) {
+            CHECK(objects[j] != objects[i]);
+        }
+    }
+    memcpy(first, objects, sizeof(first));
+    run(free_all, 1);
+
+    CHECK(Pool_getStats(&pool, &stats) == 0);
+    CHECK(stats.allocs == OBJECTS && stats.frees == OBJECTS);
+    CHECK(stats.hits == 0 && stats.in_use == 0);
+    CHECK(stats.high_water == OBJECTS);
+
+    // A third thread gets them all back from the shared list.
+    run(alloc_all, 1);
+    for (i = 0; i < OBJECTS; i++) {
+        found = 0;
+        for (j = 0; j < OBJECTS; j++) {
+            found += first[j] == objects[i];
+        }
+        CHECK(found == 1);
+    }
+    run(free_all, 1);
+
+    CHECK(Pool_getStats(&pool, &stats) == 0);
+    CHECK(stats.allocs == 2 * OBJECTS && stats.hits == OBJECTS);
+    CHECK(stats.in_use == 0);
+
+    // Several threads at once, objects going from one to another.
+    run(churn, THREADS);
+    CHECK(thread_failures == 0);
+    CHECK(stash_nr == HELD / 2);
+
+    // What's left in the stash is all that's in use.
+    CHECK(Pool_getStats(&pool, &stats) == 0);
+    CHECK(stats.allocs == 2 * OBJECTS + THREADS * ROUNDS * HELD);
+    CHECK(stats.in_use == stash_nr);
+    CHECK(stats.high_water >= HELD);
+
+    // Objects were recycled, only the ones held at once were malloc()'ed.
+    CHECK(stats.allocs - stats.hits <= OBJECTS + THREADS * (2 * HELD + POOL_CACHE_MAX));
+    for (i = 0; i < stash_nr; i++) {
+        Pool_free(&pool, stash[i]);
+    }
+
+    found = 0;
+    for (i = 0; i < Pool_getNumPools(); i++) {
+        found += Pool_getPool(i) == &pool;
+    }
+    CHECK(found == 1 && strcmp(Pool_getName(&pool), "test") == 0);
+    CHECK(Pool_getPool(Pool_getNumPools()) == NULL);
+
+    return CHECK_RESULT("pool");
+}
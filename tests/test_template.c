@@ -0,0 +1,139 @@
+/*
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/* Patches every field of a compiled Ether - IPv4 - UDPv4 - payload Packet
+ * and checks the frame, checksums included, against the Packet serialized
+ * again with the same values set through the setters.
+ */
+
+#include <string.h>
+
+#include "libpacket/packet.h"
+#include "libpacket/template.h"
+#include "libpacket/ether.h"
+#include "libpacket/ipv4.h"
+#include "libpacket/udpv4.h"
+#include "libpacket/raw.h"
+
+#include "check.h"
+
+#define PAYLOAD_LEN (37)
+
+static Packet_t *pack;
+static Ipv4Proto_t *ipv4;
+static Udpv4Proto_t *udpv4;
+static Template_t *tmpl;
+static uint8_t frame[128];
+
+/* Patches the field id of layer in frame, sets the same value in the Packet
+ * and compares both. Patches pile up, as the changes made to the Packet.
+ */
+static void check_patch(unsigned int layer, unsigned int id, uint64_t value) {
+    uint8_t expected[128];
+    TemplatePatch_t patch;
+    int index, size;
+
+    index = Template_getField(tmpl, layer, id);
+    CHECK(index >= 0);
+    if (index < 0) {
+        return;
+    }
+
+    patch.field = index;
+    patch.value = value;
+    CHECK(Template_patch(tmpl, frame, &patch, 1) == 0);
+    size = Template_getSize(tmpl);
+
+    if (layer == 1) {
+        switch (id) {
+        case IPV4_FIELD_LENGTH:
+            Ipv4Proto_setLength(ipv4, value);
+            break;
+        case IPV4_FIELD_ID:
+            Ipv4Proto_setId(ipv4, value);
+            break;
+        case IPV4_FIELD_TTL:
+            Ipv4Proto_setTtl(ipv4, value);
+            break;
+        case IPV4_FIELD_SADDR:
+            Ipv4Proto_setSaddr(ipv4, value);
+            break;
+        case IPV4_FIELD_DADDR:
+            Ipv4Proto_setDaddr(ipv4, value);
+            break;
+        }
+    } else {
+        switch (id) {
+        case UDPV4_FIELD_SPORT:
+            Udpv4Proto_setSport(udpv4, value);
+            break;
+        case UDPV4_FIELD_DPORT:
+            Udpv4Proto_setDport(udpv4, value);
+            break;
+        case UDPV4_FIELD_LENGTH:
+            Udpv4Proto_setLength(udpv4, value);
+            break;
+        }
+    }
+
+    CHECK(Packet_getBitstream(pack, expected, sizeof(expected)) == size);
+    CHECK(memcmp(frame, expected, size) == 0);
+}
+
+int main() {
+    static const uint8_t payload[PAYLOAD_LEN] = "a payload of an odd number of bytes";
+    EtherProto_t *ether;
+    RawProto_t *raw;
+
+    pack = Packet_create();
+    ether = EtherProto_create();
+    ipv4 = Ipv4Proto_create();
+    udpv4 = Udpv4Proto_create();
+    raw = RawProto_createWithParams(payload, PAYLOAD_LEN);
+    CHECK(pack != NULL && ether != NULL && ipv4 != NULL && udpv4 != NULL && raw != NULL);
+
+    Packet_stack(pack, EtherProto_getProtoBase(ether));
+    Packet_stack(pack, Ipv4Proto_getProtoBase(ipv4));
+    Packet_stack(pack, Udpv4Proto_getProtoBase(udpv4));
+    Packet_stack(pack, RawProto_getProtoBase(raw));
+    Ipv4Proto_setProtocol(ipv4, 17);
+    Ipv4Proto_setLength(ipv4, 20 + UDPV4_HEADER_LEN + PAYLOAD_LEN);
+    Udpv4Proto_setLength(udpv4, UDPV4_HEADER_LEN + PAYLOAD_LEN);
+
+    tmpl = Packet_compile(pack);
+    CHECK(tmpl != NULL);
+    CHECK(Template_emit(tmpl, frame, sizeof(frame), NULL, 0)
+            == (int)Template_getSize(tmpl));
+
+    check_patch(2, UDPV4_FIELD_LENGTH, UDPV4_HEADER_LEN + PAYLOAD_LEN - 5);
+    check_patch(2, UDPV4_FIELD_SPORT, 4242);
+    check_patch(2, UDPV4_FIELD_DPORT, 53);
+    check_patch(2, UDPV4_FIELD_LENGTH, UDPV4_HEADER_LEN + PAYLOAD_LEN);
+    check_patch(1, IPV4_FIELD_ID, 0xbeef);
+    check_patch(1, IPV4_FIELD_TTL, 3);
+    check_patch(1, IPV4_FIELD_LENGTH, 20 + UDPV4_HEADER_LEN + PAYLOAD_LEN - 1);
+    check_patch(1, IPV4_FIELD_SADDR, 0x0a000001);
+    check_patch(1, IPV4_FIELD_DADDR, 0xc0a80101);
+
+    Template_delete(tmpl);
+    Packet_delete(pack);
+    EtherProto_delete(ether);
+    Ipv4Proto_delete(ipv4);
+    Udpv4Proto_delete(udpv4);
+    RawProto_delete(raw);
+    return CHECK_RESULT("template");
+}
@@ -0,0 +1,247 @@
+/*
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/* Sets up TxRings of several geometries on the loopback interface and checks
+ * how frames are laid out in blocks, and how their status goes from free to
+ * committed and back once the kernel sent them: a full ring gives no frame,
+ * a frame the kernel refused can be filled again. Every frame committed must
+ * be captured on the interface, once.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+
+#include "libpacket/txring.h"
+
+#include "check.h"
+
+#define FRAME_LEN (60)
+#define ETHERTYPE_TEST (0x88b5)
+
+/* Where the packet starts within a frame, after its tpacket2_hdr. */
+#define FRAME_DATA_OFFSET (TPACKET2_HDRLEN - sizeof(struct sockaddr_ll))
+
+/* Opens a raw socket bound to the loopback interface, capturing the frames
+ * of ETHERTYPE_TEST if capture is set. Returns it or -1.
+ */
+static int open_socket(int capture) {
+    struct sockaddr_ll addr;
+    struct timeval tv;
+    int desc;
+
+    desc = socket(AF_PACKET, SOCK_RAW, capture? htons(ETHERTYPE_TEST): 0);
+    if (desc == -1) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = capture? htons(ETHERTYPE_TEST): 0;
+    addr.sll_ifindex = if_nametoindex("lo");
+    tv.tv_sec = 0;
+    tv.tv_usec = 200000;
+    if (setsockopt(desc, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv))
+            || bind(desc, (struct sockaddr *)&addr, sizeof(addr))) {
+        close(desc);
+        return -1;
+    }
+
+    return desc;
+}
+
+/* The header of the frame the packet at frame belongs to. */
+static struct tpacket2_hdr * header(uint8_t *frame) {
+    return (struct tpacket2_hdr *)(frame - FRAME_DATA_OFFSET);
+}
+
+/* Writes a frame numbered seq into frame. */
+static void fill(uint8_t *frame, unsigned int seq) {
+    memset(frame, 0, FRAME_LEN);
+    frame[12] = ETHERTYPE_TEST >> 8;
+    frame[13] = ETHERTYPE_TEST & 0xff;
+    frame[14] = seq >> 8;
+    frame[15] = seq & 0xff;
+}
+
+/* Receives n frames and checks they are frames first to first + n - 1, in
+ * order. The skb of a frame of the ring refers to the ring, so it's received
+ * before the frame is filled again.
+ */
+static void check_captured(int capture, unsigned int first, unsigned int n) {
+    uint8_t frame[2048];
+    unsigned int i;
+    ssize_t len;
+
+    for (i = 0; i < n; i++) {
+        len = recv(capture, frame, sizeof(frame), 0);
+        CHECK(len == FRAME_LEN);
+        CHECK(len == FRAME_LEN
+                && (unsigned int)((frame[14] << 8) | frame[15]) == first + i);
+    }
+}
+
+/* Checks the layout of the frames of ring, given the requested frame_nr. */
+static void check_geometry(TxRing_t *ring, unsigned int frame_size, unsigned int frame_nr) {
+    unsigned int i, page_size = sysconf(_SC_PAGESIZE), size = 0;
+    uint8_t *frame;
+    size_t start;
+
+    CHECK(ring->frame_size == frame_size);
+    CHECK(ring->block_size % page_size == 0);
+    CHECK(ring->frames_per_block == (frame_size <= page_size? page_size / frame_size: 1));
+    CHECK(ring->frame_nr >= frame_nr);
+    CHECK(ring->frame_nr % ring->frames_per_block == 0);
+    CHECK(ring->frame_nr - frame_nr < ring->frames_per_block);
+    CHECK(ring->map_size == (size_t)ring->block_size * (ring->frame_nr / ring->frames_per_block));
+
+    // Every frame is free, within a block, right after the previous one in
+    // its block.
+    for (i = 0; i < ring->frame_nr; i++) {
+        frame = TxRing_getFrame(ring, &size);
+        CHECK(frame != NULL && size == frame_size - FRAME_DATA_OFFSET);
+        if (frame == NULL) {
+            return;
+        }
+
+        start = (uint8_t *)header(frame) - ring->map;
+        CHECK(start == (size_t)(i / ring->frames_per_block) * ring->block_size
+                + (i % ring->frames_per_block) * frame_size);
+        CHECK(start % ring->block_size + frame_size <= ring->block_size);
+        CHECK(header(frame)->tp_status == TP_STATUS_AVAILABLE);
+
+        // Skipped by hand, as if it had been sent.
+        ring->head = (ring->head + 1) % ring->frame_nr;
+    }
+
+    CHECK(ring->head == 0);
+}
+
+int main() {
+    unsigned int i, size, page_size = sysconf(_SC_PAGESIZE), seq = 0;
+    uint8_t *frame, *first, extra[FRAME_LEN];
+    TxRing_t *ring;
+    int desc, capture;
+
+    capture = open_socket(1);
+    if (capture == -1) {
+        printf("txring: skipped, can't capture on lo (%s)\n", strerror(errno));
+        return 0;
+    }
+
+    // Geometries that can't work are refused before touching the socket.
+    desc = open_socket(0);
+    CHECK(desc != -1);
+    CHECK(TxRing_create(desc, 2000 + 8, 4) == NULL);
+    CHECK(TxRing_create(desc, 16, 4) == NULL);
+    CHECK(TxRing_create(desc, 2048, 0) == NULL);
+    close(desc);
+
+    // Several frames per block, the last block not full.
+    desc = open_socket(0);
+    ring = TxRing_create(desc, 2048, 2 * (page_size / 2048) + 1);
+    CHECK(ring != NULL);
+    if (ring != NULL) {
+        check_geometry(ring, 2048, 2 * (page_size / 2048) + 1);
+        TxRing_delete(ring);
+    }
+    close(desc);
+
+    // Frames bigger than a page, one per block.
+    desc = open_socket(0);
+    ring = TxRing_create(desc, page_size + 16, 3);
+    CHECK(ring != NULL);
+    if (ring != NULL) {
+        check_geometry(ring, page_size + 16, 3);
+        TxRing_delete(ring);
+    }
+    close(desc);
+
+    desc = open_socket(0);
+    ring = TxRing_create(desc, 2048, 4);
+    CHECK(ring != NULL);
+    if (ring == NULL) {
+        close(desc);
+        close(capture);
+        return CHECK_RESULT("txring");
+    }
+
+    // The frame only changes hands when committed.
+    first = TxRing_getFrame(ring, &size);
+    CHECK(first != NULL && TxRing_getFrame(ring, NULL) == first);
+    CHECK(TxRing_commit(ring, size + 1) == -1);
+    CHECK(TxRing_getFrame(ring, NULL) == first);
+
+    // Filled up without flushing, there is no frame left.
+    for (i = 0; i < ring->frame_nr; i++) {
+        frame = TxRing_getFrame(ring, NULL);
+        CHECK(frame != NULL);
+        if (frame == NULL) {
+            break;
+        }
+
+        fill(frame, seq++);
+        CHECK(TxRing_commit(ring, FRAME_LEN) == 0);
+        CHECK(header(frame)->tp_status == TP_STATUS_SEND_REQUEST);
+        CHECK(header(frame)->tp_len == FRAME_LEN);
+    }
+    CHECK(ring->head == 0);
+    CHECK(TxRing_getFrame(ring, NULL) == NULL);
+
+    // The loopback interface takes them all at once and releases them.
+    CHECK(TxRing_flush(ring, desc) == 0);
+    CHECK(TxRing_getFrame(ring, NULL) == first);
+    CHECK(header(first)->tp_status == TP_STATUS_AVAILABLE);
+    check_captured(capture, 0, seq);
+
+    // A frame the kernel refused is free again, and nothing is sent from it.
+    header(first)->tp_status = TP_STATUS_WRONG_FORMAT;
+    CHECK(TxRing_getFrame(ring, NULL) == first);
+    fill(first, seq);
+    CHECK(TxRing_commit(ring, FRAME_LEN) == 0);
+    CHECK(TxRing_flush(ring, desc) == 0);
+    check_captured(capture, seq, 1);
+
+    // The head wraps around.
+    for (i = 0; i < ring->frame_nr + 2; i++) {
+        frame = TxRing_getFrame(ring, NULL);
+        CHECK(frame != NULL);
+        if (frame == NULL) {
+            break;
+        }
+
+        fill(frame, ++seq);
+        CHECK(TxRing_commit(ring, FRAME_LEN) == 0);
+        CHECK(TxRing_flush(ring, desc) == 0);
+        check_captured(capture, seq, 1);
+    }
+    CHECK(ring->head == 3 % ring->frame_nr);
+
+    // Nothing was sent twice.
+    CHECK(recv(capture, extra, sizeof(extra), 0) == -1);
+
+    TxRing_delete(ring);
+    close(desc);
+    close(capture);
+    return CHECK_RESULT("txring");
+}
@@ -0,0 +1,304 @@
+/*
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/* Sends frames through a Uring on a raw socket of the loopback interface,
+ * with and without registered files and buffers. Every send committed must
+ * complete once, reported to the callback with its sequence number and its
+ * result, a frame the kernel refuses included, and its frame must be free
+ * again once reaped. The sequence numbers run past the number of frames.
+ * Every frame sent must be captured on the interface, in order. A Socket
+ * with the URING backend must report its completions through Socket_reap().
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+
+#include "libpacket/uring.h"
+#include "libpacket/socket.h"
+#include "libpacket/packet.h"
+#include "libpacket/ether.h"
+#include "libpacket/raw.h"
+
+#include "check.h"
+
+#define FRAME_LEN (60)
+#define FRAME_SIZE (2048)
+#define ETHERTYPE_TEST (0x88b5)
+#define COMPLETIONS_MAX (64)
+
+/* What the callback was told, in the order it was told. */
+typedef struct Completions {
+    uint64_t seqs[COMPLETIONS_MAX];
+    int results[COMPLETIONS_MAX];
+    unsigned int n;
+} Completions_t;
+
+/* Opens a raw socket bound to the loopback interface, capturing the frames
+ * of ETHERTYPE_TEST if capture is set. Returns it or -1.
+ */
+static int open_socket(int capture) {
+    struct sockaddr_ll addr;
+    struct timeval tv;
+    int desc;
+
+    desc = socket(AF_PACKET, SOCK_RAW, capture? htons(ETHERTYPE_TEST): 0);
+    if (desc == -1) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = capture? htons(ETHERTYPE_TEST): 0;
+    addr.sll_ifindex = if_nametoindex("lo");
+    tv.tv_sec = 0;
+    tv.tv_usec = 200000;
+    if (setsockopt(desc, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv))
+            || bind(desc, (struct sockaddr *)&addr, sizeof(addr))) {
+        close(desc);
+        return -1;
+    }
+
+    return desc;
+}
+
+static void callback(void *arg, uint64_t seq, int result) {
+    Completions_t *completions = arg;
+
+    if (completions->n < COMPLETIONS_MAX) {
+        completions->seqs[completions->n] = seq;
+        completions->results[completions->n] = result;
+    }
+
+    completions->n++;
+}
+
+/* Writes a frame numbered seq into frame. */
+static void fill(uint8_t *frame, unsigned int seq) {
+    memset(frame, 0, FRAME_LEN);
+    frame[12] = ETHERTYPE_TEST >> 8;
+    frame[13] = ETHERTYPE_TEST & 0xff;
+    frame[14] = seq >> 8;
+    frame[15] = seq & 0xff;
+}
+
+/* Receives n frames and checks they are frames first to first + n - 1, in
+ * order.
+ */
+static void check_captured(int capture, unsigned int first, unsigned int n) {
+    uint8_t frame[FRAME_SIZE];
+    unsigned int i;
+    ssize_t len;
+
+    for (i = 0; i < n; i++) {
+        len = recv(capture, frame, sizeof(frame), 0);
+        CHECK(len == FRAME_LEN);
+        CHECK(len == FRAME_LEN
+                && (unsigned int)((frame[14] << 8) | frame[15]) == first + i);
+    }
+}
+
+/* Checks the completions reaped are the ones of the sends first to
+ * first + n - 1, all of them with result, and starts them over.
+ */
+static void check_completions(
+        Completions_t *completions,
+        uint64_t first,
+        unsigned int n,
+        int result) {
+    unsigned int i;
+
+    CHECK(completions->n == n);
+    for (i = 0; i < n && i < COMPLETIONS_MAX; i++) {
+        CHECK(completions->seqs[i] == first + i);
+        CHECK(completions->results[i] == result);
+    }
+
+    completions->n = 0;
+}
+
+/* Commits a frame numbered seq, of length bytes. */
+static void commit(Uring_t *uring, unsigned int seq, unsigned int length) {
+    uint8_t *frame;
+
+    frame = Uring_getFrame(uring, NULL);
+    CHECK(frame != NULL);
+    if (frame != NULL) {
+        fill(frame, seq);
+        CHECK(Uring_commit(uring, length) == 0);
+    }
+}
+
+static void check_uring(int capture, unsigned int flags) {
+    Completions_t completions;
+    unsigned int i, size, seq = 0;
+    uint8_t *frame;
+    Uring_t *uring;
+    int desc;
+
+    desc = open_socket(0);
+    CHECK(desc != -1);
+
+    // The number of frames is rounded up to a power of two.
+    uring = Uring_create(desc, FRAME_SIZE, 5, flags);
+    CHECK(uring != NULL);
+    if (uring == NULL) {
+        close(desc);
+        return;
+    }
+
+    memset(&completions, 0, sizeof(completions));
+    CHECK(Uring_setCallback(uring, callback, &completions) == 0);
+    CHECK(uring->frame_nr == 8 && uring->free_nr == 8);
+
+    // The frame only changes hands when committed.
+    frame = Uring_getFrame(uring, &size);
+    CHECK(frame != NULL && size == FRAME_SIZE);
+    CHECK(Uring_getFrame(uring, NULL) == frame);
+    CHECK(Uring_commit(uring, FRAME_SIZE + 1) == -1);
+    CHECK(uring->free_nr == uring->frame_nr && uring->to_submit == 0);
+
+    // Every frame queued, nothing is submitted until flushed.
+    for (i = 0; i < uring->frame_nr; i++) {
+        commit(uring, seq++, FRAME_LEN);
+    }
+    CHECK(uring->free_nr == 0 && uring->to_submit == uring->frame_nr);
+    CHECK(completions.n == 0);
+
+    CHECK(Uring_flush(uring) == 0);
+    CHECK(uring->to_submit == 0);
+    CHECK(Uring_reap(uring, uring->frame_nr) == 0);
+    CHECK(uring->free_nr == uring->frame_nr);
+    check_completions(&completions, 0, seq, FRAME_LEN);
+    check_captured(capture, 0, seq);
+
+    // Shorter than an Ethernet header, the kernel refuses it, the frame is
+    // still recycled.
+    commit(uring, seq++, 5);
+    CHECK(Uring_reap(uring, 1) == 0);
+    check_completions(&completions, seq - 1, 1, -EINVAL);
+    CHECK(uring->errors == 1 && !uring->congested);
+
+    // The sequence numbers go past the number of frames, and waiting for
+    // more completions than frames in flight doesn't block.
+    for (i = 0; i < 3 * uring->frame_nr + 1; i++) {
+        commit(uring, seq++, FRAME_LEN);
+        CHECK(Uring_reap(uring, uring->frame_nr) == 0);
+        check_completions(&completions, seq - 1, 1, FRAME_LEN);
+    }
+    CHECK(uring->completed == seq && uring->seq == seq);
+    CHECK(uring->errors == 1);
+    check_captured(capture, seq - 3 * uring->frame_nr - 1, 3 * uring->frame_nr + 1);
+
+    // Frames in flight when deleted complete first.
+    for (i = 0; i < uring->frame_nr / 2; i++) {
+        commit(uring, seq++, FRAME_LEN);
+    }
+    Uring_delete(uring);
+    check_completions(&completions, seq - i, i, FRAME_LEN);
+    check_captured(capture, seq - i, i);
+    close(desc);
+}
+
+/* Injects through a Socket with the URING backend. */
+static void check_socket(int capture) {
+    static const uint8_t payload[FRAME_LEN - ETH_HLEN];
+    uint8_t frame[FRAME_SIZE];
+    Completions_t completions;
+    SocketParams_t params;
+    EtherProto_t *ether;
+    RawProto_t *raw;
+    Packet_t *pack;
+    Socket_t *sock;
+    unsigned int i;
+
+    memset(&completions, 0, sizeof(completions));
+    memset(&params, 0, sizeof(params));
+    params.backend = SOCKET_BACKEND_URING;
+    params.frame_size = FRAME_SIZE;
+    params.frame_nr = 8;
+    params.completion = callback;
+    params.completion_arg = &completions;
+    sock = Socket_createWithParams("lo", &params);
+    CHECK(sock != NULL);
+    if (sock == NULL) {
+        return;
+    }
+
+    pack = Packet_create();
+    ether = EtherProto_create();
+    raw = RawProto_createWithParams(payload, sizeof(payload));
+    Packet_stack(pack, EtherProto_getProtoBase(ether));
+    Packet_stack(pack, RawProto_getProtoBase(raw));
+    EtherProto_setType(ether, ETHERTYPE_TEST);
+
+    for (i = 0; i < 20; i++) {
+        CHECK(Socket_inject(sock, pack) == FRAME_LEN);
+    }
+    CHECK(Socket_reap(sock, 20) == 0);
+    check_completions(&completions, 0, 20, FRAME_LEN);
+    for (i = 0; i < 20; i++) {
+        CHECK(recv(capture, frame, sizeof(frame), 0) == FRAME_LEN);
+    }
+
+    Packet_delete(pack);
+    EtherProto_delete(ether);
+    RawProto_delete(raw);
+    Socket_delete(sock);
+}
+
+int main() {
+    uint8_t extra[FRAME_LEN];
+    Uring_t *uring;
+    int desc, capture;
+
+    capture = open_socket(1);
+    if (capture == -1) {
+        printf("uring: skipped, can't capture on lo (%s)\n", strerror(errno));
+        return 0;
+    }
+
+    // Kernels built without io_uring, or with it disabled.
+    desc = open_socket(0);
+    uring = Uring_create(desc, FRAME_SIZE, 1, 0);
+    if (uring == NULL) {
+        printf("uring: skipped, no io_uring (%s)\n", strerror(errno));
+        close(desc);
+        close(capture);
+        return 0;
+    }
+    Uring_delete(uring);
+    close(desc);
+
+    check_uring(capture, 0);
+    check_uring(capture, URING_FLAG_FIXED_FILE);
+    check_uring(capture, URING_FLAG_FIXED_BUFFERS);
+    check_uring(capture, URING_FLAG_FIXED_FILE | URING_FLAG_FIXED_BUFFERS);
+    check_socket(capture);
+
+    // Nothing was sent twice.
+    CHECK(recv(capture, extra, sizeof(extra), 0) == -1);
+
+    close(capture);
+    return CHECK_RESULT("uring");
+}
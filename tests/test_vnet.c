@@ -0,0 +1,388 @@
+/*
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/* Injects UDP datagrams on the loopback interface through a Socket with
+ * SOCKET_FLAG_VNET_HDR and captures them with a socket that gets the
+ * virtio_net_hdr of every frame too. Finishing the checksum as asked by that
+ * header, as the NIC would, must give the same frame as the Packet fully
+ * serialized: partial checksums are finished, final ones are left alone.
+ * A datagram as big as UDP allows, with a payload written into the frame by
+ * its layer, goes whole for the kernel to split it, through a socket created
+ * while the MTU of the interface was much smaller: the segments must carry
+ * the payload and valid checksums.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <linux/if_packet.h>
+#include <linux/virtio_net.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+
+#include "libpacket/socket.h"
+#include "libpacket/packet.h"
+#include "libpacket/ether.h"
+#include "libpacket/ipv4.h"
+#include "libpacket/udpv4.h"
+#include "libpacket/raw.h"
+#include "libpacket/checksum.h"
+
+#include "check.h"
+
+#define FRAME_MAX (70000)
+#define GSO_SIZE (1400)
+#define BLOB_SIZE (65535 - 20 - UDPV4_HEADER_LEN)
+
+/* A payload layer without getData(), its bytes are written into the frame. */
+static uint8_t blob[BLOB_SIZE];
+
+static unsigned int Blob_getSize(Protocol_t *proto) {
+    (void)proto;
+    return BLOB_SIZE;
+}
+
+static int Blob_getBitstream(Protocol_t *proto, uint8_t *buf, unsigned int size) {
+    (void)proto;
+    if (size < BLOB_SIZE) {
+        return -1;
+    }
+
+    memcpy(buf, blob, BLOB_SIZE);
+    return BLOB_SIZE;
+}
+
+static const ProtocolOps_t blob_ops = {
+    .getSize = Blob_getSize,
+    .getBitstream = Blob_getBitstream,
+    .type = PROTOCOL_TYPE_OTHER,
+};
+
+/* Opens a socket capturing every frame of the loopback interface, preceded
+ * by its virtio_net_hdr. Returns it or -1.
+ */
+static int open_capture(void) {
+    struct sockaddr_ll addr;
+    struct timeval tv;
+    int desc, val = 1;
+
+    desc = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (desc == -1) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    addr.sll_ifindex = if_nametoindex("lo");
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    if (setsockopt(desc, SOL_PACKET, PACKET_VNET_HDR, &val, sizeof(val))
+            || setsockopt(desc, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv))
+            || bind(desc, (struct sockaddr *)&addr, sizeof(addr))) {
+        close(desc);
+        return -1;
+    }
+
+    return desc;
+}
+
+/* Receives the first frame containing marker, or any frame if it's NULL,
+ * into frame, with the checksum finished if its virtio_net_hdr asks for it.
+ * Returns its length or -1.
+ */
+static int capture(int desc, const char *marker, uint8_t *frame) {
+    static uint8_t buf[sizeof(struct virtio_net_hdr) + FRAME_MAX];
+    struct virtio_net_hdr hdr;
+    unsigned int start, pos;
+    uint16_t csum;
+    ssize_t len;
+
+    for (;;) {
+        len = recv(desc, buf, sizeof(buf), 0);
+        if (len < (ssize_t)sizeof(hdr)) {
+            return -1;
+        }
+
+        len -= sizeof(hdr);
+        if (marker == NULL
+                || memmem(&buf[sizeof(hdr)], len, marker, strlen(marker)) != NULL) {
+            break;
+        }
+    }
+
+    memcpy(&hdr, buf, sizeof(hdr));
+    memcpy(frame, &buf[sizeof(hdr)], len);
+
+    if (hdr.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+        start = hdr.csum_start;
+        pos = start + hdr.csum_offset;
+        if (pos + 2 > len) {
+            return -1;
+        }
+
+        csum = ~Checksum_fold(Checksum_partial(&frame[start], len - start, 0));
+        if (csum == 0) {
+            csum = 0xffff;
+        }
+        frame[pos] = csum >> 8;
+        frame[pos + 1] = csum & 0xff;
+    }
+
+    return len;
+}
+
+/* Injects a Ether - [IPv4] - UDPv4 - payload Packet and checks what the
+ * wire gets.
+ */
+static void check_datagram(
+        Socket_t *sock,
+        int desc,
+        const char *marker,
+        int with_ipv4,
+        uint16_t checksum) {
+    static uint8_t expected[FRAME_MAX], frame[FRAME_MAX];
+    unsigned int payload_len = strlen(marker);
+    EtherProto_t *ether;
+    Ipv4Proto_t *ipv4 = NULL;
+    Udpv4Proto_t *udpv4;
+    RawProto_t *raw;
+    Packet_t *pack;
+    int size;
+
+    pack = Packet_create();
+    ether = EtherProto_create();
+    udpv4 = Udpv4Proto_createWithParams(
+            1234,
+            5678,
+            UDPV4_HEADER_LEN + payload_len,
+            checksum);
+    raw = RawProto_createWithParams((const uint8_t *)marker, payload_len);
+    Packet_stack(pack, EtherProto_getProtoBase(ether));
+    if (with_ipv4) {
+        ipv4 = Ipv4Proto_create();
+        Ipv4Proto_setProtocol(ipv4, 17);
+        Ipv4Proto_setLength(ipv4, 20 + UDPV4_HEADER_LEN + payload_len);
+        Packet_stack(pack, Ipv4Proto_getProtoBase(ipv4));
+        EtherProto_setType(ether, ETHERTYPE_IP);
+    } else {
+        EtherProto_setType(ether, 0x88b5);
+    }
+    Packet_stack(pack, Udpv4Proto_getProtoBase(udpv4));
+    Packet_stack(pack, RawProto_getProtoBase(raw));
+
+    size = Packet_getBitstream(pack, expected, sizeof(expected));
+    CHECK(size > 0);
+    CHECK(Socket_inject(sock, pack) == size);
+    CHECK(capture(desc, marker, frame) == size);
+    CHECK(memcmp(frame, expected, size) == 0);
+
+    Packet_delete(pack);
+    EtherProto_delete(ether);
+    Ipv4Proto_delete(ipv4);
+    Udpv4Proto_delete(udpv4);
+    RawProto_delete(raw);
+}
+
+/* Sets the MTU of the loopback interface to mtu. Returns the previous one or
+ * -1.
+ */
+static int set_mtu(int mtu) {
+    struct ifreq ifr;
+    int desc, old = -1;
+
+    desc = socket(AF_INET, SOCK_DGRAM, 0);
+    if (desc == -1) {
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, "lo", sizeof(ifr.ifr_name) - 1);
+    if (ioctl(desc, SIOCGIFMTU, &ifr) == 0) {
+        old = ifr.ifr_mtu;
+        ifr.ifr_mtu = mtu;
+        if (ioctl(desc, SIOCSIFMTU, &ifr) != 0) {
+            old = -1;
+        }
+    }
+
+    close(desc);
+    return old;
+}
+
+/* Receives the segments of the UDP datagram sent from port sport, until
+ * BLOB_SIZE bytes of payload, into payload. The checksum of every segment
+ * must be valid. Returns the number of segments or -1.
+ */
+static int capture_segments(int desc, uint16_t sport, uint8_t *payload) {
+    static uint8_t frame[FRAME_MAX];
+    uint8_t pseudo[12];
+    unsigned int length, received = 0;
+    int len, segments = 0;
+    uint32_t sum;
+
+    while (received < BLOB_SIZE) {
+        len = capture(desc, NULL, frame);
+        if (len < 0) {
+            return -1;
+        }
+
+        if (len < 14 + 20 + UDPV4_HEADER_LEN
+                || ((frame[12] << 8) | frame[13]) != ETHERTYPE_IP
+                || frame[23] != 17
+                || ((frame[34] << 8) | frame[35]) != sport) {
+            continue;
+        }
+
+        length = (frame[38] << 8) | frame[39];
+        if (length <= UDPV4_HEADER_LEN
+                || length - UDPV4_HEADER_LEN > GSO_SIZE
+                || 14 + 20 + length != (unsigned int)len
+                || received + length - UDPV4_HEADER_LEN > BLOB_SIZE) {
+            return -1;
+        }
+
+        memcpy(pseudo, &frame[26], 8);
+        pseudo[8] = 0;
+        pseudo[9] = 17;
+        pseudo[10] = length >> 8;
+        pseudo[11] = length & 0xff;
+        sum = Checksum_partial(pseudo, sizeof(pseudo), 0);
+        sum = Checksum_partial(&frame[34], length, sum);
+        CHECK(Checksum_fold(sum) == 0xffff);
+
+        memcpy(&payload[received], &frame[42], length - UDPV4_HEADER_LEN);
+        received += length - UDPV4_HEADER_LEN;
+        segments++;
+    }
+
+    return segments;
+}
+
+/* Injects a Ether - IPv4 - UDPv4 - blob Packet, the biggest datagram there
+ * is, through a socket splitting datagrams into GSO_SIZE bytes chunks and
+ * checks the segments the kernel sends.
+ */
+static void check_gso(int desc) {
+    static uint8_t payload[BLOB_SIZE];
+    const int segments = (BLOB_SIZE + GSO_SIZE - 1) / GSO_SIZE;
+    SocketParams_t params;
+    EtherProto_t *ether;
+    Ipv4Proto_t *ipv4;
+    Udpv4Proto_t *udpv4;
+    Protocol_t *blob_layer;
+    Packet_t *pack;
+    Socket_t *sock;
+    unsigned int i;
+    int mtu;
+
+    // The scratch buffer is sized when the socket is created, the MTU of lo
+    // is only lowered meanwhile so the segments still get through.
+    memset(&params, 0, sizeof(params));
+    params.backend = SOCKET_BACKEND_SENDTO;
+    params.flags = SOCKET_FLAG_VNET_HDR;
+    params.gso_size = GSO_SIZE;
+    mtu = set_mtu(1500);
+    sock = Socket_createWithParams("lo", &params);
+    if (mtu != -1) {
+        set_mtu(mtu);
+    }
+    CHECK(sock != NULL);
+    if (sock == NULL) {
+        return;
+    }
+
+    for (i = 0; i < BLOB_SIZE; i++) {
+        blob[i] = i * 7;
+    }
+
+    pack = Packet_create();
+    ether = EtherProto_create();
+    ipv4 = Ipv4Proto_create();
+    udpv4 = Udpv4Proto_createWithParams(
+            4321,
+            5678,
+            UDPV4_HEADER_LEN + BLOB_SIZE,
+            0);
+    blob_layer = Protocol_createWithParams(&blob_ops, NULL);
+    Packet_stack(pack, EtherProto_getProtoBase(ether));
+    Packet_stack(pack, Ipv4Proto_getProtoBase(ipv4));
+    Packet_stack(pack, Udpv4Proto_getProtoBase(udpv4));
+    Packet_stack(pack, blob_layer);
+    EtherProto_setType(ether, ETHERTYPE_IP);
+    Ipv4Proto_setProtocol(ipv4, 17);
+    Ipv4Proto_setLength(ipv4, 20 + UDPV4_HEADER_LEN + BLOB_SIZE);
+
+    CHECK(Packet_getSize(pack) == 14 + 65535);
+    CHECK(Socket_inject(sock, pack) == 14 + 65535);
+    CHECK(capture_segments(desc, 4321, payload) == segments);
+    CHECK(memcmp(payload, blob, BLOB_SIZE) == 0);
+
+    // Batches are serialized into the scratch buffer too.
+    memset(payload, 0, sizeof(payload));
+    CHECK(Socket_injectBatch(sock, (const Packet_t * const *)&pack, 1, NULL) == 1);
+    CHECK(capture_segments(desc, 4321, payload) == segments);
+    CHECK(memcmp(payload, blob, BLOB_SIZE) == 0);
+
+    Packet_delete(pack);
+    EtherProto_delete(ether);
+    Ipv4Proto_delete(ipv4);
+    Udpv4Proto_delete(udpv4);
+    Protocol_delete(blob_layer);
+    Socket_delete(sock);
+}
+
+int main() {
+    SocketParams_t params;
+    Socket_t *sock;
+    int desc;
+
+    desc = open_capture();
+    if (desc == -1) {
+        printf("vnet: skipped, can't capture on lo (%s)\n", strerror(errno));
+        return 0;
+    }
+
+    memset(&params, 0, sizeof(params));
+    params.backend = SOCKET_BACKEND_SENDTO;
+    params.flags = SOCKET_FLAG_VNET_HDR;
+    sock = Socket_createWithParams("lo", &params);
+    CHECK(sock != NULL);
+    if (sock == NULL) {
+        close(desc);
+        return CHECK_RESULT("vnet");
+    }
+
+    // Computed by the library, finished by the kernel.
+    check_datagram(sock, desc, "libpacket vnet partial", 1, 0);
+    // Set by the application, sent as it is.
+    check_datagram(sock, desc, "libpacket vnet given", 1, 0x1234);
+    // No IPv4 below, no checksum at all.
+    check_datagram(sock, desc, "libpacket vnet no ipv4", 0, 0);
+    // As big as a datagram can be, left for the kernel to split.
+    check_gso(desc);
+
+    Socket_delete(sock);
+    close(desc);
+    return CHECK_RESULT("vnet");
+}
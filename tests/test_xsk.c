@@ -0,0 +1,234 @@
+/*
+ This file is part of libpacket.
+
+ libpacket is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ libpacket is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with libpacket.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/* Binds an Xsk to the loopback interface in copy mode and checks how its
+ * frames go around: handed out from the free stack until it's empty, placed
+ * in the TX ring, and back on the stack once the kernel completed them, be
+ * it through Xsk_flush() or any other system call waking the kernel up. The
+ * indexes of the rings run past their size. Every frame committed must be
+ * captured on the interface, once and in order.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <linux/if_packet.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+
+#include "libpacket/xsk.h"
+
+#include "check.h"
+
+#define FRAME_LEN (60)
+#define FRAME_SIZE (2048)
+#define ETHERTYPE_TEST (0x88b5)
+
+#ifndef AF_XDP
+#define AF_XDP (44)
+#endif
+
+/* Opens a raw socket capturing the frames of ETHERTYPE_TEST on the loopback
+ * interface. Returns it or -1.
+ */
+static int open_capture(void) {
+    struct sockaddr_ll addr;
+    struct timeval tv;
+    int desc;
+
+    desc = socket(AF_PACKET, SOCK_RAW, htons(ETHERTYPE_TEST));
+    if (desc == -1) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETHERTYPE_TEST);
+    addr.sll_ifindex = if_nametoindex("lo");
+    tv.tv_sec = 0;
+    tv.tv_usec = 200000;
+    if (setsockopt(desc, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv))
+            || bind(desc, (struct sockaddr *)&addr, sizeof(addr))) {
+        close(desc);
+        return -1;
+    }
+
+    return desc;
+}
+
+/* Writes a frame numbered seq into frame. */
+static void fill(uint8_t *frame, unsigned int seq) {
+    memset(frame, 0, FRAME_LEN);
+    frame[12] = ETHERTYPE_TEST >> 8;
+    frame[13] = ETHERTYPE_TEST & 0xff;
+    frame[14] = seq >> 8;
+    frame[15] = seq & 0xff;
+}
+
+/* Receives n frames and checks they are frames first to first + n - 1, in
+ * order.
+ */
+static void check_captured(int capture, unsigned int first, unsigned int n) {
+    uint8_t frame[FRAME_SIZE];
+    unsigned int i;
+    ssize_t len;
+
+    for (i = 0; i < n; i++) {
+        len = recv(capture, frame, sizeof(frame), 0);
+        CHECK(len == FRAME_LEN);
+        CHECK(len == FRAME_LEN
+                && (unsigned int)((frame[14] << 8) | frame[15]) == first + i);
+    }
+}
+
+/* Checks that every frame of the UMEM is on the free stack, once. */
+static void check_all_free(Xsk_t *xsk) {
+    uint8_t seen[64];
+    unsigned int i, index;
+
+    CHECK(xsk->free_nr == xsk->frame_nr);
+    CHECK(xsk->comp.cached == xsk->tx.cached);
+    CHECK(*xsk->comp.consumer == xsk->comp.cached);
+    if (xsk->free_nr != xsk->frame_nr || xsk->frame_nr > sizeof(seen)) {
+        return;
+    }
+
+    memset(seen, 0, sizeof(seen));
+    for (i = 0; i < xsk->free_nr; i++) {
+        CHECK(xsk->free_frames[i] % xsk->frame_size == 0);
+        index = xsk->free_frames[i] / xsk->frame_size;
+        CHECK(index < xsk->frame_nr && !seen[index]);
+        if (index < xsk->frame_nr) {
+            seen[index] = 1;
+        }
+    }
+}
+
+int main() {
+    uint8_t *frame, *frames[64], extra[FRAME_LEN];
+    unsigned int i, j, size, seq = 0;
+    int desc, capture;
+    Xsk_t *xsk;
+
+    capture = open_capture();
+    if (capture == -1) {
+        printf("xsk: skipped, can't capture on lo (%s)\n", strerror(errno));
+        return 0;
+    }
+
+    desc = socket(AF_XDP, SOCK_RAW, 0);
+    if (desc == -1) {
+        printf("xsk: skipped, no AF_XDP socket (%s)\n", strerror(errno));
+        close(capture);
+        return 0;
+    }
+
+    // The number of frames is rounded up to a power of two.
+    xsk = Xsk_create(desc, if_nametoindex("lo"), 0, FRAME_SIZE, 5, XDP_COPY);
+    if (xsk == NULL) {
+        printf("xsk: skipped, can't bind an AF_XDP socket to lo\n");
+        close(desc);
+        close(capture);
+        return 0;
+    }
+
+    CHECK(xsk->frame_nr == 8);
+    CHECK(xsk->umem_size == (size_t)FRAME_SIZE * 8);
+    CHECK(xsk->tx.size == 8 && xsk->comp.size == 8);
+    check_all_free(xsk);
+
+    // The frame only changes hands when committed.
+    frame = Xsk_getFrame(xsk, &size);
+    CHECK(frame != NULL && size == FRAME_SIZE);
+    CHECK(Xsk_getFrame(xsk, NULL) == frame);
+    CHECK(Xsk_commit(xsk, FRAME_SIZE + 1) == -1);
+    CHECK(xsk->free_nr == xsk->frame_nr && xsk->tx.cached == 0);
+
+    // Filled up without waking the kernel up, there is no frame left, and
+    // every frame was a different one.
+    for (i = 0; i < xsk->frame_nr; i++) {
+        frames[i] = Xsk_getFrame(xsk, NULL);
+        CHECK(frames[i] != NULL);
+        if (frames[i] == NULL) {
+            break;
+        }
+
+        CHECK(frames[i] >= xsk->umem && frames[i] < xsk->umem + xsk->umem_size);
+        CHECK((frames[i] - xsk->umem) % FRAME_SIZE == 0);
+        for (j = 0; j < i; j++) {
+            CHECK(frames[j] != frames[i]);
+        }
+
+        fill(frames[i], seq++);
+        CHECK(Xsk_commit(xsk, FRAME_LEN) == 0);
+    }
+    CHECK(xsk->free_nr == 0);
+    CHECK(*xsk->tx.producer == xsk->frame_nr);
+    CHECK(Xsk_getFrame(xsk, NULL) == NULL);
+    CHECK(Xsk_commit(xsk, FRAME_LEN) == -1);
+
+    // A flush sends them and takes them all back.
+    CHECK(Xsk_flush(xsk, desc) == 0);
+    check_all_free(xsk);
+    check_captured(capture, 0, seq);
+
+    // Sent by a system call made without Xsk_flush(), they are taken back
+    // when the free stack runs out.
+    for (i = 0; i < xsk->frame_nr; i++) {
+        frame = Xsk_getFrame(xsk, NULL);
+        CHECK(frame != NULL);
+        if (frame == NULL) {
+            break;
+        }
+
+        fill(frame, seq++);
+        CHECK(Xsk_commit(xsk, FRAME_LEN) == 0);
+    }
+    CHECK(xsk->free_nr == 0);
+    sendto(desc, NULL, 0, MSG_DONTWAIT, NULL, 0);
+    CHECK(Xsk_getFrame(xsk, NULL) != NULL);
+    check_all_free(xsk);
+    check_captured(capture, seq - xsk->frame_nr, xsk->frame_nr);
+
+    // The indexes of the rings go past their size, frames are still taken
+    // back one by one.
+    for (i = 0; i < 3 * xsk->frame_nr + 1; i++) {
+        frame = Xsk_getFrame(xsk, NULL);
+        CHECK(frame != NULL);
+        if (frame == NULL) {
+            break;
+        }
+
+        fill(frame, seq++);
+        CHECK(Xsk_commit(xsk, FRAME_LEN) == 0);
+        CHECK(Xsk_flush(xsk, desc) == 0);
+        check_all_free(xsk);
+    }
+    CHECK(xsk->tx.cached == seq);
+    check_captured(capture, seq - 3 * xsk->frame_nr - 1, 3 * xsk->frame_nr + 1);
+
+    // Nothing was sent twice.
+    CHECK(recv(capture, extra, sizeof(extra), 0) == -1);
+
+    close(desc);
+    Xsk_delete(xsk);
+    close(capture);
+    return CHECK_RESULT("xsk");
+}